@@ -0,0 +1,181 @@
+#include <arena.h>
+#include <string.h>
+
+/**
+ * Every allocation is rounded up to this, which is enough for the pointers,
+ * sizes and Param arrays the library keeps in an arena
+ */
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    char *end;
+};
+
+struct Arena {
+    ArenaChunk *first;
+    ArenaChunk *current;
+    char *top;
+    size_t chunk_size;
+    OauthAllocStats stats;
+};
+
+/**
+ * @brief      Gets the first usable byte of a chunk
+ *
+ * @param      chunk  The chunk
+ *
+ * @return     The start of the chunk's data
+ */
+static char *chunk_data(ArenaChunk *chunk);
+
+/**
+ * @brief      Gets the number of bytes allocated for a chunk
+ *
+ * @param      chunk  The chunk
+ *
+ * @return     The size of the chunk, header included
+ */
+static size_t chunk_bytes(ArenaChunk *chunk);
+
+/**
+ * @brief      Allocates a chunk able to hold at least size bytes
+ *
+ * @param[in]  size  The number of usable bytes needed
+ *
+ * @return     The chunk or NULL if allocation failed
+ */
+static ArenaChunk *new_chunk(size_t size);
+
+/**
+ * @brief      Moves the arena to a chunk with room for size bytes
+ * @details    Chunks kept from before a reset are reused first. A chunk which
+ * is too small for the request is skipped, not freed.
+ *
+ * @param      arena  The arena
+ * @param[in]  size   The number of bytes needed
+ *
+ * @return     1 on success, 0 if a new chunk could not be allocated
+ */
+static int next_chunk(Arena *arena, size_t size);
+
+Arena *arena_new(size_t chunk_size) {
+    ArenaChunk *chunk;
+    Arena *arena;
+
+    if (chunk_size < 256) {
+        chunk_size = 256;
+    }
+
+    chunk = new_chunk(chunk_size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    /* The arena itself is the first allocation of its first chunk */
+    arena             = ( Arena * )( void * )chunk_data(chunk);
+    arena->first      = chunk;
+    arena->current    = chunk;
+    arena->top        = chunk_data(chunk) + ARENA_ROUND(sizeof(Arena));
+    arena->chunk_size = chunk_size;
+    memset(&arena->stats, 0, sizeof(OauthAllocStats));
+    oauth_charge(&arena->stats, chunk_bytes(chunk));
+
+    return arena;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    void *ptr;
+
+    size = ARENA_ROUND(size);
+    if (( size_t )(arena->current->end - arena->top) < size && !next_chunk(arena, size)) {
+        return NULL;
+    }
+
+    ptr = arena->top;
+    arena->top += size;
+
+    return ptr;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t length) {
+    char *dest = arena_alloc(arena, length + 1);
+    if (dest != NULL) {
+        memcpy(dest, s, length);
+        dest[length] = '\0';
+    }
+    return dest;
+}
+
+ArenaMark arena_mark(const Arena *arena) {
+    ArenaMark mark;
+    mark.chunk = arena->current;
+    mark.top   = arena->top;
+    return mark;
+}
+
+void arena_release(Arena *arena, ArenaMark mark) {
+    arena->current = mark.chunk;
+    arena->top     = mark.top;
+}
+
+void arena_reset(Arena *arena) {
+    arena->current = arena->first;
+    arena->top     = chunk_data(arena->first) + ARENA_ROUND(sizeof(Arena));
+}
+
+OauthAllocStats *arena_stats(Arena *arena) {
+    return &arena->stats;
+}
+
+void arena_destroy(Arena *arena) {
+    ArenaChunk *chunk = arena->first, *next;
+
+    /* arena lives in the first chunk, so it must not be touched after this */
+    while (chunk != NULL) {
+        next = chunk->next;
+        oauth_release(chunk);
+        chunk = next;
+    }
+}
+
+static char *chunk_data(ArenaChunk *chunk) {
+    return ( char * )chunk + ARENA_ROUND(sizeof(ArenaChunk));
+}
+
+static size_t chunk_bytes(ArenaChunk *chunk) {
+    return ( size_t )(chunk->end - ( char * )chunk);
+}
+
+static ArenaChunk *new_chunk(size_t size) {
+    ArenaChunk *chunk = oauth_alloc(ARENA_ROUND(sizeof(ArenaChunk)) + size);
+    if (chunk != NULL) {
+        chunk->next = NULL;
+        chunk->end  = chunk_data(chunk) + size;
+    }
+    return chunk;
+}
+
+static int next_chunk(Arena *arena, size_t size) {
+    ArenaChunk *chunk = arena->current->next;
+
+    while (chunk != NULL && ( size_t )(chunk->end - chunk_data(chunk)) < size) {
+        chunk = chunk->next;
+    }
+
+    if (chunk == NULL) {
+        chunk = new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+        if (chunk == NULL) {
+            return 0;
+        }
+        chunk->next          = arena->current->next;
+        arena->current->next = chunk;
+        oauth_charge(&arena->stats, chunk_bytes(chunk));
+    }
+
+    arena->current = chunk;
+    arena->top     = chunk_data(chunk);
+
+    return 1;
+}
@@ -0,0 +1,219 @@
+#include <base64.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OAUTH_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/**
+ * The size of the digest of HMAC-SHA1, which gets its own encoding path
+ */
+#define SHA1_DIGEST_SIZE 20
+
+/**
+ * @brief      Signature shared by the block encoders
+ *
+ * @param      out     Receives four characters for every three bytes
+ * @param[in]  in      The bytes to encode
+ * @param[in]  length  The number of bytes available
+ *
+ * @return     The number of bytes encoded, always a multiple of three
+ */
+typedef size_t (*BlockEncoder)(char *out, const unsigned char *in, size_t length);
+
+static const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static pthread_once_t ENCODER_ONCE = PTHREAD_ONCE_INIT;
+static BlockEncoder encode_blocks;
+
+/**
+ * @brief      Picks the block encoder supported by the running CPU
+ */
+static void init_encoder(void);
+
+/**
+ * @brief      Block encoder used when no SIMD variant is available, which
+ * leaves all of the input to the table driven tail
+ */
+static size_t encode_blocks_none(char *out, const unsigned char *in, size_t length);
+
+#ifdef OAUTH_X86_SIMD
+/**
+ * @brief      Block encoder using SSSE3 shuffles, twelve bytes at a time
+ */
+static size_t encode_blocks_ssse3(char *out, const unsigned char *in, size_t length);
+#endif
+
+/**
+ * @brief      Encodes the bytes left over by a block encoder
+ *
+ * @param      out     Receives the encoding and a terminating null
+ * @param[in]  in      The bytes to encode
+ * @param[in]  length  The number of bytes
+ *
+ * @return     The length of the encoding
+ */
+static size_t encode_tail(char *out, const unsigned char *in, size_t length);
+
+/**
+ * @brief      Writes one character of the alphabet, escaped if need be
+ *
+ * @param      out    Receives the character
+ * @param[in]  index  The 6 bit index of the character
+ *
+ * @return     The number of bytes written
+ */
+static size_t put_escaped(char *out, unsigned int index);
+
+/**
+ * @brief      The body of base64_encode_escaped(), inlined so that a
+ * constant length gives a fully unrolled copy
+ */
+static inline size_t encode_escaped(char *out, const unsigned char *in, size_t length);
+
+size_t base64_encode(char *out, const unsigned char *in, size_t length) {
+    size_t done;
+
+    ( void )pthread_once(&ENCODER_ONCE, init_encoder);
+    done = encode_blocks(out, in, length);
+
+    return 4 * (done / 3) + encode_tail(out + 4 * (done / 3), in + done, length - done);
+}
+
+size_t base64_encode_escaped(char *out, const unsigned char *in, size_t length) {
+    if (length == SHA1_DIGEST_SIZE) {
+        return encode_escaped(out, in, SHA1_DIGEST_SIZE);
+    }
+    return encode_escaped(out, in, length);
+}
+
+static void init_encoder(void) {
+    encode_blocks = encode_blocks_none;
+#ifdef OAUTH_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        encode_blocks = encode_blocks_ssse3;
+    }
+#endif
+}
+
+static size_t encode_blocks_none(char *out, const unsigned char *in, size_t length) {
+    ( void )out;
+    ( void )in;
+    ( void )length;
+    return 0;
+}
+
+static size_t encode_tail(char *out, const unsigned char *in, size_t length) {
+    size_t i, n = 0;
+    unsigned long group;
+
+    for (i = 0; i + 3 <= length; i += 3) {
+        group    = ( unsigned long )in[i] << 16 | ( unsigned long )in[i + 1] << 8 | in[i + 2];
+        out[n++] = ALPHABET[group >> 18];
+        out[n++] = ALPHABET[group >> 12 & 0x3F];
+        out[n++] = ALPHABET[group >> 6 & 0x3F];
+        out[n++] = ALPHABET[group & 0x3F];
+    }
+
+    if (length - i == 1) {
+        out[n++] = ALPHABET[in[i] >> 2];
+        out[n++] = ALPHABET[(in[i] & 0x03) << 4];
+        out[n++] = '=';
+        out[n++] = '=';
+    } else if (length - i == 2) {
+        out[n++] = ALPHABET[in[i] >> 2];
+        out[n++] = ALPHABET[(in[i] & 0x03) << 4 | in[i + 1] >> 4];
+        out[n++] = ALPHABET[(in[i + 1] & 0x0F) << 2];
+        out[n++] = '=';
+    }
+    out[n] = '\0';
+
+    return n;
+}
+
+static size_t put_escaped(char *out, unsigned int index) {
+    if (index < 62) {
+        out[0] = ALPHABET[index];
+        return 1;
+    }
+    out[0] = '%';
+    out[1] = '2';
+    out[2] = index == 62 ? 'B' : 'F';
+    return 3;
+}
+
+static inline size_t encode_escaped(char *out, const unsigned char *in, size_t length) {
+    size_t i, n = 0;
+    unsigned long group;
+
+    for (i = 0; i + 3 <= length; i += 3) {
+        group = ( unsigned long )in[i] << 16 | ( unsigned long )in[i + 1] << 8 | in[i + 2];
+        n += put_escaped(out + n, ( unsigned int )(group >> 18));
+        n += put_escaped(out + n, ( unsigned int )(group >> 12 & 0x3F));
+        n += put_escaped(out + n, ( unsigned int )(group >> 6 & 0x3F));
+        n += put_escaped(out + n, ( unsigned int )(group & 0x3F));
+    }
+
+    if (length - i == 1) {
+        n += put_escaped(out + n, in[i] >> 2);
+        n += put_escaped(out + n, (in[i] & 0x03u) << 4);
+        memcpy(out + n, "%3D%3D", 6);
+        n += 6;
+    } else if (length - i == 2) {
+        n += put_escaped(out + n, in[i] >> 2);
+        n += put_escaped(out + n, (in[i] & 0x03u) << 4 | in[i + 1] >> 4);
+        n += put_escaped(out + n, (in[i + 1] & 0x0Fu) << 2);
+        memcpy(out + n, "%3D", 3);
+        n += 3;
+    }
+    out[n] = '\0';
+
+    return n;
+}
+
+#ifdef OAUTH_X86_SIMD
+
+/**
+ * Each step loads sixteen bytes and uses the first twelve, so it stops while
+ * at least sixteen remain and leaves the last few groups to encode_tail().
+ *
+ * The shuffle places the three bytes of every group in a 32 bit lane as
+ * [b1 b0 b2 b1]. Multiplying the 16 bit halves by powers of two then moves
+ * each 6 bit index into a byte of its own, and the indices are turned into
+ * characters by adding an offset picked with a second shuffle: indices are
+ * first mapped to 0 for 'a'-'z', 1-10 for the digits, 11 and 12 for '+' and
+ * '/', and 13 for 'A'-'Z'.
+ */
+__attribute__((target("ssse3"))) static size_t encode_blocks_ssse3(char *out,
+                                                                   const unsigned char *in,
+                                                                   size_t length) {
+    const __m128i spread  = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i x, hi, lo, indices, select;
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 12, out += 16) {
+        x  = _mm_shuffle_epi8(_mm_loadu_si128(( const __m128i * )(in + i)), spread);
+        hi = _mm_mulhi_epu16(_mm_and_si128(x, _mm_set1_epi32(0x0FC0FC00)),
+                             _mm_set1_epi32(0x04000040));
+        lo = _mm_mullo_epi16(_mm_and_si128(x, _mm_set1_epi32(0x003F03F0)),
+                             _mm_set1_epi32(0x01000010));
+        indices = _mm_or_si128(hi, lo);
+
+        select = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        select = _mm_or_si128(select, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                                                    _mm_set1_epi8(13)));
+        x      = _mm_add_epi8(_mm_shuffle_epi8(offsets, select), indices);
+
+        _mm_storeu_si128(( __m128i * )out, x);
+    }
+
+    return i;
+}
+
+#endif
@@ -0,0 +1,524 @@
+/* oauth_bench.c - per stage signing micro-benchmarks
+**
+** Times every stage of signing a request on its own: builder creation, the
+** setters, percent-encoding, the signature base, the HMAC, base64, the nonce
+** and timestamp, and the header and curl command, plus signing from start
+** to end. Requests are drawn from a fixed corpus whose parameter counts and
+** value lengths follow those of typical API traffic, and the nonce and
+** timestamp are fixed, so runs are comparable.
+**
+** Each stage reports the time and the number of heap allocations per
+** operation. Allocations are counted by wrapping malloc, which needs glibc;
+** elsewhere they are reported as -1.
+**
+** usage:  oauth_bench [--json] [--min-time ms] [stage ...]
+*/
+
+#include <base64.h>
+#include <liboauthsign.h>
+#include <logger.h>
+#include <nonce.h>
+#include <percent_encode.h>
+#include <sha1_mb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timestamp.h>
+
+/** The number of requests in the corpus */
+#define CORPUS_SIZE 256
+
+/** The number of builders signed together by the batched stages */
+#define BATCH_WIDTH SHA1_MB_LANES
+
+/** The most parameters a request of the corpus has */
+#define MAX_PARAMS 40
+
+/** Room for any header or curl command of the corpus */
+#define OUTPUT_SIZE 65536
+
+/**
+ * This is an X-MACRO listing the stages
+ *
+ * @details    Each entry gives the name of the stage and the number of
+ * requests one call of it handles
+ */
+#define X_STAGES                    \
+    X(builder_create, 1)            \
+    X(reset_builder, 1)             \
+    X(set_http_method, 1)           \
+    X(set_base_url, 1)              \
+    X(set_request_params, 1)        \
+    X(percent_encode, 1)            \
+    X(signature_base, 1)            \
+    X(hmac_sha1, 1)                 \
+    X(hmac_sha1_batch, BATCH_WIDTH) \
+    X(base64_signature, 1)          \
+    X(nonce, 1)                     \
+    X(timestamp, 1)                 \
+    X(header_into, 1)               \
+    X(header, 1)                    \
+    X(curl_command, 1)              \
+    X(headers_batch, BATCH_WIDTH)   \
+    X(sign_request, 1)
+
+typedef struct {
+    const char *method;
+    const char *url;
+    const char *params[MAX_PARAMS];
+    int params_count;
+    /* The longest value, which the percent_encode stage encodes */
+    const char *value;
+    size_t value_len;
+} Request;
+
+typedef struct {
+    OauthCredentials *credentials;
+    Request requests[CORPUS_SIZE];
+    /* Builders loaded with the first requests of the corpus */
+    Builder *builders[BATCH_WIDTH];
+    /* A builder for the stages which change it */
+    Builder *scratch;
+    /* The signature bases of the loaded builders */
+    char *bases[BATCH_WIDTH];
+    Sha1Job jobs[BATCH_WIDTH];
+    unsigned char digests[BATCH_WIDTH][20];
+    char *output;
+    char *storage;
+    size_t next;
+} Bench;
+
+typedef void (*Stage)(Bench *bench);
+
+/** Heap allocations made so far */
+static unsigned long allocations;
+
+/** Whether allocations can be counted */
+#if defined(__GLIBC__)
+#define COUNTS_ALLOCATIONS 1
+#else
+#define COUNTS_ALLOCATIONS 0
+#endif
+
+/**
+ * @brief      Fills the corpus with requests
+ *
+ * @param      bench  The benchmark
+ *
+ * @return     1 on success, 0 if memory ran out
+ */
+static int make_corpus(Bench *bench);
+
+/**
+ * @brief      Loads a request into a builder, with the nonce and timestamp
+ * fixed
+ *
+ * @param      builder  The builder
+ * @param[in]  request  The request
+ */
+static void load_request(Builder *builder, Request *request);
+
+/**
+ * @brief      Gets the next request of the corpus
+ *
+ * @param      bench  The benchmark
+ *
+ * @return     The request
+ */
+static Request *next_request(Bench *bench);
+
+/**
+ * @brief      Gets the builder for the stages which change it, rewound once
+ * every pass over the corpus so that its arena stays small
+ *
+ * @param      bench  The benchmark
+ *
+ * @return     The builder
+ */
+static Builder *scratch_builder(Bench *bench);
+
+/**
+ * @brief      Runs a stage until it has taken at least the given time
+ *
+ * @param      bench     The benchmark
+ * @param[in]  stage     The stage
+ * @param[in]  per_call  The number of requests a call of the stage handles
+ * @param[in]  min_time  The least time to run for, in seconds
+ * @param[out] ns        The nanoseconds per request
+ * @param[out] allocs    The allocations per request
+ * @param[out] ops       The number of requests handled
+ */
+static void run_stage(Bench *bench, Stage stage, int per_call, double min_time, double *ns,
+                      double *allocs, long *ops);
+
+/**
+ * @brief      Tells whether a stage was asked for on the command line
+ *
+ * @param[in]  name    The name of the stage
+ * @param[in]  argc    The number of stage names
+ * @param[in]  argv    The stage names
+ *
+ * @return     1 if it was or no stage was named, 0 otherwise
+ */
+static int wanted(const char *name, int argc, char **argv);
+
+/**
+ * @brief      Gets the value of the monotonic clock in seconds
+ *
+ * @return     The current time
+ */
+static double now_seconds(void);
+
+/**
+ * @brief      Gets a pseudo random number from a fixed sequence
+ *
+ * @return     The number
+ */
+static unsigned int next_random(void);
+
+#define X(name, per_call) static void stage_##name(Bench *bench);
+X_STAGES
+#undef X
+
+#if COUNTS_ALLOCATIONS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static const char *PARAM_NAMES[] = {"status",      "include_entities", "screen_name", "user_id",
+                                    "count",       "since_id",         "max_id",      "cursor",
+                                    "trim_user",   "tweet_mode",       "lang",        "q",
+                                    "in_reply_to", "media_ids",        "place_id",    "lat"};
+
+static const char *URLS[] = {"https://api.twitter.com/1.1/statuses/update.json",
+                             "https://api.twitter.com/1.1/statuses/home_timeline.json",
+                             "https://api.twitter.com/1.1/users/lookup.json",
+                             "https://api.twitter.com/1.1/search/tweets.json"};
+
+static unsigned int random_state = 1;
+
+int main(int argc, char **argv) {
+    Bench bench;
+    double min_time = 0.2, ns, allocs;
+    int json = 0, i;
+    long ops;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]) / 1000;
+        } else {
+            e_log("usage:  %s [--json] [--min-time ms] [stage ...]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    memset(&bench, 0, sizeof bench);
+    if (!make_corpus(&bench)) {
+        e_log("out of memory\n");
+        return 1;
+    }
+
+    if (!json) {
+        o_log("%-20s %12s %12s %12s", "stage", "ns/op", "allocs/op", "ops");
+    }
+
+#define X(name, per_call)                                                                    \
+    if (wanted(#name, argc - i, argv + i)) {                                                 \
+        run_stage(&bench, stage_##name, per_call, min_time, &ns, &allocs, &ops);             \
+        if (json) {                                                                          \
+            o_log("{\"stage\": \"%s\", \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, "       \
+                  "\"ops\": %ld}",                                                           \
+                  #name, ns, allocs, ops);                                                   \
+        } else {                                                                             \
+            o_log("%-20s %12.1f %12.2f %12ld", #name, ns, allocs, ops);                      \
+        }                                                                                    \
+    }
+    X_STAGES
+#undef X
+
+    for (i = 0; i < BATCH_WIDTH; ++i) {
+        destroy_builder(&bench.builders[i]);
+        free(bench.bases[i]);
+    }
+    destroy_builder(&bench.scratch);
+    destroy_credentials(&bench.credentials);
+    free(bench.output);
+    free(bench.storage);
+
+    return 0;
+}
+
+static int make_corpus(Bench *bench) {
+    char *p;
+    size_t length, c;
+    unsigned int pick;
+    Request *request;
+    int r, n;
+
+    bench->credentials = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    bench->output  = malloc(OUTPUT_SIZE);
+    bench->storage = p = malloc(( size_t )CORPUS_SIZE * MAX_PARAMS * 1040);
+    bench->scratch     = new_oauth_request(bench->credentials);
+    if (bench->credentials == NULL || bench->output == NULL || bench->storage == NULL ||
+        bench->scratch == NULL) {
+        return 0;
+    }
+
+    for (r = 0; r < CORPUS_SIZE; ++r) {
+        request         = &bench->requests[r];
+        request->method = r % 4 == 0 ? "POST" : "GET";
+        request->url    = URLS[r % 4];
+
+        /* Mostly a few parameters, now and then many */
+        pick                  = next_random() % 100;
+        request->params_count = pick < 15   ? 0
+                                : pick < 35 ? 1
+                                : pick < 55 ? 2
+                                : pick < 75 ? 3 + ( int )(next_random() % 2)
+                                : pick < 90 ? 5 + ( int )(next_random() % 4)
+                                : pick < 97 ? 9 + ( int )(next_random() % 8)
+                                            : 17 + ( int )(next_random() % 24);
+        request->value     = "";
+        request->value_len = 0;
+
+        for (n = 0; n < request->params_count; ++n) {
+            /* Mostly short ids and flags, some tweets, a few long texts */
+            pick   = next_random() % 100;
+            length = pick < 70   ? 1 + next_random() % 20
+                     : pick < 95 ? 20 + next_random() % 121
+                                 : 140 + next_random() % 861;
+
+            request->params[n] = p;
+            p += sprintf(p, "%s=", PARAM_NAMES[next_random() % 16]);
+            for (c = 0; c < length; ++c) {
+                /* Text needs escaping now and then, ids never */
+                pick = next_random() % 100;
+                *p++ = length < 20 ? ( char )('0' + pick % 10)
+                       : pick < 80 ? ( char )('a' + pick % 26)
+                       : pick < 92 ? ' '
+                                   : "!#$&'()*+,/:;=?@[]"[pick % 18];
+            }
+            *p++ = '\0';
+
+            if (length > request->value_len) {
+                request->value     = strchr(request->params[n], '=') + 1;
+                request->value_len = length;
+            }
+        }
+    }
+
+    for (n = 0; n < BATCH_WIDTH; ++n) {
+        bench->builders[n] = new_oauth_request(bench->credentials);
+        if (bench->builders[n] == NULL) {
+            return 0;
+        }
+        load_request(bench->builders[n], &bench->requests[n]);
+        bench->bases[n] = get_signature_base(bench->builders[n]);
+
+        /* The hashes of an HMAC, from the midstates which are kept for a key */
+        bench->jobs[n].state[0] = 0x67452301u;
+        bench->jobs[n].state[1] = 0xEFCDAB89u;
+        bench->jobs[n].state[2] = 0x98BADCFEu;
+        bench->jobs[n].state[3] = 0x10325476u;
+        bench->jobs[n].state[4] = 0xC3D2E1F0u;
+        bench->jobs[n].hashed   = 64;
+        bench->jobs[n].data     = ( const unsigned char * )bench->bases[n];
+        bench->jobs[n].length   = strlen(bench->bases[n]);
+        bench->jobs[n].digest   = bench->digests[n];
+    }
+
+    return 1;
+}
+
+static void load_request(Builder *builder, Request *request) {
+    set_http_method(builder, request->method);
+    set_base_url(builder, request->url);
+    set_request_params(builder, request->params, request->params_count);
+    set_nonce(builder, "kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg");
+    set_timestamp(builder, "1318622958");
+    set_signature_method(builder, "HMAC-SHA1");
+    set_oauth_version(builder, "1.0");
+}
+
+static Request *next_request(Bench *bench) {
+    return &bench->requests[bench->next++ % CORPUS_SIZE];
+}
+
+static Builder *scratch_builder(Bench *bench) {
+    if (bench->next % CORPUS_SIZE == 0) {
+        reset_builder(bench->scratch);
+    }
+    return bench->scratch;
+}
+
+static void run_stage(Bench *bench, Stage stage, int per_call, double min_time, double *ns,
+                      double *allocs, long *ops) {
+    unsigned long before;
+    long calls = 16, i;
+    double began, elapsed;
+
+    /* Warm up, then double the calls until the run is long enough */
+    stage(bench);
+    for (;;) {
+        bench->next = 0;
+        before      = allocations;
+        began       = now_seconds();
+        for (i = 0; i < calls; ++i) {
+            stage(bench);
+        }
+        elapsed = now_seconds() - began;
+        if (elapsed >= min_time) {
+            break;
+        }
+        calls *= elapsed > 0 && min_time / elapsed < 2 ? 2 : 4;
+    }
+
+    *ops    = calls * per_call;
+    *ns     = elapsed * 1e9 / ( double )*ops;
+    *allocs = COUNTS_ALLOCATIONS ? ( double )(allocations - before) / ( double )*ops : -1;
+}
+
+static int wanted(const char *name, int argc, char **argv) {
+    int i;
+
+    for (i = 0; i < argc; ++i) {
+        if (strcmp(name, argv[i]) == 0) {
+            return 1;
+        }
+    }
+    return argc == 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( double )ts.tv_sec + ( double )ts.tv_nsec / 1e9;
+}
+
+static unsigned int next_random(void) {
+    random_state = random_state * 1103515245 + 12345;
+    return random_state >> 8;
+}
+
+static void stage_builder_create(Bench *bench) {
+    Builder *builder = new_oauth_request(bench->credentials);
+    destroy_builder(&builder);
+}
+
+static void stage_reset_builder(Bench *bench) {
+    reset_builder(bench->scratch);
+}
+
+static void stage_set_http_method(Bench *bench) {
+    Builder *builder = scratch_builder(bench);
+    set_http_method(builder, next_request(bench)->method);
+}
+
+static void stage_set_base_url(Bench *bench) {
+    Builder *builder = scratch_builder(bench);
+    set_base_url(builder, next_request(bench)->url);
+}
+
+static void stage_set_request_params(Bench *bench) {
+    Builder *builder       = scratch_builder(bench);
+    Request *request       = next_request(bench);
+
+    set_request_params(builder, request->params, request->params_count);
+}
+
+static void stage_percent_encode(Bench *bench) {
+    Request *request       = next_request(bench);
+    percent_encode(bench->output, request->value, request->value_len);
+}
+
+static void stage_signature_base(Bench *bench) {
+    get_signature_base_into(bench->builders[bench->next++ % BATCH_WIDTH], bench->output,
+                            OUTPUT_SIZE);
+}
+
+static void stage_hmac_sha1(Bench *bench) {
+    Sha1Job *job = &bench->jobs[bench->next++ % BATCH_WIDTH], outer = *job;
+
+    sha1_multi(job, 1);
+    outer.data   = outer.digest;
+    outer.length = 20;
+    sha1_multi(&outer, 1);
+}
+
+static void stage_hmac_sha1_batch(Bench *bench) {
+    Sha1Job outer[BATCH_WIDTH];
+    int i;
+
+    sha1_multi(bench->jobs, BATCH_WIDTH);
+    for (i = 0; i < BATCH_WIDTH; ++i) {
+        outer[i]        = bench->jobs[i];
+        outer[i].data   = outer[i].digest;
+        outer[i].length = 20;
+    }
+    sha1_multi(outer, BATCH_WIDTH);
+}
+
+static void stage_base64_signature(Bench *bench) {
+    base64_encode_escaped(bench->output, bench->digests[bench->next++ % BATCH_WIDTH], 20);
+}
+
+static void stage_nonce(Bench *bench) {
+    make_nonce(bench->output);
+}
+
+static void stage_timestamp(Bench *bench) {
+    current_timestamp(bench->output);
+}
+
+static void stage_header_into(Bench *bench) {
+    get_authorization_header_into(bench->builders[bench->next++ % BATCH_WIDTH], bench->output,
+                                  OUTPUT_SIZE);
+}
+
+static void stage_header(Bench *bench) {
+    free(get_authorization_header(bench->builders[bench->next++ % BATCH_WIDTH]));
+}
+
+static void stage_curl_command(Bench *bench) {
+    free(get_cURL_command(bench->builders[bench->next++ % BATCH_WIDTH]));
+}
+
+static void stage_headers_batch(Bench *bench) {
+    char *headers[BATCH_WIDTH];
+    int i;
+
+    get_authorization_headers(bench->builders, headers, BATCH_WIDTH);
+    for (i = 0; i < BATCH_WIDTH; ++i) {
+        free(headers[i]);
+    }
+}
+
+static void stage_sign_request(Bench *bench) {
+    Request *request       = next_request(bench);
+    Builder *builder       = bench->scratch;
+
+    reset_builder(builder);
+    load_request(builder, request);
+    get_authorization_header_into(builder, bench->output, OUTPUT_SIZE);
+}
@@ -0,0 +1,152 @@
+/* oauth_stress.c - multi-threaded signing throughput benchmark
+**
+** Runs the full sign path (builder creation, setters, header generation and
+** teardown) on 1, 2, 4, ... threads and reports how the aggregate number of
+** signatures per second scales with the thread count.
+**
+** usage:  oauth_stress [max_threads] [signatures_per_thread]
+*/
+
+#include <liboauthsign.h>
+#include <logger.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    pthread_barrier_t *start;
+    long iterations;
+    int failures;
+} Worker;
+
+/**
+ * @brief      Signs the same request over and over
+ *
+ * @param      arg   The Worker describing this thread's share of the work
+ *
+ * @return     NULL
+ */
+static void *run_worker(void *arg);
+
+/**
+ * @brief      Runs one round of the benchmark
+ *
+ * @param[in]  threads     The number of threads to sign on
+ * @param[in]  iterations  The number of signatures per thread
+ *
+ * @return     The aggregate throughput in signatures per second
+ */
+static double run_round(int threads, long iterations);
+
+/**
+ * @brief      Gets the value of the monotonic clock in seconds
+ *
+ * @return     The current time
+ */
+static double now_seconds(void);
+
+static const char *PARAMS[] = {
+    "include_entities=true",
+    "status=Hello Ladies + Gentlemen, a signed OAuth request!"};
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : ( int )sysconf(_SC_NPROCESSORS_ONLN);
+    long iterations = argc > 2 ? atol(argv[2]) : 20000;
+    double base     = 0, rate;
+    int threads;
+
+    if (max_threads < 1 || iterations < 1) {
+        e_log("usage:  %s [max_threads] [signatures_per_thread]\n", argv[0]);
+        return 1;
+    }
+
+    o_log("%8s %16s %10s %11s", "threads", "signatures/sec", "speedup", "efficiency");
+    for (threads = 1;; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+
+        rate = run_round(threads, iterations);
+        if (rate < 0) {
+            e_log("signing failed\n");
+            return 1;
+        }
+        if (threads == 1) {
+            base = rate;
+        }
+        o_log("%8d %16.0f %9.2fx %10.0f%%", threads, rate, rate / base,
+              100.0 * rate / (base * threads));
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static void *run_worker(void *arg) {
+    Worker *worker = arg;
+    Builder *builder;
+    char *header;
+    long i;
+
+    pthread_barrier_wait(worker->start);
+
+    for (i = 0; i < worker->iterations; ++i) {
+        builder = new_oauth_builder();
+        set_consumer_key(builder, "xvz1evFS4wEEPTGEFPHBog");
+        set_consumer_secret(builder, "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw");
+        set_token(builder, "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb");
+        set_token_secret(builder, "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+        set_http_method(builder, "POST");
+        set_base_url(builder, "https://api.twitter.com/1/statuses/update.json");
+        set_request_params(builder, PARAMS, sizeof PARAMS / sizeof PARAMS[0]);
+
+        header = get_authorization_header(builder);
+        if (header == NULL) {
+            worker->failures++;
+        }
+        free(header);
+        destroy_builder(&builder);
+    }
+
+    return NULL;
+}
+
+static double run_round(int threads, long iterations) {
+    pthread_t *ids    = malloc(sizeof(pthread_t) * ( size_t )threads);
+    Worker *workers   = calloc(( size_t )threads, sizeof(Worker));
+    pthread_barrier_t start;
+    double began, elapsed;
+    int t, failures = 0;
+
+    pthread_barrier_init(&start, NULL, ( unsigned int )threads + 1);
+    for (t = 0; t < threads; ++t) {
+        workers[t].start      = &start;
+        workers[t].iterations = iterations;
+        pthread_create(&ids[t], NULL, run_worker, &workers[t]);
+    }
+
+    began = now_seconds();
+    pthread_barrier_wait(&start);
+    for (t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        failures += workers[t].failures;
+    }
+    elapsed = now_seconds() - began;
+
+    pthread_barrier_destroy(&start);
+    free(workers);
+    free(ids);
+
+    return failures ? -1 : ( double )threads * ( double )iterations / elapsed;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( double )ts.tv_sec + ( double )ts.tv_nsec / 1e9;
+}
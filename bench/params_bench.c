@@ -0,0 +1,105 @@
+/* params_bench.c - parameter normalization scaling benchmark
+**
+** Signs requests carrying 1, 4, 16, ... request parameters, in random order,
+** and reports the time per signature base and per parameter. Normalization
+** is linear when the time per parameter stays flat as the count grows.
+**
+** usage:  params_bench [max_params] [total_params_per_round]
+*/
+
+#include <liboauthsign.h>
+#include <logger.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * @brief      Times one parameter count
+ *
+ * @param[in]  count       The number of request parameters
+ * @param[in]  iterations  The number of signature bases to build
+ *
+ * @return     The nanoseconds per signature base, or a negative value on
+ * failure
+ */
+static double run_round(int count, long iterations);
+
+/**
+ * @brief      Gets the value of the monotonic clock in seconds
+ *
+ * @return     The current time
+ */
+static double now_seconds(void);
+
+int main(int argc, char **argv) {
+    int max_params = argc > 1 ? atoi(argv[1]) : 4096;
+    long total     = argc > 2 ? atol(argv[2]) : 2000000;
+    double ns;
+    int count;
+
+    if (max_params < 1 || total < 1) {
+        e_log("usage:  %s [max_params] [total_params_per_round]\n", argv[0]);
+        return 1;
+    }
+
+    o_log("%8s %14s %14s", "params", "ns/signature", "ns/param");
+    for (count = 1; count <= max_params; count *= 4) {
+        ns = run_round(count, total / count > 0 ? total / count : 1);
+        if (ns < 0) {
+            e_log("signing failed\n");
+            return 1;
+        }
+        o_log("%8d %14.0f %14.1f", count, ns, ns / count);
+    }
+
+    return 0;
+}
+
+static double run_round(int count, long iterations) {
+    OauthCredentials *credentials = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    Builder *builder     = new_oauth_request(credentials);
+    const char **params  = malloc(sizeof(char *) * ( size_t )count);
+    char *storage        = malloc(( size_t )count * 32), buffer[256];
+    unsigned int seed    = 1;
+    double began, elapsed;
+    long i;
+    int c;
+
+    /* Lookup style ids in random order, all under a handful of names */
+    for (c = 0; c < count; ++c) {
+        seed = seed * 1103515245 + 12345;
+        snprintf(storage + c * 32, 32, "%s%u=%u", c % 2 ? "user_id" : "screen_name", seed % 997,
+                 seed);
+        params[c] = storage + c * 32;
+    }
+
+    began = now_seconds();
+    for (i = 0; i < iterations; ++i) {
+        reset_builder(builder);
+        set_http_method(builder, "GET");
+        set_base_url(builder, "https://api.twitter.com/1.1/users/lookup.json");
+        set_nonce(builder, "kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg");
+        set_timestamp(builder, "1318622958");
+        set_request_params(builder, params, count);
+        if (get_authorization_header_into(builder, buffer, sizeof buffer) == 0) {
+            iterations = -1;
+            break;
+        }
+    }
+    elapsed = now_seconds() - began;
+
+    free(storage);
+    free(params);
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+
+    return iterations < 0 ? -1 : elapsed * 1e9 / ( double )iterations;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( double )ts.tv_sec + ( double )ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,166 @@
+/* replay_bench.c - multi-threaded nonce replay cache throughput benchmark
+**
+** Each thread checks fresh nonces against one shared cache, with the clock
+** moving on a second every so often so that slots keep expiring and being
+** reused. Reports the aggregate number of nonces checked per second on 1,
+** 2, 4, ... threads.
+**
+** usage:  replay_bench [max_threads] [nonces_per_thread]
+*/
+
+#include <logger.h>
+#include <pthread.h>
+#include <replay_cache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** The seconds a timestamp may be off */
+#define WINDOW 300
+
+/** The nonces checked in one second of the benchmark's clock, by each thread */
+#define NONCES_PER_SECOND 20000
+
+typedef struct {
+    pthread_barrier_t *start;
+    OauthReplayCache *cache;
+    int index;
+    long iterations;
+    int failures;
+} Worker;
+
+/**
+ * @brief      Checks distinct nonces over and over
+ *
+ * @param      arg   The Worker describing this thread's share of the work
+ *
+ * @return     NULL
+ */
+static void *run_worker(void *arg);
+
+/**
+ * @brief      Runs one round of the benchmark
+ *
+ * @param[in]  threads     The number of threads to check nonces on
+ * @param[in]  iterations  The number of nonces per thread
+ *
+ * @return     The aggregate throughput in nonces per second
+ */
+static double run_round(int threads, long iterations);
+
+/**
+ * @brief      Gets the value of the monotonic clock in seconds
+ *
+ * @return     The current time
+ */
+static double now_seconds(void);
+
+static int round_number;
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : ( int )sysconf(_SC_NPROCESSORS_ONLN);
+    long iterations = argc > 2 ? atol(argv[2]) : 1000000;
+    double base     = 0, rate;
+    int threads;
+
+    if (max_threads < 1 || iterations < 1) {
+        e_log("usage:  %s [max_threads] [nonces_per_thread]\n", argv[0]);
+        return 1;
+    }
+
+    o_log("%8s %14s %10s %11s", "threads", "nonces/sec", "speedup", "efficiency");
+    for (threads = 1;; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+
+        rate = run_round(threads, iterations);
+        if (rate < 0) {
+            e_log("a fresh nonce was not accepted\n");
+            return 1;
+        }
+        if (threads == 1) {
+            base = rate;
+        }
+        o_log("%8d %14.0f %9.2fx %10.0f%%", threads, rate, rate / base,
+              100.0 * rate / (base * threads));
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static void *run_worker(void *arg) {
+    Worker *worker = arg;
+    char nonce[64];
+    long i, now;
+    int length;
+
+    pthread_barrier_wait(worker->start);
+
+    for (i = 0; i < worker->iterations; ++i) {
+        now    = 1318622958L + i / NONCES_PER_SECOND;
+        length = snprintf(nonce, sizeof nonce, "%d-%d-%ld", round_number, worker->index, i);
+        if (check_nonce(worker->cache, "xvz1evFS4wEEPTGEFPHBog", 22,
+                        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", 50, nonce,
+                        ( size_t )length, now, now) != OAUTH_REPLAY_NEW) {
+            worker->failures++;
+        }
+    }
+
+    return NULL;
+}
+
+static double run_round(int threads, long iterations) {
+    pthread_t *ids  = malloc(sizeof(pthread_t) * ( size_t )threads);
+    Worker *workers = calloc(( size_t )threads, sizeof(Worker));
+    OauthReplayCache *cache;
+    pthread_barrier_t start;
+    double began, elapsed;
+    int t, failures = 0;
+
+    /* Room for every nonce of the window, from every thread */
+    cache = new_replay_cache(( size_t )threads * NONCES_PER_SECOND * (2 * WINDOW + 1), WINDOW,
+                             NULL);
+    if (cache == NULL) {
+        free(workers);
+        free(ids);
+        return -1;
+    }
+    round_number++;
+
+    pthread_barrier_init(&start, NULL, ( unsigned int )threads + 1);
+    for (t = 0; t < threads; ++t) {
+        workers[t].start      = &start;
+        workers[t].cache      = cache;
+        workers[t].index      = t;
+        workers[t].iterations = iterations;
+        pthread_create(&ids[t], NULL, run_worker, &workers[t]);
+    }
+
+    began = now_seconds();
+    pthread_barrier_wait(&start);
+    for (t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        failures += workers[t].failures;
+    }
+    elapsed = now_seconds() - began;
+
+    pthread_barrier_destroy(&start);
+    destroy_replay_cache(&cache);
+    free(workers);
+    free(ids);
+
+    return failures ? -1 : ( double )threads * ( double )iterations / elapsed;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( double )ts.tv_sec + ( double )ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,205 @@
+/* verify_bench.c - multi-threaded sign and verify round trip benchmark
+**
+** Each thread signs a request with reused builders, as a client would, then
+** verifies the Authorization header against the same request, as a server
+** would. Reports the aggregate number of round trips per second on 1, 2,
+** 4, ... threads.
+**
+** usage:  verify_bench [max_threads] [round_trips_per_thread]
+*/
+
+#include <liboauthsign.h>
+#include <logger.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CONSUMER_KEY "xvz1evFS4wEEPTGEFPHBog"
+
+typedef struct {
+    pthread_barrier_t *start;
+    OauthCredentials *credentials;
+    long iterations;
+    int failures;
+} Worker;
+
+/**
+ * @brief      Finds the only credentials of the benchmark
+ *
+ * @param[in]  consumer_key      The consumer key
+ * @param[in]  consumer_key_len  The length of the consumer key
+ * @param[in]  token             The token
+ * @param[in]  token_len         The length of the token
+ * @param      context           The credentials
+ *
+ * @return     The credentials if the consumer key is theirs, NULL otherwise
+ */
+static const OauthCredentials *find_credentials(const char *consumer_key,
+                                                size_t consumer_key_len, const char *token,
+                                                size_t token_len, void *context);
+
+/**
+ * @brief      Signs and verifies the same request over and over
+ *
+ * @param      arg   The Worker describing this thread's share of the work
+ *
+ * @return     NULL
+ */
+static void *run_worker(void *arg);
+
+/**
+ * @brief      Runs one round of the benchmark
+ *
+ * @param[in]  credentials  The credentials to sign with
+ * @param[in]  threads      The number of threads to run on
+ * @param[in]  iterations   The number of round trips per thread
+ *
+ * @return     The aggregate throughput in round trips per second
+ */
+static double run_round(OauthCredentials *credentials, int threads, long iterations);
+
+/**
+ * @brief      Gets the value of the monotonic clock in seconds
+ *
+ * @return     The current time
+ */
+static double now_seconds(void);
+
+static const char *PARAMS[] = {
+    "include_entities=true",
+    "status=Hello Ladies + Gentlemen, a signed OAuth request!"};
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : ( int )sysconf(_SC_NPROCESSORS_ONLN);
+    long iterations = argc > 2 ? atol(argv[2]) : 100000;
+    OauthCredentials *credentials;
+    double base = 0, rate;
+    int threads;
+
+    if (max_threads < 1 || iterations < 1) {
+        e_log("usage:  %s [max_threads] [round_trips_per_thread]\n", argv[0]);
+        return 1;
+    }
+
+    credentials =
+        new_oauth_credentials(CONSUMER_KEY, "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+                              "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb",
+                              "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    if (credentials == NULL) {
+        e_log("could not create the credentials\n");
+        return 1;
+    }
+
+    o_log("%8s %17s %10s %11s", "threads", "round trips/sec", "speedup", "efficiency");
+    for (threads = 1;; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+
+        rate = run_round(credentials, threads, iterations);
+        if (rate < 0) {
+            e_log("a signature did not verify\n");
+            destroy_credentials(&credentials);
+            return 1;
+        }
+        if (threads == 1) {
+            base = rate;
+        }
+        o_log("%8d %17.0f %9.2fx %10.0f%%", threads, rate, rate / base,
+              100.0 * rate / (base * threads));
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    destroy_credentials(&credentials);
+    return 0;
+}
+
+static const OauthCredentials *find_credentials(const char *consumer_key,
+                                                size_t consumer_key_len, const char *token,
+                                                size_t token_len, void *context) {
+    ( void )token;
+    ( void )token_len;
+
+    if (consumer_key_len != sizeof CONSUMER_KEY - 1 ||
+        memcmp(consumer_key, CONSUMER_KEY, consumer_key_len) != 0) {
+        return NULL;
+    }
+    return context;
+}
+
+static void *run_worker(void *arg) {
+    Worker *worker    = arg;
+    Builder *signer   = new_oauth_request(worker->credentials);
+    Builder *verifier = new_oauth_builder();
+    OauthVerifyResult result;
+    char header[1024];
+    size_t length;
+    long i;
+
+    pthread_barrier_wait(worker->start);
+
+    for (i = 0; i < worker->iterations; ++i) {
+        reset_builder(signer);
+        set_http_method(signer, "POST");
+        set_base_url(signer, "https://api.twitter.com/1/statuses/update.json");
+        set_request_params(signer, PARAMS, sizeof PARAMS / sizeof PARAMS[0]);
+        length = get_authorization_header_into(signer, header, sizeof header);
+
+        reset_builder(verifier);
+        set_http_method(verifier, "POST");
+        set_base_url(verifier, "https://api.twitter.com/1/statuses/update.json");
+        set_request_params(verifier, PARAMS, sizeof PARAMS / sizeof PARAMS[0]);
+        result = length == 0 ? OAUTH_VERIFY_MALFORMED
+                             : verify_authorization_header(verifier, header, length,
+                                                           find_credentials, worker->credentials);
+        if (result != OAUTH_VERIFY_OK) {
+            worker->failures++;
+        }
+    }
+
+    destroy_builder(&signer);
+    destroy_builder(&verifier);
+    return NULL;
+}
+
+static double run_round(OauthCredentials *credentials, int threads, long iterations) {
+    pthread_t *ids    = malloc(sizeof(pthread_t) * ( size_t )threads);
+    Worker *workers   = calloc(( size_t )threads, sizeof(Worker));
+    pthread_barrier_t start;
+    double began, elapsed;
+    int t, failures = 0;
+
+    pthread_barrier_init(&start, NULL, ( unsigned int )threads + 1);
+    for (t = 0; t < threads; ++t) {
+        workers[t].start       = &start;
+        workers[t].credentials = credentials;
+        workers[t].iterations  = iterations;
+        pthread_create(&ids[t], NULL, run_worker, &workers[t]);
+    }
+
+    began = now_seconds();
+    pthread_barrier_wait(&start);
+    for (t = 0; t < threads; ++t) {
+        pthread_join(ids[t], NULL);
+        failures += workers[t].failures;
+    }
+    elapsed = now_seconds() - began;
+
+    pthread_barrier_destroy(&start);
+    free(workers);
+    free(ids);
+
+    return failures ? -1 : ( double )threads * ( double )iterations / elapsed;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ( double )ts.tv_sec + ( double )ts.tv_nsec / 1e9;
+}
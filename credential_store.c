@@ -0,0 +1,522 @@
+#include <credential_store.h>
+#include <fcntl.h>
+#include <logger.h>
+#include <oauth_alloc.h>
+#include <percent_encode.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Marks a credential store file, and its layout */
+#define STORE_MAGIC "OAUTHCS1"
+
+/** The entries of an index bucket, which fill one cache line */
+#define BUCKET_ENTRIES 4
+
+/** The strings of a record: the account, then those of its credentials */
+#define X_STORED_STRINGS \
+    X(account)           \
+    X_CREDENTIAL_STRINGS
+
+enum {
+#define X(string) STORED_##string,
+    X_STORED_STRINGS
+#undef X
+    STORED_STRING_COUNT
+};
+
+/**
+ * The start of a store file. The index follows it, then the records.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t buckets;
+    uint64_t size;
+    char padding[64 - 8 - 3 * sizeof(uint64_t)];
+} StoreHeader;
+
+/**
+ * An account in the index. The tag is the top half of the hash of the
+ * account, so most other accounts of the bucket are told apart without
+ * reading their record. An offset of 0 marks an empty entry.
+ */
+typedef struct {
+    uint32_t tag;
+    uint32_t number;
+    uint64_t offset;
+} IndexEntry;
+
+/**
+ * The start of a record, which is followed by its strings in the order of
+ * X_STORED_STRINGS, each null terminated, and padded to 8 bytes
+ */
+typedef struct {
+    uint32_t lengths[STORED_STRING_COUNT];
+} RecordHeader;
+
+/** Credentials made from a store, kept in a list to be destroyed with it */
+typedef struct Published {
+    OauthCredentials *credentials;
+    struct Published *next;
+} Published;
+
+struct OauthCredentialStore {
+    char *map;
+    size_t size;
+    const StoreHeader *header;
+    const IndexEntry *index;
+    /**
+     * The credentials of each account, made on first use. The array is
+     * mapped without reserving memory, so only the pages of accounts that
+     * are used are ever touched.
+     */
+    OauthCredentials **views;
+    size_t views_size;
+    Published *published;
+};
+
+/**
+ * @brief      Works out the lengths of the strings of an account's record
+ *
+ * @param[in]  account  The account
+ * @param[out] lengths  Receives the lengths, STORED_STRING_COUNT of them
+ */
+static void account_lengths(const OauthAccount *account, uint32_t *lengths);
+
+/**
+ * @brief      Copies a string and its terminating null
+ *
+ * @param      out     Where to copy it
+ * @param[in]  string  The string
+ * @param[in]  length  The length of the string
+ *
+ * @return     The position after the null
+ */
+static char *copy_string(char *out, const char *string, size_t length);
+
+/**
+ * @brief      Gets the size of a record
+ *
+ * @param[in]  lengths  The lengths of its strings
+ *
+ * @return     The size, a multiple of 8
+ */
+static size_t record_size(const uint32_t *lengths);
+
+/**
+ * @brief      Finds the strings of a record
+ *
+ * @param[in]  store    The store
+ * @param[in]  offset   The offset of the record
+ * @param[out] strings  Receives the strings, STORED_STRING_COUNT of them
+ * @param[out] lengths  Receives their lengths
+ *
+ * @return     1 on success, 0 if the record does not fit in the file
+ */
+static int read_record(const OauthCredentialStore *store, uint64_t offset, const char **strings,
+                       size_t *lengths);
+
+/**
+ * @brief      Finds the index entry of an account
+ *
+ * @param[in]  index        The index
+ * @param[in]  buckets      The number of buckets of the index
+ * @param[in]  map          The start of the file, which offsets are from
+ * @param[in]  size         The size of the file
+ * @param[in]  account      The account
+ * @param[in]  account_len  The length of the account
+ * @param[out] empty        Receives the first empty entry along the probe if
+ * the account is not there, and may be NULL
+ *
+ * @return     The entry or NULL if the account is not in the index
+ */
+static const IndexEntry *find_entry(const IndexEntry *index, uint64_t buckets, const char *map,
+                                    size_t size, const char *account, size_t account_len,
+                                    const IndexEntry **empty);
+
+/**
+ * @brief      Gets the credentials of an entry, making them on first use
+ *
+ * @param      store  The store
+ * @param[in]  entry  The entry
+ *
+ * @return     The credentials or NULL if they could not be made
+ */
+static const OauthCredentials *entry_credentials(OauthCredentialStore *store,
+                                                 const IndexEntry *entry);
+
+/**
+ * @brief      Hashes an account with FNV-1a
+ *
+ * @param[in]  account  The account
+ * @param[in]  length   The length of the account
+ *
+ * @return     The hash
+ */
+static uint64_t hash_account(const char *account, size_t length);
+
+int write_credential_store(const char *path, const OauthAccount *accounts, size_t count) {
+    uint32_t lengths[STORED_STRING_COUNT];
+    const IndexEntry *empty;
+    char *tmp, *map, *out;
+    uint64_t buckets = 1, hash;
+    size_t i, size, offset;
+    StoreHeader *header;
+    IndexEntry *index, *entry;
+    RecordHeader *record;
+    int fd, ok = 0;
+
+    /* Half the entries are kept empty, so that an account is nearly always
+       in the first bucket it hashes to */
+    while (buckets * BUCKET_ENTRIES < 2 * ( uint64_t )count) {
+        buckets *= 2;
+    }
+
+    size = sizeof(StoreHeader) + buckets * sizeof(IndexEntry) * BUCKET_ENTRIES;
+    for (i = 0; i < count; ++i) {
+        account_lengths(&accounts[i], lengths);
+        size += record_size(lengths);
+    }
+
+    tmp = oauth_alloc(strlen(path) + 5);
+    if (tmp == NULL) {
+        return 0;
+    }
+    sprintf(tmp, "%s.new", path);
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, ( off_t )size) != 0) {
+        e_log("Could not create %s\n", tmp);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        oauth_release(tmp);
+        return 0;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        e_log("Could not map %s\n", tmp);
+        close(fd);
+        unlink(tmp);
+        oauth_release(tmp);
+        return 0;
+    }
+
+    header = ( StoreHeader * )map;
+    memcpy(header->magic, STORE_MAGIC, sizeof header->magic);
+    header->count   = count;
+    header->buckets = buckets;
+    header->size    = size;
+    index           = ( IndexEntry * )(header + 1);
+
+    offset = sizeof(StoreHeader) + buckets * sizeof(IndexEntry) * BUCKET_ENTRIES;
+    for (i = 0; i < count; ++i) {
+        account_lengths(&accounts[i], lengths);
+        if (find_entry(index, buckets, map, size, accounts[i].account, lengths[STORED_account],
+                       &empty) != NULL) {
+            e_log("The account %s is given twice\n", accounts[i].account);
+            goto done;
+        }
+
+        hash          = hash_account(accounts[i].account, lengths[STORED_account]);
+        entry         = index + (empty - index);
+        entry->tag    = ( uint32_t )(hash >> 32);
+        entry->number = ( uint32_t )i;
+        entry->offset = offset;
+
+        record = ( RecordHeader * )(map + offset);
+        memcpy(record->lengths, lengths, sizeof lengths);
+        out = ( char * )(record + 1);
+
+        /* The file starts zeroed, so the encoded strings are terminated already */
+        out = copy_string(out, accounts[i].account, lengths[STORED_account]);
+        out = copy_string(out, accounts[i].consumer_key, lengths[STORED_consumer_key]);
+        out += percent_encode(out, accounts[i].consumer_key, lengths[STORED_consumer_key]) + 1;
+        out = copy_string(out, accounts[i].consumer_secret, lengths[STORED_consumer_secret]);
+        out = copy_string(out, accounts[i].token, lengths[STORED_token]);
+        out += percent_encode(out, accounts[i].token, lengths[STORED_token]) + 1;
+        out = copy_string(out, accounts[i].token_secret, lengths[STORED_token_secret]);
+        out += percent_encode(out, accounts[i].consumer_secret, lengths[STORED_consumer_secret]);
+        *out++ = '&';
+        percent_encode(out, accounts[i].token_secret, lengths[STORED_token_secret]);
+
+        offset += record_size(lengths);
+    }
+    ok = 1;
+
+done:
+    munmap(map, size);
+    if (ok && (fsync(fd) != 0 || rename(tmp, path) != 0)) {
+        e_log("Could not write %s\n", path);
+        ok = 0;
+    }
+    close(fd);
+    if (!ok) {
+        unlink(tmp);
+    }
+    oauth_release(tmp);
+
+    return ok;
+}
+
+OauthCredentialStore *open_credential_store(const char *path) {
+    OauthCredentialStore *store;
+    const StoreHeader *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || ( size_t )st.st_size < sizeof(StoreHeader)) {
+        e_log("Could not open the credential store %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    map = mmap(NULL, ( size_t )st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        e_log("Could not map the credential store %s\n", path);
+        return NULL;
+    }
+
+    /* Only the header is checked; records are checked as they are read */
+    header = map;
+    if (memcmp(header->magic, STORE_MAGIC, sizeof header->magic) != 0 ||
+        header->size != ( uint64_t )st.st_size || header->buckets == 0 ||
+        (header->buckets & (header->buckets - 1)) != 0 ||
+        header->buckets > (header->size - sizeof(StoreHeader)) / sizeof(IndexEntry) /
+                              BUCKET_ENTRIES ||
+        header->count > header->buckets * BUCKET_ENTRIES) {
+        e_log("%s is not a credential store\n", path);
+        munmap(map, ( size_t )st.st_size);
+        return NULL;
+    }
+
+    store = oauth_alloc_zeroed(1, sizeof(OauthCredentialStore));
+    if (store == NULL) {
+        munmap(map, ( size_t )st.st_size);
+        return NULL;
+    }
+    store->views_size = ( size_t )(header->count + 1) * sizeof(OauthCredentials *);
+    store->views = mmap(NULL, store->views_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (store->views == MAP_FAILED) {
+        oauth_release(store);
+        munmap(map, ( size_t )st.st_size);
+        return NULL;
+    }
+
+    store->map    = map;
+    store->size   = ( size_t )st.st_size;
+    store->header = header;
+    store->index  = ( const IndexEntry * )(header + 1);
+    return store;
+}
+
+size_t get_store_size(const OauthCredentialStore *store) {
+    return ( size_t )store->header->count;
+}
+
+const OauthCredentials *find_account(OauthCredentialStore *store, const char *account,
+                                     size_t account_len) {
+    const IndexEntry *entry = find_entry(store->index, store->header->buckets, store->map,
+                                         store->size, account, account_len, NULL);
+
+    return entry != NULL ? entry_credentials(store, entry) : NULL;
+}
+
+const OauthCredentials *find_stored_credentials(const char *consumer_key,
+                                                size_t consumer_key_len, const char *token,
+                                                size_t token_len, void *context) {
+    OauthCredentialStore *store = context;
+    const char *strings[STORED_STRING_COUNT];
+    size_t lengths[STORED_STRING_COUNT];
+    const IndexEntry *entry;
+
+    entry = find_entry(store->index, store->header->buckets, store->map, store->size, token,
+                       token_len, NULL);
+    if (entry == NULL || !read_record(store, entry->offset, strings, lengths) ||
+        lengths[STORED_consumer_key] != consumer_key_len ||
+        memcmp(strings[STORED_consumer_key], consumer_key, consumer_key_len) != 0) {
+        return NULL;
+    }
+
+    return entry_credentials(store, entry);
+}
+
+void destroy_credential_store(OauthCredentialStore **store) {
+    OauthCredentialStore *ref = *store;
+    Published *published, *next;
+
+    if (ref == NULL) {
+        return;
+    }
+
+    /* Only the accounts that were used have credentials to destroy */
+    for (published = ref->published; published != NULL; published = next) {
+        next = published->next;
+        destroy_credentials(&published->credentials);
+        oauth_release(published);
+    }
+    munmap(ref->views, ref->views_size);
+    munmap(ref->map, ref->size);
+    oauth_release(ref);
+    *store = NULL;
+}
+
+static void account_lengths(const OauthAccount *account, uint32_t *lengths) {
+    size_t consumer_secret = strlen(account->consumer_secret);
+    size_t token_secret    = strlen(account->token_secret);
+
+    lengths[STORED_account]      = ( uint32_t )strlen(account->account);
+    lengths[STORED_consumer_key] = ( uint32_t )strlen(account->consumer_key);
+    lengths[STORED_encoded_consumer_key] =
+        ( uint32_t )percent_encoded_length(account->consumer_key, lengths[STORED_consumer_key]);
+    lengths[STORED_consumer_secret] = ( uint32_t )consumer_secret;
+    lengths[STORED_token]           = ( uint32_t )strlen(account->token);
+    lengths[STORED_encoded_token] =
+        ( uint32_t )percent_encoded_length(account->token, lengths[STORED_token]);
+    lengths[STORED_token_secret] = ( uint32_t )token_secret;
+    lengths[STORED_signing_key] =
+        ( uint32_t )(percent_encoded_length(account->consumer_secret, consumer_secret) + 1 +
+                     percent_encoded_length(account->token_secret, token_secret));
+}
+
+static char *copy_string(char *out, const char *string, size_t length) {
+    memcpy(out, string, length + 1);
+    return out + length + 1;
+}
+
+static size_t record_size(const uint32_t *lengths) {
+    size_t size = sizeof(RecordHeader);
+    int i;
+
+    for (i = 0; i < STORED_STRING_COUNT; ++i) {
+        size += ( size_t )lengths[i] + 1;
+    }
+    return (size + 7) & ~( size_t )7;
+}
+
+static int read_record(const OauthCredentialStore *store, uint64_t offset, const char **strings,
+                       size_t *lengths) {
+    const RecordHeader *record;
+    const char *p;
+    int i;
+
+    if (offset > store->size - sizeof(RecordHeader)) {
+        return 0;
+    }
+    record = ( const RecordHeader * )(store->map + offset);
+    if (record_size(record->lengths) > store->size - offset) {
+        return 0;
+    }
+
+    p = ( const char * )(record + 1);
+    for (i = 0; i < STORED_STRING_COUNT; ++i) {
+        strings[i] = p;
+        lengths[i] = record->lengths[i];
+        p += lengths[i] + 1;
+    }
+    return 1;
+}
+
+static const IndexEntry *find_entry(const IndexEntry *index, uint64_t buckets, const char *map,
+                                    size_t size, const char *account, size_t account_len,
+                                    const IndexEntry **empty) {
+    uint64_t hash = hash_account(account, account_len), b;
+    uint32_t tag  = ( uint32_t )(hash >> 32);
+    const RecordHeader *record;
+    const IndexEntry *entry;
+    int i;
+
+    for (b = 0; b < buckets; ++b) {
+        entry = index + ((hash + b) & (buckets - 1)) * BUCKET_ENTRIES;
+        for (i = 0; i < BUCKET_ENTRIES; ++i, ++entry) {
+            if (entry->offset == 0) {
+                if (empty != NULL) {
+                    *empty = entry;
+                }
+                return NULL;
+            }
+            if (entry->tag != tag || entry->offset > size - sizeof(RecordHeader)) {
+                continue;
+            }
+
+            /* The account is the first string of the record */
+            record = ( const RecordHeader * )(map + entry->offset);
+            if (record->lengths[STORED_account] == account_len &&
+                account_len < size - entry->offset - sizeof(RecordHeader) &&
+                memcmp(record + 1, account, account_len) == 0) {
+                return entry;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static const OauthCredentials *entry_credentials(OauthCredentialStore *store,
+                                                 const IndexEntry *entry) {
+    const char *strings[STORED_STRING_COUNT];
+    size_t lengths[STORED_STRING_COUNT];
+    OauthCredentialStrings view;
+    OauthCredentials *credentials, *expected = NULL;
+    Published *published;
+
+    if (entry->number >= store->header->count) {
+        return NULL;
+    }
+    credentials = __atomic_load_n(&store->views[entry->number], __ATOMIC_ACQUIRE);
+    if (credentials != NULL) {
+        return credentials;
+    }
+
+    if (!read_record(store, entry->offset, strings, lengths)) {
+        return NULL;
+    }
+#define X(string)                                 \
+    view.string          = strings[STORED_##string]; \
+    view.string##_len    = lengths[STORED_##string];
+    X_CREDENTIAL_STRINGS
+#undef X
+    credentials = new_credentials_view(&view);
+    published   = oauth_alloc(sizeof(Published));
+    if (credentials == NULL || published == NULL) {
+        destroy_credentials(&credentials);
+        oauth_release(published);
+        return NULL;
+    }
+
+    /* Two threads can make the same view; the one published first is kept */
+    if (!__atomic_compare_exchange_n(&store->views[entry->number], &expected, credentials, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        destroy_credentials(&credentials);
+        oauth_release(published);
+        return expected;
+    }
+
+    published->credentials = credentials;
+    published->next        = __atomic_load_n(&store->published, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&store->published, &published->next, published, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return credentials;
+}
+
+static uint64_t hash_account(const char *account, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        hash ^= ( unsigned char )account[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,43 @@
+#ifndef OAUTH_ACCOUNTS_H
+#define OAUTH_ACCOUNTS_H
+
+#include <liboauthsign.h>
+
+typedef struct AccountCache AccountCache;
+
+/**
+ * @brief      Creates a cache of credentials keyed by their four strings
+ * @details    The cache is not synchronized; each thread keeps its own.
+ * A call to destroy_account_cache() must follow after making use of this
+ * object
+ *
+ * @return     The cache or NULL if allocation failed
+ */
+AccountCache *new_account_cache(void);
+
+/**
+ * @brief      Finds the credentials of an account, creating them on first use
+ *
+ * @details    Credentials are kept until the cache is destroyed, so the
+ * returned pointer stays valid for the lifetime of the cache.
+ *
+ * @param      cache            The cache
+ * @param[in]  consumer_key     The consumer key
+ * @param[in]  consumer_secret  The consumer secret
+ * @param[in]  token            The token
+ * @param[in]  token_secret     The token secret
+ *
+ * @return     The credentials or NULL if allocation failed
+ */
+const OauthCredentials *find_credentials(AccountCache *cache, const char *consumer_key,
+                                         const char *consumer_secret, const char *token,
+                                         const char *token_secret);
+
+/**
+ * @brief      Destroys a cache and every set of credentials it holds
+ *
+ * @param      cache  The cache
+ */
+void destroy_account_cache(AccountCache **cache);
+
+#endif // OAUTH_ACCOUNTS_H
@@ -0,0 +1,98 @@
+#ifndef OAUTH_ARENA_H
+#define OAUTH_ARENA_H
+
+#include <oauth_alloc.h>
+#include <stddef.h>
+
+typedef struct Arena Arena;
+typedef struct ArenaChunk ArenaChunk;
+
+/**
+ * @brief      A position in an arena, see arena_mark()
+ */
+typedef struct {
+    ArenaChunk *chunk;
+    char *top;
+} ArenaMark;
+
+/**
+ * @brief      Creates a new bump allocator
+ * @details    The arena lives in its own first chunk, so creating one costs a
+ * single allocation. Chunks are added as needed, each at least chunk_size
+ * bytes, and are kept across arena_reset() so a reused arena stops
+ * allocating once it has grown to its working size.
+ * A call to arena_destroy() must follow after making use of this object
+ *
+ * @param[in]  chunk_size  The minimum size of each chunk
+ *
+ * @return     The arena or NULL if allocation failed
+ */
+Arena *arena_new(size_t chunk_size);
+
+/**
+ * @brief      Allocates memory from an arena
+ * @details    The memory is suitably aligned for any pointer or size_t and
+ * stays valid until the arena is reset, destroyed or released past it.
+ *
+ * @param      arena  The arena
+ * @param[in]  size   The number of bytes to allocate
+ *
+ * @return     The memory or NULL if a new chunk could not be allocated
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * @brief      Copies a string into an arena
+ *
+ * @param      arena   The arena
+ * @param[in]  s       The string to copy
+ * @param[in]  length  The number of bytes to copy
+ *
+ * @return     The null terminated copy or NULL if allocation failed
+ */
+char *arena_strndup(Arena *arena, const char *s, size_t length);
+
+/**
+ * @brief      Remembers the current position of an arena
+ *
+ * @param[in]  arena  The arena
+ *
+ * @return     The position, to be passed to arena_release()
+ */
+ArenaMark arena_mark(const Arena *arena);
+
+/**
+ * @brief      Frees everything allocated since a call to arena_mark()
+ *
+ * @param      arena  The arena
+ * @param[in]  mark   A mark taken from the same arena
+ */
+void arena_release(Arena *arena, ArenaMark mark);
+
+/**
+ * @brief      Frees everything allocated from an arena but keeps its chunks
+ *
+ * @param      arena  The arena
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * @brief      Gets the allocation counters of an arena
+ * @details    The chunks of the arena are counted as held until it is
+ * destroyed. Allocations made on behalf of the owner of the arena may be
+ * charged to the counters as well.
+ *
+ * @param      arena  The arena
+ *
+ * @return     The counters
+ */
+OauthAllocStats *arena_stats(Arena *arena);
+
+/**
+ * @brief      Destroys an arena and every allocation made from it
+ *
+ * @param      arena  The arena
+ */
+void arena_destroy(Arena *arena);
+
+#endif // OAUTH_ARENA_H
@@ -0,0 +1,49 @@
+#ifndef OAUTH_BASE64_H
+#define OAUTH_BASE64_H
+
+#include <stddef.h>
+
+/**
+ * The length of the base64 encoding of length bytes, padding included
+ */
+#define BASE64_LENGTH(length) (4 * (((length) + 2) / 3))
+
+/**
+ * The longest percent-encoded base64 encoding of length bytes, where every
+ * character but the padding may be '+' or '/' and every one is escaped
+ */
+#define BASE64_ESCAPED_LENGTH(length) (3 * BASE64_LENGTH(length))
+
+/**
+ * @brief      Base64 encodes bytes (RFC 4648, with padding)
+ *
+ * @details    Twelve bytes at a time are spread into sixteen 6 bit indices
+ * and translated to the alphabet with SSSE3 shuffles when the CPU supports
+ * them, which is checked once at runtime. The rest goes through a table.
+ *
+ * @param      out     Receives the encoding and a terminating null,
+ * BASE64_LENGTH(length) + 1 bytes
+ * @param[in]  in      The bytes to encode
+ * @param[in]  length  The number of bytes
+ *
+ * @return     The length of the encoding
+ */
+size_t base64_encode(char *out, const unsigned char *in, size_t length);
+
+/**
+ * @brief      Base64 encodes bytes and percent-encodes the result in one go
+ *
+ * @details    '+', '/' and '=' come out as "%2B", "%2F" and "%3D", so the
+ * result can go straight into an OAuth header or signature base. The 20 byte
+ * digest of HMAC-SHA1 takes a path of its own which the compiler unrolls.
+ *
+ * @param      out     Receives the encoding and a terminating null,
+ * BASE64_ESCAPED_LENGTH(length) + 1 bytes
+ * @param[in]  in      The bytes to encode
+ * @param[in]  length  The number of bytes
+ *
+ * @return     The length of the encoding
+ */
+size_t base64_encode_escaped(char *out, const unsigned char *in, size_t length);
+
+#endif // OAUTH_BASE64_H
@@ -0,0 +1,43 @@
+#ifndef OAUTH_BATCH_H
+#define OAUTH_BATCH_H
+
+#include <stdio.h>
+
+/**
+ * @brief      Checks that a method is one oauth_sign knows how to sign
+ * @details    The method is converted to uppercase in place.
+ *
+ * @param      method  The method
+ *
+ * @return     1 if the method is valid, 0 otherwise
+ */
+int check_method(char *method);
+
+/**
+ * @brief      Signs newline delimited requests read from a stream
+ *
+ * @details    Each line is either tab separated:
+ *
+ *     consumer_key  consumer_secret  token  token_secret  method  url  [name=value ...]
+ *
+ * or a JSON object with the string members consumer_key, consumer_secret,
+ * token, token_secret, method and url, and an optional params member which is
+ * an array of "name=value" strings or an object of string values.
+ *
+ * Lines are read in blocks and signed on a pool of threads. One
+ * Authorization header is written to out per line, in input order. A line
+ * which cannot be signed gives an empty line on out and a diagnostic on
+ * stderr. Credentials are created once per distinct account and reused for
+ * every later line signed with it.
+ *
+ * @param      in       The stream to read the requests from
+ * @param      out      The stream to write the headers to
+ * @param[in]  threads  The number of threads to sign on, or 0 to use one per
+ * online processor
+ *
+ * @return     The number of lines which could not be signed, or -1 if the
+ * input could not be read or the output could not be written
+ */
+long run_batch(FILE *in, FILE *out, int threads);
+
+#endif // OAUTH_BATCH_H
@@ -0,0 +1,111 @@
+#ifndef OAUTH_CREDENTIAL_STORE_H
+#define OAUTH_CREDENTIAL_STORE_H
+
+#include <liboauthsign.h>
+#include <stddef.h>
+
+typedef struct OauthCredentialStore OauthCredentialStore;
+
+/**
+ * @brief      The strings of one account of a store
+ *
+ * @details    The account is the name the credentials are found by, for
+ * instance a user id or the token itself.
+ */
+typedef struct {
+    const char *account;
+    const char *consumer_key;
+    const char *consumer_secret;
+    const char *token;
+    const char *token_secret;
+} OauthAccount;
+
+/**
+ * @brief      Writes a credential store file
+ *
+ * @details    Each account is written once, with its consumer key and token
+ * both as they are and percent-encoded, its secrets, and the signing key
+ * made from the encoded secrets, followed by a hash index on the account.
+ * The file is written beside the path and renamed over it, so processes
+ * which have the old store open keep it until they open it again.
+ * The layout is that of the machine it is written on.
+ *
+ * @param[in]  path      The file
+ * @param[in]  accounts  The accounts, which must all differ in account
+ * @param[in]  count     The number of accounts
+ *
+ * @return     1 on success, 0 if an account is given twice or the file could
+ * not be written
+ */
+int write_credential_store(const char *path, const OauthAccount *accounts, size_t count);
+
+/**
+ * @brief      Opens a credential store file
+ *
+ * @details    The file is mapped read-only and only its header is read, so
+ * opening takes the same time whatever the number of accounts. The pages of
+ * the accounts are read as they are first used, and shared by every process
+ * which opens the file.
+ * A call to destroy_credential_store() must follow after making use of this
+ * object
+ *
+ * @param[in]  path  The file
+ *
+ * @return     The store or NULL if the file is not a credential store
+ */
+OauthCredentialStore *open_credential_store(const char *path);
+
+/**
+ * @brief      Gets the number of accounts of a store
+ *
+ * @param[in]  store  The store
+ *
+ * @return     The number of accounts
+ */
+size_t get_store_size(const OauthCredentialStore *store);
+
+/**
+ * @brief      Finds the credentials of an account
+ *
+ * @details    The account is hashed to one cache line of the index, which
+ * almost always holds it. The credentials are made on first use as a view
+ * of the strings in the file, see new_credentials_view(), and kept until the
+ * store is destroyed. Any number of threads may look up accounts at once.
+ *
+ * @param      store        The store
+ * @param[in]  account      The account, which need not be null terminated
+ * @param[in]  account_len  The length of the account
+ *
+ * @return     The credentials or NULL if there is no such account or they
+ * could not be allocated
+ */
+const OauthCredentials *find_account(OauthCredentialStore *store, const char *account,
+                                     size_t account_len);
+
+/**
+ * @brief      Finds the credentials a request claims, for a store whose
+ * accounts are the tokens
+ *
+ * @details    Meant to be passed to verify_authorization_header() with the
+ * store as its context. The consumer key has to match the one stored.
+ *
+ * @param[in]  consumer_key      The consumer key
+ * @param[in]  consumer_key_len  The length of the consumer key
+ * @param[in]  token             The token, looked up as the account
+ * @param[in]  token_len         The length of the token
+ * @param      context           The store
+ *
+ * @return     The credentials, or NULL if there are none
+ */
+const OauthCredentials *find_stored_credentials(const char *consumer_key,
+                                                size_t consumer_key_len, const char *token,
+                                                size_t token_len, void *context);
+
+/**
+ * @brief      Destroys a store and the credentials made from it
+ *
+ * @param      store  The store
+ */
+void destroy_credential_store(OauthCredentialStore **store);
+
+#endif // OAUTH_CREDENTIAL_STORE_H
@@ -0,0 +1,40 @@
+#ifndef OAUTH_DAEMON_H
+#define OAUTH_DAEMON_H
+
+/**
+ * The largest request the daemon accepts. A connection sending a larger one
+ * is closed.
+ */
+#define DAEMON_MAX_FRAME (1 << 20)
+
+/**
+ * @brief      Serves signing requests on a Unix domain socket until SIGINT or
+ * SIGTERM
+ *
+ * @details    Every message, in either direction, is a frame made of a 32 bit
+ * big endian length followed by that many bytes. A request frame holds a 16
+ * bit big endian count of strings followed by each string as a 16 bit big
+ * endian length and its bytes:
+ *
+ *     consumer_key consumer_secret token token_secret method url [name=value ...]
+ *
+ * The reply frame holds a status byte followed by the Authorization header
+ * when the status is 0, or a message saying what was wrong otherwise.
+ * Replies come back in the order the requests were sent, so a client may
+ * pipeline any number of requests on one connection.
+ *
+ * Each thread runs its own epoll loop and accepts connections for itself,
+ * and keeps its own builder and credentials, so requests are signed without
+ * any locking. With more than one process, the listening socket is bound once
+ * and shared by forked copies of the daemon, which take turns accepting.
+ *
+ * @param[in]  path       The path of the socket, replaced if it exists
+ * @param[in]  threads    The number of threads per process, or 0 to use one
+ * per online processor
+ * @param[in]  processes  The number of processes
+ *
+ * @return     0 once stopped, -1 if the socket could not be set up
+ */
+int run_daemon(const char *path, int threads, int processes);
+
+#endif // OAUTH_DAEMON_H
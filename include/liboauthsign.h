@@ -1,7 +1,12 @@
 #ifndef LIB_OAUTH_SIGN_H
 #define LIB_OAUTH_SIGN_H
 
+#include <oauth_alloc.h>
+#include <replay_cache.h>
+#include <stddef.h>
+
 typedef struct OauthBuilder Builder;
+typedef struct OauthCredentials OauthCredentials;
 
 /**
  * @brief      Creates a new builder object
@@ -12,6 +17,100 @@ typedef struct OauthBuilder Builder;
  */
 Builder *new_oauth_builder(void);
 
+/**
+ * @brief      Creates a read-only set of credentials
+ *
+ * @details    The four values change rarely compared to how often requests
+ * are signed, so they are copied and percent-encoded once here, along with
+ * the signing key made from the two secrets. The object is never modified
+ * after this call, so any number of threads may sign with it at the same time.
+ * A call to destroy_credentials() must follow after making use of this object,
+ * once no builder refers to it anymore.
+ *
+ * @param[in]  consumer_key     The consumer key
+ * @param[in]  consumer_secret  The consumer secret
+ * @param[in]  token            The token or NULL if not known yet
+ * @param[in]  token_secret     The token secret or NULL if not known yet
+ *
+ * @return     The credentials or NULL if allocation failed
+ */
+OauthCredentials *new_oauth_credentials(const char *consumer_key, const char *consumer_secret,
+                                       const char *token, const char *token_secret);
+
+/**
+ * This is an X-MACRO listing the strings of credentials made by
+ * new_credentials_view(), each of which comes with its length
+ *
+ * @details    The signing key is the encoded consumer secret and the encoded
+ * token secret joined by '&'.
+ */
+#define X_CREDENTIAL_STRINGS    \
+    X(consumer_key)             \
+    X(encoded_consumer_key)     \
+    X(consumer_secret)          \
+    X(token)                    \
+    X(encoded_token)            \
+    X(token_secret)             \
+    X(signing_key)
+
+typedef struct {
+#define X(string)        \
+    const char *string;  \
+    size_t string##_len;
+    X_CREDENTIAL_STRINGS
+#undef X
+} OauthCredentialStrings;
+
+/**
+ * @brief      Creates a read-only set of credentials from strings which
+ * are already encoded
+ *
+ * @details    Unlike new_oauth_credentials() the strings are neither copied
+ * nor encoded; the credentials refer to them, so they must outlive the
+ * credentials. Only the HMAC midstates of the signing key are worked out.
+ * A call to destroy_credentials() must follow after making use of this
+ * object, once no builder refers to it anymore.
+ *
+ * @param[in]  strings  The strings
+ *
+ * @return     The credentials or NULL if allocation failed or the signing key
+ * has no '&'
+ */
+OauthCredentials *new_credentials_view(const OauthCredentialStrings *strings);
+
+/**
+ * @brief      Destroys a set of credentials.
+ *
+ * @param      credentials  The credentials
+ */
+void destroy_credentials(OauthCredentials **credentials);
+
+/**
+ * @brief      Creates a builder for a single request signed with shared credentials
+ *
+ * @details    The builder only holds what is particular to the request: the
+ * method, url, parameters, nonce and timestamp. The credentials are referenced,
+ * not copied, and must outlive the builder. Unlike the other values they are
+ * kept by reset_builder(), so the builder can be reused for the next request.
+ * A call to destroy_builder() must follow after making use of this object
+ *
+ * @param[in]  credentials  The credentials
+ *
+ * @return     a builder for collecting the remaining parameters
+ */
+Builder *new_oauth_request(const OauthCredentials *credentials);
+
+/**
+ * @brief      Makes a builder sign with shared credentials
+ *
+ * @details    Replaces any values given through set_consumer_key(),
+ * set_consumer_secret(), set_token() and set_token_secret().
+ *
+ * @param      builder      The builder
+ * @param[in]  credentials  The credentials, which must outlive the builder
+ */
+void set_credentials(Builder *builder, const OauthCredentials *credentials);
+
 /**
  * @brief      Sets the consumer key.
  *
@@ -86,6 +185,9 @@ char *get_token(const Builder *builder);
 /**
  * @brief      Sets the token secret.
  *
+ * @details    Left unset, as when getting a request token, the token secret
+ * and the token are empty.
+ *
  * @param      builder  The builder
  * @param[in]  key      The token secret
  */
@@ -136,6 +238,77 @@ char *get_http_method(const Builder *builder);
  */
 void set_base_url(Builder *builder, const char *key);
 
+/**
+ * @brief      Sets the url of the request, query string and all
+ *
+ * @details    The part before any '?' or '#' becomes the base url, as if given
+ * to set_base_url(), and the fragment is dropped. The query string is split
+ * into parameters, which are signed along with those of set_request_params()
+ * but are not returned by get_request_params().
+ *
+ * The parameters are not copied: they refer to the url, which must stay
+ * unchanged until the builder is reset or destroyed. One is only decoded and
+ * encoded again if its form in the url is not the one the signature needs,
+ * such as a '+' standing for a space or a lowercase escape.
+ *
+ * @param      builder  The builder
+ * @param[in]  url      The url
+ */
+void set_request_url(Builder *builder, const char *url);
+
+/**
+ * @brief      Sets the application/x-www-form-urlencoded body of the request
+ *
+ * @details    The body is split into parameters, which are signed along with
+ * those of set_request_params() and set_request_url(). It need not be null
+ * terminated, so a file mapped into memory can be given as it is.
+ *
+ * Nothing is copied: the parameters refer to the body, which must stay
+ * unchanged until the builder is reset or destroyed. A value which is not
+ * encoded the way the signature needs, such as base64 media data, is decoded
+ * and encoded again a piece at a time while it is signed, and the signature
+ * base of a request with a body is hashed as it is written, so a large body
+ * is never held in memory a second time.
+ *
+ * @param      builder  The builder
+ * @param[in]  body     The body
+ * @param[in]  length   The length of the body
+ */
+void set_request_body(Builder *builder, const char *body, size_t length);
+
+/**
+ * @brief      Hashes part of a request body for the oauth_body_hash parameter
+ *
+ * @details    The OAuth Request Body Hash extension covers bodies which are
+ * not form encoded, such as JSON or binary uploads: the base64 hash of the
+ * body is signed and sent as oauth_body_hash. The body may be given in any
+ * number of pieces, as it is read or from a region mapped into memory, and
+ * is never held by the builder. The hash is finished when the header is
+ * first asked for, so every piece must come before that.
+ *
+ * The body is hashed with the hash function of the signature method, SHA-1
+ * or SHA-256, so set_signature_method() has to come first. A request with
+ * no body hashed has no oauth_body_hash; an empty body is hashed by giving
+ * a single empty piece. Form encoded bodies go to set_request_body()
+ * instead, and must not be hashed.
+ *
+ * @param      builder  The builder
+ * @param[in]  data     The next piece of the body
+ * @param[in]  length   The length of the piece
+ */
+void update_body_hash(Builder *builder, const void *data, size_t length);
+
+/**
+ * @brief      Hashes the rest of what can be read from a file descriptor for
+ * the oauth_body_hash parameter, as update_body_hash() does
+ *
+ * @param      builder  The builder
+ * @param[in]  fd       The file descriptor, read until end of file
+ *
+ * @return     0 on success, -1 if a read failed, with errno set
+ */
+int hash_body_fd(Builder *builder, int fd);
+
 /**
  * @brief      Gets the base url.
  * The user is responsible for freeing the array
@@ -146,9 +319,129 @@ void set_base_url(Builder *builder, const char *key);
  */
 char *get_base_url(const Builder *builder);
 
+/**
+ * @brief      sets the nonce
+ *
+ * @details    The oauth_nonce parameter is a unique token your application
+ * should generate for each unique request. Twitter will use this
+ * value to determine whether a request has been submitted multiple times.
+ * The value for this request was generated by base64 encoding
+ * 32 bytes of random data, and stripping out all non-word characters, but
+ * any approach which produces a relatively random alphanumeric string
+ * should be OK here.
+ *
+ * @example    oauth_nonce  kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg
+ *
+ * @param      builder  The builder
+ * @param[in]  nonce    The nonce
+ */
+void set_nonce(Builder *builder, const char *nonce);
+
+/**
+ * @brief      Sets the signature method.
+ *
+ * @details    The <b>oauth_signature_method</b> used by Twitter is
+ * <b>HMAC-SHA1</b>.
+ * This value should be used for any authorized request sent to Twitter’s API.
+ * <b>HMAC-SHA256</b> is also supported. Any other method is refused and
+ * the builder keeps the method it had, HMAC-SHA1 unless set before.
+ *
+ * @example    oauth_signature_method   HMAC-SHA1
+ *
+ * @param      builder    The builder
+ * @param[in]  method     The name of the signature method
+ *
+ * @return     0 on success, -1 if the method is not supported
+ */
+int set_signature_method(Builder *builder, const char *method);
+
+/**
+ * @brief      Sets the timestamp.
+ *
+ * @details    The <b>oauth_timestamp parameter</b> indicates when the request
+ * was created. This value should be the number of seconds since the Unix
+ * epoch at the point the request is generated, and should be easily generated
+ * in most programming languages. Twitter will reject requests which were
+ * created too far in the past, so it is important to keep the clock of the
+ * computer generating requests in sync with NTP.
+ *
+ * @example    oauth_timestamp  1318622958
+ *
+ * @param      builder    The builder
+ * @param[in]  timestamp  The timestamp
+ */
+void set_timestamp(Builder *builder, const char *timestamp);
+
+/**
+ * @brief      Sets the oauth version.
+ *
+ * @details    The oauth_version parameter should always be 1.0 for any
+ * request sent to the Twitter API.
+ *
+ * @example    oauth_version    1.0
+ *
+ * @param      builder  The builder
+ * @param[in]  version  The version
+ */
+void set_oauth_version(Builder *builder, const char *version);
+
+/**
+ * @brief      Gets the nonce.
+ * The returned string must be freed after use
+ *
+ * @param[in]  builder  The builder
+ *
+ * @return     The nonce.
+ */
+char *get_nonce(const Builder *builder);
+
+/**
+ * @brief      Gets the oauth version.
+ * The returned string must be freed after use
+ *
+ * @param[in]  builder  The builder
+ *
+ * @return     The oauth version.
+ */
+char *get_oauth_version(const Builder *builder);
+
+/**
+ * @brief      Gets the signature.
+ *
+ * @details    This should be called after all the setters
+ * in order for the properties needed to create the signature to be ready.
+ * Also the returned string must be freed after use
+ *
+ * @param[in]  builder  The builder
+ *
+ * @return     The signature.
+ */
+char *get_signature(const Builder *builder);
+
+/**
+ * @brief      Gets the signature method.
+ *
+ * @param[in]  builder  The builder
+ *
+ * @return     The signature method.
+ */
+char *get_signature_method(const Builder *builder);
+
+/**
+ * @brief      Gets the timestamp.
+ * The returned string must be freed after use
+ *
+ * @param[in]  builder  The builder
+ *
+ * @return     The timestamp.
+ */
+char *get_timestamp(const Builder *builder);
+
 /**
  * @brief      Sets the request parameters.
  *
+ * @details    If they cannot all be allocated, the builder is left with none.
+ *
  * @param      builder  The builder
  * @param      params   The parameters
  * @param[in]  length    The length of the parameters
@@ -177,10 +470,48 @@ char **get_request_params(const Builder *builder);
  *
  * @param      builder  The builder
  *
- * @return     The header string.
+ * @return     The header string, or NULL if the builder has no consumer
+ * secret or the signing key could not be allocated.
  */
 char *get_authorization_header(Builder *builder);
 
+/**
+ * @brief      Gets the header strings of many builders at once
+ *
+ * @details    Works like calling get_authorization_header(Builder *) on each
+ * builder, but the HMAC-SHA1 signatures are worked out side by side, several
+ * messages per vector instruction, on CPUs where that is faster than one at
+ * a time. Builders using another signature method are signed one by one.
+ *
+ * @param      builders  The builders
+ * @param      headers   Receives the header of each builder, or NULL if it
+ * could not be made. Each header must be freed after use
+ * @param[in]  count     The number of builders
+ *
+ * @return     The number of headers which could not be made
+ */
+size_t get_authorization_headers(Builder **builders, char **headers, size_t count);
+
+/**
+ * @brief      Writes the header string into a buffer supplied by the caller
+ *
+ * @details    Works like get_authorization_header(Builder *) but allocates
+ * nothing once the builder has been used for a request of similar size,
+ * so signing can happen on paths which must not touch the heap.
+ * As with snprintf, at most size - 1 characters are written followed by a
+ * terminator, and the length the whole header needs is returned. A result of
+ * size or more means the header was cut short; calling again with a larger
+ * buffer gives the same header, as the nonce and timestamp are kept.
+ *
+ * @param      builder  The builder
+ * @param      buffer   The buffer, which may be NULL if size is 0
+ * @param[in]  size     The size of the buffer
+ *
+ * @return     The length of the header, without the terminator, or 0 if the
+ * builder could not be signed
+ */
+size_t get_authorization_header_into(Builder *builder, char *buffer, size_t size);
+
 /**
  * @brief      Gets the curl command for executing a request with the header
  * The returned string must be freed after use
@@ -190,10 +521,25 @@ char *get_authorization_header(Builder *builder);
  *
  * @param      builder  The builder
  *
- * @return     The curl command syntax
+ * @return     The curl command syntax, or NULL if the builder could not be
+ * signed
  */
 char *get_cURL_command(Builder *builder);
 
+/**
+ * @brief      Writes the curl command into a buffer supplied by the caller
+ *
+ * @details    See get_authorization_header_into() for how the buffer is used.
+ *
+ * @param      builder  The builder
+ * @param      buffer   The buffer, which may be NULL if size is 0
+ * @param[in]  size     The size of the buffer
+ *
+ * @return     The length of the command, without the terminator, or 0 if the
+ * builder could not be signed
+ */
+size_t get_cURL_command_into(Builder *builder, char *buffer, size_t size);
+
 /**
  * @brief      Creates a signature base.
  *             The returned BUF_MEM object must be freed by calling BUF_MEM_free()
@@ -215,6 +561,145 @@ char *get_cURL_command(Builder *builder);
  */
 char *get_signature_base(const Builder *builder);
 
+/**
+ * @brief      Writes the signature base into a buffer supplied by the caller
+ *
+ * @details    See get_authorization_header_into() for how the buffer is used.
+ *
+ * @param[in]  builder  The builder
+ * @param      buffer   The buffer, which may be NULL if size is 0
+ * @param[in]  size     The size of the buffer
+ *
+ * @return     The length of the signature base, without the terminator
+ */
+size_t get_signature_base_into(const Builder *builder, char *buffer, size_t size);
+
+/**
+ * This is an X-MACRO listing the outcomes of verifying a header
+ *
+ * @details    Each entry gives the suffix of the outcome's OauthVerifyResult
+ * and a description of it
+ */
+#define X_OAUTH_VERIFY_RESULTS                                  \
+    X(OK, "valid")                                              \
+    X(MALFORMED, "malformed header")                            \
+    X(UNSUPPORTED_METHOD, "unsupported signature method")       \
+    X(UNKNOWN_CREDENTIALS, "unknown consumer key or token")     \
+    X(BAD_BODY_HASH, "body hash does not match")                \
+    X(BAD_SIGNATURE, "signature does not match")
+
+typedef enum {
+#define X(result, description) OAUTH_VERIFY_##result,
+    X_OAUTH_VERIFY_RESULTS
+#undef X
+} OauthVerifyResult;
+
+/**
+ * @brief      Finds the credentials a request claims to be signed with
+ *
+ * @details    The consumer key and token are decoded but are not null
+ * terminated. The credentials returned must stay valid until the builder
+ * being verified is reset or destroyed.
+ *
+ * @param[in]  consumer_key      The consumer key
+ * @param[in]  consumer_key_len  The length of the consumer key
+ * @param[in]  token             The token
+ * @param[in]  token_len         The length of the token, which is 0 when
+ * there is none
+ * @param      context           The context given to
+ * verify_authorization_header()
+ *
+ * @return     The credentials, or NULL if there are none
+ */
+typedef const OauthCredentials *(*OauthCredentialsLookup)(const char *consumer_key,
+                                                          size_t consumer_key_len,
+                                                          const char *token, size_t token_len,
+                                                          void *context);
+
+/**
+ * @brief      Verifies the Authorization header of a request
+ *
+ * @details    The builder holds the rest of the request, as set for signing:
+ * the method, the url and any request parameters, form body or body hash.
+ * The header, with or without its "Authorization:" name, is parsed in place
+ * and its oauth parameters are taken into the builder as views into it, so
+ * the header must stay unchanged until the builder is reset or destroyed.
+ * The signature base is then built just as for signing, and the signature
+ * worked out with the credentials from lookup is compared with the one in
+ * the header in constant time.
+ *
+ * The header must carry every oauth parameter this library writes, besides
+ * oauth_body_hash, and no others; a realm is ignored. If a body was hashed
+ * into the builder, the header's oauth_body_hash has to match it, which
+ * needs the body hashed with the method the header names. Nonces and
+ * timestamps are not checked for replays here.
+ *
+ * @param      builder  The builder
+ * @param[in]  header   The header
+ * @param[in]  length   The length of the header
+ * @param[in]  lookup   Finds the credentials
+ * @param      context  Passed on to lookup
+ *
+ * @return     OAUTH_VERIFY_OK if the signature is valid, why not otherwise
+ */
+OauthVerifyResult verify_authorization_header(Builder *builder, const char *header,
+                                              size_t length, OauthCredentialsLookup lookup,
+                                              void *context);
+
+/**
+ * @brief      Describes the outcome of verifying a header
+ *
+ * @param[in]  result  The outcome
+ *
+ * @return     The description
+ */
+const char *oauth_verify_result_name(OauthVerifyResult result);
+
+/**
+ * @brief      Checks that the nonce of a verified request was not used before
+ *
+ * @details    Meant to follow verify_authorization_header(), so that only
+ * requests with a valid signature take room in the cache. The nonce and
+ * timestamp are the ones the header gave, and the consumer key and token
+ * those of the credentials it was verified with.
+ *
+ * @param[in]  builder  The builder
+ * @param      cache    The cache
+ * @param[in]  now      The current time in seconds since the epoch
+ *
+ * @return     OAUTH_REPLAY_NEW if the request may go ahead, why not otherwise
+ */
+OauthReplayResult check_replay(const Builder *builder, OauthReplayCache *cache, long now);
+
+/**
+ * @brief      Clears every value of a builder so it can be used for another request
+ *
+ * @details    All the strings of a builder are kept in a single arena owned by
+ * the builder. Resetting rewinds that arena without giving its memory back,
+ * so a builder which is reset and reused for similar requests stops
+ * allocating altogether. Strings previously returned by the getters are
+ * unaffected since those are copies. Shared credentials given to
+ * new_oauth_request() or set_credentials() are kept.
+ *
+ * @param      builder  The builder
+ */
+void reset_builder(Builder *builder);
+
+/**
+ * @brief      Gets the allocation counters of a builder
+ *
+ * @details    The chunks of the builder's arena count as allocations in use
+ * until the builder is destroyed. Strings returned by the getters count as
+ * allocations but not as memory in use, since they belong to the caller. A
+ * builder which is reused in a steady state shows the same counters from one
+ * request to the next as long as only the _into() functions are used.
+ *
+ * @param[in]  builder  The builder
+ *
+ * @return     The counters
+ */
+OauthAllocStats get_builder_alloc_stats(const Builder *builder);
+
 /**
  * @brief      Destroys a builder.
  *
@@ -0,0 +1,27 @@
+#ifndef OAUTH_NONCE_H
+#define OAUTH_NONCE_H
+
+/**
+ * The number of characters in a nonce. 32 characters out of 62 carry a little
+ * over 190 bits.
+ */
+#define NONCE_LENGTH 32
+
+/**
+ * @brief      Makes a random alphanumeric nonce
+ *
+ * @details    Every thread keeps its own ring of random bytes, refilled from
+ * RAND_bytes() a few kilobytes at a time, so making a nonce takes no lock and
+ * allocates nothing. Each byte below 248 gives one character (the byte modulo
+ * 62) and the rest are thrown away, which keeps every character equally
+ * likely. A child process throws away the ring it inherited from its parent
+ * before making its first nonce.
+ *
+ * @param      out   Receives the nonce and a terminating null, NONCE_LENGTH + 1
+ * bytes
+ *
+ * @return     1 on success, 0 if the random generator failed
+ */
+int make_nonce(char *out);
+
+#endif // OAUTH_NONCE_H
@@ -0,0 +1,121 @@
+#ifndef OAUTH_ALLOC_H
+#define OAUTH_ALLOC_H
+
+#include <stddef.h>
+
+/**
+ * The functions the library, and OpenSSL once it is routed through them,
+ * allocate memory with. Each gets the context along with its usual arguments.
+ */
+typedef struct {
+    void *(*malloc)(size_t size, void *context);
+    void *(*realloc)(void *ptr, size_t size, void *context);
+    void (*free)(void *ptr, void *context);
+    void *context;
+} OauthAllocator;
+
+/**
+ * Allocation counters, kept for every thread and every builder
+ */
+typedef struct {
+    /* Allocations made, strings returned to the caller included */
+    size_t allocations;
+    /* The bytes those allocations asked for */
+    size_t bytes_allocated;
+    /* Memory the library holds on to now, returned strings not included */
+    size_t bytes_in_use;
+    /* The most bytes_in_use has been */
+    size_t peak_bytes;
+} OauthAllocStats;
+
+/**
+ * @brief      Makes the library allocate through the given functions
+ *
+ * @details    OpenSSL is routed through them as well, so that its allocations
+ * are counted along with those of the library. That is only possible before
+ * OpenSSL has allocated anything, so this must be called before any other
+ * function of the library and before the program uses OpenSSL itself.
+ * Passing NULL keeps malloc(), realloc() and free() but still routes and
+ * counts OpenSSL.
+ *
+ * Strings and arrays returned by the library come from the allocator and are
+ * freed with oauth_free(), which is the same as free() unless an allocator
+ * was set.
+ *
+ * @param[in]  allocator  The allocator, copied, or NULL for the C library's
+ *
+ * @return     1 on success, 0 if OpenSSL had already allocated memory, in
+ * which case only the library's own allocations use the allocator
+ */
+int oauth_set_allocator(const OauthAllocator *allocator);
+
+/**
+ * @brief      Frees memory returned by the library
+ *
+ * @param      ptr   The memory, may be NULL
+ */
+void oauth_free(void *ptr);
+
+/**
+ * @brief      Gets the allocation counters of the calling thread
+ *
+ * @details    Memory is charged to the thread which allocates it and credited
+ * to the thread which frees it. A thread which frees more than it allocated
+ * shows nothing in use.
+ *
+ * @return     The counters
+ */
+OauthAllocStats oauth_thread_alloc_stats(void);
+
+/*
+ * What follows is used inside the library
+ */
+
+/**
+ * @brief      Allocates memory the library holds on to
+ *
+ * @param[in]  size  The number of bytes
+ *
+ * @return     The memory, to be freed by oauth_release(), or NULL
+ */
+void *oauth_alloc(size_t size);
+
+/**
+ * @brief      Allocates zeroed memory the library holds on to
+ *
+ * @param[in]  count  The number of elements
+ * @param[in]  size   The size of an element
+ *
+ * @return     The memory, to be freed by oauth_release(), or NULL
+ */
+void *oauth_alloc_zeroed(size_t count, size_t size);
+
+/**
+ * @brief      Frees memory from oauth_alloc() or oauth_alloc_zeroed()
+ *
+ * @param      ptr   The memory, may be NULL
+ */
+void oauth_release(void *ptr);
+
+/**
+ * @brief      Allocates memory to be returned to the caller
+ *
+ * @details    The memory is counted as an allocation of the thread and of the
+ * given account, but is not in use by either since it is the caller's.
+ *
+ * @param[in]  size     The number of bytes
+ * @param      account  The account to charge as well, or NULL
+ *
+ * @return     The memory, to be freed by oauth_free(), or NULL
+ */
+void *oauth_alloc_result(size_t size, OauthAllocStats *account);
+
+/**
+ * @brief      Counts memory held on to by the owner of an account
+ *
+ * @param      account  The account
+ * @param[in]  size     The number of bytes
+ */
+void oauth_charge(OauthAllocStats *account, size_t size);
+
+#endif // OAUTH_ALLOC_H
@@ -0,0 +1,78 @@
+#ifndef OAUTH_POOL_H
+#define OAUTH_POOL_H
+
+#include <liboauthsign.h>
+#include <stddef.h>
+
+typedef struct OauthPool OauthPool;
+
+/**
+ * @brief      Describes one request of a batch
+ *
+ * @details    Every pointer is borrowed for the duration of sign_batch().
+ * The nonce and timestamp are normally left NULL so that fresh ones are
+ * generated, as get_authorization_header() does.
+ */
+typedef struct {
+    const OauthCredentials *credentials;
+    const char *method;
+    const char *url;
+    const char **params;
+    int params_count;
+    const char *nonce;
+    const char *timestamp;
+} OauthRequest;
+
+/**
+ * @brief      Creates a pool of signing threads
+ * @details    The thread calling sign_batch() does its share of the work, so
+ * a pool of n threads starts n - 1 of its own. Each thread keeps a builder
+ * for every request of the chunks it claims, resets them between chunks and
+ * signs each chunk with get_authorization_headers().
+ * A call to destroy_pool() must follow after making use of this object
+ *
+ * @param[in]  threads  The number of threads to sign on, or 0 to use one per
+ * online processor
+ *
+ * @return     The pool or NULL if it could not be started
+ */
+OauthPool *new_oauth_pool(int threads);
+
+/**
+ * @brief      Gets the number of threads a pool signs on
+ *
+ * @param[in]  pool  The pool
+ *
+ * @return     The number of threads, including the caller of sign_batch()
+ */
+int get_pool_size(const OauthPool *pool);
+
+/**
+ * @brief      Signs many requests at once
+ *
+ * @details    The batch is split into one contiguous range per thread. Each
+ * thread takes small chunks from the front of its own range and, once that
+ * is empty, steals chunks from the ranges of the others, so a few slow
+ * requests cannot leave the rest of the pool idle.
+ * Only one batch may run on a pool at a time; concurrent callers are
+ * serialized.
+ *
+ * @param      pool      The pool
+ * @param[in]  requests  The requests
+ * @param      headers   Receives the Authorization header of each request in
+ * the same order, or NULL for a request which could not be signed. Each
+ * header must be freed after use
+ * @param[in]  count     The number of requests
+ *
+ * @return     The number of requests which could not be signed
+ */
+size_t sign_batch(OauthPool *pool, const OauthRequest *requests, char **headers, size_t count);
+
+/**
+ * @brief      Stops the threads of a pool and destroys it.
+ *
+ * @param      pool  The pool
+ */
+void destroy_pool(OauthPool **pool);
+
+#endif // OAUTH_POOL_H
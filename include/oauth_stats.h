@@ -0,0 +1,138 @@
+#ifndef OAUTH_STATS_H
+#define OAUTH_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * This is an X-MACRO listing the stages of signing which are timed
+ *
+ * @details    Each entry gives the suffix of the stage's OauthStage and the
+ * name it is reported under
+ */
+#define X_OAUTH_STAGES                \
+    X(ENCODE, "encode")               \
+    X(NORMALIZE, "normalize")         \
+    X(BASE_STRING, "base_string")     \
+    X(MAC, "mac")                     \
+    X(BASE64, "base64")               \
+    X(HEADER, "header")
+
+typedef enum {
+#define X(stage, name) OAUTH_STAGE_##stage,
+    X_OAUTH_STAGES
+#undef X
+    OAUTH_STAGE_COUNT
+} OauthStage;
+
+/**
+ * The number of buckets of a stage's histogram. Bucket i counts the calls
+ * which took less than 2^i nanoseconds and, for i > 0, at least 2^(i - 1).
+ * The last bucket also takes everything slower.
+ */
+#define OAUTH_STATS_BUCKETS 32
+
+typedef struct {
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t buckets[OAUTH_STATS_BUCKETS];
+} OauthStageStats;
+
+typedef struct {
+    OauthStageStats stages[OAUTH_STAGE_COUNT];
+} OauthStats;
+
+/**
+ * @brief      Tells whether the library was built to record stats, with
+ * OAUTH_STATS defined
+ *
+ * @return     1 if it was, 0 if every count stays at zero
+ */
+int oauth_stats_enabled(void);
+
+/**
+ * @brief      Gets the stats recorded so far by every thread
+ *
+ * @details    Every thread records into a shard of its own, without locks,
+ * and this adds the shards up. The counts keep growing for as long as the
+ * program runs and include threads which have exited. A snapshot taken while
+ * other threads sign may catch a call counted but not yet added to its
+ * bucket.
+ *
+ * @param[out] stats  Receives the stats
+ */
+void oauth_stats_snapshot(OauthStats *stats);
+
+/**
+ * @brief      Gets the name a stage is reported under
+ *
+ * @param[in]  stage  The stage
+ *
+ * @return     The name
+ */
+const char *oauth_stage_name(OauthStage stage);
+
+/**
+ * @brief      Writes stats in the Prometheus text format
+ *
+ * @details    Each stage is a series of the histogram oauth_stage_seconds,
+ * labelled with the stage's name.
+ *
+ * @param[in]  stats   The stats
+ * @param      buffer  Receives the text and a terminating null
+ * @param[in]  size    The size of the buffer
+ *
+ * @return     The length of the full text, which was cut short if it is not
+ * less than size
+ */
+size_t oauth_stats_prometheus(const OauthStats *stats, char *buffer, size_t size);
+
+/*
+ * What follows is used inside the library
+ */
+
+typedef struct {
+    uint64_t started;
+} OauthTimer;
+
+#ifdef OAUTH_STATS
+
+/**
+ * @brief      Gets the time the timers measure from, in nanoseconds
+ *
+ * @return     The time
+ */
+uint64_t oauth_stats_clock(void);
+
+/**
+ * @brief      Records one call of a stage in the calling thread's shard
+ *
+ * @param[in]  stage        The stage
+ * @param[in]  nanoseconds  How long the call took
+ */
+void oauth_stats_record(OauthStage stage, uint64_t nanoseconds);
+
+static inline void oauth_timer_start(OauthTimer *timer) {
+    timer->started = oauth_stats_clock();
+}
+
+static inline void oauth_timer_stop(OauthTimer *timer, OauthStage stage) {
+    oauth_stats_record(stage, oauth_stats_clock() - timer->started);
+}
+
+#else
+
+/* Without OAUTH_STATS the timers compile to nothing */
+
+static inline void oauth_timer_start(OauthTimer *timer) {
+    ( void )timer;
+}
+
+static inline void oauth_timer_stop(OauthTimer *timer, OauthStage stage) {
+    ( void )timer;
+    ( void )stage;
+}
+
+#endif // OAUTH_STATS
+
+#endif // OAUTH_STATS_H
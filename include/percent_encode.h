@@ -0,0 +1,66 @@
+#ifndef OAUTH_PERCENT_ENCODE_H
+#define OAUTH_PERCENT_ENCODE_H
+
+#include <stddef.h>
+
+/**
+ * @brief      Gets the length of the RFC 3986 percent-encoding of a string
+ *
+ * @details    Every byte outside the unreserved set (ALPHA, DIGIT, '-', '.',
+ * '_', '~') is written as '%' followed by two uppercase hex digits, so the
+ * result is the input length plus two for every such byte.
+ *
+ * @param[in]  in      The string to encode
+ * @param[in]  length  The number of bytes to encode
+ *
+ * @return     The number of bytes percent_encode() will write
+ */
+size_t percent_encoded_length(const char *in, size_t length);
+
+/**
+ * @brief      percent-encodes a string into caller provided memory
+ *
+ * @details    Runs of unreserved characters are found with the widest SIMD
+ * scanner the CPU supports (AVX2, SSE2 or a table driven scalar loop, picked
+ * once at runtime) and copied in one go. No terminating null is written.
+ *
+ * @param      out     The destination, which must have room for
+ * percent_encoded_length(in, length) bytes
+ * @param[in]  in      The string to encode
+ * @param[in]  length  The number of bytes to encode
+ *
+ * @return     The number of bytes written to out
+ */
+size_t percent_encode(char *out, const char *in, size_t length);
+
+/**
+ * @brief      Decodes a percent-encoded string (opposite of encode)
+ *
+ * @details    Malformed escapes are copied through unchanged. Since the output
+ * is never longer than the input, out may be the same as in. No terminating
+ * null is written.
+ *
+ * @param      out     The destination, which must have room for length bytes
+ * @param[in]  in      The encoded string to decode
+ * @param[in]  length  The length of the encoded string
+ *
+ * @return     The number of bytes written to out
+ */
+size_t percent_decode(char *out, const char *in, size_t length);
+
+/**
+ * @brief      Tells whether a string is already percent-encoded the way
+ * percent_encode() would encode it
+ *
+ * @details    That is every byte is unreserved or a '%' escape in uppercase
+ * hex of a byte which is not, so that decoding the string and encoding it
+ * again gives it back unchanged.
+ *
+ * @param[in]  in      The string
+ * @param[in]  length  The length of the string
+ *
+ * @return     1 if it is, 0 otherwise
+ */
+int percent_is_canonical(const char *in, size_t length);
+
+#endif // OAUTH_PERCENT_ENCODE_H
@@ -0,0 +1,99 @@
+#ifndef OAUTH_REPLAY_CACHE_H
+#define OAUTH_REPLAY_CACHE_H
+
+#include <stddef.h>
+
+typedef struct OauthReplayCache OauthReplayCache;
+
+/**
+ * This is an X-MACRO listing the outcomes of checking a nonce
+ *
+ * @details    Each entry gives the suffix of the outcome's OauthReplayResult
+ * and a description of it
+ */
+#define X_OAUTH_REPLAY_RESULTS                                  \
+    X(NEW, "new")                                               \
+    X(REPLAYED, "nonce already used")                           \
+    X(EXPIRED, "timestamp outside the window")                  \
+    X(FULL, "replay cache full")
+
+typedef enum {
+#define X(result, description) OAUTH_REPLAY_##result,
+    X_OAUTH_REPLAY_RESULTS
+#undef X
+} OauthReplayResult;
+
+/**
+ * @brief      Creates a cache of the nonces seen within a timestamp window
+ *
+ * @details    A nonce is remembered by 32 bits of a keyed hash of the
+ * consumer key, token and nonce, together with the second of its timestamp,
+ * in one 8 byte slot of a table sized up front; nothing is allocated
+ * afterwards. Timestamps past 2106 are never accepted.
+ * Entries are never evicted one by one: a slot whose second has left the
+ * window is simply free for the next nonce that hashes near it, so time
+ * passing costs nothing at all.
+ *
+ * Slots are claimed with a compare and swap. Nonces are also serialized on
+ * one of a few hundred mutexes picked by their hash, so the same nonce
+ * checked on two threads at once is only new to one of them, while
+ * different nonces almost never wait on each other.
+ *
+ * With a path the table lives in that file, mapped shared, so the nonces
+ * seen survive a restart. A file made with another capacity or window is
+ * started afresh.
+ * A call to destroy_replay_cache() must follow after making use of this
+ * object
+ *
+ * @param[in]  capacity  The number of nonces the cache must be able to hold,
+ * which is the most requests expected over twice the window
+ * @param[in]  window    How many seconds a timestamp may be from now, either
+ * way
+ * @param[in]  path      The file to keep the cache in, or NULL to keep it in
+ * memory
+ *
+ * @return     The cache or NULL if it could not be created
+ */
+OauthReplayCache *new_replay_cache(size_t capacity, unsigned int window, const char *path);
+
+/**
+ * @brief      Checks that a nonce was not used before and remembers it
+ *
+ * @details    None of the strings need to be null terminated. The timestamp
+ * is checked against the window first, so a nonce which is too old to be
+ * remembered is never accepted either. A nonce is used up for its consumer
+ * key and token whatever the timestamp it came with.
+ *
+ * @param      cache             The cache
+ * @param[in]  consumer_key      The consumer key
+ * @param[in]  consumer_key_len  The length of the consumer key
+ * @param[in]  token             The token
+ * @param[in]  token_len         The length of the token
+ * @param[in]  nonce             The nonce
+ * @param[in]  nonce_len         The length of the nonce
+ * @param[in]  timestamp         The oauth_timestamp of the request
+ * @param[in]  now               The current time in seconds since the epoch
+ *
+ * @return     OAUTH_REPLAY_NEW if the request may go ahead, why not otherwise
+ */
+OauthReplayResult check_nonce(OauthReplayCache *cache, const char *consumer_key,
+                              size_t consumer_key_len, const char *token, size_t token_len,
+                              const char *nonce, size_t nonce_len, long timestamp, long now);
+
+/**
+ * @brief      Describes the outcome of checking a nonce
+ *
+ * @param[in]  result  The outcome
+ *
+ * @return     The description
+ */
+const char *oauth_replay_result_name(OauthReplayResult result);
+
+/**
+ * @brief      Destroys a cache, writing it back to its file if it has one
+ *
+ * @param      cache  The cache
+ */
+void destroy_replay_cache(OauthReplayCache **cache);
+
+#endif // OAUTH_REPLAY_CACHE_H
@@ -0,0 +1,78 @@
+#ifndef OAUTH_SHA1_MB_H
+#define OAUTH_SHA1_MB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The number of messages hashed side by side
+ */
+#define SHA1_MB_LANES 16
+
+/**
+ * The ways sha1_multi() can hash
+ */
+typedef enum {
+    /* One message at a time through OpenSSL, which uses the SHA extensions
+       of the CPU when it has them */
+    SHA1_ENGINE_OPENSSL,
+    /* SHA1_MB_LANES messages at a time with plain vector code */
+    SHA1_ENGINE_VECTOR,
+    /* The same vector code compiled for AVX2 */
+    SHA1_ENGINE_AVX2,
+    /* The same vector code compiled for AVX-512 */
+    SHA1_ENGINE_AVX512
+} Sha1Engine;
+
+/**
+ * @brief      One message for sha1_multi()
+ *
+ * @details    The hash may start part way through a longer message, as HMAC
+ * does after hashing its padded key: state is the chaining value after the
+ * first hashed bytes, which must be a whole number of 64 byte blocks.
+ */
+typedef struct {
+    uint32_t state[5];
+    uint64_t hashed;
+    const unsigned char *data;
+    size_t length;
+    /* Receives the 20 byte digest, and may be the same memory as data */
+    unsigned char *digest;
+} Sha1Job;
+
+/**
+ * @brief      Hashes many messages with SHA-1
+ *
+ * @details    Messages are taken SHA1_MB_LANES at a time and each block is
+ * worked on for all of them at once, one message per vector lane. Lanes
+ * which run out of blocks are masked off, so messages of similar lengths are
+ * hashed best.
+ *
+ * On a CPU with the SHA extensions OpenSSL hashes one message faster than the
+ * vector code hashes several, so it is used instead. Otherwise the widest
+ * vector code the CPU supports is used. The choice is made once at runtime.
+ *
+ * @param      jobs   The messages
+ * @param[in]  count  The number of messages
+ */
+void sha1_multi(const Sha1Job *jobs, size_t count);
+
+/**
+ * @brief      Gets the engine sha1_multi() uses
+ *
+ * @return     The engine
+ */
+Sha1Engine sha1_engine(void);
+
+/**
+ * @brief      Makes sha1_multi() use the given engine, to compare them
+ *
+ * @details    Must not be called while another thread is in sha1_multi().
+ *
+ * @param[in]  engine  The engine
+ *
+ * @return     1 on success, 0 if the CPU cannot run the engine
+ */
+int sha1_set_engine(Sha1Engine engine);
+
+#endif // OAUTH_SHA1_MB_H
@@ -0,0 +1,26 @@
+#ifndef OAUTH_TIMESTAMP_H
+#define OAUTH_TIMESTAMP_H
+
+#include <stddef.h>
+
+/**
+ * Room for any timestamp current_timestamp() writes and its terminating null
+ */
+#define TIMESTAMP_SIZE 21
+
+/**
+ * @brief      Writes the current time as decimal seconds since the epoch
+ *
+ * @details    The time is read from the coarse realtime clock, which needs no
+ * system call. The decimal digits of the current second are kept in a single
+ * word shared by every thread, so they are worked out once per second and
+ * read with one atomic load the rest of the time. No lock is ever taken.
+ *
+ * @param      out   Receives the timestamp and a terminating null,
+ * TIMESTAMP_SIZE bytes
+ *
+ * @return     The length of the timestamp
+ */
+size_t current_timestamp(char *out);
+
+#endif // OAUTH_TIMESTAMP_H
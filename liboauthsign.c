@@ -1,28 +1,70 @@
-#include <ctype.h>
-#include <curl/curl.h>
+/* SHA_CTX and SHA256_CTX are used directly: the HMAC midstates have to be
+   plain structs which can be copied without allocating */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <arena.h>
+#include <base64.h>
+#include <errno.h>
 #include <liboauthsign.h>
 #include <logger.h>
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
-#include <openssl/evp.h>
-#include <openssl/hmac.h>
-#include <openssl/rand.h>
+#include <nonce.h>
+#include <oauth_stats.h>
+#include <openssl/crypto.h>
 #include <openssl/sha.h>
+#include <percent_encode.h>
+#include <sha1_mb.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <timestamp.h>
+#include <unistd.h>
+
+/**
+ * The size of the chunks a builder's arena grows by. One chunk comfortably
+ * holds the builder itself and every string of a typical request.
+ */
+#define BUILDER_CHUNK_SIZE 4096
+
+/**
+ * The size of the single chunk holding a credentials object
+ */
+#define CREDENTIALS_CHUNK_SIZE 1024
+
+/**
+ * Request parameter lists at least this long are radix sorted, shorter ones
+ * go through qsort
+ */
+#define RADIX_SORT_MIN 64
+
+/**
+ * The number of bytes of a value from a query string or form body which are
+ * decoded and encoded again at a time
+ */
+#define FORM_PIECE_SIZE 1024
+
+/**
+ * The size of the buffer a signature base is hashed from when it is not
+ * built in full. It takes a piece of a form value encoded for the base.
+ */
+#define SIGN_BUFFER_SIZE (FORM_PIECE_SIZE * 16)
 
-#define FREE_IF_NOT_NULL(obj) \
-    do {                      \
-        if ((obj) != NULL)    \
-            free(obj);        \
-    } while (0)
+/**
+ * The size of the reads a body is hashed from a file descriptor with
+ */
+#define BODY_READ_SIZE (64 * 1024)
 
+/**
+ * A name and value together with their percent encodings. The lengths are
+ * kept so that assembling the output never has to look for terminators.
+ */
 typedef struct {
-    char *name;
-    char *value;
-    char *encoded_name;
-    char *encoded_value;
+    const char *name;
+    const char *value;
+    const char *encoded_name;
+    const char *encoded_value;
+    size_t name_len;
+    size_t value_len;
+    size_t encoded_name_len;
+    size_t encoded_value_len;
 } Param;
 
 /**
@@ -30,111 +72,353 @@ typedef struct {
  * spent retyping these members in the code
  *
  * @details    To make use of these, simply define an X function which takes
- * a two arguements - type and name and then do whatever you want with them
+ * a two arguements - where the member lives (the builder or its credentials)
+ * and its name - and then do whatever you want with them
  *
  * @example    Examples of using these can be found in the code
  */
-#define X_BUILDER_OAUTH_MEMBERS      \
-    X(Param, oauth_consumer_key)     \
-    X(Param, oauth_nonce)            \
-    X(Param, oauth_signature)        \
-    X(Param, oauth_signature_method) \
-    X(Param, oauth_timestamp)        \
-    X(Param, oauth_token)            \
-    X(Param, oauth_version)
+#define X_BUILDER_OAUTH_MEMBERS        \
+    X(builder, oauth_body_hash)        \
+    X(credentials, oauth_consumer_key) \
+    X(builder, oauth_nonce)            \
+    X(builder, oauth_signature)        \
+    X(builder, oauth_signature_method) \
+    X(builder, oauth_timestamp)        \
+    X(credentials, oauth_token)        \
+    X(builder, oauth_version)
+
+/**
+ * @brief      Gets a pointer to one of the X_BUILDER_OAUTH_MEMBERS
+ *
+ * @param      where   Where the member lives
+ * @param      b       The builder
+ * @param      member  The name of the member
+ */
+#define OAUTH_MEMBER(where, b, member) OAUTH_MEMBER_##where(b, member)
+#define OAUTH_MEMBER_builder(b, member) (&(b)->member)
+#define OAUTH_MEMBER_credentials(b, member) (&(b)->credentials->member)
+
+/**
+ * A bounded output buffer. Writes past the end are counted but dropped, so
+ * the final length is what the whole output needs, as with snprintf.
+ *
+ * A sink with a flush function never drops anything: whenever the buffer is
+ * full its contents are handed to the function and it starts over empty.
+ */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t length;
+    void (*flush)(void *context, const char *data, size_t length);
+    void *context;
+} Sink;
+
+/**
+ * Walks the encoded form of a param's value a piece at a time. Values from
+ * a query string or form body which are not encoded the way the signature
+ * needs are kept as they are and only decoded and encoded again here, a
+ * FORM_PIECE_SIZE piece at a time.
+ */
+typedef struct {
+    const char *next;
+    const char *end;
+    /* Whether the text still has to be decoded and encoded */
+    int raw;
+    char decoded[FORM_PIECE_SIZE];
+    char encoded[FORM_PIECE_SIZE * 3];
+} ValueCursor;
+
+/**
+ * This is an X-MACRO listing the supported signature methods
+ *
+ * @details    Each entry gives the identifier of the method, its name, the
+ * size of its digest and the prefix of the functions implementing it
+ */
+#define X_SIGNATURE_METHODS                                           \
+    X(HMAC_SHA1, "HMAC-SHA1", SHA_DIGEST_LENGTH, hmac_sha1)          \
+    X(HMAC_SHA256, "HMAC-SHA256", SHA256_DIGEST_LENGTH, hmac_sha256)
 
 /**
- * @brief      This X function is used to count the number of members
+ * The largest digest of any signature method
  */
-#define X(_, __) +1
-static const int OAUTH_MEMBERS_COUNT = 0 X_BUILDER_OAUTH_MEMBERS;
+#define SIGNATURE_MAX_DIGEST SHA256_DIGEST_LENGTH
+
+typedef enum {
+#define X(id, name, size, prefix) SIGNATURE_##id,
+    X_SIGNATURE_METHODS
 #undef X
+        SIGNATURE_METHOD_COUNT
+} SignatureMethodId;
 
-static CURL *curl;
-static int BUILDER_REF_COUNT = 0;
+/**
+ * The hash states after hashing the key xor ipad and the key xor opad. Every
+ * HMAC made with the key starts from a copy of these.
+ */
+typedef union {
+    struct {
+        SHA_CTX inner;
+        SHA_CTX outer;
+    } hmac_sha1;
+    struct {
+        SHA256_CTX inner;
+        SHA256_CTX outer;
+    } hmac_sha256;
+} HmacKey;
+
+/**
+ * The state of the hash of a request body, made with the hash function of
+ * the signature method
+ */
+typedef union {
+    SHA_CTX sha1;
+    SHA256_CTX sha256;
+} BodyHash;
+
+/**
+ * The operations of a signature method. Methods are looked up by name once
+ * when they are set, and signing goes through these pointers.
+ */
+typedef struct {
+    const char *name;
+    size_t name_len;
+    size_t digest_size;
+    /* Works out the midstates of a key */
+    void (*key)(HmacKey *key, const unsigned char *secret, size_t length);
+    /* Signs a message starting from the midstates */
+    void (*sign)(const HmacKey *key, const char *data, size_t length, unsigned char *mac);
+    /* Signs the signature base of a builder as it is written, without
+       building it in full */
+    void (*sign_stream)(const HmacKey *key, const Builder *builder, unsigned char *mac);
+    /* Starts, feeds and finishes the hash of a body */
+    void (*body_start)(BodyHash *hash);
+    void (*body_update)(void *hash, const char *data, size_t length);
+    void (*body_finish)(BodyHash *hash, unsigned char *digest);
+} SignatureMethod;
+
+struct OauthCredentials {
+    Param oauth_consumer_key;
+    Param oauth_token;
+    Param consumer_secret;
+    Param token_secret;
+    /* The percent encoded consumer secret and token secret joined by '&',
+       or NULL when it has to be worked out again */
+    const char *signing_key;
+    size_t signing_key_len;
+    /* The HMAC midstates of the key for every signature method */
+    HmacKey keys[SIGNATURE_METHOD_COUNT];
+    /* The arena holding this object and all of its strings */
+    Arena *arena;
+};
 
 struct OauthBuilder {
 
 /**
- * @brief      This X function creates some struct members
+ * @brief      This X function creates the struct members which belong to
+ * a single request. The others are found through the credentials.
  *
- * @param      type  The type
- * @param      name  The name of the member
+ * @param      where  Where the member lives
+ * @param      name   The name of the member
  */
-#define X(type, name) type name;
+#define X(where, name) X_MEMBER_##where(name)
+#define X_MEMBER_builder(name) Param name;
+#define X_MEMBER_credentials(name)
     X_BUILDER_OAUTH_MEMBERS
-    Param consumer_secret;
-    Param token_secret;
     Param http_method;
     Param base_url;
     Param *request_params;
     int req_params_size;
+    /* The parameters of the query string given to set_request_url(), whose
+       names and values are views into it */
+    Param *query_params;
+    int query_params_size;
+    const char *query;
+    size_t query_len;
+    /* The parameters of the form body given to set_request_body(), views
+       into it as well */
+    Param *body_params;
+    int body_params_size;
+    const char *body;
+    size_t body_len;
+    /* Holds the timestamp filled in by prepare_header() */
+    char timestamp[TIMESTAMP_SIZE];
+    /* Holds the escaped signature, so that signing again allocates nothing */
+    char signature[BASE64_ESCAPED_LENGTH(SIGNATURE_MAX_DIGEST) + 1];
+    /* The method named by oauth_signature_method */
+    const SignatureMethod *method;
+    /* The method whose hash function the body is being hashed with, or NULL
+       when there is no body hash */
+    const SignatureMethod *body_hash_method;
+    BodyHash body_hash;
+#undef X_MEMBER_credentials
+#undef X_MEMBER_builder
 #undef X
+    /* Either shared credentials from new_oauth_request() or own_credentials */
+    const OauthCredentials *credentials;
+    /* Credentials filled in through set_consumer_key() and friends, which
+       live in the arena of this builder */
+    OauthCredentials *own_credentials;
+    /* Every string above is allocated from this arena, which also holds the
+       builder itself */
+    Arena *arena;
+    ArenaMark base;
 };
 
 /**
- * @brief      Creates a base64 encoding of the given input
+ * The oauth parameters of an Authorization header being verified, as views
+ * into the header
+ */
+typedef struct {
+#define X(where, member) Param member;
+    X_BUILDER_OAUTH_MEMBERS
+#undef X
+} HeaderParams;
+
+/**
+ * @brief      Creates a null terminated copy of the value of a param,
+ * counted as an allocation of the builder
  *             User is responsible for freeing this array after use
  *
- * @param      src       The input array or NULL
- * @param[in]  src_size  The source size
+ * @details    The value need not be null terminated itself, as with the
+ * views a verified header leaves in the builder.
  *
- * @return     An array containing the base64 encoding of the given src
- * or a randomly generated base64 encoding if src was NULL
+ * @param[in]  builder  The builder
+ * @param[in]  param    The param
+ *
+ * @return     The copy of the value or null if the copying failed
  */
-static char *base64_bytes(unsigned char *src, int src_size);
+static char *oauth_strdup(const Builder *builder, const Param *param);
 
 /**
- * @brief      Creates a copy of a string
- *             User is responsible for freeing this array after use
+ * @brief      percent-encodes a given string into an arena
+ *
+ * @param      arena    The arena to allocate the result from
+ * @param[in]  in       The string to encode
+ * @param[in]  length   The length
+ * @param[out] encoded  The length of the result
  *
- * @param[in]  s     The string to copy
+ * @return     The null terminated percent encoded string
+ */
+static char *arena_encode(Arena *arena, const char *in, size_t length, size_t *encoded);
+
+/**
+ * @brief      Sets the value of a param and its encoded form
+ *
+ * @param      arena    The arena to allocate the strings from
+ * @param      param    The param
+ * @param[in]  value    The value
+ * @param[in]  length   The length of the value
+ *
+ * @return     1 on success, 0 if either string could not be allocated
+ */
+static int set_param(Arena *arena, Param *param, const char *value, size_t length);
+
+/**
+ * @brief      Gets the encoded form of a name from a query string or form body
  *
- * @return     The copy of the string or null if the copying failed
+ * @details    Most query strings are encoded just as the signature needs them,
+ * in which case the text itself is used. Otherwise it is decoded as a form
+ * (with '+' for a space) and encoded again into the arena.
+ *
+ * @param      arena    The arena to allocate the result from if need be
+ * @param[in]  raw      The text from the query string
+ * @param[in]  length   The length of the text
+ * @param[out] encoded  The length of the result
+ *
+ * @return     The encoded form, not null terminated
  */
-static char *oauth_strdup(const char *s);
+static const char *form_encode(Arena *arena, const char *raw, size_t length, size_t *encoded);
 
 /**
- * @brief      percent-encodes a given string
- *             The returned string must be freed after use
+ * @brief      Splits application/x-www-form-urlencoded text into params
+ *
+ * @details    The names and values are views into the text. Names are
+ * encoded with form_encode(); a value which is not encoded the way the
+ * signature needs is left without an encoded form, for a ValueCursor to
+ * work out as it is used. Empty parameters are skipped.
+ *
+ * @param      arena   The arena to allocate the params from
+ * @param[in]  text    The text
+ * @param[in]  length  The length of the text
+ * @param[out] count   The number of params
  *
- * @param[in]  in      The string to encode
- * @param[in]  length  The length
+ * @return     The sorted params, or NULL if there are none
+ */
+static Param *split_form(Arena *arena, const char *text, size_t length, int *count);
+
+/**
+ * @brief      Starts walking the encoded form of a param's value
  *
- * @return     The percent encoded string
+ * @param      cursor  The cursor
+ * @param[in]  param   The param
  */
-static char *curl_encode_len(const char *in, int length);
+static void open_value(ValueCursor *cursor, const Param *param);
 
 /**
- * @brief      percent-encodes a given string
- *             The returned string must be freed after use
+ * @brief      Gets the next piece of the encoded form of a value
+ *
+ * @details    A piece never ends inside a '%' escape, so each piece is
+ * decoded on its own.
  *
- * @param[in]  in    The string to encode
+ * @param      cursor  The cursor
+ * @param[out] piece   The piece, valid until the next call
  *
- * @return     The percent encoded string
+ * @return     The length of the piece, 0 once the value is done
  */
-static char *curl_encode(const char *in);
+static size_t next_piece(ValueCursor *cursor, const char **piece);
 
 /**
- * @brief      Decodes a given string (opposite of encode)
- *             The returned string must be freed after use
+ * @brief      Gives a param its name, which for the oauth parameters is also
+ * its encoded name because they contain only unreserved characters
  *
- * @param[in]  in      The encoded string to decode
- * @param[in]  length  The length of the encoded string
+ * @param      param   The param
+ * @param[in]  name    The name
+ * @param[in]  length  The length of the name
+ */
+static void name_param(Param *param, const char *name, size_t length);
+
+/**
+ * @brief      Names a param after a string literal
+ */
+#define NAME_PARAM(param, name) name_param(param, name, sizeof name - 1)
+
+/**
+ * @brief      Sets the value of a param without copying or encoding it
+ *
+ * @details    The value must contain only unreserved characters and outlive
+ * the param.
+ *
+ * @param      param   The param
+ * @param[in]  value   The value
+ * @param[in]  length  The length of the value
+ */
+static void plain_param(Param *param, const char *value, size_t length);
+
+/**
+ * @brief      Sets the value of a param to a string literal
+ */
+#define PLAIN_PARAM(param, value) plain_param(param, value, sizeof value - 1)
+
+/**
+ * @brief      Sets the value of a param to strings kept elsewhere
  *
- * @return     A decoded string
+ * @param      param        The param
+ * @param[in]  value        The value
+ * @param[in]  length       The length of the value
+ * @param[in]  encoded      The encoded value
+ * @param[in]  encoded_len  The length of the encoded value
  */
-static char *curl_decode_len(const char *in, int length);
+static void view_param(Param *param, const char *value, size_t length, const char *encoded,
+                       size_t encoded_len);
 
 /**
- * @brief      Decodes a given string (opposite of encode)
- *             The returned string must be freed after use
+ * @brief      Gets the credentials owned by a builder, creating them on first use
  *
- * @param[in]  in      The encoded string to decode
+ * @param      builder  The builder
  *
- * @return     A decoded string
+ * @return     The credentials which set_consumer_key() and friends update, or
+ * NULL if they could not be allocated
  */
-static char *curl_decode(const char *in);
+static OauthCredentials *own_credentials(Builder *builder);
 
 /**
  * @brief      Gets the request parameters as a string.
@@ -146,9 +430,7 @@ static char *curl_decode(const char *in);
 static char *get_request_param_string(const Builder *builder);
 
 /**
- * @brief      Gets the signing key.
- *             The returned BUF_MEM object must be freed by calling
- * BUF_MEM_free()
+ * @brief      Works out the signing key and the HMAC midstates for it
  *
  * @details    The value which identifies your application to Twitter is called
  * the
@@ -182,650 +464,1696 @@ static char *get_request_param_string(const Builder *builder);
  * encoded](https://dev.twitter.com/oauth/overview/percent-encoding-parameters)
  * *consumer secret* followed by an ampersand character ‘&’.
  *
+ * The key is fixed for a set of credentials, and so are the first blocks
+ * hashed by HMAC (the key xor'ed with the inner and outer pads). The hash
+ * states after those blocks are kept for every signature method, so that
+ * signing only hashes the message.
+ *
+ * @param      credentials  The credentials
+ * @param      arena        The arena to allocate the key from
+ *
+ * @return     1 on success, 0 if a secret is missing or the key could not be
+ * allocated, in which case the credentials are left without one
+ */
+static int key_credentials(OauthCredentials *credentials, Arena *arena);
+
+/**
+ * @brief      Gets the credentials of a builder, ready for signing
+ *
  * @param[in]  builder  The builder
  *
- * @return     The object holding the signing key
+ * @return     The credentials with their signing key and midstates in place,
+ * or NULL if there are none or the key could not be worked out
  */
-static BUF_MEM *get_signing_key(const Builder *builder);
+static const OauthCredentials *get_signing_credentials(const Builder *builder);
 
 /**
- * @brief      Gets the parameters
- *             The returned BUF_MEM object must be freed by calling
- * BUF_MEM_free()
+ * @brief      Finds a signature method by name
  *
- * @details    In the HTTP request the parameters are URL encoded, but you
- * should collect
- * the raw values. In addition to the request parameters, every *oauth_**
- * parameter needs to be included
- * in the signature, so collect those too.
+ * @param[in]  name    The name
+ * @param[in]  length  The length of the name
  *
- * 1. Percent encode every key and value that will be signed.
- * 2. Sort the list of parameters alphabetically[1] by encoded key[2].
- *     [2] Note: In case of two parameters with the same encoded key, the
- *     OAuth spec says to continue sorting based on value. However,
- *     Twitter does not accept duplicate keys in API requests.
- * 3. For each key/value pair:
- *     a. Append the encoded key to the output string.
- *     b. Append the ‘=’ character to the output string.
- *     c. Append the encoded value to the output string.
- *     d. If there are more key/value pairs remaining, append a '&' character to
- * the output string.
+ * @return     The method, or NULL if it is not supported
+ */
+static const SignatureMethod *find_signature_method(const char *name, size_t length);
+
+/**
+ * @brief      Fills the first HMAC block with a key
  *
- * @param[in]  builder  The builder
+ * @details    Keys longer than the block are hashed first, see RFC 2104. The
+ * block must be zeroed beforehand.
  *
- * @return     A pointer to a buffer holding the parameter string
+ * @param      block    The block
+ * @param[in]  size     The size of the block
+ * @param[in]  secret   The key
+ * @param[in]  length   The length of the key
+ * @param[in]  digest   Hashes keys which do not fit the block
  */
-static BUF_MEM *collect_parameters(const Builder *builder);
+static void load_hmac_block(unsigned char *block, size_t size, const unsigned char *secret,
+                            size_t length,
+                            unsigned char *(*digest)(const unsigned char *, size_t,
+                                                     unsigned char *));
 
 /**
- * @brief      Helper to free the params of a Builder object
+ * @brief      Xors a block with a pad byte
  *
- * @param      param  A pointer to the param to deallocate memory for
+ * @param      out    Receives the result
+ * @param[in]  block  The block
+ * @param[in]  size   The size of the block
+ * @param[in]  pad    The pad byte
  */
-static void free_param(Param *param);
+static void xor_block(unsigned char *out, const unsigned char *block, size_t size,
+                      unsigned char pad);
 
 /**
- * @brief      Sets the oauth signature.
+ * @brief      Works out the HMAC-SHA1 midstates of a key
  *
- * @details    The <b>oauth_signature</b> parameter contains a value which
- * is generated by running all of the other request parameters and two
- * secret values through a signing algorithm. The purpose of the signature
- * is so that Twitter can verify that the request has not been modified in
- * transit,
- * verify the application sending the request, and verify that the application
- * has
- * authorization to interact with the user’s account.
- * The process for calculating the oauth_signature for this request is described
- * in
- * [Creating a
- * signature](https://dev.twitter.com/oauth/overview/creating-signatures)
+ * @param      key     Receives the midstates
+ * @param[in]  secret  The key
+ * @param[in]  length  The length of the key
+ */
+static void hmac_sha1_key(HmacKey *key, const unsigned char *secret, size_t length);
+
+/**
+ * @brief      Computes HMAC-SHA1 starting from the midstates of a key
  *
+ * @param[in]  key     The midstates
+ * @param[in]  data    The message
+ * @param[in]  length  The length of the message
+ * @param      mac     Receives the SHA_DIGEST_LENGTH byte result
+ */
+static void hmac_sha1_sign(const HmacKey *key, const char *data, size_t length, unsigned char *mac);
+
+/**
+ * @brief      Computes the HMAC-SHA1 of a builder's signature base as it is
+ * written
  *
- * @example    oauth_signature  tnnArxj06cWHq44gCs1OSKk/jLY=
+ * @param[in]  key      The midstates
+ * @param[in]  builder  The builder
+ * @param      mac      Receives the SHA_DIGEST_LENGTH byte result
+ */
+static void hmac_sha1_sign_stream(const HmacKey *key, const Builder *builder, unsigned char *mac);
+
+/**
+ * @brief      Works out the HMAC-SHA256 midstates of a key
  *
- * @param      builder  The builder
+ * @param      key     Receives the midstates
+ * @param[in]  secret  The key
+ * @param[in]  length  The length of the key
  */
-static void create_signature(Builder *builder);
+static void hmac_sha256_key(HmacKey *key, const unsigned char *secret, size_t length);
 
 /**
- * @brief      Function for comparing parameters
+ * @brief      Computes HMAC-SHA256 starting from the midstates of a key
  *
- * @param[in]  v1    The first parameter
- * @param[in]  v2    The second parameter
+ * @param[in]  key     The midstates
+ * @param[in]  data    The message
+ * @param[in]  length  The length of the message
+ * @param      mac     Receives the SHA256_DIGEST_LENGTH byte result
+ */
+static void hmac_sha256_sign(const HmacKey *key, const char *data, size_t length,
+                             unsigned char *mac);
+
+/**
+ * @brief      Computes the HMAC-SHA256 of a builder's signature base as it is
+ * written
  *
- * @return     <0 if v1 goes before v2
- *             0  if vi is equivalent to v2
- *             >0 if v1 goes after v2
+ * @param[in]  key      The midstates
+ * @param[in]  builder  The builder
+ * @param      mac      Receives the SHA256_DIGEST_LENGTH byte result
  */
-static int compare_p2p(const void *v1, const void *v2);
+static void hmac_sha256_sign_stream(const HmacKey *key, const Builder *builder,
+                                    unsigned char *mac);
 
 /**
- * @brief      Function to compare Params in an array
+ * @brief      Feeds bytes to a hash, as the flush function of a sink
  *
- * @param[in]  v1    The first param
- * @param[in]  v2    The second param
+ * @param      context  The SHA_CTX or SHA256_CTX
+ * @param[in]  data     The bytes
+ * @param[in]  length   The number of bytes
+ */
+static void hmac_sha1_update(void *context, const char *data, size_t length);
+static void hmac_sha256_update(void *context, const char *data, size_t length);
+
+/**
+ * @brief      Starts the hash of a body
  *
- * @return     <0 if v1 goes before v2
- *             0  if vi is equivalent to v2
- *             >0 if v1 goes after v2
+ * @param      hash  The hash
  */
-static int compare_p(const void *v1, const void *v2);
+static void hmac_sha1_body_start(BodyHash *hash);
+static void hmac_sha256_body_start(BodyHash *hash);
+
+/**
+ * @brief      Finishes the hash of a body
+ *
+ * @param      hash    The hash
+ * @param      digest  Receives the digest of the method's size
+ */
+static void hmac_sha1_body_finish(BodyHash *hash, unsigned char *digest);
+static void hmac_sha256_body_finish(BodyHash *hash, unsigned char *digest);
+
+static const SignatureMethod SIGNATURE_METHODS[SIGNATURE_METHOD_COUNT] = {
+#define X(id, name, size, prefix)                                                    \
+    {name, sizeof name - 1, size, prefix##_key, prefix##_sign, prefix##_sign_stream, \
+     prefix##_body_start, prefix##_update, prefix##_body_finish},
+    X_SIGNATURE_METHODS
+#undef X
+};
 
 /**
- * @brief      sets the nonce
+ * @brief      Tells whether an oauth parameter goes into the header and the
+ * signature. Only the body hash is ever left out, when there is none.
  *
- * @details    The oauth_nonce parameter is a unique token your application
- * should generate for each unique request. Twitter will use this
- * value to determine whether a request has been submitted multiple times.
- * The value for this request was generated by base64 encoding
- * 32 bytes of random data, and stripping out all non-word characters, but
- * any approach which produces a relatively random alphanumeric string
- * should be OK here.
+ * @param[in]  builder  The builder
+ * @param[in]  param    One of the X_BUILDER_OAUTH_MEMBERS
  *
- * @example    oauth_nonce  kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg
+ * @return     1 if it does, 0 otherwise
+ */
+static int is_listed(const Builder *builder, const Param *param);
+
+/**
+ * @brief      Starts hashing the body with the hash function of the
+ * signature method, unless that was done already
  *
  * @param      builder  The builder
- * @param[in]  nonce    The nonce
  */
-void set_nonce(Builder *builder, const char *nonce);
+static void start_body_hash(Builder *builder);
 
 /**
- * @brief      Sets the signature method.
+ * @brief      Finishes the body hash and sets oauth_body_hash to it
  *
- * @details    The <b>oauth_signature_method</b> used by Twitter is
- * <b>HMAC-SHA1</b>.
- * This value should be used for any authorized request sent to Twitter’s API.
+ * @param      builder  The builder
+ */
+static void finish_body_hash(Builder *builder);
+
+/**
+ * @brief      Splits an Authorization header into its oauth parameters
  *
- * @example    oauth_signature_method   HMAC-SHA1
+ * @param      arena   The arena to decode values into if need be
+ * @param[in]  header  The header
+ * @param[in]  length  The length of the header
+ * @param[out] params  Receives the parameters
  *
- * @param      builder    The builder
- * @param[in]  <unnamed>  { parameter_description }
+ * @return     1 if the header is well formed and has every parameter the
+ * signature needs, 0 otherwise
  */
-void set_signature_method(Builder *builder, const char *method);
+static int parse_header(Arena *arena, const char *header, size_t length, HeaderParams *params);
 
 /**
- * @brief      Sets the timestamp.
+ * @brief      Finds the param of a header a name stands for
  *
- * @details    The <b>oauth_timestamp parameter</b> indicates when the request
- * was created. This value should be the number of seconds since the Unix
- * epoch at the point the request is generated, and should be easily generated
- * in most programming languages. Twitter will reject requests which were
- * created too far in the past, so it is important to keep the clock of the
- * computer generating requests in sync with NTP.
+ * @param      params    The params of the header
+ * @param[in]  name      The name
+ * @param[in]  name_len  The length of the name
  *
- * @example    oauth_timestamp  1318622958
- *
- * @param      builder    The builder
- * @param[in]  timestamp  The timestamp
+ * @return     The param, or NULL if the name is not one of them
  */
-void set_timestamp(Builder *builder, const char *timestamp);
+static Param *header_param(HeaderParams *params, const char *name, size_t name_len);
 
 /**
- * @brief      Sets the oauth version.
- *
- * @details    The oauth_version parameter should always be 1.0 for any
- * request sent to the Twitter API.
+ * @brief      Gives a param a value from a header, where it is encoded
  *
- * @example    oauth_version    1.0
+ * @details    The value is decoded into the arena only if it has escapes,
+ * and encoded again only if they are not the ones the signature needs.
  *
- * @param      builder  The builder
- * @param[in]  version  The version
+ * @param      arena   The arena
+ * @param      param   The param
+ * @param[in]  value   The encoded value
+ * @param[in]  length  The length of the encoded value
  */
-void set_oauth_version(Builder *builder, const char *version);
+static void header_value(Arena *arena, Param *param, const char *value, size_t length);
 
 /**
- * @brief      Gets the nonce.
- * The returned string must be freed after use
+ * @brief      Skips a word at the start of text, whatever its case
  *
- * @param[in]  builder  The builder
+ * @param      text  The text, moved past the word if it is there
+ * @param[in]  end   The end of the text
+ * @param[in]  word  The word in lowercase
  *
- * @return     The nonce.
+ * @return     1 if the word was there, 0 otherwise
  */
-char *get_nonce(const Builder *builder);
+static int skip_word(const char **text, const char *end, const char *word);
 
 /**
- * @brief      Gets the oauth version.
- * The returned string must be freed after use
+ * @brief      Skips spaces, tabs and, if commas is set, commas
  *
- * @param[in]  builder  The builder
+ * @param[in]  text    The text
+ * @param[in]  end     The end of the text
+ * @param[in]  commas  Whether commas are skipped too
  *
- * @return     The oauth version.
+ * @return     The first character not skipped
  */
-char *get_oauth_version(const Builder *builder);
+static const char *skip_space(const char *text, const char *end, int commas);
 
 /**
- * @brief      Gets the signature.
+ * @brief      Writes the signature base of a builder: the method, the encoded
+ * base url and the encoded parameter string, joined by '&'
  *
- * @details    This should be called after all the setters
- * in order for the properties needed to create the signature to be ready.
- * Also the returned string must be freed after use
+ * @details    The parameter string is put together as follows.
  *
- * @param[in]  builder  The builder
+ * In the HTTP request the parameters are URL encoded, but you
+ * should collect
+ * the raw values. In addition to the request parameters, every *oauth_**
+ * parameter needs to be included
+ * in the signature, so collect those too.
+ *
+ * 1. Percent encode every key and value that will be signed.
+ * 2. Sort the list of parameters alphabetically[1] by encoded key[2].
+ *     [2] Note: In case of two parameters with the same encoded key, the
+ *     OAuth spec says to continue sorting based on value. However,
+ *     Twitter does not accept duplicate keys in API requests.
  *
- * @return     The signature.
+ * The request, query and body parameters are sorted when they are set and
+ * the oauth parameters are listed in order, so the lists are merged here in
+ * linear time rather than sorted together again for every signature. Each
+ * pair is encoded again as it is written, which is all the parameter string
+ * is needed for, so it is never built on its own.
+ *
+ * 3. For each key/value pair:
+ *     a. Append the encoded key to the output string.
+ *     b. Append the ‘=’ character to the output string.
+ *     c. Append the encoded value to the output string.
+ *     d. If there are more key/value pairs remaining, append a '&' character to
+ * the output string.
+ *
+ * @param[in]  builder  The builder
+ * @param      sink     The sink
  */
-char *get_signature(const Builder *builder);
+static void write_signature_base(const Builder *builder, Sink *sink);
 
 /**
- * @brief      Gets the signature method.
+ * @brief      Builds the signature base string in the builder's arena
  *
  * @param[in]  builder  The builder
+ * @param[out] length   The length of the signature base
  *
- * @return     The signature method.
+ * @return     The signature base
  */
-char *get_signature_method(const Builder *builder);
+static char *signature_base(const Builder *builder, size_t *length);
 
 /**
- * @brief      Gets the timestamp.
- * The returned string must be freed after use
+ * @brief      Fills in the oauth values which were not set and signs
  *
- * @param[in]  builder  The builder
+ * @param      builder  The builder
  *
- * @return     The timestamp.
+ * @return     1 on success, 0 if the builder could not be signed
  */
-char *get_timestamp(const Builder *builder);
-
-void set_consumer_key(Builder *builder, const char *key) {
-    builder->oauth_consumer_key.value = oauth_strdup(key);
+static int prepare_header(Builder *builder);
 
-    builder->oauth_consumer_key.encoded_value =
-        curl_encode(builder->oauth_consumer_key.value);
-}
+/**
+ * @brief      Fills in the oauth values which were not set
+ *
+ * @param      builder  The builder
+ */
+static void fill_defaults(Builder *builder);
 
-void set_consumer_secret(Builder *builder, const char *key) {
-    builder->consumer_secret.value = oauth_strdup(key);
+/**
+ * @brief      Signs up to SHA1_MB_LANES builders together
+ *
+ * @details    The HMAC-SHA1 of every builder is worked out by sha1_multi(),
+ * first the inner hashes of all the signature bases and then the outer
+ * hashes of all their digests. Builders using another method are signed one
+ * at a time.
+ *
+ * @param      builders  The builders, their defaults filled in
+ * @param[in]  count     The number of builders
+ */
+static void sign_together(Builder **builders, size_t count);
 
-    builder->consumer_secret.encoded_value =
-        curl_encode(builder->consumer_secret.value);
-}
+/**
+ * @brief      Sets up a job continuing a SHA-1 hash from a midstate
+ *
+ * @param      job     The job
+ * @param[in]  start   The midstate, which must be at a block boundary
+ * @param[in]  data    The rest of the message
+ * @param[in]  length  The length of the rest of the message
+ * @param      digest  Receives the digest
+ */
+static void sha1_job(Sha1Job *job, const SHA_CTX *start, const unsigned char *data, size_t length,
+                     unsigned char *digest);
 
-void set_token(Builder *builder, const char *key) {
-    builder->oauth_token.value = oauth_strdup(key);
+/**
+ * @brief      Keeps the percent-encoded base64 of a signature in a builder
+ *
+ * @param      builder  The builder
+ * @param[in]  mac      The signature
+ * @param[in]  size     The size of the signature
+ */
+static void store_signature(Builder *builder, const unsigned char *mac, size_t size);
 
-    builder->oauth_token.encoded_value = curl_encode(builder->oauth_token.value);
-}
+/**
+ * @brief      Writes the Authorization header of a prepared builder
+ *
+ * @param[in]  builder  The builder
+ * @param      sink     The sink
+ */
+static void write_header(const Builder *builder, Sink *sink);
 
-void set_token_secret(Builder *builder, const char *key) {
-    builder->token_secret.value = oauth_strdup(key);
+/**
+ * @brief      Writes the curl command of a prepared builder
+ *
+ * @param[in]  builder  The builder
+ * @param      sink     The sink
+ */
+static void write_cURL_command(const Builder *builder, Sink *sink);
 
-    builder->token_secret.encoded_value =
-        curl_encode(builder->token_secret.value);
-}
+/**
+ * @brief      Appends bytes to a sink, keeping only what fits
+ *
+ * @param      sink    The sink
+ * @param[in]  data    The bytes
+ * @param[in]  length  The number of bytes
+ */
+static void sink_write(Sink *sink, const char *data, size_t length);
 
-void set_http_method(Builder *builder, const char *key) {
-    builder->http_method.value = oauth_strdup(key);
+/**
+ * @brief      Appends the percent-encoding of bytes to a sink
+ *
+ * @param      sink    The sink
+ * @param[in]  in      The bytes
+ * @param[in]  length  The number of bytes
+ */
+static void sink_encode(Sink *sink, const char *in, size_t length);
 
-    builder->http_method.encoded_value = curl_encode(builder->http_method.value);
-}
+/**
+ * @brief      Hands what a sink with a flush function holds to the function
+ *
+ * @param      sink  The sink
+ */
+static void sink_flush(Sink *sink);
 
-void set_base_url(Builder *builder, const char *key) {
-    builder->base_url.value = oauth_strdup(key);
+/**
+ * @brief      Appends the encoded name and value of a param as name="value"
+ *
+ * @param      sink   The sink
+ * @param[in]  param  The param
+ */
+static void sink_quoted_param(Sink *sink, const Param *param);
 
-    builder->base_url.encoded_value = curl_encode(builder->base_url.value);
-}
+/**
+ * @brief      Runs a writer into a heap string of exactly the right size
+ * @details    The writer runs twice: once into an empty sink, which only
+ * counts, and once into the allocated string.
+ *
+ * @param[in]  builder  The builder
+ * @param[in]  write    The writer
+ *
+ * @return     The string, to be freed by the caller, or NULL if allocation
+ * failed
+ */
+static char *render(const Builder *builder, void (*write)(const Builder *, Sink *));
+
+/**
+ * @brief      Null terminates the output of a sink
+ *
+ * @param      sink  The sink
+ *
+ * @return     The length the whole output needs, without the terminator
+ */
+static size_t sink_finish(Sink *sink);
+
+/**
+ * @brief      Sets the oauth signature.
+ *
+ * @details    The <b>oauth_signature</b> parameter contains a value which
+ * is generated by running all of the other request parameters and two
+ * secret values through a signing algorithm. The purpose of the signature
+ * is so that Twitter can verify that the request has not been modified in
+ * transit,
+ * verify the application sending the request, and verify that the application
+ * has
+ * authorization to interact with the user’s account.
+ * The process for calculating the oauth_signature for this request is described
+ * in
+ * [Creating a
+ * signature](https://dev.twitter.com/oauth/overview/creating-signatures)
+ *
+ *
+ * @example    oauth_signature  tnnArxj06cWHq44gCs1OSKk/jLY=
+ *
+ * @param      builder  The builder
+ *
+ * @return     1 on success, 0 if there was no key to sign with, in which case
+ * the builder is left without a signature
+ */
+static int create_signature(Builder *builder);
+
+/**
+ * @brief      Works out the signature of a builder whose oauth values are
+ * all in place
+ *
+ * @param[in]  builder  The builder
+ * @param      mac      Receives the digest of the builder's method
+ *
+ * @return     1 on success, 0 if there was no key to sign with
+ */
+static int compute_signature(const Builder *builder, unsigned char *mac);
+
+/**
+ * @brief      Orders two params by encoded name, then by encoded value
+ *
+ * @param[in]  p1    The first param
+ * @param[in]  p2    The second param
+ *
+ * @return     <0 if p1 goes before p2
+ *             0  if p1 is equivalent to p2
+ *             >0 if p1 goes after p2
+ */
+static int compare_params(const Param *p1, const Param *p2);
+
+/**
+ * @brief      Orders the encoded values of two params, either of which may
+ * only be worked out by a ValueCursor
+ *
+ * @param[in]  p1    The first param
+ * @param[in]  p2    The second param
+ *
+ * @return     <0, 0 or >0 as strcmp() would
+ */
+static int compare_values(const Param *p1, const Param *p2);
+
+/**
+ * @brief      Compares two strings of known length byte by byte
+ *
+ * @param[in]  s1    The first string
+ * @param[in]  len1  The length of the first string
+ * @param[in]  s2    The second string
+ * @param[in]  len2  The length of the second string
+ *
+ * @return     <0, 0 or >0 as strcmp() would
+ */
+static int compare_bytes(const char *s1, size_t len1, const char *s2, size_t len2);
+
+/**
+ * @brief      Sorts the request parameters as the signature needs them
+ *
+ * @details    Short lists are sorted with qsort(). Bulk requests can carry
+ * hundreds of parameters, which are radix sorted on their encoded names
+ * instead so the cost stays linear in the total length of the names.
+ *
+ * @param      params  The params
+ * @param[in]  count   The number of params
+ * @param      arena   The arena to take scratch space from
+ */
+static void sort_params(Param *params, size_t count, Arena *arena);
+
+/**
+ * @brief      Most significant digit first radix sort of params
+ *
+ * @details    Params are distributed on the byte of their encoded name at
+ * depth, with names which end there going first. Those are equal in name and
+ * are ordered by value with qsort(); every other bucket is sorted on the next
+ * byte, or with qsort() once it is small.
+ *
+ * @param      params   The params
+ * @param      scratch  Space for as many params
+ * @param[in]  count    The number of params
+ * @param[in]  depth    The number of leading name bytes all params share
+ */
+static void radix_sort_params(Param *params, Param *scratch, size_t count, size_t depth);
+
+/**
+ * @brief      Function to compare Params in an array
+ *
+ * @param[in]  v1    The first param
+ * @param[in]  v2    The second param
+ *
+ * @return     <0 if v1 goes before v2
+ *             0  if vi is equivalent to v2
+ *             >0 if v1 goes after v2
+ */
+static int compare_p(const void *v1, const void *v2);
+
+OauthCredentials *new_oauth_credentials(const char *consumer_key, const char *consumer_secret,
+                                       const char *token, const char *token_secret) {
+    Arena *arena = arena_new(CREDENTIALS_CHUNK_SIZE);
+    OauthCredentials *credentials;
+
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    credentials = arena_alloc(arena, sizeof(OauthCredentials));
+    if (credentials == NULL) {
+        arena_destroy(arena);
+        return NULL;
+    }
+    memset(credentials, 0, sizeof(OauthCredentials));
+    credentials->arena = arena;
+
+    token        = token != NULL ? token : "";
+    token_secret = token_secret != NULL ? token_secret : "";
+    NAME_PARAM(&credentials->oauth_consumer_key, "oauth_consumer_key");
+    NAME_PARAM(&credentials->oauth_token, "oauth_token");
+
+    /* The signing key never changes, so it is worked out once here too */
+    if (!set_param(arena, &credentials->oauth_consumer_key, consumer_key, strlen(consumer_key)) ||
+        !set_param(arena, &credentials->consumer_secret, consumer_secret,
+                   strlen(consumer_secret)) ||
+        !set_param(arena, &credentials->oauth_token, token, strlen(token)) ||
+        !set_param(arena, &credentials->token_secret, token_secret, strlen(token_secret)) ||
+        !key_credentials(credentials, arena)) {
+        arena_destroy(arena);
+        return NULL;
+    }
+
+    return credentials;
+}
+
+OauthCredentials *new_credentials_view(const OauthCredentialStrings *strings) {
+    const char *amp = memchr(strings->signing_key, '&', strings->signing_key_len);
+    OauthCredentials *credentials;
+    size_t consumer_len;
+    int i;
+
+    if (amp == NULL) {
+        return NULL;
+    }
+    credentials = oauth_alloc_zeroed(1, sizeof(OauthCredentials));
+    if (credentials == NULL) {
+        return NULL;
+    }
+
+    NAME_PARAM(&credentials->oauth_consumer_key, "oauth_consumer_key");
+    NAME_PARAM(&credentials->oauth_token, "oauth_token");
+    view_param(&credentials->oauth_consumer_key, strings->consumer_key, strings->consumer_key_len,
+               strings->encoded_consumer_key, strings->encoded_consumer_key_len);
+    view_param(&credentials->oauth_token, strings->token, strings->token_len,
+               strings->encoded_token, strings->encoded_token_len);
+
+    /* The encoded secrets are the two sides of the signing key */
+    consumer_len = ( size_t )(amp - strings->signing_key);
+    view_param(&credentials->consumer_secret, strings->consumer_secret,
+               strings->consumer_secret_len, strings->signing_key, consumer_len);
+    view_param(&credentials->token_secret, strings->token_secret, strings->token_secret_len,
+               strings->signing_key + consumer_len + 1,
+               strings->signing_key_len - consumer_len - 1);
+
+    credentials->signing_key     = strings->signing_key;
+    credentials->signing_key_len = strings->signing_key_len;
+    for (i = 0; i < SIGNATURE_METHOD_COUNT; ++i) {
+        SIGNATURE_METHODS[i].key(&credentials->keys[i],
+                                 ( const unsigned char * )credentials->signing_key,
+                                 credentials->signing_key_len);
+    }
+
+    return credentials;
+}
+
+void destroy_credentials(OauthCredentials **credentials) {
+    if (*credentials == NULL) {
+        return;
+    }
+
+    /* The credentials live in their own arena, so this frees everything,
+       unless they are a view of strings kept elsewhere */
+    if ((*credentials)->arena != NULL) {
+        arena_destroy((*credentials)->arena);
+    } else {
+        oauth_release(*credentials);
+    }
+    *credentials = NULL;
+}
+
+void set_credentials(Builder *builder, const OauthCredentials *credentials) {
+    builder->credentials     = credentials;
+    builder->own_credentials = NULL;
+}
+
+void set_consumer_key(Builder *builder, const char *key) {
+    OauthCredentials *credentials = own_credentials(builder);
+    if (credentials != NULL) {
+        set_param(builder->arena, &credentials->oauth_consumer_key, key, strlen(key));
+    }
+}
+
+void set_consumer_secret(Builder *builder, const char *key) {
+    OauthCredentials *credentials = own_credentials(builder);
+    if (credentials != NULL) {
+        set_param(builder->arena, &credentials->consumer_secret, key, strlen(key));
+        credentials->signing_key = NULL;
+    }
+}
+
+void set_token(Builder *builder, const char *key) {
+    OauthCredentials *credentials = own_credentials(builder);
+    if (credentials != NULL) {
+        set_param(builder->arena, &credentials->oauth_token, key, strlen(key));
+    }
+}
+
+void set_token_secret(Builder *builder, const char *key) {
+    OauthCredentials *credentials = own_credentials(builder);
+    if (credentials != NULL) {
+        set_param(builder->arena, &credentials->token_secret, key, strlen(key));
+        credentials->signing_key = NULL;
+    }
+}
+
+void set_http_method(Builder *builder, const char *key) {
+    set_param(builder->arena, &builder->http_method, key, strlen(key));
+}
+
+void set_base_url(Builder *builder, const char *key) {
+    set_param(builder->arena, &builder->base_url, key, strlen(key));
+}
 
 void set_request_params(Builder *builder, const char **params, int length) {
+    OauthTimer timer;
     int c;
     size_t d;
     const char *value;
+    Param *param;
 
-    builder->request_params  = calloc(( size_t )length, sizeof(Param));
-    builder->req_params_size = length;
+    /* The params only count once every one of them is in place */
+    builder->request_params  = arena_alloc(builder->arena, sizeof(Param) * ( size_t )length);
+    builder->req_params_size = 0;
+    if (builder->request_params == NULL) {
+        return;
+    }
 
-    /* using strncat because it appends a null terminating character
-  at the end of the string */
+    /* The parameters are encoded as a whole, timing each would cost more */
+    oauth_timer_start(&timer);
     for (c = 0; c < length; ++c) {
-        d                                  = strcspn(params[c], "=");
-        builder->request_params[c].name    = malloc(d);
-        builder->request_params[c].name[0] = '\0';
-        strncat(builder->request_params[c].name, params[c], d);
+        param               = &builder->request_params[c];
+        d                   = strcspn(params[c], "=");
+        param->name         = arena_strndup(builder->arena, params[c], d);
+        param->name_len     = d;
+        param->encoded_name = arena_encode(builder->arena, params[c], d, &param->encoded_name_len);
+
+        /* a parameter without '=' has an empty value */
+        value = params[c][d] == '=' ? &params[c][d + 1] : &params[c][d];
+        if (param->name == NULL || param->encoded_name == NULL ||
+            !set_param(builder->arena, param, value, strlen(value))) {
+            break;
+        }
+    }
+    oauth_timer_stop(&timer, OAUTH_STAGE_ENCODE);
+    if (c < length) {
+        return;
+    }
+    builder->req_params_size = length;
 
-        builder->request_params[c].encoded_name =
-            curl_encode(builder->request_params[c].name);
+    oauth_timer_start(&timer);
+    sort_params(builder->request_params, ( size_t )length, builder->arena);
+    oauth_timer_stop(&timer, OAUTH_STAGE_NORMALIZE);
+}
 
-        value                               = &params[c][d + 1];
-        d                                   = strlen(value);
-        builder->request_params[c].value    = malloc(d);
-        builder->request_params[c].value[0] = '\0';
-        strncat(builder->request_params[c].value, value, d);
+void set_request_url(Builder *builder, const char *url) {
+    const char *query = url + strcspn(url, "?#");
 
-        builder->request_params[c].encoded_value =
-            curl_encode(builder->request_params[c].value);
+    set_param(builder->arena, &builder->base_url, url, ( size_t )(query - url));
+
+    builder->query     = NULL;
+    builder->query_len = 0;
+    if (*query == '?') {
+        builder->query     = ++query;
+        builder->query_len = strcspn(query, "#");
     }
+    builder->query_params = split_form(builder->arena, builder->query, builder->query_len,
+                                       &builder->query_params_size);
+}
 
-    qsort(builder->request_params, length, sizeof builder->request_params[0],
-          compare_p);
+void set_request_body(Builder *builder, const char *body, size_t length) {
+    builder->body        = length > 0 ? body : NULL;
+    builder->body_len    = length;
+    builder->body_params = split_form(builder->arena, body, length, &builder->body_params_size);
 }
 
-void set_nonce(Builder *builder, const char *nonce) {
+void update_body_hash(Builder *builder, const void *data, size_t length) {
+    start_body_hash(builder);
+    builder->body_hash_method->body_update(&builder->body_hash, data, length);
+}
 
-    builder->oauth_nonce.value = oauth_strdup(nonce);
+int hash_body_fd(Builder *builder, int fd) {
+    char buffer[BODY_READ_SIZE];
+    ssize_t n;
+
+    start_body_hash(builder);
+    for (;;) {
+        n = read(fd, buffer, sizeof buffer);
+        if (n > 0) {
+            builder->body_hash_method->body_update(&builder->body_hash, buffer, ( size_t )n);
+        } else if (n == 0) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
 
-    builder->oauth_nonce.encoded_value = curl_encode(nonce);
+void set_nonce(Builder *builder, const char *nonce) {
+    set_param(builder->arena, &builder->oauth_nonce, nonce, strlen(nonce));
 }
 
-void set_signature_method(Builder *builder, const char *method) {
-    builder->oauth_signature_method.value = oauth_strdup(method);
-    builder->oauth_signature_method.encoded_value =
-        curl_encode(builder->oauth_signature_method.value);
+int set_signature_method(Builder *builder, const char *method) {
+    size_t length                 = strlen(method);
+    const SignatureMethod *chosen = find_signature_method(method, length);
+
+    /* A header naming a method it was not signed with is always rejected */
+    if (chosen == NULL) {
+        e_log("Unsupported signature method %s\n", method);
+        return -1;
+    }
+
+    set_param(builder->arena, &builder->oauth_signature_method, method, length);
+    builder->method = chosen;
+    return 0;
 }
 
 void set_timestamp(Builder *builder, const char *timestamp) {
-    builder->oauth_timestamp.value = oauth_strdup(timestamp);
-
-    builder->oauth_timestamp.encoded_value =
-        curl_encode(builder->oauth_timestamp.value);
+    set_param(builder->arena, &builder->oauth_timestamp, timestamp, strlen(timestamp));
 }
 
 void set_oauth_version(Builder *builder, const char *version) {
-    builder->oauth_version.value = oauth_strdup(version);
-
-    builder->oauth_version.encoded_value =
-        curl_encode(builder->oauth_version.value);
+    set_param(builder->arena, &builder->oauth_version, version, strlen(version));
 }
 
 Builder *new_oauth_builder(void) {
-    Builder *builder = malloc(sizeof(Builder));
-    Builder temp     = {
+    Arena *arena = arena_new(BUILDER_CHUNK_SIZE);
+    Builder *builder;
 
-/**
- * @brief      This X function initializes some of the struct members
- *
- * @param      member  The name of the member
- */
-#define X(_, member) {oauth_strdup(#member), NULL, NULL, NULL},
-        X_BUILDER_OAUTH_MEMBERS
-#undef X
-        {NULL, NULL, NULL, NULL},
-        {NULL, NULL, NULL, NULL},
-        {NULL, NULL, NULL, NULL},
-        {NULL, NULL, NULL, NULL},
-        NULL,
-        0};
+    if (arena == NULL) {
+        return NULL;
+    }
 
-/**
- * @brief      This X function percent-encodes some of the struct members
- *
- * @param      member  The member
- */
-#define X(_, member) temp.member.encoded_name = curl_encode(temp.member.name);
+    builder                  = arena_alloc(arena, sizeof(Builder));
+    builder->arena           = arena;
+    builder->base            = arena_mark(arena);
+    builder->credentials     = NULL;
+    builder->own_credentials = NULL;
+    reset_builder(builder);
+
+    return builder;
+}
+
+Builder *new_oauth_request(const OauthCredentials *credentials) {
+    Builder *builder = new_oauth_builder();
+    if (builder != NULL) {
+        set_credentials(builder, credentials);
+    }
+    return builder;
+}
+
+OauthVerifyResult verify_authorization_header(Builder *builder, const char *header,
+                                              size_t length, OauthCredentialsLookup lookup,
+                                              void *context) {
+    unsigned char mac[SIGNATURE_MAX_DIGEST];
+    char expected[BASE64_LENGTH(SIGNATURE_MAX_DIGEST) + 1];
+    const OauthCredentials *credentials;
+    const SignatureMethod *method;
+    const Param *claimed;
+    HeaderParams params;
+    size_t expected_len;
+
+    if (!parse_header(builder->arena, header, length, &params)) {
+        return OAUTH_VERIFY_MALFORMED;
+    }
+
+    method = find_signature_method(params.oauth_signature_method.value,
+                                   params.oauth_signature_method.value_len);
+    if (method == NULL) {
+        return OAUTH_VERIFY_UNSUPPORTED_METHOD;
+    }
+
+    credentials = lookup(params.oauth_consumer_key.value, params.oauth_consumer_key.value_len,
+                         params.oauth_token.value, params.oauth_token.value_len, context);
+    if (credentials == NULL) {
+        return OAUTH_VERIFY_UNKNOWN_CREDENTIALS;
+    }
+    set_credentials(builder, credentials);
+    builder->method = method;
+
+    /* A body hashed into the builder is what the header has to claim */
+    if (builder->body_hash_method != NULL) {
+        if (builder->oauth_body_hash.value == NULL) {
+            finish_body_hash(builder);
+        }
+        if (params.oauth_body_hash.value == NULL ||
+            compare_bytes(params.oauth_body_hash.value, params.oauth_body_hash.value_len,
+                          builder->oauth_body_hash.value, builder->oauth_body_hash.value_len)) {
+            return OAUTH_VERIFY_BAD_BODY_HASH;
+        }
+    }
+
+    /* The rest of the oauth values are taken as the header has them. The
+       consumer key and token come with the credentials. */
+#define X(where, member) X_TAKE_##where(member)
+#define X_TAKE_builder(member)                                                  \
+    builder->member.value             = params.member.value;                   \
+    builder->member.value_len         = params.member.value_len;               \
+    builder->member.encoded_value     = params.member.encoded_value;           \
+    builder->member.encoded_value_len = params.member.encoded_value_len;
+#define X_TAKE_credentials(member)
     X_BUILDER_OAUTH_MEMBERS
+#undef X_TAKE_credentials
+#undef X_TAKE_builder
 #undef X
 
-    memcpy(builder, &temp, sizeof(Builder));
+    if (!compute_signature(builder, mac)) {
+        return OAUTH_VERIFY_UNKNOWN_CREDENTIALS;
+    }
+    expected_len = base64_encode(expected, mac, method->digest_size);
 
-    if (++BUILDER_REF_COUNT == 1) {
-        curl = curl_easy_init();
+    /* Only the length of the signature may show in the time this takes */
+    claimed = &params.oauth_signature;
+    if (claimed->value_len != expected_len ||
+        CRYPTO_memcmp(claimed->value, expected, expected_len) != 0) {
+        return OAUTH_VERIFY_BAD_SIGNATURE;
     }
+    return OAUTH_VERIFY_OK;
+}
 
-    return builder;
+const char *oauth_verify_result_name(OauthVerifyResult result) {
+    static const char *NAMES[] = {
+#define X(result, description) description,
+        X_OAUTH_VERIFY_RESULTS
+#undef X
+    };
+
+    return ( size_t )result < sizeof NAMES / sizeof NAMES[0] ? NAMES[result] : "unknown";
 }
 
-void destroy_builder(Builder **builder) {
+OauthReplayResult check_replay(const Builder *builder, OauthReplayCache *cache, long now) {
+    const OauthCredentials *credentials = builder->credentials;
+    const Param *timestamp              = &builder->oauth_timestamp;
+    long seconds                        = 0;
+    size_t i;
 
-    if (*builder != NULL && BUILDER_REF_COUNT > 0) {
-        Builder *ref = *builder;
-        if (ref->request_params != NULL) {
-            int i;
-            for (i = 0; i < ref->req_params_size; ++i) {
-                free_param(&ref->request_params[i]);
-            }
-            ref->request_params = NULL;
+    /* A timestamp which is not a plain number of seconds is in no window */
+    if (timestamp->value_len == 0 || timestamp->value_len > 18) {
+        return OAUTH_REPLAY_EXPIRED;
+    }
+    for (i = 0; i < timestamp->value_len; ++i) {
+        if (timestamp->value[i] < '0' || timestamp->value[i] > '9') {
+            return OAUTH_REPLAY_EXPIRED;
         }
-        free_param(&ref->base_url);
-        free_param(&ref->http_method);
-        free_param(&ref->token_secret);
-        free_param(&ref->consumer_secret);
+        seconds = seconds * 10 + (timestamp->value[i] - '0');
+    }
+
+    return check_nonce(cache, credentials->oauth_consumer_key.value,
+                       credentials->oauth_consumer_key.value_len, credentials->oauth_token.value,
+                       credentials->oauth_token.value_len, builder->oauth_nonce.value,
+                       builder->oauth_nonce.value_len, seconds, now);
+}
+
+void reset_builder(Builder *builder) {
+    Arena *arena                        = builder->arena;
+    ArenaMark base                      = builder->base;
+    const OauthCredentials *credentials = builder->credentials;
+
+    /* Own credentials are in the arena being rewound, shared ones are kept */
+    if (builder->own_credentials != NULL) {
+        credentials = NULL;
+    }
+
+    arena_release(arena, base);
+    memset(builder, 0, sizeof(Builder));
+
+    builder->arena       = arena;
+    builder->base        = base;
+    builder->credentials = credentials;
+
 /**
- * @brief      This X function frees some of the struct members
+ * @brief      This X function names the members which belong to the builder
  *
- * @param      member  The member
+ * @param      where   Where the member lives
+ * @param      member  The name of the member
  */
-#define X(_, member) free_param(&ref->member);
-        X_BUILDER_OAUTH_MEMBERS
+#define X(where, member) X_NAME_##where(member)
+#define X_NAME_builder(member) NAME_PARAM(&builder->member, #member);
+#define X_NAME_credentials(member)
+    X_BUILDER_OAUTH_MEMBERS
+#undef X_NAME_credentials
+#undef X_NAME_builder
 #undef X
+}
+
+void destroy_builder(Builder **builder) {
 
-        free(*builder);
+    if (*builder != NULL) {
+        /* The builder lives in its own arena, so this frees everything */
+        arena_destroy((*builder)->arena);
 
         *builder = NULL;
-        if (--BUILDER_REF_COUNT == 0) {
-            curl_easy_cleanup(curl);
-        }
     }
 }
 
+OauthAllocStats get_builder_alloc_stats(const Builder *builder) {
+    return *arena_stats(builder->arena);
+}
+
 char *get_base_url(const Builder *builder) {
-    return oauth_strdup(builder->base_url.value);
+    return oauth_strdup(builder, &builder->base_url);
 }
 
 char *get_consumer_key(const Builder *builder) {
-    return oauth_strdup(builder->oauth_consumer_key.value);
+    return oauth_strdup(builder, &builder->credentials->oauth_consumer_key);
 }
 
 char *get_consumer_secret(const Builder *builder) {
-    return oauth_strdup(builder->consumer_secret.value);
+    return oauth_strdup(builder, &builder->credentials->consumer_secret);
 }
 
 char *get_http_method(const Builder *builder) {
-    return oauth_strdup(builder->http_method.value);
+    return oauth_strdup(builder, &builder->http_method);
 }
 
 char **get_request_params(const Builder *builder) {
-    char **params = malloc(sizeof(char *) * builder->req_params_size);
+    OauthAllocStats *account = arena_stats(builder->arena);
+    char **params =
+        oauth_alloc_result(sizeof(char *) * ( size_t )builder->req_params_size, account);
     Param *ptr;
     int c;
-    size_t nsize;
     for (c = 0; c < builder->req_params_size; ++c) {
-        ptr          = &builder->request_params[c];
-        nsize        = strlen(ptr->name);
-        params[c]    = malloc(nsize + strlen(ptr->value) + 2);
-        params[c][0] = '\0';
-        strcat(params[c], ptr->name);
-        strcat(&params[c][nsize], "=");
-        strcat(&params[c][nsize + 1], ptr->value);
+        ptr       = &builder->request_params[c];
+        params[c] = oauth_alloc_result(ptr->name_len + ptr->value_len + 2, account);
+        memcpy(params[c], ptr->name, ptr->name_len);
+        params[c][ptr->name_len] = '=';
+        memcpy(&params[c][ptr->name_len + 1], ptr->value, ptr->value_len + 1);
     }
     return params;
 }
 
 char *get_token(const Builder *builder) {
-    return oauth_strdup(builder->oauth_token.value);
+    return oauth_strdup(builder, &builder->credentials->oauth_token);
 }
 
 char *get_token_secret(const Builder *builder) {
-    return oauth_strdup(builder->token_secret.value);
+    return oauth_strdup(builder, &builder->credentials->token_secret);
 }
 
 char *get_nonce(const Builder *builder) {
-    return oauth_strdup(builder->oauth_nonce.value);
+    return oauth_strdup(builder, &builder->oauth_nonce);
 }
 
 char *get_oauth_version(const Builder *builder) {
-    return oauth_strdup(builder->oauth_version.value);
+    return oauth_strdup(builder, &builder->oauth_version);
 }
 
 char *get_signature(const Builder *builder) {
-    return oauth_strdup(builder->oauth_signature.value);
+    const Param *signature = &builder->oauth_signature;
+    char *decoded;
+
+    if (signature->encoded_value == NULL) {
+        return NULL;
+    }
+
+    decoded = oauth_alloc_result(signature->encoded_value_len + 1, arena_stats(builder->arena));
+    if (decoded != NULL) {
+        decoded[percent_decode(decoded, signature->encoded_value, signature->encoded_value_len)] =
+            '\0';
+    }
+    return decoded;
 }
 
 char *get_signature_method(const Builder *builder) {
-    return oauth_strdup(builder->oauth_signature_method.value);
+    return oauth_strdup(builder, &builder->oauth_signature_method);
 }
 
 char *get_timestamp(const Builder *builder) {
-    return oauth_strdup(builder->oauth_timestamp.value);
+    return oauth_strdup(builder, &builder->oauth_timestamp);
 }
 
 char *get_authorization_header(Builder *builder) {
-    BIO *mem      = NULL;
-    BUF_MEM *bptr = NULL;
-    int count     = 0, col, run;
-    char *random_str, timestamp[20];
-    time_t now = time(NULL);
-
-    if (builder->oauth_nonce.value == NULL) {
-        // Nonce
-        random_str = base64_bytes(NULL, 32);
-        for (col = 0, run = 0; random_str[run]; run++) {
-            if (isalnum(random_str[run])) {
-                random_str[col++] = random_str[run];
-            } else {
-                random_str[run] = '\0';
-            }
+    OauthTimer timer;
+    char *header;
+
+    if (!prepare_header(builder)) {
+        return NULL;
+    }
+
+    oauth_timer_start(&timer);
+    header = render(builder, write_header);
+    oauth_timer_stop(&timer, OAUTH_STAGE_HEADER);
+
+    return header;
+}
+
+size_t get_authorization_headers(Builder **builders, char **headers, size_t count) {
+    OauthTimer timer;
+    size_t i, n, failures = 0;
+
+    for (i = 0; i < count; ++i) {
+        fill_defaults(builders[i]);
+    }
+    for (i = 0; i < count; i += n) {
+        n = count - i < SHA1_MB_LANES ? count - i : SHA1_MB_LANES;
+        sign_together(builders + i, n);
+    }
+
+    for (i = 0; i < count; ++i) {
+        headers[i] = NULL;
+        if (builders[i]->oauth_signature.encoded_value != NULL) {
+            oauth_timer_start(&timer);
+            headers[i] = render(builders[i], write_header);
+            oauth_timer_stop(&timer, OAUTH_STAGE_HEADER);
+        }
+        if (headers[i] == NULL) {
+            failures++;
         }
+    }
 
-        set_nonce(builder, random_str);
-        free(random_str);
+    return failures;
+}
+
+size_t get_authorization_header_into(Builder *builder, char *buffer, size_t size) {
+    Sink sink = {buffer, size, 0};
+    OauthTimer timer;
+    size_t length;
+
+    if (!prepare_header(builder)) {
+        return sink_finish(&sink);
+    }
+
+    oauth_timer_start(&timer);
+    write_header(builder, &sink);
+    length = sink_finish(&sink);
+    oauth_timer_stop(&timer, OAUTH_STAGE_HEADER);
+
+    return length;
+}
+
+char *get_cURL_command(Builder *builder) {
+    if (!prepare_header(builder)) {
+        return NULL;
+    }
+    return render(builder, write_cURL_command);
+}
+
+size_t get_cURL_command_into(Builder *builder, char *buffer, size_t size) {
+    Sink sink = {buffer, size, 0};
+
+    if (prepare_header(builder)) {
+        write_cURL_command(builder, &sink);
+    }
+
+    return sink_finish(&sink);
+}
+
+char *get_signature_base(const Builder *builder) {
+    return render(builder, write_signature_base);
+}
+
+size_t get_signature_base_into(const Builder *builder, char *buffer, size_t size) {
+    Sink sink = {buffer, size, 0};
+
+    write_signature_base(builder, &sink);
+
+    return sink_finish(&sink);
+}
+
+static int prepare_header(Builder *builder) {
+    fill_defaults(builder);
+
+    // Done last in order to have the values needed
+    return create_signature(builder);
+}
+
+static void fill_defaults(Builder *builder) {
+    char nonce[NONCE_LENGTH + 1];
+    size_t length;
+
+    if (builder->oauth_nonce.value == NULL && make_nonce(nonce)) {
+        set_nonce(builder, nonce);
     }
 
     if (builder->oauth_signature_method.value == NULL) {
         // Signature method
-        set_signature_method(builder, "HMAC-SHA1");
+        PLAIN_PARAM(&builder->oauth_signature_method, "HMAC-SHA1");
+    }
+
+    if (builder->method == NULL) {
+        builder->method = &SIGNATURE_METHODS[SIGNATURE_HMAC_SHA1];
+    }
+
+    if (builder->body_hash_method != NULL && builder->oauth_body_hash.value == NULL) {
+        if (builder->body_hash_method != builder->method) {
+            e_log("The body was hashed for %s but is signed with %s\n",
+                  builder->body_hash_method->name, builder->method->name);
+        }
+        finish_body_hash(builder);
     }
 
     if (builder->oauth_timestamp.value == NULL) {
-        // timestamp
-        ( void )snprintf(timestamp, sizeof timestamp, "%ld", ( long int )now);
-        set_timestamp(builder, timestamp);
+        // timestamp, which is all digits and so needs no encoding
+        length = current_timestamp(builder->timestamp);
+        plain_param(&builder->oauth_timestamp, builder->timestamp, length);
     }
 
     if (NULL == builder->oauth_version.value) {
         // oauth version
-        set_oauth_version(builder, "1.0");
+        PLAIN_PARAM(&builder->oauth_version, "1.0");
     }
+}
 
-    // Done last in order to have the values needed
-    create_signature(builder);
+static void sign_together(Builder **builders, size_t count) {
+    unsigned char digests[SHA1_MB_LANES][SHA_DIGEST_LENGTH];
+    const OauthCredentials *credentials;
+    const HmacKey *keys[SHA1_MB_LANES];
+    Builder *batch[SHA1_MB_LANES];
+    ArenaMark marks[SHA1_MB_LANES];
+    Sha1Job jobs[SHA1_MB_LANES];
+    OauthTimer timer;
+    size_t i, n = 0, length;
+    char *base;
 
-    mem = BIO_new(BIO_s_mem());
-    BIO_write(mem, "OAuth ", 6);
-#define X(_, member)                                           \
-    count++;                                                   \
-    BIO_printf(mem, "%s=\"%s\"", builder->member.encoded_name, \
-               builder->member.encoded_value);                 \
-    if (count < OAUTH_MEMBERS_COUNT) {                         \
-        BIO_write(mem, ", ", 2);                               \
+    for (i = 0; i < count; ++i) {
+        /* A form body is hashed as it is written rather than batched */
+        if (builders[i]->method != &SIGNATURE_METHODS[SIGNATURE_HMAC_SHA1] ||
+            builders[i]->body != NULL) {
+            create_signature(builders[i]);
+            continue;
+        }
+
+        /* The key may be cached in the arena, so it is fetched before the mark */
+        credentials = get_signing_credentials(builders[i]);
+        if (credentials == NULL) {
+            create_signature(builders[i]);
+            continue;
+        }
+        keys[n]  = &credentials->keys[SIGNATURE_HMAC_SHA1];
+        marks[n] = arena_mark(builders[i]->arena);
+        base     = signature_base(builders[i], &length);
+        sha1_job(&jobs[n], &keys[n]->hmac_sha1.inner, ( const unsigned char * )base, length,
+                 digests[n]);
+        batch[n++] = builders[i];
     }
 
-    X_BUILDER_OAUTH_MEMBERS
-#undef X
+    if (n == 0) {
+        return;
+    }
+
+    /* The batch is timed as one call, since its requests are signed together */
+    oauth_timer_start(&timer);
+    sha1_multi(jobs, n);
+    for (i = 0; i < n; ++i) {
+        sha1_job(&jobs[i], &keys[i]->hmac_sha1.outer, digests[i], SHA_DIGEST_LENGTH, digests[i]);
+    }
+    sha1_multi(jobs, n);
+    oauth_timer_stop(&timer, OAUTH_STAGE_MAC);
+
+    for (i = 0; i < n; ++i) {
+        /* The bases are scratch, the signatures are kept */
+        arena_release(batch[i]->arena, marks[i]);
+        store_signature(batch[i], digests[i], SHA_DIGEST_LENGTH);
+    }
+}
+
+static void sha1_job(Sha1Job *job, const SHA_CTX *start, const unsigned char *data, size_t length,
+                     unsigned char *digest) {
+    job->state[0] = start->h0;
+    job->state[1] = start->h1;
+    job->state[2] = start->h2;
+    job->state[3] = start->h3;
+    job->state[4] = start->h4;
+    job->hashed   = (( uint64_t )start->Nh << 32 | start->Nl) >> 3;
+    job->data     = data;
+    job->length   = length;
+    job->digest   = digest;
+}
 
-    BIO_write(mem, "\0", 1);
+static void write_header(const Builder *builder, Sink *sink) {
+    int count = 0;
 
-    BIO_get_mem_ptr(mem, &bptr);
-    BIO_set_close(mem, BIO_NOCLOSE);
-    BIO_free_all(mem);
+    sink_write(sink, "OAuth ", 6);
+#define X(where, member)                                                \
+    if (is_listed(builder, OAUTH_MEMBER(where, builder, member))) {     \
+        if (count++ > 0) {                                              \
+            sink_write(sink, ", ", 2);                                  \
+        }                                                               \
+        sink_quoted_param(sink, OAUTH_MEMBER(where, builder, member));  \
+    }
 
-    return bptr->data;
+    X_BUILDER_OAUTH_MEMBERS
+#undef X
 }
 
-char *get_cURL_command(Builder *builder) {
-    char *auth_header = get_authorization_header(builder);
-    BIO *mem          = BIO_new(BIO_s_mem());
-    BUF_MEM *cc;
+static void write_cURL_command(const Builder *builder, Sink *sink) {
+    const Param *param;
     int c;
 
-    BIO_printf(mem, "curl --request '%s' '%s' --data '",
-               builder->http_method.value, builder->base_url.value);
+    sink_write(sink, "curl --request '", 16);
+    sink_write(sink, builder->http_method.value, builder->http_method.value_len);
+    sink_write(sink, "' '", 3);
+    sink_write(sink, builder->base_url.value, builder->base_url.value_len);
+    if (builder->query != NULL) {
+        sink_write(sink, "?", 1);
+        sink_write(sink, builder->query, builder->query_len);
+    }
+    sink_write(sink, "' --data '", 10);
 
     for (c = 0; c < builder->req_params_size; ++c) {
-        BIO_printf(mem, c == 0 ? "%s=%s" : "&%s=%s",
-                   builder->request_params[c].name,
-                   builder->request_params[c].value);
+        param = &builder->request_params[c];
+        if (c != 0) {
+            sink_write(sink, "&", 1);
+        }
+        sink_write(sink, param->name, param->name_len);
+        sink_write(sink, "=", 1);
+        sink_write(sink, param->value, param->value_len);
+    }
+    if (builder->body != NULL) {
+        if (builder->req_params_size > 0) {
+            sink_write(sink, "&", 1);
+        }
+        sink_write(sink, builder->body, builder->body_len);
     }
 
-    BIO_printf(mem, "' --header 'Authorization: %s' --verbose", auth_header);
-    BIO_write(mem, "\0", 1);
+    sink_write(sink, "' --header 'Authorization: ", 27);
+    write_header(builder, sink);
+    sink_write(sink, "' --verbose", 11);
+}
 
-    BIO_get_mem_ptr(mem, &cc);
-    BIO_set_close(mem, BIO_NOCLOSE);
-    BIO_free_all(mem);
-    free(auth_header);
+static void sink_write(Sink *sink, const char *data, size_t length) {
+    size_t room;
 
-    return cc->data;
+    if (sink->flush != NULL && sink->size - sink->length <= length) {
+        sink_flush(sink);
+        if (length >= sink->size) {
+            sink->flush(sink->context, data, length);
+            return;
+        }
+    }
+
+    room = sink->size > sink->length ? sink->size - sink->length - 1 : 0;
+
+    /* The last byte of the buffer is kept for the terminator */
+    if (sink->size > 0 && sink->length < sink->size - 1) {
+        memcpy(sink->data + sink->length, data, length < room ? length : room);
+    }
+    sink->length += length;
 }
 
-char *get_signature_base(const Builder *builder) {
-    BIO *mem      = NULL;
-    BUF_MEM *bptr = NULL, *params = collect_parameters(builder);
+static void sink_encode(Sink *sink, const char *in, size_t length) {
+    char piece[FORM_PIECE_SIZE * 3];
+    size_t room, n;
 
-    char *encoded_param = curl_encode_len(params->data, ( int )params->length);
+    if (sink->flush != NULL && sink->size - sink->length <= length * 3) {
+        sink_flush(sink);
+    }
 
-    mem = BIO_new(BIO_s_mem());
-    if (mem) {
-        BIO_write(mem, builder->http_method.value,
-                  ( int )strlen(builder->http_method.value));
-        BIO_write(mem, "&", 1);
-        BIO_write(mem, builder->base_url.encoded_value,
-                  ( int )strlen(builder->base_url.encoded_value));
-        BIO_write(mem, "&", 1);
-        BIO_write(mem, encoded_param, ( int )strlen(encoded_param));
-        BIO_write(mem, "\0", 1);
+    /* Most of the time the encoding fits and goes straight in */
+    room = sink->size > sink->length ? sink->size - sink->length - 1 : 0;
+    if (length <= room / 3) {
+        sink->length += percent_encode(sink->data + sink->length, in, length);
+        return;
+    }
+    if (sink->size == 0) {
+        sink->length += percent_encoded_length(in, length);
+        return;
+    }
 
-        BIO_get_mem_ptr(mem, &bptr);
-        BIO_set_close(mem, BIO_NOCLOSE);
-        BIO_free_all(mem);
+    for (; length > 0; in += n, length -= n) {
+        n = length < FORM_PIECE_SIZE ? length : FORM_PIECE_SIZE;
+        sink_write(sink, piece, percent_encode(piece, in, n));
     }
+}
+
+static void sink_flush(Sink *sink) {
+    if (sink->length > 0) {
+        sink->flush(sink->context, sink->data, sink->length);
+        sink->length = 0;
+    }
+}
+
+static void sink_quoted_param(Sink *sink, const Param *param) {
+    sink_write(sink, param->encoded_name, param->encoded_name_len);
+    sink_write(sink, "=\"", 2);
+    sink_write(sink, param->encoded_value, param->encoded_value_len);
+    sink_write(sink, "\"", 1);
+}
+
+static char *render(const Builder *builder, void (*write)(const Builder *, Sink *)) {
+    Sink sink = {NULL, 0, 0};
+
+    write(builder, &sink);
+
+    sink.size   = sink.length + 1;
+    sink.data   = oauth_alloc_result(sink.size, arena_stats(builder->arena));
+    sink.length = 0;
+    if (sink.data != NULL) {
+        write(builder, &sink);
+        sink_finish(&sink);
+    }
+
+    return sink.data;
+}
+
+static size_t sink_finish(Sink *sink) {
+    if (sink->size > 0) {
+        sink->data[sink->length < sink->size ? sink->length : sink->size - 1] = '\0';
+    }
+    return sink->length;
+}
 
-    free(encoded_param);
-    BUF_MEM_free(params);
+static int create_signature(Builder *builder) {
+    unsigned char sig[SIGNATURE_MAX_DIGEST] = {0};
 
-    return bptr->data;
+    if (!compute_signature(builder, sig)) {
+        builder->oauth_signature.encoded_value     = NULL;
+        builder->oauth_signature.encoded_value_len = 0;
+        return 0;
+    }
+    store_signature(builder, sig, builder->method->digest_size);
+    return 1;
 }
 
-static void create_signature(Builder *builder) {
-    BUF_MEM *bptr = NULL, *key = NULL;
-    unsigned char sig[SHA_DIGEST_LENGTH] = {0};
+static int compute_signature(const Builder *builder, unsigned char *mac) {
+    const SignatureMethod *method = builder->method;
+    const OauthCredentials *credentials;
+    const HmacKey *key;
+    OauthTimer timer;
     char *base;
+    size_t base_len;
+    ArenaMark mark;
 
-    int len;
+    /* The key may be cached in the arena, so it is fetched before the mark */
+    credentials = get_signing_credentials(builder);
+    if (credentials == NULL) {
+        return 0;
+    }
+    key = &credentials->keys[method - SIGNATURE_METHODS];
+
+    /* A form body can be large, so its base is never held in full */
+    if (builder->body != NULL) {
+        oauth_timer_start(&timer);
+        method->sign_stream(key, builder, mac);
+        oauth_timer_stop(&timer, OAUTH_STAGE_MAC);
+        return 1;
+    }
 
-    base = get_signature_base(builder);
-    key  = get_signing_key(builder);
+    mark = arena_mark(builder->arena);
+    base = signature_base(builder, &base_len);
 
     /**
    * Finally, the signature is calculated by passing the signature base string
    * and signing key to the
-   * HMAC-SHA1 hashing algorithm.
+   * HMAC hashing algorithm of the signature method.
    *
    * The output of the HMAC signing function is a binary string. This needs to
    * be base64 encoded
    * to produce the signature string.
    */
-    ( void )HMAC(EVP_sha1(), key->data, ( int )key->length, ( unsigned char * )base,
-                 strlen(base), sig, ( unsigned int * )&len);
+    oauth_timer_start(&timer);
+    method->sign(key, base, base_len, mac);
+    oauth_timer_stop(&timer, OAUTH_STAGE_MAC);
+
+    /* The base is scratch */
+    arena_release(builder->arena, mark);
+    return 1;
+}
 
-    builder->oauth_signature.value = base64_bytes(sig, len);
-    builder->oauth_signature.encoded_value =
-        curl_encode(builder->oauth_signature.value);
+static void store_signature(Builder *builder, const unsigned char *mac, size_t size) {
+    /* Only the escaped form goes into the header, get_signature() undoes it */
+    OauthTimer timer;
 
-    BUF_MEM_free(key);
-    BUF_MEM_free(bptr);
-    free(base);
+    oauth_timer_start(&timer);
+    builder->oauth_signature.encoded_value = builder->signature;
+    builder->oauth_signature.encoded_value_len =
+        base64_encode_escaped(builder->signature, mac, size);
+    oauth_timer_stop(&timer, OAUTH_STAGE_BASE64);
 }
 
-static BUF_MEM *get_signing_key(const Builder *builder) {
-    BIO *mem      = NULL;
-    BUF_MEM *bptr = NULL;
+static char *signature_base(const Builder *builder, size_t *length) {
+    const Param *lists[] = {builder->request_params, builder->query_params, builder->body_params};
+    const int sizes[]    = {builder->req_params_size, builder->query_params_size,
+                            builder->body_params_size};
+    Sink sink            = {NULL, 0, 0};
+    const Param *param;
+    OauthTimer timer;
+    size_t l;
+    int c;
 
-    mem = BIO_new(BIO_s_mem());
-    if (mem) {
-        BIO_printf(mem, "%s&%s", builder->consumer_secret.encoded_value,
-                   builder->token_secret.encoded_value);
+    oauth_timer_start(&timer);
 
-        BIO_get_mem_ptr(mem, &bptr);
-        BIO_set_close(mem, BIO_NOCLOSE);
-        BIO_free_all(mem);
+    /* Encoding at most triples a length, and a value still to be decoded
+       and encoded can grow three times more. This is scratch space, so
+       room enough is taken rather than the base being written twice. */
+    sink.size = builder->http_method.value_len + builder->base_url.encoded_value_len + 3;
+#define X(where, member)                                                           \
+    param = OAUTH_MEMBER(where, builder, member);                                  \
+    sink.size += (param->encoded_name_len + param->encoded_value_len + 2) * 3;
+    X_BUILDER_OAUTH_MEMBERS
+#undef X
+    for (l = 0; l < sizeof lists / sizeof lists[0]; ++l) {
+        for (c = 0; c < sizes[l]; ++c) {
+            param = &lists[l][c];
+            sink.size += (param->encoded_name_len + 2) * 3 +
+                         (param->encoded_value != NULL ? param->encoded_value_len * 3
+                                                       : param->value_len * 9);
+        }
+    }
+
+    sink.data = arena_alloc(builder->arena, sink.size);
+    if (sink.data == NULL) {
+        sink.size = 0;
     }
+    write_signature_base(builder, &sink);
+    *length = sink_finish(&sink);
+    oauth_timer_stop(&timer, OAUTH_STAGE_BASE_STRING);
 
-    return bptr;
+    return sink.data != NULL ? sink.data : "";
 }
 
-static BUF_MEM *collect_parameters(const Builder *builder) {
-    BIO *mem        = NULL;
-    BUF_MEM *bptr   = NULL;
-    int members_cnt = OAUTH_MEMBERS_COUNT -
-                      1; /* -1 because we don't use oauth_signature here */
-    int size = members_cnt + builder->req_params_size, i;
+static int key_credentials(OauthCredentials *credentials, Arena *arena) {
+    size_t consumer_len = credentials->consumer_secret.encoded_value_len;
+    size_t token_len    = credentials->token_secret.encoded_value_len;
+    char *key;
+    int i;
 
-    const Param **lst = malloc(sizeof(Param *) * size);
+    if (credentials->consumer_secret.encoded_value == NULL ||
+        credentials->token_secret.encoded_value == NULL) {
+        return 0;
+    }
+    key = arena_alloc(arena, consumer_len + 1 + token_len + 1);
+    if (key == NULL) {
+        return 0;
+    }
+    credentials->signing_key_len = consumer_len + 1 + token_len;
+    credentials->signing_key     = key;
 
-    /* Didn't use X-functions here because we don't have
-   oauth_signature yet
-   */
+    memcpy(key, credentials->consumer_secret.encoded_value, consumer_len);
+    key[consumer_len] = '&';
+    memcpy(&key[consumer_len + 1], credentials->token_secret.encoded_value, token_len + 1);
 
-    lst[0] = &builder->oauth_consumer_key;
-    lst[1] = &builder->oauth_nonce;
-    lst[2] = &builder->oauth_signature_method;
-    lst[3] = &builder->oauth_timestamp;
-    lst[4] = &builder->oauth_token;
-    lst[5] = &builder->oauth_version;
+    for (i = 0; i < SIGNATURE_METHOD_COUNT; ++i) {
+        SIGNATURE_METHODS[i].key(&credentials->keys[i], ( const unsigned char * )key,
+                                 credentials->signing_key_len);
+    }
+    return 1;
+}
 
-    for (i = members_cnt; i < size; ++i) {
-        lst[i] = &builder->request_params[i - members_cnt];
+static const OauthCredentials *get_signing_credentials(const Builder *builder) {
+    /* Only a builder's own credentials are ever missing the key, and it is
+       kept with them until a secret changes */
+    if (builder->credentials == NULL ||
+        (builder->credentials->signing_key == NULL &&
+         !key_credentials(builder->own_credentials, builder->arena))) {
+        return NULL;
     }
 
-    qsort(lst, ( unsigned int )size, sizeof(Param *), compare_p2p);
+    return builder->credentials;
+}
+
+static const SignatureMethod *find_signature_method(const char *name, size_t length) {
+    int i;
 
-    mem = BIO_new(BIO_s_mem());
-    if (mem) {
-        for (i = 0; i < size; ++i) {
-            if (i != 0) {
-                ( void )BIO_write(mem, "&", 1);
-            }
-            ( void )BIO_write(mem, lst[i]->encoded_name, strlen(lst[i]->encoded_name));
-            ( void )BIO_write(mem, "=", 1);
-            ( void )BIO_write(mem, lst[i]->encoded_value,
-                              strlen(lst[i]->encoded_value));
+    for (i = 0; i < SIGNATURE_METHOD_COUNT; ++i) {
+        if (SIGNATURE_METHODS[i].name_len == length &&
+            memcmp(SIGNATURE_METHODS[i].name, name, length) == 0) {
+            return &SIGNATURE_METHODS[i];
         }
+    }
+    return NULL;
+}
+
+static void load_hmac_block(unsigned char *block, size_t size, const unsigned char *secret,
+                            size_t length,
+                            unsigned char *(*digest)(const unsigned char *, size_t,
+                                                     unsigned char *)) {
+    if (length > size) {
+        ( void )digest(secret, length, block);
+    } else {
+        memcpy(block, secret, length);
+    }
+}
 
-        BIO_get_mem_ptr(mem, &bptr);
-        BIO_set_close(mem, BIO_NOCLOSE);
-        BIO_free_all(mem);
+static void xor_block(unsigned char *out, const unsigned char *block, size_t size,
+                      unsigned char pad) {
+    size_t i;
+    for (i = 0; i < size; ++i) {
+        out[i] = block[i] ^ pad;
     }
+}
+
+static void hmac_sha1_key(HmacKey *key, const unsigned char *secret, size_t length) {
+    unsigned char block[SHA_CBLOCK] = {0}, pad[SHA_CBLOCK];
+
+    load_hmac_block(block, SHA_CBLOCK, secret, length, SHA1);
+
+    xor_block(pad, block, SHA_CBLOCK, 0x36);
+    SHA1_Init(&key->hmac_sha1.inner);
+    SHA1_Update(&key->hmac_sha1.inner, pad, SHA_CBLOCK);
+
+    xor_block(pad, block, SHA_CBLOCK, 0x5c);
+    SHA1_Init(&key->hmac_sha1.outer);
+    SHA1_Update(&key->hmac_sha1.outer, pad, SHA_CBLOCK);
+
+    OPENSSL_cleanse(block, sizeof block);
+    OPENSSL_cleanse(pad, sizeof pad);
+}
+
+static void hmac_sha1_sign(const HmacKey *key, const char *data, size_t length,
+                           unsigned char *mac) {
+    SHA_CTX ctx = key->hmac_sha1.inner;
+
+    SHA1_Update(&ctx, data, length);
+    SHA1_Final(mac, &ctx);
+
+    ctx = key->hmac_sha1.outer;
+    SHA1_Update(&ctx, mac, SHA_DIGEST_LENGTH);
+    SHA1_Final(mac, &ctx);
+}
+
+static void hmac_sha1_sign_stream(const HmacKey *key, const Builder *builder, unsigned char *mac) {
+    char buffer[SIGN_BUFFER_SIZE];
+    SHA_CTX ctx = key->hmac_sha1.inner;
+    Sink sink   = {buffer, sizeof buffer, 0, hmac_sha1_update, &ctx};
+
+    write_signature_base(builder, &sink);
+    sink_flush(&sink);
+    SHA1_Final(mac, &ctx);
+
+    ctx = key->hmac_sha1.outer;
+    SHA1_Update(&ctx, mac, SHA_DIGEST_LENGTH);
+    SHA1_Final(mac, &ctx);
+}
+
+static void hmac_sha256_key(HmacKey *key, const unsigned char *secret, size_t length) {
+    unsigned char block[SHA256_CBLOCK] = {0}, pad[SHA256_CBLOCK];
+
+    load_hmac_block(block, SHA256_CBLOCK, secret, length, SHA256);
+
+    xor_block(pad, block, SHA256_CBLOCK, 0x36);
+    SHA256_Init(&key->hmac_sha256.inner);
+    SHA256_Update(&key->hmac_sha256.inner, pad, SHA256_CBLOCK);
+
+    xor_block(pad, block, SHA256_CBLOCK, 0x5c);
+    SHA256_Init(&key->hmac_sha256.outer);
+    SHA256_Update(&key->hmac_sha256.outer, pad, SHA256_CBLOCK);
+
+    OPENSSL_cleanse(block, sizeof block);
+    OPENSSL_cleanse(pad, sizeof pad);
+}
+
+static void hmac_sha256_sign(const HmacKey *key, const char *data, size_t length,
+                             unsigned char *mac) {
+    SHA256_CTX ctx = key->hmac_sha256.inner;
 
-    free(lst);
+    SHA256_Update(&ctx, data, length);
+    SHA256_Final(mac, &ctx);
 
-    return bptr;
+    ctx = key->hmac_sha256.outer;
+    SHA256_Update(&ctx, mac, SHA256_DIGEST_LENGTH);
+    SHA256_Final(mac, &ctx);
+}
+
+static void hmac_sha256_sign_stream(const HmacKey *key, const Builder *builder,
+                                    unsigned char *mac) {
+    char buffer[SIGN_BUFFER_SIZE];
+    SHA256_CTX ctx = key->hmac_sha256.inner;
+    Sink sink      = {buffer, sizeof buffer, 0, hmac_sha256_update, &ctx};
+
+    write_signature_base(builder, &sink);
+    sink_flush(&sink);
+    SHA256_Final(mac, &ctx);
+
+    ctx = key->hmac_sha256.outer;
+    SHA256_Update(&ctx, mac, SHA256_DIGEST_LENGTH);
+    SHA256_Final(mac, &ctx);
+}
+
+static void hmac_sha1_update(void *context, const char *data, size_t length) {
+    SHA1_Update(context, data, length);
+}
+
+static void hmac_sha256_update(void *context, const char *data, size_t length) {
+    SHA256_Update(context, data, length);
+}
+
+static void hmac_sha1_body_start(BodyHash *hash) {
+    SHA1_Init(&hash->sha1);
+}
+
+static void hmac_sha256_body_start(BodyHash *hash) {
+    SHA256_Init(&hash->sha256);
+}
+
+static void hmac_sha1_body_finish(BodyHash *hash, unsigned char *digest) {
+    SHA1_Final(digest, &hash->sha1);
+}
+
+static void hmac_sha256_body_finish(BodyHash *hash, unsigned char *digest) {
+    SHA256_Final(digest, &hash->sha256);
+}
+
+static void write_signature_base(const Builder *builder, Sink *sink) {
+    const Param *oauth[] = {
+#define X(where, member) OAUTH_MEMBER(where, builder, member),
+        X_BUILDER_OAUTH_MEMBERS
+#undef X
+    };
+    const Param *lists[]  = {builder->request_params, builder->query_params, builder->body_params};
+    size_t sizes[]        = {( size_t )builder->req_params_size,
+                             ( size_t )builder->query_params_size,
+                             ( size_t )builder->body_params_size};
+    size_t next[]         = {0, 0, 0};
+    size_t oauth_size     = sizeof oauth / sizeof oauth[0], i, l, *from;
+    const Param *param;
+    const char *piece;
+    ValueCursor cursor;
+    size_t length;
+    int count = 0;
+
+    sink_write(sink, builder->http_method.value, builder->http_method.value_len);
+    sink_write(sink, "&", 1);
+    sink_write(sink, builder->base_url.encoded_value, builder->base_url.encoded_value_len);
+    sink_write(sink, "&", 1);
+
+    for (i = 0;;) {
+        /* The signature is not part of what it signs */
+        if (i < oauth_size &&
+            (oauth[i] == &builder->oauth_signature || !is_listed(builder, oauth[i]))) {
+            ++i;
+            continue;
+        }
+
+        /* The lists are each sorted, so they are merged */
+        param = i < oauth_size ? oauth[i] : NULL;
+        from  = &i;
+        for (l = 0; l < sizeof lists / sizeof lists[0]; ++l) {
+            if (next[l] < sizes[l] &&
+                (param == NULL || compare_params(&lists[l][next[l]], param) < 0)) {
+                param = &lists[l][next[l]];
+                from  = &next[l];
+            }
+        }
+        if (param == NULL) {
+            break;
+        }
+        ++*from;
+
+        /* The '&' and '=' of the parameter string, encoded */
+        if (count++ > 0) {
+            sink_write(sink, "%26", 3);
+        }
+        sink_encode(sink, param->encoded_name, param->encoded_name_len);
+        sink_write(sink, "%3D", 3);
+        open_value(&cursor, param);
+        while ((length = next_piece(&cursor, &piece)) > 0) {
+            sink_encode(sink, piece, length);
+        }
+    }
 }
 
 static char *get_request_param_string(const Builder *builder) {
@@ -837,7 +2165,7 @@ static char *get_request_param_string(const Builder *builder) {
         bufflen += strlen(params[c]) + 1;
     }
 
-    string  = malloc(bufflen);
+    string  = oauth_alloc_result(bufflen, arena_stats(builder->arena));
     *string = '\0';
     for (c = 0; c < size; ++c) {
         if (c != 0) {
@@ -850,124 +2178,445 @@ static char *get_request_param_string(const Builder *builder) {
     return string;
 }
 
-static int compare_p2p(const void *v1, const void *v2) {
-    const Param *p1 = *( Param * const * )v1;
-    const Param *p2 = *( Param * const * )v2;
-    int r           = strcmp(p1->encoded_name, p2->encoded_name);
-    if (r == 0) /* (r == 0) This should never happen, but just
-               * for the sake of completeness, we will leave this in */
-        r = strcmp(p1->encoded_value, p2->encoded_value);
-    return r;
+static int compare_p(const void *v1, const void *v2) {
+    return compare_params(v1, v2);
 }
 
-static int compare_p(const void *v1, const void *v2) {
-    const Param *p1 = v1;
-    const Param *p2 = v2;
-    int r           = strcmp(p1->encoded_name, p2->encoded_name);
-    if (r == 0) /* (r == 0) This should never happen, but just
-               * for the sake of completeness, we will leave this in */
-        r = strcmp(p1->encoded_value, p2->encoded_value);
+static int compare_params(const Param *p1, const Param *p2) {
+    int r = compare_bytes(p1->encoded_name, p1->encoded_name_len, p2->encoded_name,
+                          p2->encoded_name_len);
+    if (r != 0) {
+        return r;
+    }
+
+    /* This should never happen, but just for the sake of completeness, we
+       will leave this in */
+    if (p1->encoded_value == NULL || p2->encoded_value == NULL) {
+        return compare_values(p1, p2);
+    }
+    return compare_bytes(p1->encoded_value, p1->encoded_value_len, p2->encoded_value,
+                         p2->encoded_value_len);
+}
+
+static int compare_values(const Param *p1, const Param *p2) {
+    ValueCursor c1, c2;
+    const char *s1 = NULL, *s2 = NULL;
+    size_t len1 = 0, len2 = 0, n;
+    int r;
+
+    open_value(&c1, p1);
+    open_value(&c2, p2);
+    for (;;) {
+        if (len1 == 0) {
+            len1 = next_piece(&c1, &s1);
+        }
+        if (len2 == 0) {
+            len2 = next_piece(&c2, &s2);
+        }
+        if (len1 == 0 || len2 == 0) {
+            return len1 == 0 ? -(len2 != 0) : 1;
+        }
+
+        n = len1 < len2 ? len1 : len2;
+        r = memcmp(s1, s2, n);
+        if (r != 0) {
+            return r;
+        }
+        s1 += n;
+        s2 += n;
+        len1 -= n;
+        len2 -= n;
+    }
+}
+
+static int compare_bytes(const char *s1, size_t len1, const char *s2, size_t len2) {
+    int r = memcmp(s1, s2, len1 < len2 ? len1 : len2);
+    if (r == 0) {
+        r = len1 < len2 ? -1 : len1 > len2;
+    }
     return r;
 }
 
-static char *base64_bytes(unsigned char *src, int src_size) {
-    BIO *b64 = NULL, *mem = NULL;
-    BUF_MEM *bptr = NULL;
-    char *bytes   = NULL;
-    int freesrc   = 0;
+static void sort_params(Param *params, size_t count, Arena *arena) {
+    ArenaMark mark;
+    Param *scratch;
 
-    if (src == NULL) {
-        src = malloc(( size_t )src_size);
-        if (!RAND_bytes(src, src_size)) {
-            e_log("The random generator is proving difficult");
-            return ( char * )NULL;
+    if (count < RADIX_SORT_MIN) {
+        qsort(params, count, sizeof(Param), compare_p);
+        return;
+    }
+
+    mark    = arena_mark(arena);
+    scratch = arena_alloc(arena, sizeof(Param) * count);
+    if (scratch != NULL) {
+        radix_sort_params(params, scratch, count, 0);
+    } else {
+        qsort(params, count, sizeof(Param), compare_p);
+    }
+    arena_release(arena, mark);
+}
+
+static void radix_sort_params(Param *params, Param *scratch, size_t count, size_t depth) {
+    /* Bucket 0 holds the names which end at depth, 1 + byte the others */
+    size_t start[258] = {0}, next[257], i, b;
+
+#define BUCKET(param) \
+    ((param).encoded_name_len > depth ? 1 + ( unsigned char )(param).encoded_name[depth] : 0)
+
+    for (i = 0; i < count; ++i) {
+        start[BUCKET(params[i]) + 1]++;
+    }
+    for (b = 1; b < 258; ++b) {
+        start[b] += start[b - 1];
+    }
+
+    memcpy(next, start, sizeof next);
+    for (i = 0; i < count; ++i) {
+        scratch[next[BUCKET(params[i])]++] = params[i];
+    }
+    memcpy(params, scratch, sizeof(Param) * count);
+#undef BUCKET
+
+    qsort(params, start[1], sizeof(Param), compare_p);
+    for (b = 1; b < 257; ++b) {
+        count = start[b + 1] - start[b];
+        if (count >= RADIX_SORT_MIN) {
+            radix_sort_params(params + start[b], scratch, count, depth + 1);
+        } else if (count > 1) {
+            qsort(params + start[b], count, sizeof(Param), compare_p);
         }
-        freesrc = 1;
     }
+}
 
-    /*Create a base64 filter/sink*/
-    if ((b64 = BIO_new(BIO_f_base64())) == NULL) {
-        e_log("Could not create a base64 filter!");
-        return ( char * )NULL;
+static char *oauth_strdup(const Builder *builder, const Param *param) {
+    char *dest = oauth_alloc_result(param->value_len + 1, arena_stats(builder->arena));
+
+    if (dest != NULL) {
+        memcpy(dest, param->value, param->value_len);
+        dest[param->value_len] = '\0';
     }
+    return dest;
+}
+
+static char *arena_encode(Arena *arena, const char *in, size_t length, size_t *encoded) {
+    char *out;
 
-    /*Create a memory source, this is where everything will end up eventually*/
-    if ((mem = BIO_new(BIO_s_mem())) == NULL) {
-        e_log("Could not allocate storage for the conversion");
-        return ( char * )NULL;
+    out      = arena_alloc(arena, percent_encoded_length(in, length) + 1);
+    *encoded = 0;
+    if (out != NULL) {
+        *encoded      = percent_encode(out, in, length);
+        out[*encoded] = '\0';
     }
 
-    /* Chain them: --> b64 >|> mem */
-    mem = BIO_push(b64, mem);
-    BIO_set_flags(mem, BIO_FLAGS_BASE64_NO_NL);
+    return out;
+}
+
+static const char *form_encode(Arena *arena, const char *raw, size_t length, size_t *encoded) {
+    char *decoded, *c;
+    size_t decoded_len;
+
+    if (memchr(raw, '+', length) == NULL && percent_is_canonical(raw, length)) {
+        *encoded = length;
+        return raw;
+    }
 
-    /*Write the bytes*/
-    BIO_write(mem, src, src_size);
-    BIO_flush(b64);
+    decoded = arena_strndup(arena, raw, length);
+    if (decoded == NULL) {
+        *encoded = 0;
+        return "";
+    }
+    for (c = decoded; (c = memchr(c, '+', ( size_t )(decoded + length - c))) != NULL; ++c) {
+        *c = ' ';
+    }
+    decoded_len = percent_decode(decoded, decoded, length);
 
-    /*Now remove the base64 filter: -->mem, and write a null terminator*/
-    mem = BIO_pop(b64);
-    BIO_write(mem, "\0", 1);
+    return arena_encode(arena, decoded, decoded_len, encoded);
+}
 
-    /*Retrieve the underlying memory pointer*/
-    BIO_get_mem_ptr(mem, &bptr);
+static Param *split_form(Arena *arena, const char *text, size_t length, int *count) {
+    const char *end = text + length, *amp, *equals;
+    OauthTimer timer;
+    Param *params, *param;
+    size_t size;
+
+    *count = 0;
+    if (length == 0) {
+        return NULL;
+    }
+
+    /* one param for every '&', the empty ones are skipped below */
+    for (size = 1, amp = text; (amp = memchr(amp, '&', ( size_t )(end - amp))) != NULL; ++amp) {
+        ++size;
+    }
+    params = arena_alloc(arena, sizeof(Param) * size);
+    if (params == NULL) {
+        return NULL;
+    }
+
+    oauth_timer_start(&timer);
+    for (; text <= end; text = amp + 1) {
+        amp = memchr(text, '&', ( size_t )(end - text));
+        amp = amp != NULL ? amp : end;
+        if (amp == text) {
+            continue;
+        }
 
-    /*Allocate memory for the internal buffer and copy it to the new location*/
-    bytes = oauth_strdup(bptr->data);
+        /* a parameter without '=' has an empty value */
+        equals = memchr(text, '=', ( size_t )(amp - text));
+        equals = equals != NULL ? equals : amp;
+
+        param               = &params[(*count)++];
+        param->name         = text;
+        param->name_len     = ( size_t )(equals - text);
+        param->value        = equals == amp ? amp : equals + 1;
+        param->value_len    = ( size_t )(amp - param->value);
+        param->encoded_name = form_encode(arena, param->name, param->name_len,
+                                          &param->encoded_name_len);
+
+        /* values can be large, so they are only encoded as they are used */
+        if (memchr(param->value, '+', param->value_len) == NULL &&
+            percent_is_canonical(param->value, param->value_len)) {
+            param->encoded_value     = param->value;
+            param->encoded_value_len = param->value_len;
+        } else {
+            param->encoded_value     = NULL;
+            param->encoded_value_len = 0;
+        }
+    }
+    oauth_timer_stop(&timer, OAUTH_STAGE_ENCODE);
 
-    /*Cleanup*/
-    BIO_set_close(mem, BIO_CLOSE);
-    BIO_free_all(mem);
-    if (freesrc)
-        free(src);
+    oauth_timer_start(&timer);
+    sort_params(params, ( size_t )*count, arena);
+    oauth_timer_stop(&timer, OAUTH_STAGE_NORMALIZE);
 
-    return bytes;
+    return params;
 }
 
-static char *oauth_strdup(const char *s) {
-    size_t len = 1 + strlen(s);
-    char *dest = malloc(len);
-    // no need to manually append \0 because strlen stops at that symbol
-    return dest ? memcpy(dest, s, len) : ( char * )0;
+static void open_value(ValueCursor *cursor, const Param *param) {
+    cursor->raw  = param->encoded_value == NULL;
+    cursor->next = cursor->raw ? param->value : param->encoded_value;
+    cursor->end  = cursor->next + (cursor->raw ? param->value_len : param->encoded_value_len);
 }
 
-static char *curl_encode_len(const char *in, int length) {
-    char *encode = curl_easy_escape(curl, in, length);
-    char *out    = oauth_strdup(encode);
-    curl_free(encode);
-    return out;
+static size_t next_piece(ValueCursor *cursor, const char **piece) {
+    size_t length = ( size_t )(cursor->end - cursor->next), c;
+
+    if (!cursor->raw || length == 0) {
+        *piece       = cursor->next;
+        cursor->next = cursor->end;
+        return length;
+    }
+
+    /* Cut the piece short rather than split an escape */
+    if (length > FORM_PIECE_SIZE) {
+        length = FORM_PIECE_SIZE;
+        if (cursor->next[length - 2] == '%') {
+            length -= 2;
+        } else if (cursor->next[length - 1] == '%') {
+            length -= 1;
+        }
+    }
+
+    memcpy(cursor->decoded, cursor->next, length);
+    cursor->next += length;
+    for (c = 0; c < length; ++c) {
+        if (cursor->decoded[c] == '+') {
+            cursor->decoded[c] = ' ';
+        }
+    }
+    length = percent_decode(cursor->decoded, cursor->decoded, length);
+
+    *piece = cursor->encoded;
+    return percent_encode(cursor->encoded, cursor->decoded, length);
 }
 
-static char *curl_encode(const char *in) {
-    char *encode = curl_easy_escape(curl, in, 0);
-    char *out    = oauth_strdup(encode);
-    curl_free(encode);
-    return out;
+static int is_listed(const Builder *builder, const Param *param) {
+    return param != &builder->oauth_body_hash || param->value != NULL;
 }
 
-static char *curl_decode_len(const char *in, int length) {
-    int len;
-    char *decode = curl_easy_unescape(curl, in, length, &len);
-    char *out    = oauth_strdup(decode);
-    curl_free(decode);
-    return out;
+static void start_body_hash(Builder *builder) {
+    if (builder->body_hash_method == NULL) {
+        builder->body_hash_method =
+            builder->method != NULL ? builder->method : &SIGNATURE_METHODS[SIGNATURE_HMAC_SHA1];
+        builder->body_hash_method->body_start(&builder->body_hash);
+    }
 }
 
-static char *curl_decode(const char *in) {
-    int len;
-    char *decode = curl_easy_unescape(curl, in, 0, &len);
-    char *out    = oauth_strdup(decode);
-    curl_free(decode);
-    return out;
+static void finish_body_hash(Builder *builder) {
+    const SignatureMethod *method = builder->body_hash_method;
+    unsigned char digest[SIGNATURE_MAX_DIGEST];
+    char base64[BASE64_LENGTH(SIGNATURE_MAX_DIGEST) + 1];
+    size_t length;
+
+    method->body_finish(&builder->body_hash, digest);
+    length = base64_encode(base64, digest, method->digest_size);
+    set_param(builder->arena, &builder->oauth_body_hash, base64, length);
+}
+
+static int parse_header(Arena *arena, const char *header, size_t length, HeaderParams *params) {
+    const char *p = header, *end = header + length, *name, *value;
+    Param *param;
+    size_t name_len;
+
+    memset(params, 0, sizeof(HeaderParams));
+
+    /* The name of the header is optional, the scheme is not */
+    p = skip_space(p, end, 0);
+    if (skip_word(&p, end, "authorization:")) {
+        p = skip_space(p, end, 0);
+    }
+    if (!skip_word(&p, end, "oauth") || (p < end && *p != ' ' && *p != '\t')) {
+        return 0;
+    }
+
+    /* name="value" pairs, separated by commas */
+    for (p = skip_space(p, end, 1); p < end; p = skip_space(p, end, 1)) {
+        for (name = p; p < end && *p != '=' && *p != ',' && *p != ' ' && *p != '\t'; ++p) {
+        }
+        name_len = ( size_t )(p - name);
+        if (name_len == 0 || end - p < 2 || p[0] != '=' || p[1] != '"') {
+            return 0;
+        }
+
+        value = p + 2;
+        p     = memchr(value, '"', ( size_t )(end - value));
+        if (p == NULL) {
+            return 0;
+        }
+        ++p;
+        if (p < end && *p != ',' && *p != ' ' && *p != '\t') {
+            return 0;
+        }
+
+        /* The realm is not signed */
+        if (name_len == 5 && memcmp(name, "realm", 5) == 0) {
+            continue;
+        }
+
+        param = header_param(params, name, name_len);
+        if (param == NULL || param->encoded_value != NULL) {
+            return 0;
+        }
+        header_value(arena, param, value, ( size_t )(p - 1 - value));
+    }
+
+    /* Every parameter the library signs with, but the body hash */
+#define X(where, member)                                                          \
+    if (params->member.encoded_value == NULL && &params->member != &params->oauth_body_hash) { \
+        return 0;                                                                 \
+    }
+    X_BUILDER_OAUTH_MEMBERS
+#undef X
+
+    return 1;
+}
+
+static Param *header_param(HeaderParams *params, const char *name, size_t name_len) {
+#define X(where, member)                                                        \
+    if (name_len == sizeof #member - 1 && memcmp(name, #member, name_len) == 0) { \
+        return &params->member;                                                 \
+    }
+    X_BUILDER_OAUTH_MEMBERS
+#undef X
+
+    return NULL;
+}
+
+static void header_value(Arena *arena, Param *param, const char *value, size_t length) {
+    char *decoded;
+
+    param->value             = value;
+    param->value_len         = length;
+    param->encoded_value     = value;
+    param->encoded_value_len = length;
+    if (memchr(value, '%', length) == NULL) {
+        return;
+    }
+
+    decoded = arena_alloc(arena, length + 1);
+    if (decoded == NULL) {
+        return;
+    }
+    param->value            = decoded;
+    param->value_len        = percent_decode(decoded, value, length);
+    decoded[param->value_len] = '\0';
+    if (!percent_is_canonical(value, length)) {
+        param->encoded_value = arena_encode(arena, decoded, param->value_len,
+                                            &param->encoded_value_len);
+    }
+}
+
+static int skip_word(const char **text, const char *end, const char *word) {
+    const char *p = *text;
+
+    for (; *word != '\0'; ++word, ++p) {
+        if (p == end || (*p | 0x20) != *word) {
+            return 0;
+        }
+    }
+    *text = p;
+    return 1;
+}
+
+static const char *skip_space(const char *text, const char *end, int commas) {
+    while (text < end && (*text == ' ' || *text == '\t' || (commas && *text == ','))) {
+        ++text;
+    }
+    return text;
+}
+
+static void name_param(Param *param, const char *name, size_t length) {
+    param->name             = name;
+    param->encoded_name     = name;
+    param->name_len         = length;
+    param->encoded_name_len = length;
+}
+
+static void plain_param(Param *param, const char *value, size_t length) {
+    param->value             = value;
+    param->encoded_value     = value;
+    param->value_len         = length;
+    param->encoded_value_len = length;
+}
+
+static OauthCredentials *own_credentials(Builder *builder) {
+    OauthCredentials *credentials = builder->own_credentials;
+
+    if (credentials == NULL) {
+        credentials = arena_alloc(builder->arena, sizeof(OauthCredentials));
+        if (credentials == NULL) {
+            return NULL;
+        }
+        memset(credentials, 0, sizeof(OauthCredentials));
+        credentials->arena = builder->arena;
+        NAME_PARAM(&credentials->oauth_consumer_key, "oauth_consumer_key");
+        NAME_PARAM(&credentials->oauth_token, "oauth_token");
+
+        /* Until they are set, the token and its secret are empty, as when
+           getting a request token */
+        if (!set_param(builder->arena, &credentials->oauth_token, "", 0) ||
+            !set_param(builder->arena, &credentials->token_secret, "", 0)) {
+            return NULL;
+        }
+
+        builder->own_credentials = credentials;
+        builder->credentials     = credentials;
+    }
+
+    return credentials;
+}
+
+static void view_param(Param *param, const char *value, size_t length, const char *encoded,
+                       size_t encoded_len) {
+    param->value             = value;
+    param->value_len         = length;
+    param->encoded_value     = encoded;
+    param->encoded_value_len = encoded_len;
 }
 
-static void free_param(Param *param) {
-    FREE_IF_NOT_NULL(param->name);
-    param->name = NULL;
-    FREE_IF_NOT_NULL(param->value);
-    param->value = NULL;
-    FREE_IF_NOT_NULL(param->encoded_name);
-    param->encoded_name = NULL;
-    FREE_IF_NOT_NULL(param->encoded_value);
-    param->encoded_value = NULL;
+static int set_param(Arena *arena, Param *param, const char *value, size_t length) {
+    param->value         = arena_strndup(arena, value, length);
+    param->value_len     = length;
+    param->encoded_value = arena_encode(arena, value, length, &param->encoded_value_len);
+    return param->value != NULL && param->encoded_value != NULL;
 }
@@ -0,0 +1,92 @@
+#include <logger.h>
+#include <nonce.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+
+/**
+ * The number of random bytes drawn from the generator at a time
+ */
+#define NONCE_RING_SIZE 4096
+
+/**
+ * Bytes from this value up are rejected, it being the largest multiple of 62
+ * which fits in a byte
+ */
+#define NONCE_BYTE_LIMIT 248
+
+typedef struct {
+    unsigned char bytes[NONCE_RING_SIZE];
+    size_t next;
+    unsigned long generation;
+} NonceRing;
+
+static const char ALPHANUMERIC[] = "0123456789"
+                                   "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                   "abcdefghijklmnopqrstuvwxyz";
+
+static pthread_once_t FORK_HANDLER_ONCE = PTHREAD_ONCE_INIT;
+
+/** Bumped in every child process, which makes each thread refill its ring */
+static volatile unsigned long fork_generation = 1;
+
+/** Starts out empty, with a generation which never matches */
+static __thread NonceRing ring = {{0}, NONCE_RING_SIZE, 0};
+
+/**
+ * @brief      Registers on_fork() to run in every child process
+ */
+static void register_fork_handler(void);
+
+/**
+ * @brief      Marks the rings inherited from the parent as used up
+ */
+static void on_fork(void);
+
+/**
+ * @brief      Refills the ring of the calling thread
+ *
+ * @return     1 on success, 0 if the random generator failed
+ */
+static int refill_ring(void);
+
+int make_nonce(char *out) {
+    size_t length = 0;
+    unsigned char byte;
+
+    ( void )pthread_once(&FORK_HANDLER_ONCE, register_fork_handler);
+
+    if (ring.generation != fork_generation) {
+        ring.next = NONCE_RING_SIZE;
+    }
+
+    while (length < NONCE_LENGTH) {
+        if (ring.next == NONCE_RING_SIZE && !refill_ring()) {
+            return 0;
+        }
+        byte = ring.bytes[ring.next++];
+        if (byte < NONCE_BYTE_LIMIT) {
+            out[length++] = ALPHANUMERIC[byte % 62];
+        }
+    }
+    out[length] = '\0';
+
+    return 1;
+}
+
+static void register_fork_handler(void) {
+    ( void )pthread_atfork(NULL, NULL, on_fork);
+}
+
+static void on_fork(void) {
+    fork_generation++;
+}
+
+static int refill_ring(void) {
+    if (!RAND_bytes(ring.bytes, NONCE_RING_SIZE)) {
+        e_log("The random generator is proving difficult\n");
+        return 0;
+    }
+    ring.next       = 0;
+    ring.generation = fork_generation;
+    return 1;
+}
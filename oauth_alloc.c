@@ -0,0 +1,208 @@
+#include <oauth_alloc.h>
+#include <openssl/crypto.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Sits in front of every block the library holds on to, so that freeing it
+ * knows how many bytes go out of use. The union keeps the block aligned.
+ */
+typedef union {
+    size_t size;
+    long double align;
+} BlockHeader;
+
+/**
+ * @brief      The allocator of the C library
+ */
+static void *libc_malloc(size_t size, void *context);
+static void *libc_realloc(void *ptr, size_t size, void *context);
+static void libc_free(void *ptr, void *context);
+
+/**
+ * @brief      The allocation functions given to OpenSSL
+ */
+static void *crypto_malloc(size_t size, const char *file, int line);
+static void *crypto_realloc(void *ptr, size_t size, const char *file, int line);
+static void crypto_free(void *ptr, const char *file, int line);
+
+/**
+ * @brief      Resizes a block from oauth_alloc()
+ *
+ * @param      ptr   The block or NULL
+ * @param[in]  size  The new size, 0 to free the block
+ *
+ * @return     The resized block or NULL
+ */
+static void *oauth_resize(void *ptr, size_t size);
+
+/**
+ * @brief      Counts an allocation
+ *
+ * @param      stats  The counters
+ * @param[in]  size   The number of bytes allocated
+ * @param[in]  held   Whether the library holds on to them
+ */
+static void count_allocation(OauthAllocStats *stats, size_t size, int held);
+
+/**
+ * @brief      Counts bytes of a block from oauth_alloc() going out of use
+ *
+ * @param[in]  size  The number of bytes
+ */
+static void count_release(size_t size);
+
+static const OauthAllocator LIBC_ALLOCATOR = {libc_malloc, libc_realloc, libc_free, NULL};
+
+static OauthAllocator allocator = {libc_malloc, libc_realloc, libc_free, NULL};
+static __thread OauthAllocStats thread_stats;
+
+int oauth_set_allocator(const OauthAllocator *custom) {
+    allocator = custom != NULL ? *custom : LIBC_ALLOCATOR;
+    return CRYPTO_set_mem_functions(crypto_malloc, crypto_realloc, crypto_free);
+}
+
+void oauth_free(void *ptr) {
+    if (ptr != NULL) {
+        allocator.free(ptr, allocator.context);
+    }
+}
+
+OauthAllocStats oauth_thread_alloc_stats(void) {
+    return thread_stats;
+}
+
+void *oauth_alloc(size_t size) {
+    BlockHeader *header;
+
+    if (size > SIZE_MAX - sizeof(BlockHeader)) {
+        return NULL;
+    }
+
+    header = allocator.malloc(sizeof(BlockHeader) + size, allocator.context);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    count_allocation(&thread_stats, size, 1);
+
+    return header + 1;
+}
+
+void *oauth_alloc_zeroed(size_t count, size_t size) {
+    void *ptr;
+
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    ptr = oauth_alloc(count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void oauth_release(void *ptr) {
+    BlockHeader *header;
+
+    if (ptr != NULL) {
+        header = ( BlockHeader * )ptr - 1;
+        count_release(header->size);
+        allocator.free(header, allocator.context);
+    }
+}
+
+void *oauth_alloc_result(size_t size, OauthAllocStats *account) {
+    void *ptr = allocator.malloc(size, allocator.context);
+
+    if (ptr != NULL) {
+        count_allocation(&thread_stats, size, 0);
+        if (account != NULL) {
+            count_allocation(account, size, 0);
+        }
+    }
+    return ptr;
+}
+
+void oauth_charge(OauthAllocStats *account, size_t size) {
+    count_allocation(account, size, 1);
+}
+
+static void *libc_malloc(size_t size, void *context) {
+    ( void )context;
+    return malloc(size);
+}
+
+static void *libc_realloc(void *ptr, size_t size, void *context) {
+    ( void )context;
+    return realloc(ptr, size);
+}
+
+static void libc_free(void *ptr, void *context) {
+    ( void )context;
+    free(ptr);
+}
+
+static void *crypto_malloc(size_t size, const char *file, int line) {
+    ( void )file;
+    ( void )line;
+    return oauth_alloc(size);
+}
+
+static void *crypto_realloc(void *ptr, size_t size, const char *file, int line) {
+    ( void )file;
+    ( void )line;
+    return oauth_resize(ptr, size);
+}
+
+static void crypto_free(void *ptr, const char *file, int line) {
+    ( void )file;
+    ( void )line;
+    oauth_release(ptr);
+}
+
+static void *oauth_resize(void *ptr, size_t size) {
+    BlockHeader *header;
+    size_t old_size;
+
+    if (ptr == NULL) {
+        return oauth_alloc(size);
+    }
+    if (size == 0) {
+        oauth_release(ptr);
+        return NULL;
+    }
+    if (size > SIZE_MAX - sizeof(BlockHeader)) {
+        return NULL;
+    }
+
+    header   = ( BlockHeader * )ptr - 1;
+    old_size = header->size;
+    header   = allocator.realloc(header, sizeof(BlockHeader) + size, allocator.context);
+    if (header == NULL) {
+        return NULL;
+    }
+    header->size = size;
+    count_release(old_size);
+    count_allocation(&thread_stats, size, 1);
+
+    return header + 1;
+}
+
+static void count_allocation(OauthAllocStats *stats, size_t size, int held) {
+    stats->allocations++;
+    stats->bytes_allocated += size;
+    if (held) {
+        stats->bytes_in_use += size;
+        if (stats->bytes_in_use > stats->peak_bytes) {
+            stats->peak_bytes = stats->bytes_in_use;
+        }
+    }
+}
+
+static void count_release(size_t size) {
+    thread_stats.bytes_in_use -= size < thread_stats.bytes_in_use ? size
+                                                                  : thread_stats.bytes_in_use;
+}
@@ -0,0 +1,334 @@
+#include <liboauthsign.h>
+#include <oauth_alloc.h>
+#include <oauth_pool.h>
+#include <pthread.h>
+#include <sha1_mb.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The number of requests a thread claims at a time. Small enough to balance
+ * the load, large enough to keep the shared counters cold, and as many as
+ * get_authorization_headers() signs side by side.
+ */
+#define POOL_CHUNK SHA1_MB_LANES
+
+/**
+ * The share of a batch first handed to one thread. Items are claimed by
+ * advancing next, by the owner and thieves alike, so no lock is needed.
+ * Each range sits on its own cache line.
+ */
+typedef struct {
+    size_t next;
+    size_t end;
+    char padding[64 - 2 * sizeof(size_t)];
+} WorkRange;
+
+typedef struct {
+    OauthPool *pool;
+    int index;
+} Worker;
+
+struct OauthPool {
+    int size;
+    /* The threads running, counting the caller, which destroy_pool() joins */
+    int started;
+    pthread_t *threads;
+    Worker *workers;
+    /* POOL_CHUNK builders for every thread */
+    Builder **builders;
+    WorkRange *ranges;
+
+    /* The batch being signed */
+    const OauthRequest *requests;
+    char **headers;
+    size_t failures;
+
+    /* Serializes callers of sign_batch() */
+    pthread_mutex_t batch_lock;
+
+    /* Wakes the threads for a batch and tells the caller when they are done */
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    int running;
+    int stopping;
+};
+
+/**
+ * @brief      The main loop of a pool thread
+ *
+ * @param      arg   The Worker of this thread
+ *
+ * @return     NULL
+ */
+static void *pool_thread(void *arg);
+
+/**
+ * @brief      Signs requests until every range of the batch is empty
+ *
+ * @param      pool   The pool
+ * @param[in]  index  The index of the calling thread, whose range is tried first
+ */
+static void work_batch(OauthPool *pool, int index);
+
+/**
+ * @brief      Claims the next chunk of a range
+ *
+ * @param      range  The range
+ * @param[out] begin  The first request claimed
+ * @param[out] end    One past the last request claimed
+ *
+ * @return     1 if requests were claimed, 0 if the range is empty
+ */
+static int claim(WorkRange *range, size_t *begin, size_t *end);
+
+/**
+ * @brief      Sets up a reusable builder for a request
+ *
+ * @param      builder  The builder
+ * @param[in]  request  The request
+ *
+ * @return     1 on success, 0 if the request cannot be signed
+ */
+static int load_request(Builder *builder, const OauthRequest *request);
+
+OauthPool *new_oauth_pool(int threads) {
+    OauthPool *pool;
+    int i;
+
+    if (threads <= 0) {
+        threads = ( int )sysconf(_SC_NPROCESSORS_ONLN);
+        threads = threads > 0 ? threads : 1;
+    }
+
+    pool = oauth_alloc_zeroed(1, sizeof(OauthPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->size     = threads;
+    pool->threads  = oauth_alloc_zeroed(( size_t )threads, sizeof(pthread_t));
+    pool->workers  = oauth_alloc_zeroed(( size_t )threads, sizeof(Worker));
+    pool->builders = oauth_alloc_zeroed(( size_t )threads * POOL_CHUNK, sizeof(Builder *));
+    pool->ranges   = oauth_alloc_zeroed(( size_t )threads, sizeof(WorkRange));
+    pthread_mutex_init(&pool->batch_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->started  = 1;
+    if (pool->threads == NULL || pool->workers == NULL || pool->builders == NULL ||
+        pool->ranges == NULL) {
+        destroy_pool(&pool);
+        return NULL;
+    }
+
+    for (i = 0; i < threads; ++i) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].index = i;
+    }
+    for (i = 0; i < threads * POOL_CHUNK; ++i) {
+        pool->builders[i] = new_oauth_builder();
+        if (pool->builders[i] == NULL) {
+            destroy_pool(&pool);
+            return NULL;
+        }
+    }
+
+    /* Index 0 is the caller of sign_batch(), which has no thread of its own */
+    for (i = 1; i < threads; ++i) {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, &pool->workers[i]) != 0) {
+            destroy_pool(&pool);
+            return NULL;
+        }
+        pool->started = i + 1;
+    }
+
+    return pool;
+}
+
+int get_pool_size(const OauthPool *pool) {
+    return pool->size;
+}
+
+size_t sign_batch(OauthPool *pool, const OauthRequest *requests, char **headers, size_t count) {
+    size_t share, failures;
+    int i, helpers;
+
+    pthread_mutex_lock(&pool->batch_lock);
+
+    pool->requests = requests;
+    pool->headers  = headers;
+    pool->failures = 0;
+
+    /* A batch too small to split is signed by the caller alone */
+    helpers = count >= 2 * POOL_CHUNK ? pool->size - 1 : 0;
+    share   = count / ( size_t )(helpers + 1);
+    for (i = 0; i <= helpers; ++i) {
+        pool->ranges[i].next = share * ( size_t )i;
+        pool->ranges[i].end  = i == helpers ? count : share * ( size_t )(i + 1);
+    }
+    for (; i < pool->size; ++i) {
+        pool->ranges[i].next = pool->ranges[i].end = 0;
+    }
+
+    if (helpers > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->generation++;
+        pool->running = helpers;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    work_batch(pool, 0);
+
+    if (helpers > 0) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->running > 0) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    failures = pool->failures;
+    pthread_mutex_unlock(&pool->batch_lock);
+
+    return failures;
+}
+
+void destroy_pool(OauthPool **pool) {
+    OauthPool *ref = *pool;
+    int i;
+
+    if (ref == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&ref->lock);
+    ref->stopping = 1;
+    pthread_cond_broadcast(&ref->start);
+    pthread_mutex_unlock(&ref->lock);
+
+    for (i = 1; i < ref->started; ++i) {
+        pthread_join(ref->threads[i], NULL);
+    }
+    if (ref->builders != NULL) {
+        for (i = 0; i < ref->size * POOL_CHUNK; ++i) {
+            destroy_builder(&ref->builders[i]);
+        }
+    }
+
+    pthread_cond_destroy(&ref->done);
+    pthread_cond_destroy(&ref->start);
+    pthread_mutex_destroy(&ref->lock);
+    pthread_mutex_destroy(&ref->batch_lock);
+    oauth_release(ref->ranges);
+    oauth_release(ref->builders);
+    oauth_release(ref->workers);
+    oauth_release(ref->threads);
+    oauth_release(ref);
+
+    *pool = NULL;
+}
+
+static void *pool_thread(void *arg) {
+    Worker *worker           = arg;
+    OauthPool *pool          = worker->pool;
+    unsigned long generation = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stopping && pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (pool->stopping) {
+            break;
+        }
+
+        work_batch(pool, worker->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+static void work_batch(OauthPool *pool, int index) {
+    Builder **builders = pool->builders + ( size_t )index * POOL_CHUNK;
+    char *headers[POOL_CHUNK];
+    size_t slots[POOL_CHUNK], begin, end, loaded, i, failures = 0;
+    int victim, tries;
+
+    /* Own range first, then steal from the others in turn */
+    for (tries = 0, victim = index; tries < pool->size; ++tries) {
+        if (!claim(&pool->ranges[victim], &begin, &end)) {
+            victim = (victim + 1) % pool->size;
+            continue;
+        }
+
+        /* The chunk is signed together, a builder is only used up by a
+           request which can be signed */
+        for (loaded = 0; begin < end; ++begin) {
+            if (load_request(builders[loaded], &pool->requests[begin])) {
+                slots[loaded++] = begin;
+            } else {
+                pool->headers[begin] = NULL;
+                failures++;
+            }
+        }
+
+        failures += get_authorization_headers(builders, headers, loaded);
+        for (i = 0; i < loaded; ++i) {
+            pool->headers[slots[i]] = headers[i];
+        }
+        tries = -1;
+    }
+
+    if (failures > 0) {
+        __atomic_fetch_add(&pool->failures, failures, __ATOMIC_RELAXED);
+    }
+}
+
+static int claim(WorkRange *range, size_t *begin, size_t *end) {
+    if (__atomic_load_n(&range->next, __ATOMIC_RELAXED) >= range->end) {
+        return 0;
+    }
+
+    *begin = __atomic_fetch_add(&range->next, POOL_CHUNK, __ATOMIC_RELAXED);
+    if (*begin >= range->end) {
+        return 0;
+    }
+
+    *end = *begin + POOL_CHUNK < range->end ? *begin + POOL_CHUNK : range->end;
+    return 1;
+}
+
+static int load_request(Builder *builder, const OauthRequest *request) {
+    if (builder == NULL || request->credentials == NULL || request->method == NULL ||
+        request->url == NULL) {
+        return 0;
+    }
+
+    reset_builder(builder);
+    set_credentials(builder, request->credentials);
+    set_http_method(builder, request->method);
+    set_base_url(builder, request->url);
+    set_request_params(builder, request->params, request->params_count);
+    if (request->nonce != NULL) {
+        set_nonce(builder, request->nonce);
+    }
+    if (request->timestamp != NULL) {
+        set_timestamp(builder, request->timestamp);
+    }
+
+    return 1;
+}
@@ -0,0 +1,210 @@
+#include <oauth_alloc.h>
+#include <oauth_stats.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * The stats of the threads which have recorded anything. A shard belongs to
+ * one thread at a time and is only written by that thread. When the thread
+ * exits the shard is kept, counts and all, for the next new thread to take
+ * over, so the list only grows to the most threads alive at once.
+ */
+typedef struct StatsShard {
+    OauthStats stats;
+    struct StatsShard *next;
+    int taken;
+} StatsShard;
+
+static const char *STAGE_NAMES[OAUTH_STAGE_COUNT] = {
+#define X(stage, name) name,
+    X_OAUTH_STAGES
+#undef X
+};
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static StatsShard *shards;
+
+#ifdef OAUTH_STATS
+
+static pthread_once_t SHARD_KEY_ONCE = PTHREAD_ONCE_INIT;
+static pthread_key_t shard_key;
+static __thread StatsShard *shard;
+
+/**
+ * @brief      Creates the key whose destructor gives up a thread's shard
+ */
+static void init_shard_key(void);
+
+/**
+ * @brief      Gives up the shard of an exiting thread
+ *
+ * @param      ptr   The shard
+ */
+static void release_shard(void *ptr);
+
+/**
+ * @brief      Takes over an idle shard or adds a new one
+ *
+ * @return     The shard or NULL if none could be allocated
+ */
+static StatsShard *take_shard(void);
+
+/**
+ * @brief      Adds to a counter only the calling thread writes
+ *
+ * @param      counter  The counter
+ * @param[in]  value    The amount to add
+ */
+static void add_counter(uint64_t *counter, uint64_t value);
+
+/**
+ * @brief      Gets the histogram bucket of a duration
+ *
+ * @param[in]  nanoseconds  The duration
+ *
+ * @return     The bucket
+ */
+static size_t bucket_of(uint64_t nanoseconds);
+
+#endif
+
+int oauth_stats_enabled(void) {
+#ifdef OAUTH_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void oauth_stats_snapshot(OauthStats *stats) {
+    const uint64_t *from;
+    uint64_t *to;
+    StatsShard *next;
+    size_t i;
+
+    memset(stats, 0, sizeof(OauthStats));
+
+    pthread_mutex_lock(&shards_lock);
+    for (next = shards; next != NULL; next = next->next) {
+        /* The stats are nothing but counters, so they add up word by word */
+        from = ( const uint64_t * )( const void * )&next->stats;
+        to   = ( uint64_t * )( void * )stats;
+        for (i = 0; i < sizeof(OauthStats) / sizeof(uint64_t); ++i) {
+            to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&shards_lock);
+}
+
+const char *oauth_stage_name(OauthStage stage) {
+    return stage < OAUTH_STAGE_COUNT ? STAGE_NAMES[stage] : "unknown";
+}
+
+size_t oauth_stats_prometheus(const OauthStats *stats, char *buffer, size_t size) {
+    const OauthStageStats *stage;
+    size_t length = 0, i, b;
+    uint64_t below;
+    int n;
+
+#define APPEND(...)                                                                         \
+    do {                                                                                    \
+        n = snprintf(length < size ? buffer + length : NULL, length < size ? size - length : 0, \
+                     __VA_ARGS__);                                                          \
+        length += n > 0 ? ( size_t )n : 0;                                                  \
+    } while (0)
+
+    if (size > 0) {
+        buffer[0] = '\0';
+    }
+
+    APPEND("# HELP oauth_stage_seconds Time spent in each stage of signing a request.\n");
+    APPEND("# TYPE oauth_stage_seconds histogram\n");
+    for (i = 0; i < OAUTH_STAGE_COUNT; ++i) {
+        stage = &stats->stages[i];
+        below = 0;
+        for (b = 0; b + 1 < OAUTH_STATS_BUCKETS; ++b) {
+            below += stage->buckets[b];
+            APPEND("oauth_stage_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n", STAGE_NAMES[i],
+                   ( double )(( uint64_t )1 << b) / 1e9, ( unsigned long long )below);
+        }
+        APPEND("oauth_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", STAGE_NAMES[i],
+               ( unsigned long long )stage->calls);
+        APPEND("oauth_stage_seconds_sum{stage=\"%s\"} %.9f\n", STAGE_NAMES[i],
+               ( double )stage->total_ns / 1e9);
+        APPEND("oauth_stage_seconds_count{stage=\"%s\"} %llu\n", STAGE_NAMES[i],
+               ( unsigned long long )stage->calls);
+    }
+
+#undef APPEND
+
+    return length;
+}
+
+#ifdef OAUTH_STATS
+
+uint64_t oauth_stats_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ( uint64_t )now.tv_sec * 1000000000u + ( uint64_t )now.tv_nsec;
+}
+
+void oauth_stats_record(OauthStage stage, uint64_t nanoseconds) {
+    OauthStageStats *stats;
+
+    if (shard == NULL && (shard = take_shard()) == NULL) {
+        return;
+    }
+
+    stats = &shard->stats.stages[stage];
+    add_counter(&stats->calls, 1);
+    add_counter(&stats->total_ns, nanoseconds);
+    add_counter(&stats->buckets[bucket_of(nanoseconds)], 1);
+}
+
+static void init_shard_key(void) {
+    ( void )pthread_key_create(&shard_key, release_shard);
+}
+
+static void release_shard(void *ptr) {
+    __atomic_store_n(&(( StatsShard * )ptr)->taken, 0, __ATOMIC_RELEASE);
+}
+
+static StatsShard *take_shard(void) {
+    StatsShard *next;
+
+    ( void )pthread_once(&SHARD_KEY_ONCE, init_shard_key);
+
+    pthread_mutex_lock(&shards_lock);
+    for (next = shards; next != NULL; next = next->next) {
+        if (!__atomic_load_n(&next->taken, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+    if (next == NULL && (next = oauth_alloc_zeroed(1, sizeof(StatsShard))) != NULL) {
+        next->next = shards;
+        shards     = next;
+    }
+    if (next != NULL) {
+        __atomic_store_n(&next->taken, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shards_lock);
+
+    if (next != NULL) {
+        ( void )pthread_setspecific(shard_key, next);
+    }
+    return next;
+}
+
+static void add_counter(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                     __ATOMIC_RELAXED);
+}
+
+static size_t bucket_of(uint64_t nanoseconds) {
+    size_t bits = nanoseconds == 0 ? 0 : 64 - ( size_t )__builtin_clzll(nanoseconds);
+    return bits < OAUTH_STATS_BUCKETS ? bits : OAUTH_STATS_BUCKETS - 1;
+}
+
+#endif // OAUTH_STATS
@@ -0,0 +1,255 @@
+#include <percent_encode.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OAUTH_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief      Signature shared by the unreserved-run scanners
+ *
+ * @param[in]  in      The bytes to scan
+ * @param[in]  length  The number of bytes to scan
+ *
+ * @return     The number of leading bytes which need no escaping
+ */
+typedef size_t (*Scanner)(const unsigned char *in, size_t length);
+
+/**
+ * Lookup table of the RFC 3986 unreserved characters:
+ * ALPHA / DIGIT / "-" / "." / "_" / "~"
+ */
+static const unsigned char UNRESERVED[256] = {
+    ['-'] = 1, ['.'] = 1, ['_'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1,
+    ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1,
+    ['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1,
+    ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1, ['U'] = 1,
+    ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1,
+    ['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1,
+    ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1, ['u'] = 1,
+    ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1};
+
+static const char HEX[] = "0123456789ABCDEF";
+
+static pthread_once_t SCANNER_ONCE = PTHREAD_ONCE_INIT;
+static Scanner scan_unreserved;
+
+/**
+ * @brief      Picks the widest scanner supported by the running CPU
+ */
+static void init_scanner(void);
+
+/**
+ * @brief      Gets the scanner picked by init_scanner()
+ *
+ * @return     The scanner
+ */
+static Scanner get_scanner(void);
+
+/**
+ * @brief      Table driven scanner used when no SIMD variant is available
+ */
+static size_t scan_scalar(const unsigned char *in, size_t length);
+
+/**
+ * @brief      Gets the value of a hex digit
+ *
+ * @param[in]  c     The digit
+ *
+ * @return     The value of the digit or -1 if c is not a hex digit
+ */
+static int hex_value(char c);
+
+#ifdef OAUTH_X86_SIMD
+/**
+ * @brief      Scans 16 bytes at a time using SSE2
+ */
+static size_t scan_sse2(const unsigned char *in, size_t length);
+
+/**
+ * @brief      Scans 32 bytes at a time using AVX2
+ */
+static size_t scan_avx2(const unsigned char *in, size_t length);
+#endif
+
+size_t percent_encoded_length(const char *in, size_t length) {
+    const unsigned char *src = ( const unsigned char * )in;
+    Scanner scan             = get_scanner();
+    size_t total = length, i = 0;
+
+    while ((i += scan(src + i, length - i)) < length) {
+        total += 2;
+        ++i;
+    }
+
+    return total;
+}
+
+size_t percent_encode(char *out, const char *in, size_t length) {
+    const unsigned char *src = ( const unsigned char * )in;
+    Scanner scan             = get_scanner();
+    size_t i = 0, run;
+    char *dst = out;
+
+    while (i < length) {
+        run = scan(src + i, length - i);
+        memcpy(dst, src + i, run);
+        dst += run;
+        i += run;
+
+        if (i < length) {
+            *dst++ = '%';
+            *dst++ = HEX[src[i] >> 4];
+            *dst++ = HEX[src[i] & 0xF];
+            ++i;
+        }
+    }
+
+    return ( size_t )(dst - out);
+}
+
+size_t percent_decode(char *out, const char *in, size_t length) {
+    size_t i = 0, n = 0;
+    int hi, lo;
+
+    while (i < length) {
+        if (in[i] == '%' && i + 2 < length &&
+            (hi = hex_value(in[i + 1])) >= 0 && (lo = hex_value(in[i + 2])) >= 0) {
+            out[n++] = ( char )(hi << 4 | lo);
+            i += 3;
+        } else {
+            out[n++] = in[i++];
+        }
+    }
+
+    return n;
+}
+
+int percent_is_canonical(const char *in, size_t length) {
+    const unsigned char *src = ( const unsigned char * )in;
+    Scanner scan             = get_scanner();
+    size_t i                 = 0;
+    int hi, lo;
+
+    while ((i += scan(src + i, length - i)) < length) {
+        /* lowercase hex would be encoded again in uppercase */
+        if (src[i] != '%' || i + 2 >= length || (hi = hex_value(in[i + 1])) < 0 ||
+            (lo = hex_value(in[i + 2])) < 0 || (in[i + 1] >= 'a' || in[i + 2] >= 'a') ||
+            UNRESERVED[hi << 4 | lo]) {
+            return 0;
+        }
+        i += 3;
+    }
+
+    return 1;
+}
+
+static void init_scanner(void) {
+    scan_unreserved = scan_scalar;
+#ifdef OAUTH_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan_unreserved = scan_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan_unreserved = scan_sse2;
+    }
+#endif
+}
+
+static Scanner get_scanner(void) {
+    ( void )pthread_once(&SCANNER_ONCE, init_scanner);
+    return scan_unreserved;
+}
+
+static size_t scan_scalar(const unsigned char *in, size_t length) {
+    size_t i = 0;
+    while (i < length && UNRESERVED[in[i]]) {
+        ++i;
+    }
+    return i;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+#ifdef OAUTH_X86_SIMD
+
+/**
+ * The unreserved set is the union of the byte ranges [-.], [0-9], [A-Z] and
+ * [a-z] plus the single bytes '_' and '~'. A byte x lies in [lo, hi] exactly
+ * when the unsigned value (x - lo) is at most (hi - lo), which SIMD can test
+ * with a subtract, an unsigned max and an equality compare.
+ */
+#define IN_RANGE_128(x, lo, hi)                                                   \
+    _mm_cmpeq_epi8(_mm_max_epu8(_mm_sub_epi8((x), _mm_set1_epi8(( char )(lo))), \
+                                _mm_set1_epi8(( char )((hi) - (lo)))),          \
+                   _mm_set1_epi8(( char )((hi) - (lo))))
+
+#define IN_RANGE_256(x, lo, hi)                                                            \
+    _mm256_cmpeq_epi8(_mm256_max_epu8(_mm256_sub_epi8((x), _mm256_set1_epi8(( char )(lo))), \
+                                      _mm256_set1_epi8(( char )((hi) - (lo)))),             \
+                      _mm256_set1_epi8(( char )((hi) - (lo))))
+
+__attribute__((target("sse2"))) static size_t scan_sse2(const unsigned char *in, size_t length) {
+    size_t i = 0;
+    unsigned int mask;
+    __m128i x, ok;
+
+    for (; i + 16 <= length; i += 16) {
+        x  = _mm_loadu_si128(( const __m128i * )(in + i));
+        ok = _mm_or_si128(_mm_or_si128(IN_RANGE_128(x, '-', '.'), IN_RANGE_128(x, '0', '9')),
+                          _mm_or_si128(IN_RANGE_128(x, 'A', 'Z'), IN_RANGE_128(x, 'a', 'z')));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')),
+                                           _mm_cmpeq_epi8(x, _mm_set1_epi8('~'))));
+
+        mask = ( unsigned int )_mm_movemask_epi8(ok);
+        if (mask != 0xFFFFu) {
+            return i + ( size_t )__builtin_ctz(~mask);
+        }
+    }
+
+    return i + scan_scalar(in + i, length - i);
+}
+
+__attribute__((target("avx2"))) static size_t scan_avx2(const unsigned char *in, size_t length) {
+    size_t i = 0;
+    unsigned int mask;
+    __m256i x, ok;
+
+    for (; i + 32 <= length; i += 32) {
+        x  = _mm256_loadu_si256(( const __m256i * )(in + i));
+        ok = _mm256_or_si256(_mm256_or_si256(IN_RANGE_256(x, '-', '.'), IN_RANGE_256(x, '0', '9')),
+                             _mm256_or_si256(IN_RANGE_256(x, 'A', 'Z'), IN_RANGE_256(x, 'a', 'z')));
+        ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')),
+                                                 _mm256_cmpeq_epi8(x, _mm256_set1_epi8('~'))));
+
+        mask = ( unsigned int )_mm256_movemask_epi8(ok);
+        if (mask != 0xFFFFFFFFu) {
+            _mm256_zeroupper();
+            return i + ( size_t )__builtin_ctz(~mask);
+        }
+    }
+
+    /* GCC does not clear the upper halves of the registers on its own in a
+       function compiled for another target, and left dirty they slow down
+       every SSE instruction which follows */
+    _mm256_zeroupper();
+    return i + scan_sse2(in + i, length - i);
+}
+
+#undef IN_RANGE_128
+#undef IN_RANGE_256
+
+#endif // OAUTH_X86_SIMD
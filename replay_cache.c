@@ -0,0 +1,399 @@
+#include <fcntl.h>
+#include <logger.h>
+#include <oauth_alloc.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <replay_cache.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** The slots of a group, which fill one cache line */
+#define GROUP_SLOTS 8
+
+/** How many groups from its hash a nonce may be kept in */
+#define PROBE_GROUPS 4
+
+/** The number of locks nonces are serialized on, a power of two */
+#define STRIPES 256
+
+/** The latest second a slot can hold */
+#define MAX_SECOND 0xffffffffL
+
+/** Rotates a 64 bit word left */
+#define ROTATE(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+/** Marks a file holding a replay cache, and its layout */
+#define REPLAY_MAGIC "OAUTHRC2"
+
+/**
+ * The start of a replay cache, in memory or in its file. The slots follow
+ * it, a cache line in.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t groups;
+    uint64_t window;
+    uint64_t key[2];
+    char padding[64 - 8 - 4 * sizeof(uint64_t)];
+} ReplayHeader;
+
+/** A lock on a cache line of its own */
+typedef struct {
+    pthread_mutex_t lock;
+    char padding[64 - sizeof(pthread_mutex_t)];
+} Stripe;
+
+struct OauthReplayCache {
+    ReplayHeader *header;
+    size_t map_size;
+    /**
+     * Every slot is either 0, never used, or the top 32 bits of a nonce's
+     * hash, never 0, above the second of its timestamp
+     */
+    uint64_t *slots;
+    uint64_t mask;
+    long window;
+    Stripe stripes[STRIPES];
+};
+
+/** The state of a SipHash-2-4 being fed piece by piece */
+typedef struct {
+    uint64_t v[4];
+    uint64_t tail;
+    size_t length;
+} SipHash;
+
+/**
+ * @brief      Maps the memory of a cache, from a file or not
+ *
+ * @param      cache   The cache, whose map_size is set
+ * @param[in]  groups  The number of groups
+ * @param[in]  window  The window
+ * @param[in]  path    The file, or NULL
+ *
+ * @return     1 on success, 0 otherwise
+ */
+static int map_cache(OauthReplayCache *cache, uint64_t groups, uint64_t window,
+                     const char *path);
+
+/**
+ * @brief      Tells whether a slot holds a nonce of the window
+ *
+ * @param[in]  slot    The slot
+ * @param[in]  oldest  The oldest second of the window
+ * @param[in]  newest  The newest second of the window
+ *
+ * @return     1 if it does, 0 if the slot is unused or its nonce has expired
+ */
+static int is_live(uint64_t slot, long oldest, long newest);
+
+/**
+ * @brief      Hashes the consumer key, token and nonce with the cache's key
+ *
+ * @details    Each string is followed by its length, so that no two
+ * different triples feed the hash the same bytes.
+ *
+ * @param[in]  cache             The cache
+ * @param[in]  consumer_key      The consumer key
+ * @param[in]  consumer_key_len  The length of the consumer key
+ * @param[in]  token             The token
+ * @param[in]  token_len         The length of the token
+ * @param[in]  nonce             The nonce
+ * @param[in]  nonce_len         The length of the nonce
+ *
+ * @return     The hash
+ */
+static uint64_t hash_nonce(const OauthReplayCache *cache, const char *consumer_key,
+                           size_t consumer_key_len, const char *token, size_t token_len,
+                           const char *nonce, size_t nonce_len);
+
+/**
+ * @brief      Starts a SipHash-2-4
+ *
+ * @param      sip   The state
+ * @param[in]  key   The 128 bit key
+ */
+static void sip_init(SipHash *sip, const uint64_t *key);
+
+/**
+ * @brief      Feeds bytes to a SipHash
+ *
+ * @param      sip     The state
+ * @param[in]  data    The bytes
+ * @param[in]  length  The number of bytes
+ */
+static void sip_update(SipHash *sip, const void *data, size_t length);
+
+/**
+ * @brief      Finishes a SipHash
+ *
+ * @param      sip   The state
+ *
+ * @return     The hash
+ */
+static uint64_t sip_finish(SipHash *sip);
+
+/**
+ * @brief      Runs the SipRounds of the hash
+ *
+ * @param      v       The state words
+ * @param[in]  rounds  The number of rounds
+ */
+static void sip_rounds(uint64_t *v, int rounds);
+
+OauthReplayCache *new_replay_cache(size_t capacity, unsigned int window, const char *path) {
+    OauthReplayCache *cache;
+    uint64_t groups = 1;
+    int i;
+
+    /* Half the slots are kept free, so that nonces seldom probe far */
+    while (groups * GROUP_SLOTS < 2 * ( uint64_t )capacity) {
+        groups *= 2;
+    }
+
+    cache = oauth_alloc_zeroed(1, sizeof(OauthReplayCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (!map_cache(cache, groups, window, path)) {
+        oauth_release(cache);
+        return NULL;
+    }
+
+    cache->slots  = ( uint64_t * )(cache->header + 1);
+    cache->mask   = groups - 1;
+    cache->window = ( long )window;
+    for (i = 0; i < STRIPES; ++i) {
+        pthread_mutex_init(&cache->stripes[i].lock, NULL);
+    }
+
+    return cache;
+}
+
+OauthReplayResult check_nonce(OauthReplayCache *cache, const char *consumer_key,
+                              size_t consumer_key_len, const char *token, size_t token_len,
+                              const char *nonce, size_t nonce_len, long timestamp, long now) {
+    long oldest = now - cache->window, newest = now + cache->window;
+    uint64_t hash, entry, slot, *at, *free_slot = NULL, free_value = 0;
+    pthread_mutex_t *lock;
+    OauthReplayResult result;
+    int g, i;
+
+    if (timestamp < oldest || timestamp > newest || timestamp < 0 || timestamp > MAX_SECOND) {
+        return OAUTH_REPLAY_EXPIRED;
+    }
+
+    hash = hash_nonce(cache, consumer_key, consumer_key_len, token, token_len, nonce, nonce_len);
+    if (hash >> 32 == 0) {
+        hash |= ( uint64_t )1 << 32;
+    }
+    entry = (hash & ~( uint64_t )0xffffffff) | ( uint64_t )timestamp;
+    lock  = &cache->stripes[hash & (STRIPES - 1)].lock;
+
+    pthread_mutex_lock(lock);
+    for (;;) {
+        result = OAUTH_REPLAY_FULL;
+
+        /* The nonce would be in the first unused slot along its probe, if not before */
+        for (g = 0; g < PROBE_GROUPS && result == OAUTH_REPLAY_FULL; ++g) {
+            at = cache->slots + ((hash + ( uint64_t )g) & cache->mask) * GROUP_SLOTS;
+            for (i = 0; i < GROUP_SLOTS; ++i) {
+                slot = __atomic_load_n(&at[i], __ATOMIC_ACQUIRE);
+                if (is_live(slot, oldest, newest)) {
+                    if ((slot ^ entry) >> 32 == 0) {
+                        result = OAUTH_REPLAY_REPLAYED;
+                        break;
+                    }
+                    continue;
+                }
+                if (free_slot == NULL) {
+                    free_slot  = &at[i];
+                    free_value = slot;
+                }
+                if (slot == 0) {
+                    result = OAUTH_REPLAY_NEW;
+                    break;
+                }
+            }
+        }
+        if (result == OAUTH_REPLAY_REPLAYED || free_slot == NULL) {
+            break;
+        }
+
+        /* Nonces on other stripes can take the slot first; then look again */
+        if (__atomic_compare_exchange_n(free_slot, &free_value, entry, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            result = OAUTH_REPLAY_NEW;
+            break;
+        }
+        free_slot = NULL;
+    }
+    pthread_mutex_unlock(lock);
+
+    return result;
+}
+
+const char *oauth_replay_result_name(OauthReplayResult result) {
+    static const char *NAMES[] = {
+#define X(result, description) description,
+        X_OAUTH_REPLAY_RESULTS
+#undef X
+    };
+
+    return ( size_t )result < sizeof NAMES / sizeof NAMES[0] ? NAMES[result] : "unknown";
+}
+
+void destroy_replay_cache(OauthReplayCache **cache) {
+    OauthReplayCache *ref = *cache;
+    int i;
+
+    if (ref == NULL) {
+        return;
+    }
+
+    for (i = 0; i < STRIPES; ++i) {
+        pthread_mutex_destroy(&ref->stripes[i].lock);
+    }
+    munmap(ref->header, ref->map_size);
+    oauth_release(ref);
+    *cache = NULL;
+}
+
+static int map_cache(OauthReplayCache *cache, uint64_t groups, uint64_t window,
+                     const char *path) {
+    ReplayHeader *header;
+    struct stat st;
+    int fd, fresh = 1;
+
+    cache->map_size = sizeof(ReplayHeader) + groups * GROUP_SLOTS * sizeof(uint64_t);
+
+    if (path == NULL) {
+        header = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    } else {
+        fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            e_log("Could not open %s\n", path);
+            return 0;
+        }
+        /* A file of another size cannot be the same cache; it is started afresh */
+        if (fstat(fd, &st) != 0 || ( uint64_t )st.st_size != cache->map_size) {
+            if (ftruncate(fd, 0) != 0 || ftruncate(fd, ( off_t )cache->map_size) != 0) {
+                e_log("Could not size %s\n", path);
+                close(fd);
+                return 0;
+            }
+        }
+        header = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (header == MAP_FAILED) {
+        e_log("Could not map a replay cache of %zu bytes\n", cache->map_size);
+        return 0;
+    }
+
+    if (path != NULL && memcmp(header->magic, REPLAY_MAGIC, sizeof header->magic) == 0 &&
+        header->groups == groups && header->window == window) {
+        fresh = 0;
+    }
+
+    if (fresh) {
+        /* The key is secret so that nobody can pick nonces that crowd one group */
+        if (!RAND_bytes(( unsigned char * )header->key, sizeof header->key)) {
+            e_log("Could not make a key for the replay cache\n");
+            munmap(header, cache->map_size);
+            return 0;
+        }
+        memset(header + 1, 0, cache->map_size - sizeof(ReplayHeader));
+        header->groups = groups;
+        header->window = window;
+        memcpy(header->magic, REPLAY_MAGIC, sizeof header->magic);
+    }
+
+    cache->header = header;
+    return 1;
+}
+
+static int is_live(uint64_t slot, long oldest, long newest) {
+    long second = ( long )(slot & 0xffffffff);
+
+    return slot != 0 && second >= oldest && second <= newest;
+}
+
+static uint64_t hash_nonce(const OauthReplayCache *cache, const char *consumer_key,
+                           size_t consumer_key_len, const char *token, size_t token_len,
+                           const char *nonce, size_t nonce_len) {
+    uint64_t lengths[3];
+    SipHash sip;
+
+    lengths[0] = consumer_key_len;
+    lengths[1] = token_len;
+    lengths[2] = nonce_len;
+
+    sip_init(&sip, cache->header->key);
+    sip_update(&sip, consumer_key, consumer_key_len);
+    sip_update(&sip, &lengths[0], sizeof lengths[0]);
+    sip_update(&sip, token, token_len);
+    sip_update(&sip, &lengths[1], sizeof lengths[1]);
+    sip_update(&sip, nonce, nonce_len);
+    sip_update(&sip, &lengths[2], sizeof lengths[2]);
+    return sip_finish(&sip);
+}
+
+static void sip_init(SipHash *sip, const uint64_t *key) {
+    sip->v[0]   = key[0] ^ 0x736f6d6570736575ULL;
+    sip->v[1]   = key[1] ^ 0x646f72616e646f6dULL;
+    sip->v[2]   = key[0] ^ 0x6c7967656e657261ULL;
+    sip->v[3]   = key[1] ^ 0x7465646279746573ULL;
+    sip->tail   = 0;
+    sip->length = 0;
+}
+
+static void sip_update(SipHash *sip, const void *data, size_t length) {
+    const unsigned char *in = data;
+    size_t i;
+
+    /* Bytes go into the tail, little endian, and each full word is compressed */
+    for (i = 0; i < length; ++i) {
+        sip->tail |= ( uint64_t )in[i] << (8 * (sip->length & 7));
+        if ((++sip->length & 7) == 0) {
+            sip->v[3] ^= sip->tail;
+            sip_rounds(sip->v, 2);
+            sip->v[0] ^= sip->tail;
+            sip->tail = 0;
+        }
+    }
+}
+
+static uint64_t sip_finish(SipHash *sip) {
+    uint64_t last = sip->tail | (( uint64_t )sip->length << 56);
+
+    sip->v[3] ^= last;
+    sip_rounds(sip->v, 2);
+    sip->v[0] ^= last;
+    sip->v[2] ^= 0xff;
+    sip_rounds(sip->v, 4);
+    return sip->v[0] ^ sip->v[1] ^ sip->v[2] ^ sip->v[3];
+}
+
+static void sip_rounds(uint64_t *v, int rounds) {
+    while (rounds-- > 0) {
+        v[0] += v[1];
+        v[1] = ROTATE(v[1], 13);
+        v[1] ^= v[0];
+        v[0] = ROTATE(v[0], 32);
+        v[2] += v[3];
+        v[3] = ROTATE(v[3], 16);
+        v[3] ^= v[2];
+        v[0] += v[3];
+        v[3] = ROTATE(v[3], 21);
+        v[3] ^= v[0];
+        v[2] += v[1];
+        v[1] = ROTATE(v[1], 17);
+        v[1] ^= v[2];
+        v[2] = ROTATE(v[2], 32);
+    }
+}
@@ -0,0 +1,486 @@
+/* SHA_CTX is rebuilt from a job's chaining value, which only the low level
+   interface allows */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <sha1_mb.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OAUTH_X86_SIMD 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/**
+ * One uint32_t per message, in the width of an SSE2, AVX2 or AVX-512
+ * register. Each engine works on as many messages at a time as fit in its
+ * registers, as wider vectors would be split up and spill the schedule.
+ */
+typedef uint32_t Lanes4 __attribute__((vector_size(16)));
+typedef uint32_t Lanes8 __attribute__((vector_size(32)));
+typedef uint32_t Lanes16 __attribute__((vector_size(64)));
+
+/**
+ * Whether words read straight from memory need their bytes swapped to be
+ * big endian
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LITTLE_ENDIAN_WORDS 0
+#else
+#define LITTLE_ENDIAN_WORDS 1
+#endif
+
+/**
+ * Room for the padded end of a message, which never takes more than two
+ * blocks
+ */
+#define SHA1_TAIL_SIZE 128
+
+/**
+ * The messages of one pass of a vector engine
+ */
+typedef struct {
+    /* The chaining values, word by word across the lanes */
+    uint32_t state[5][SHA1_MB_LANES];
+    /* The blocks of each message which are read from the message itself */
+    const unsigned char *data[SHA1_MB_LANES];
+    size_t full_blocks[SHA1_MB_LANES];
+    /* The number of blocks of each message, and the most of any */
+    size_t blocks[SHA1_MB_LANES];
+    size_t most_blocks;
+    /* The padded end of each message */
+    unsigned char tail[SHA1_MB_LANES][SHA1_TAIL_SIZE];
+} Sha1Group;
+
+/**
+ * @brief      Signature shared by the engines
+ *
+ * @param      jobs   The messages
+ * @param[in]  count  The number of messages, at most SHA1_MB_LANES for the
+ * vector engines
+ */
+typedef void (*Sha1Hasher)(const Sha1Job *jobs, size_t count);
+
+static pthread_once_t ENGINE_ONCE = PTHREAD_ONCE_INIT;
+static Sha1Engine engine;
+static Sha1Hasher hasher;
+
+/** The block hashed by lanes which have run out of their own */
+static const unsigned char ZERO_BLOCK[64];
+
+/**
+ * @brief      Picks the engine for the running CPU
+ */
+static void init_engine(void);
+
+/**
+ * @brief      Tells whether the CPU can run an engine
+ *
+ * @param[in]  candidate  The engine
+ *
+ * @return     1 if it can, 0 otherwise
+ */
+static int engine_supported(Sha1Engine candidate);
+
+/**
+ * @brief      Hashes each message through OpenSSL
+ */
+static void hash_openssl(const Sha1Job *jobs, size_t count);
+
+/**
+ * @brief      Hashes up to SHA1_MB_LANES messages with the plain vector code
+ */
+static void hash_vector(const Sha1Job *jobs, size_t count);
+
+#ifdef OAUTH_X86_SIMD
+/**
+ * @brief      Hashes up to SHA1_MB_LANES messages with the vector code built
+ * for AVX2
+ */
+static void hash_avx2(const Sha1Job *jobs, size_t count);
+
+/**
+ * @brief      Hashes up to SHA1_MB_LANES messages with the vector code built
+ * for AVX-512
+ */
+static void hash_avx512(const Sha1Job *jobs, size_t count);
+#endif
+
+/**
+ * @brief      Sets up a group of messages for the vector code
+ *
+ * @param      group  The group
+ * @param[in]  jobs   The messages
+ * @param[in]  count  The number of messages, at most SHA1_MB_LANES
+ */
+static void load_group(Sha1Group *group, const Sha1Job *jobs, size_t count);
+
+/**
+ * @brief      Writes the digests of a group
+ *
+ * @param[in]  group  The group
+ * @param[in]  jobs   The messages
+ * @param[in]  count  The number of messages
+ */
+static void store_group(const Sha1Group *group, const Sha1Job *jobs, size_t count);
+
+/**
+ * @brief      Gathers the words of one block of every message of a group
+ *
+ * @param[in]  group   The group
+ * @param[in]  index   The index of the block
+ * @param      words   Receives the words, word by word across the lanes, in
+ * memory order
+ * @param      active  Receives all ones for the lanes which have the block
+ * and zero for the others
+ */
+static void gather_block(const Sha1Group *group, size_t index, uint32_t words[16][SHA1_MB_LANES],
+                         uint32_t *active);
+
+void sha1_multi(const Sha1Job *jobs, size_t count) {
+    size_t step = SHA1_MB_LANES;
+
+    ( void )pthread_once(&ENGINE_ONCE, init_engine);
+    if (engine == SHA1_ENGINE_OPENSSL) {
+        step = count;
+    }
+
+    for (; count > step; jobs += step, count -= step) {
+        hasher(jobs, step);
+    }
+    if (count > 0) {
+        hasher(jobs, count);
+    }
+}
+
+Sha1Engine sha1_engine(void) {
+    ( void )pthread_once(&ENGINE_ONCE, init_engine);
+    return engine;
+}
+
+int sha1_set_engine(Sha1Engine candidate) {
+    ( void )pthread_once(&ENGINE_ONCE, init_engine);
+    if (!engine_supported(candidate)) {
+        return 0;
+    }
+
+    engine = candidate;
+    switch (candidate) {
+#ifdef OAUTH_X86_SIMD
+        case SHA1_ENGINE_AVX512:
+            hasher = hash_avx512;
+            break;
+        case SHA1_ENGINE_AVX2:
+            hasher = hash_avx2;
+            break;
+#endif
+        case SHA1_ENGINE_VECTOR:
+            hasher = hash_vector;
+            break;
+        default:
+            hasher = hash_openssl;
+            break;
+    }
+    return 1;
+}
+
+static void init_engine(void) {
+    engine = SHA1_ENGINE_OPENSSL;
+    hasher = hash_openssl;
+#ifdef OAUTH_X86_SIMD
+    {
+        unsigned int a, b, c, d;
+
+        /* OpenSSL beats every vector engine on the SHA extensions */
+        if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA)) {
+            return;
+        }
+    }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        engine = SHA1_ENGINE_AVX512;
+        hasher = hash_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        engine = SHA1_ENGINE_AVX2;
+        hasher = hash_avx2;
+    } else {
+        engine = SHA1_ENGINE_VECTOR;
+        hasher = hash_vector;
+    }
+#endif
+}
+
+static int engine_supported(Sha1Engine candidate) {
+    switch (candidate) {
+        case SHA1_ENGINE_OPENSSL:
+        case SHA1_ENGINE_VECTOR:
+            return 1;
+#ifdef OAUTH_X86_SIMD
+        case SHA1_ENGINE_AVX2:
+            return __builtin_cpu_supports("avx2") != 0;
+        case SHA1_ENGINE_AVX512:
+            return __builtin_cpu_supports("avx512f") != 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+#define ROTL(x, n) ((x) << (n) | (x) >> (32 - (n)))
+
+/* The message schedule, kept in a ring of the last 16 words */
+#define SCHEDULE(w, t)                                                                         \
+    ((w)[(t)&15] = ROTL((w)[((t) + 13) & 15] ^ (w)[((t) + 8) & 15] ^ (w)[((t) + 2) & 15] ^ \
+                            (w)[(t)&15],                                                       \
+                        1))
+
+#define ROUND(a, b, c, d, e, f, k, wt)           \
+    do {                                         \
+        (e) += ROTL(a, 5) + (f) + (k) + (wt);    \
+        (b) = ROTL(b, 30);                       \
+    } while (0)
+
+#define F_CHOOSE(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F_PARITY(b, c, d) ((b) ^ (c) ^ (d))
+#define F_MAJORITY(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+
+/* Five rounds at a time, so the working variables rotate by renaming */
+#define ROUNDS_5(f, k, t, w_of)                                         \
+    do {                                                                \
+        ROUND(a, b, c, d, e, f(b, c, d), k, w_of(w, (t)));              \
+        ROUND(e, a, b, c, d, f(a, b, c), k, w_of(w, (t) + 1));          \
+        ROUND(d, e, a, b, c, f(e, a, b), k, w_of(w, (t) + 2));          \
+        ROUND(c, d, e, a, b, f(d, e, a), k, w_of(w, (t) + 3));          \
+        ROUND(b, c, d, e, a, f(c, d, e), k, w_of(w, (t) + 4));          \
+    } while (0)
+
+#define W_LOADED(w, t) ((w)[t])
+
+/**
+ * Defines a function which runs the compression function on the lanes of a
+ * group from first on, as many as fit in the given vector type. The function
+ * is always inlined into an engine, so the one body is compiled for each
+ * instruction set.
+ */
+#define DEFINE_COMPRESS(name, type)                                                         \
+    static inline __attribute__((always_inline)) void name(                                \
+        uint32_t(*state)[SHA1_MB_LANES], uint32_t(*words)[SHA1_MB_LANES],                  \
+        const uint32_t *active, size_t first) {                                            \
+        type h[5], w[16], a, b, c, d, e, mask;                                             \
+        int i, t;                                                                          \
+                                                                                           \
+        for (i = 0; i < 5; ++i) {                                                          \
+            memcpy(&h[i], &state[i][first], sizeof(type));                                 \
+        }                                                                                  \
+        for (t = 0; t < 16; ++t) {                                                         \
+            memcpy(&w[t], &words[t][first], sizeof(type));                                 \
+            if (LITTLE_ENDIAN_WORDS) {                                                     \
+                w[t] = w[t] << 24 | (w[t] & 0xFF00u) << 8 | (w[t] >> 8 & 0xFF00u) |        \
+                       w[t] >> 24;                                                         \
+            }                                                                              \
+        }                                                                                  \
+        memcpy(&mask, active + first, sizeof(type));                                       \
+                                                                                           \
+        a = h[0];                                                                          \
+        b = h[1];                                                                          \
+        c = h[2];                                                                          \
+        d = h[3];                                                                          \
+        e = h[4];                                                                          \
+                                                                                           \
+        ROUNDS_5(F_CHOOSE, 0x5A827999u, 0, W_LOADED);                                      \
+        ROUNDS_5(F_CHOOSE, 0x5A827999u, 5, W_LOADED);                                      \
+        ROUNDS_5(F_CHOOSE, 0x5A827999u, 10, W_LOADED);                                     \
+        ROUND(a, b, c, d, e, F_CHOOSE(b, c, d), 0x5A827999u, w[15]);                       \
+        ROUND(e, a, b, c, d, F_CHOOSE(a, b, c), 0x5A827999u, SCHEDULE(w, 16));             \
+        ROUND(d, e, a, b, c, F_CHOOSE(e, a, b), 0x5A827999u, SCHEDULE(w, 17));             \
+        ROUND(c, d, e, a, b, F_CHOOSE(d, e, a), 0x5A827999u, SCHEDULE(w, 18));             \
+        ROUND(b, c, d, e, a, F_CHOOSE(c, d, e), 0x5A827999u, SCHEDULE(w, 19));             \
+                                                                                           \
+        ROUNDS_5(F_PARITY, 0x6ED9EBA1u, 20, SCHEDULE);                                     \
+        ROUNDS_5(F_PARITY, 0x6ED9EBA1u, 25, SCHEDULE);                                     \
+        ROUNDS_5(F_PARITY, 0x6ED9EBA1u, 30, SCHEDULE);                                     \
+        ROUNDS_5(F_PARITY, 0x6ED9EBA1u, 35, SCHEDULE);                                     \
+                                                                                           \
+        ROUNDS_5(F_MAJORITY, 0x8F1BBCDCu, 40, SCHEDULE);                                   \
+        ROUNDS_5(F_MAJORITY, 0x8F1BBCDCu, 45, SCHEDULE);                                   \
+        ROUNDS_5(F_MAJORITY, 0x8F1BBCDCu, 50, SCHEDULE);                                   \
+        ROUNDS_5(F_MAJORITY, 0x8F1BBCDCu, 55, SCHEDULE);                                   \
+                                                                                           \
+        ROUNDS_5(F_PARITY, 0xCA62C1D6u, 60, SCHEDULE);                                     \
+        ROUNDS_5(F_PARITY, 0xCA62C1D6u, 65, SCHEDULE);                                     \
+        ROUNDS_5(F_PARITY, 0xCA62C1D6u, 70, SCHEDULE);                                     \
+        ROUNDS_5(F_PARITY, 0xCA62C1D6u, 75, SCHEDULE);                                     \
+                                                                                           \
+        /* Lanes past the end of their message keep their state */                        \
+        h[0] += a & mask;                                                                  \
+        h[1] += b & mask;                                                                  \
+        h[2] += c & mask;                                                                  \
+        h[3] += d & mask;                                                                  \
+        h[4] += e & mask;                                                                  \
+                                                                                           \
+        for (i = 0; i < 5; ++i) {                                                          \
+            memcpy(&state[i][first], &h[i], sizeof(type));                                 \
+        }                                                                                  \
+    }
+
+DEFINE_COMPRESS(compress_4, Lanes4)
+#ifdef OAUTH_X86_SIMD
+DEFINE_COMPRESS(compress_8, Lanes8)
+DEFINE_COMPRESS(compress_16, Lanes16)
+#endif
+
+/**
+ * The body of a vector engine: every block of a group goes through the
+ * compression function width lanes at a time
+ */
+#define HASH_GROUP(jobs, count, compress, width)                              \
+    do {                                                                      \
+        uint32_t words[16][SHA1_MB_LANES], active[SHA1_MB_LANES];             \
+        Sha1Group group;                                                      \
+        size_t index, first;                                                  \
+                                                                              \
+        load_group(&group, jobs, count);                                      \
+        for (index = 0; index < group.most_blocks; ++index) {                 \
+            gather_block(&group, index, words, active);                       \
+            for (first = 0; first < SHA1_MB_LANES; first += (width)) {        \
+                compress(group.state, words, active, first);                  \
+            }                                                                 \
+        }                                                                     \
+        store_group(&group, jobs, count);                                     \
+    } while (0)
+
+static void hash_openssl(const Sha1Job *jobs, size_t count) {
+    SHA_CTX ctx;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        memset(&ctx, 0, sizeof ctx);
+        ctx.h0 = jobs[i].state[0];
+        ctx.h1 = jobs[i].state[1];
+        ctx.h2 = jobs[i].state[2];
+        ctx.h3 = jobs[i].state[3];
+        ctx.h4 = jobs[i].state[4];
+        ctx.Nl = ( SHA_LONG )(jobs[i].hashed << 3);
+        ctx.Nh = ( SHA_LONG )(jobs[i].hashed >> 29);
+
+        SHA1_Update(&ctx, jobs[i].data, jobs[i].length);
+        SHA1_Final(jobs[i].digest, &ctx);
+    }
+}
+
+static void hash_vector(const Sha1Job *jobs, size_t count) {
+    HASH_GROUP(jobs, count, compress_4, 4);
+}
+
+#ifdef OAUTH_X86_SIMD
+
+/* Both clear the upper halves of the vector registers before returning,
+   which GCC leaves to the caller in code compiled for another target */
+
+__attribute__((target("avx2"))) static void hash_avx2(const Sha1Job *jobs, size_t count) {
+    HASH_GROUP(jobs, count, compress_8, 8);
+    _mm256_zeroupper();
+}
+
+__attribute__((target("avx512f"))) static void hash_avx512(const Sha1Job *jobs, size_t count) {
+    HASH_GROUP(jobs, count, compress_16, 16);
+    _mm256_zeroupper();
+}
+
+#endif
+
+static void load_group(Sha1Group *group, const Sha1Job *jobs, size_t count) {
+    size_t lane, rest, padded;
+    uint64_t bits;
+    int word, i;
+
+    group->most_blocks = 0;
+    for (lane = 0; lane < SHA1_MB_LANES; ++lane) {
+        if (lane >= count) {
+            group->blocks[lane] = group->full_blocks[lane] = 0;
+            group->data[lane]   = ZERO_BLOCK;
+            for (word = 0; word < 5; ++word) {
+                group->state[word][lane] = 0;
+            }
+            continue;
+        }
+
+        for (word = 0; word < 5; ++word) {
+            group->state[word][lane] = jobs[lane].state[word];
+        }
+
+        /* The last partial block, the 0x80 byte and the 64 bit length make
+           one or two more blocks */
+        group->data[lane]        = jobs[lane].data;
+        group->full_blocks[lane] = jobs[lane].length / 64;
+        rest                     = jobs[lane].length % 64;
+        padded                   = rest < 56 ? 64 : 128;
+
+        if (rest > 0) {
+            memcpy(group->tail[lane], jobs[lane].data + jobs[lane].length - rest, rest);
+        }
+        group->tail[lane][rest] = 0x80;
+        memset(group->tail[lane] + rest + 1, 0, padded - rest - 9);
+
+        bits = (jobs[lane].hashed + jobs[lane].length) << 3;
+        for (i = 0; i < 8; ++i) {
+            group->tail[lane][padded - 1 - i] = ( unsigned char )(bits >> (8 * i));
+        }
+
+        group->blocks[lane] = group->full_blocks[lane] + padded / 64;
+        if (group->blocks[lane] > group->most_blocks) {
+            group->most_blocks = group->blocks[lane];
+        }
+    }
+}
+
+static void store_group(const Sha1Group *group, const Sha1Job *jobs, size_t count) {
+    size_t lane;
+    int word;
+
+    for (lane = 0; lane < count; ++lane) {
+        for (word = 0; word < 5; ++word) {
+            jobs[lane].digest[4 * word]     = ( unsigned char )(group->state[word][lane] >> 24);
+            jobs[lane].digest[4 * word + 1] = ( unsigned char )(group->state[word][lane] >> 16);
+            jobs[lane].digest[4 * word + 2] = ( unsigned char )(group->state[word][lane] >> 8);
+            jobs[lane].digest[4 * word + 3] = ( unsigned char )group->state[word][lane];
+        }
+    }
+}
+
+static void gather_block(const Sha1Group *group, size_t index, uint32_t words[16][SHA1_MB_LANES],
+                         uint32_t *active) {
+    const unsigned char *block;
+    size_t lane;
+    int t;
+
+    for (lane = 0; lane < SHA1_MB_LANES; ++lane) {
+        if (index < group->full_blocks[lane]) {
+            block = group->data[lane] + 64 * index;
+        } else if (index < group->blocks[lane]) {
+            block = group->tail[lane] + 64 * (index - group->full_blocks[lane]);
+        } else {
+            block = ZERO_BLOCK;
+        }
+        active[lane] = index < group->blocks[lane] ? 0xFFFFFFFFu : 0;
+
+        /* Words are gathered as they are and put in big endian order by the
+           compression function, across all lanes at once */
+        for (t = 0; t < 16; ++t) {
+            memcpy(&words[t][lane], block + 4 * t, 4);
+        }
+    }
+}
+
+#undef HASH_GROUP
+#undef DEFINE_COMPRESS
+#undef W_LOADED
+#undef ROUNDS_5
+#undef F_MAJORITY
+#undef F_PARITY
+#undef F_CHOOSE
+#undef ROUND
+#undef SCHEDULE
+#undef ROTL
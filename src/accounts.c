@@ -0,0 +1,187 @@
+#include "accounts.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The initial number of slots of the cache, a power of two */
+#define ACCOUNT_CACHE_SIZE 64
+
+/** The four strings which identify an account, in key order */
+#define X_ACCOUNT_FIELDS \
+    X(consumer_key)      \
+    X(consumer_secret)   \
+    X(token)             \
+    X(token_secret)
+
+/**
+ * A distinct set of four credential strings and the credentials made from
+ * them. The key holds the four strings back to back, each null terminated.
+ */
+typedef struct {
+    uint64_t hash;
+    char *key;
+    size_t key_length;
+    OauthCredentials *credentials;
+} Account;
+
+struct AccountCache {
+    Account *slots;
+    size_t capacity;
+    size_t count;
+};
+
+/**
+ * @brief      Doubles the number of slots of the cache
+ *
+ * @param      cache  The cache
+ *
+ * @return     1 on success, 0 if allocation failed
+ */
+static int grow_cache(AccountCache *cache);
+
+/**
+ * @brief      Continues an FNV-1a hash over more bytes
+ *
+ * @param[in]  hash    The hash so far
+ * @param[in]  data    The bytes
+ * @param[in]  length  The number of bytes
+ *
+ * @return     The hash including the bytes
+ */
+static uint64_t hash_bytes(uint64_t hash, const char *data, size_t length);
+
+AccountCache *new_account_cache(void) {
+    AccountCache *cache = calloc(1, sizeof(AccountCache));
+
+    if (cache != NULL && !grow_cache(cache)) {
+        free(cache);
+        cache = NULL;
+    }
+
+    return cache;
+}
+
+const OauthCredentials *find_credentials(AccountCache *cache, const char *consumer_key,
+                                         const char *consumer_secret, const char *token,
+                                         const char *token_secret) {
+    uint64_t hash     = 0xcbf29ce484222325ULL;
+    size_t key_length = 0, mask, slot, offset;
+    Account *account;
+    char *k;
+    int match;
+
+    /* Each string is hashed with its terminator so the boundaries count */
+#define X(field)                                                \
+    size_t field##_length = strlen(field) + 1;                  \
+    hash                  = hash_bytes(hash, field, field##_length); \
+    key_length += field##_length;
+
+    X_ACCOUNT_FIELDS
+#undef X
+
+    if (cache->count * 4 >= cache->capacity * 3 && !grow_cache(cache)) {
+        return NULL;
+    }
+
+    mask = cache->capacity - 1;
+    for (slot = ( size_t )hash & mask; cache->slots[slot].key != NULL; slot = (slot + 1) & mask) {
+        account = &cache->slots[slot];
+        if (account->hash != hash || account->key_length != key_length) {
+            continue;
+        }
+
+        match  = 1;
+        offset = 0;
+#define X(field)                                                                        \
+    match = match && memcmp(account->key + offset, field, field##_length) == 0;         \
+    offset += field##_length;
+
+        X_ACCOUNT_FIELDS
+#undef X
+
+        if (match) {
+            return account->credentials;
+        }
+    }
+
+    account              = &cache->slots[slot];
+    account->credentials = new_oauth_credentials(consumer_key, consumer_secret, token, token_secret);
+    account->key         = malloc(key_length);
+    if (account->credentials == NULL || account->key == NULL) {
+        destroy_credentials(&account->credentials);
+        free(account->key);
+        account->key = NULL;
+        return NULL;
+    }
+
+    k = account->key;
+#define X(field)                          \
+    memcpy(k, field, field##_length);     \
+    k += field##_length;
+
+    X_ACCOUNT_FIELDS
+#undef X
+
+    account->key_length = key_length;
+    account->hash       = hash;
+    cache->count++;
+
+    return account->credentials;
+}
+
+void destroy_account_cache(AccountCache **cache) {
+    AccountCache *ref = *cache;
+    size_t i;
+
+    if (ref == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ref->capacity; ++i) {
+        if (ref->slots[i].key != NULL) {
+            destroy_credentials(&ref->slots[i].credentials);
+            free(ref->slots[i].key);
+        }
+    }
+    free(ref->slots);
+    free(ref);
+
+    *cache = NULL;
+}
+
+static int grow_cache(AccountCache *cache) {
+    size_t capacity = cache->capacity ? cache->capacity * 2 : ACCOUNT_CACHE_SIZE;
+    Account *slots  = calloc(capacity, sizeof(Account));
+    size_t i, slot;
+
+    if (slots == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < cache->capacity; ++i) {
+        if (cache->slots[i].key != NULL) {
+            slot = ( size_t )cache->slots[i].hash & (capacity - 1);
+            while (slots[slot].key != NULL) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = cache->slots[i];
+        }
+    }
+
+    free(cache->slots);
+    cache->slots    = slots;
+    cache->capacity = capacity;
+
+    return 1;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const char *data, size_t length) {
+    size_t i;
+
+    for (i = 0; i < length; ++i) {
+        hash ^= ( unsigned char )data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
@@ -0,0 +1,649 @@
+#include "accounts.h"
+#include "batch.h"
+#include "logger.h"
+#include <arena.h>
+#include <ctype.h>
+#include <liboauthsign.h>
+#include <oauth_pool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The number of lines handed to the pool at a time */
+#define BATCH_LINES 4096
+
+/** The initial size of the input buffer, which grows to fit the longest line */
+#define READ_BUFFER_SIZE (1 << 20)
+
+/** Headers are collected up to this size before being written out */
+#define WRITE_BUFFER_SIZE (1 << 20)
+
+/**
+ * The string fields of a line, in the order they appear in the tab separated
+ * format and named as the members of the JSON format
+ */
+#define X_LINE_FIELDS \
+    X(consumer_key)   \
+    X(consumer_secret) \
+    X(token)          \
+    X(token_secret)   \
+    X(method)         \
+    X(url)
+
+typedef struct {
+#define X(field) char *field;
+    X_LINE_FIELDS
+#undef X
+    const char **params;
+    int params_count;
+    int params_capacity;
+} Line;
+
+typedef struct {
+    FILE *in;
+    char *data;
+    size_t length;
+    size_t capacity;
+    int eof;
+} Reader;
+
+typedef struct {
+    FILE *out;
+    char *data;
+    size_t length;
+    int failed;
+} Writer;
+
+/**
+ * @brief      Reads until the buffer is full or the input ends
+ * @details    One byte is always kept free so the last line can be terminated
+ * even when the input does not end with a newline.
+ *
+ * @param      reader  The reader
+ *
+ * @return     1 on success, 0 on a read error
+ */
+static int fill_reader(Reader *reader);
+
+/**
+ * @brief      Doubles the size of the input buffer
+ *
+ * @param      reader  The reader
+ *
+ * @return     1 on success, 0 if allocation failed
+ */
+static int grow_reader(Reader *reader);
+
+/**
+ * @brief      Appends bytes to the output, flushing it when full
+ *
+ * @param      writer  The writer
+ * @param[in]  data    The bytes
+ * @param[in]  length  The number of bytes
+ */
+static void write_bytes(Writer *writer, const char *data, size_t length);
+
+/**
+ * @brief      Writes out everything collected so far
+ *
+ * @param      writer  The writer
+ */
+static void flush_writer(Writer *writer);
+
+/**
+ * @brief      Turns one line of input into a request
+ *
+ * @param      line     The line, which is modified in place and must outlive
+ * the request
+ * @param      arena    Where to keep anything that does not fit in the line
+ * @param      cache    The account cache
+ * @param[out] request  The request
+ *
+ * @return     NULL on success or a message saying why the line was rejected
+ */
+static const char *parse_request(char *line, Arena *arena, AccountCache *cache,
+                                 OauthRequest *request);
+
+/**
+ * @brief      Splits a tab separated line
+ *
+ * @param      text    The line
+ * @param      arena   The arena for the parameter array
+ * @param[out] fields  The fields
+ *
+ * @return     NULL on success or a message saying why the line was rejected
+ */
+static const char *parse_tsv(char *text, Arena *arena, Line *fields);
+
+/**
+ * @brief      Parses a JSON object line
+ *
+ * @param      text    The line
+ * @param      arena   The arena for the parameters
+ * @param[out] fields  The fields
+ *
+ * @return     NULL on success or a message saying why the line was rejected
+ */
+static const char *parse_json(char *text, Arena *arena, Line *fields);
+
+/**
+ * @brief      Parses the value of the params member of a JSON line
+ *
+ * @param      p       The position of the value, advanced past it
+ * @param      arena   The arena for the parameters
+ * @param      fields  The fields to add the parameters to
+ *
+ * @return     NULL on success or a message saying why the line was rejected
+ */
+static const char *parse_json_params(char **p, Arena *arena, Line *fields);
+
+/**
+ * @brief      Decodes a JSON string in place
+ *
+ * @param      p     The position of the opening quote, advanced past the
+ * closing one
+ *
+ * @return     The null terminated string or NULL if it is malformed
+ */
+static char *json_string(char **p);
+
+/**
+ * @brief      Skips JSON whitespace
+ *
+ * @param      p     The position
+ *
+ * @return     The first position which is not whitespace
+ */
+static char *skip_space(char *p);
+
+/**
+ * @brief      Adds a parameter to a line
+ *
+ * @param      arena   The arena to grow the parameter array in
+ * @param      fields  The fields
+ * @param[in]  param   The parameter, as name=value
+ *
+ * @return     1 on success, 0 if allocation failed
+ */
+static int add_param(Arena *arena, Line *fields, const char *param);
+
+int check_method(char *method) {
+    static const char *methods[] = {
+        "GET", "POST", "DELETE",
+        "PUT", "HEAD"};
+
+    int valid = 0, size = sizeof methods / sizeof methods[0], cnt;
+    char *up = method;
+
+    while (*up) {
+        *up = ( char )toupper(*up);
+        ++up;
+    }
+
+    for (cnt = 0; cnt < size; cnt++) {
+        if (strcmp(method, methods[cnt]) == 0) {
+            valid = 1;
+            break;
+        }
+    }
+
+    return valid;
+}
+
+long run_batch(FILE *in, FILE *out, int threads) {
+    Reader reader      = {NULL, NULL, 0, READ_BUFFER_SIZE, 0};
+    Writer writer      = {NULL, NULL, 0, 0};
+    OauthRequest *requests;
+    AccountCache *cache;
+    OauthPool *pool;
+    Arena *arena;
+    const char **errors;
+    char **headers, *line, *newline;
+    size_t start, end, count, i;
+    unsigned long line_number = 0;
+    long failures             = 0;
+
+    reader.in   = in;
+    reader.data = malloc(reader.capacity);
+    writer.out  = out;
+    writer.data = malloc(WRITE_BUFFER_SIZE);
+    requests    = malloc(BATCH_LINES * sizeof(OauthRequest));
+    headers     = malloc(BATCH_LINES * sizeof(char *));
+    errors      = malloc(BATCH_LINES * sizeof(char *));
+    pool        = new_oauth_pool(threads);
+    arena       = arena_new(READ_BUFFER_SIZE / 4);
+    cache       = new_account_cache();
+
+    if (reader.data == NULL || writer.data == NULL || requests == NULL || headers == NULL ||
+        errors == NULL || pool == NULL || arena == NULL || cache == NULL) {
+        e_log("batch: out of memory\n");
+        failures = -1;
+        goto done;
+    }
+
+    for (;;) {
+        if (!fill_reader(&reader)) {
+            e_log("batch: could not read the input\n");
+            failures = -1;
+            break;
+        }
+
+        /* Cut as many complete lines as fit in one batch */
+        for (start = 0, count = 0; count < BATCH_LINES && start < reader.length; ++count) {
+            line    = reader.data + start;
+            newline = memchr(line, '\n', reader.length - start);
+            if (newline != NULL) {
+                end = ( size_t )(newline - reader.data);
+            } else if (reader.eof) {
+                end = reader.length;
+            } else {
+                break;
+            }
+
+            reader.data[end] = '\0';
+            if (end > start && reader.data[end - 1] == '\r') {
+                reader.data[end - 1] = '\0';
+            }
+            start = end + 1;
+
+            errors[count] = parse_request(line, arena, cache, &requests[count]);
+            if (errors[count] != NULL) {
+                requests[count].credentials = NULL;
+            }
+        }
+
+        if (count == 0) {
+            if (reader.eof) {
+                break;
+            }
+            /* A line longer than the whole buffer */
+            if (!grow_reader(&reader)) {
+                e_log("batch: out of memory\n");
+                failures = -1;
+                break;
+            }
+            continue;
+        }
+
+        ( void )sign_batch(pool, requests, headers, count);
+
+        for (i = 0; i < count; ++i) {
+            ++line_number;
+            if (headers[i] != NULL) {
+                write_bytes(&writer, headers[i], strlen(headers[i]));
+                free(headers[i]);
+            } else {
+                e_log("batch: line %lu: %s\n", line_number,
+                      errors[i] != NULL ? errors[i] : "signing failed");
+                ++failures;
+            }
+            write_bytes(&writer, "\n", 1);
+        }
+
+        arena_reset(arena);
+        start = start < reader.length ? start : reader.length;
+        memmove(reader.data, reader.data + start, reader.length - start);
+        reader.length -= start;
+    }
+
+    flush_writer(&writer);
+    if (fflush(out) != 0 || writer.failed) {
+        e_log("batch: could not write the output\n");
+        failures = -1;
+    }
+
+done:
+    destroy_account_cache(&cache);
+    if (arena != NULL) {
+        arena_destroy(arena);
+    }
+    destroy_pool(&pool);
+    free(errors);
+    free(headers);
+    free(requests);
+    free(writer.data);
+    free(reader.data);
+
+    return failures;
+}
+
+static int fill_reader(Reader *reader) {
+    size_t n;
+
+    while (!reader->eof && reader->length + 1 < reader->capacity) {
+        n = fread(reader->data + reader->length, 1, reader->capacity - 1 - reader->length,
+                  reader->in);
+        reader->length += n;
+        if (n == 0) {
+            if (ferror(reader->in)) {
+                return 0;
+            }
+            reader->eof = 1;
+        }
+    }
+
+    return 1;
+}
+
+static int grow_reader(Reader *reader) {
+    char *data = realloc(reader->data, reader->capacity * 2);
+    if (data == NULL) {
+        return 0;
+    }
+    reader->data = data;
+    reader->capacity *= 2;
+    return 1;
+}
+
+static void write_bytes(Writer *writer, const char *data, size_t length) {
+    if (writer->length + length > WRITE_BUFFER_SIZE) {
+        flush_writer(writer);
+    }
+    if (length > WRITE_BUFFER_SIZE) {
+        if (fwrite(data, 1, length, writer->out) != length) {
+            writer->failed = 1;
+        }
+        return;
+    }
+    memcpy(writer->data + writer->length, data, length);
+    writer->length += length;
+}
+
+static void flush_writer(Writer *writer) {
+    if (writer->length > 0 && fwrite(writer->data, 1, writer->length, writer->out) != writer->length) {
+        writer->failed = 1;
+    }
+    writer->length = 0;
+}
+
+static const char *parse_request(char *line, Arena *arena, AccountCache *cache,
+                                 OauthRequest *request) {
+    Line fields;
+    const char *error;
+
+    memset(&fields, 0, sizeof fields);
+    memset(request, 0, sizeof(OauthRequest));
+
+    line = skip_space(line);
+    if (*line == '\0') {
+        return "empty line";
+    }
+
+    error = *line == '{' ? parse_json(line, arena, &fields) : parse_tsv(line, arena, &fields);
+    if (error != NULL) {
+        return error;
+    }
+
+    if (fields.consumer_key == NULL || fields.consumer_secret == NULL) {
+        return "missing consumer key or secret";
+    }
+    if (fields.method == NULL || fields.url == NULL) {
+        return "missing method or url";
+    }
+    if (check_method(fields.method) != 1) {
+        return "method must be GET, POST, DELETE, PUT, or HEAD";
+    }
+    if (fields.token == NULL) {
+        fields.token = "";
+    }
+    if (fields.token_secret == NULL) {
+        fields.token_secret = "";
+    }
+
+    request->credentials = find_credentials(cache, fields.consumer_key, fields.consumer_secret,
+                                            fields.token, fields.token_secret);
+    if (request->credentials == NULL) {
+        return "out of memory";
+    }
+    request->method       = fields.method;
+    request->url          = fields.url;
+    request->params       = fields.params;
+    request->params_count = fields.params_count;
+
+    return NULL;
+}
+
+static const char *parse_tsv(char *text, Arena *arena, Line *fields) {
+    char **field[] = {
+#define X(name) &fields->name,
+        X_LINE_FIELDS
+#undef X
+    };
+    size_t count = sizeof field / sizeof field[0], i;
+    char *tab;
+
+    /* The fields in order, then whatever follows as parameters */
+    for (i = 0; text != NULL; ++i) {
+        tab = strchr(text, '\t');
+        if (tab != NULL) {
+            *tab = '\0';
+        }
+
+        if (i < count) {
+            *field[i] = text;
+        } else if (!add_param(arena, fields, text)) {
+            return "out of memory";
+        }
+
+        text = tab != NULL ? tab + 1 : NULL;
+    }
+
+    if (i < count) {
+        return "expected at least 6 tab separated fields";
+    }
+
+    return NULL;
+}
+
+static const char *parse_json(char *text, Arena *arena, Line *fields) {
+    char *p = skip_space(text + 1), *key, *value;
+    const char *error;
+    int more = *p != '}';
+
+    while (more) {
+        if (*p != '"' || (key = json_string(&p)) == NULL) {
+            return "expected a member name";
+        }
+        p = skip_space(p);
+        if (*p != ':') {
+            return "expected ':' after a member name";
+        }
+        p = skip_space(p + 1);
+
+        if (strcmp(key, "params") == 0) {
+            error = parse_json_params(&p, arena, fields);
+            if (error != NULL) {
+                return error;
+            }
+        } else if (*p == '"' && (value = json_string(&p)) != NULL) {
+#define X(field)                    \
+    if (strcmp(key, #field) == 0) { \
+        fields->field = value;      \
+    } else
+
+            X_LINE_FIELDS {
+                /* Members this format does not know about are ignored */
+            }
+#undef X
+        } else {
+            return "member values must be strings";
+        }
+
+        p = skip_space(p);
+        if (*p != ',' && *p != '}') {
+            return "expected ',' or '}' after a member";
+        }
+        more = *p == ',';
+        p    = skip_space(p + 1);
+    }
+
+    if (*skip_space(p + (*p == '}')) != '\0') {
+        return "unexpected characters after the object";
+    }
+
+    return NULL;
+}
+
+static const char *parse_json_params(char **p, Arena *arena, Line *fields) {
+    char *name, *value, *param;
+    size_t name_len, value_len;
+    char close = **p == '[' ? ']' : '}';
+
+    if (**p != '[' && **p != '{') {
+        return "params must be an array or an object";
+    }
+
+    *p = skip_space(*p + 1);
+    while (**p != close) {
+        if (**p != '"' || (name = json_string(p)) == NULL) {
+            return "params must hold strings";
+        }
+
+        if (close == '}') {
+            *p = skip_space(*p);
+            if (**p != ':') {
+                return "expected ':' after a parameter name";
+            }
+            *p = skip_space(*p + 1);
+            if (**p != '"' || (value = json_string(p)) == NULL) {
+                return "params must hold strings";
+            }
+
+            name_len  = strlen(name);
+            value_len = strlen(value);
+            param     = arena_alloc(arena, name_len + value_len + 2);
+            if (param == NULL) {
+                return "out of memory";
+            }
+            memcpy(param, name, name_len);
+            param[name_len] = '=';
+            memcpy(param + name_len + 1, value, value_len + 1);
+            name = param;
+        }
+
+        if (!add_param(arena, fields, name)) {
+            return "out of memory";
+        }
+
+        *p = skip_space(*p);
+        if (**p == ',') {
+            *p = skip_space(*p + 1);
+        } else if (**p != close) {
+            return "expected ',' between parameters";
+        }
+    }
+    ++*p;
+
+    return NULL;
+}
+
+static char *json_string(char **p) {
+    char *in = *p + 1, *out = *p + 1, *start = *p + 1, digits[5] = {0};
+    unsigned long code, low;
+
+    for (; *in != '"'; ++in) {
+        if (*in == '\0') {
+            return NULL;
+        }
+        if (*in != '\\') {
+            *out++ = *in;
+            continue;
+        }
+
+        switch (*++in) {
+        case '"':
+        case '\\':
+        case '/':
+            *out++ = *in;
+            break;
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'u':
+            if (strspn(in + 1, "0123456789abcdefABCDEF") < 4) {
+                return NULL;
+            }
+            memcpy(digits, in + 1, 4);
+            code = strtoul(digits, NULL, 16);
+            in += 4;
+
+            /* A high surrogate must be followed by a low one */
+            if (code >= 0xD800 && code < 0xDC00) {
+                if (in[1] != '\\' || in[2] != 'u' || strspn(in + 3, "0123456789abcdefABCDEF") < 4) {
+                    return NULL;
+                }
+                memcpy(digits, in + 3, 4);
+                low = strtoul(digits, NULL, 16);
+                if (low < 0xDC00 || low >= 0xE000) {
+                    return NULL;
+                }
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                in += 6;
+            } else if (code == 0 || (code >= 0xDC00 && code < 0xE000)) {
+                return NULL;
+            }
+
+            if (code < 0x80) {
+                *out++ = ( char )code;
+            } else if (code < 0x800) {
+                *out++ = ( char )(0xC0 | (code >> 6));
+                *out++ = ( char )(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                *out++ = ( char )(0xE0 | (code >> 12));
+                *out++ = ( char )(0x80 | ((code >> 6) & 0x3F));
+                *out++ = ( char )(0x80 | (code & 0x3F));
+            } else {
+                *out++ = ( char )(0xF0 | (code >> 18));
+                *out++ = ( char )(0x80 | ((code >> 12) & 0x3F));
+                *out++ = ( char )(0x80 | ((code >> 6) & 0x3F));
+                *out++ = ( char )(0x80 | (code & 0x3F));
+            }
+            break;
+        default:
+            return NULL;
+        }
+    }
+
+    /* The decoded string is never longer, so it always fits where it was */
+    *out = '\0';
+    *p   = in + 1;
+
+    return start;
+}
+
+static char *skip_space(char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        ++p;
+    }
+    return p;
+}
+
+static int add_param(Arena *arena, Line *fields, const char *param) {
+    const char **params;
+
+    if (fields->params_count == fields->params_capacity) {
+        fields->params_capacity = fields->params_capacity ? fields->params_capacity * 2 : 8;
+        params = arena_alloc(arena, sizeof(char *) * ( size_t )fields->params_capacity);
+        if (params == NULL) {
+            return 0;
+        }
+        if (fields->params_count > 0) {
+            memcpy(params, fields->params, sizeof(char *) * ( size_t )fields->params_count);
+        }
+        fields->params = params;
+    }
+
+    fields->params[fields->params_count++] = param;
+    return 1;
+}
@@ -0,0 +1,636 @@
+/* accept4() */
+#define _GNU_SOURCE
+
+#include "accounts.h"
+#include "batch.h"
+#include "daemon.h"
+#include "logger.h"
+#include <arena.h>
+#include <errno.h>
+#include <liboauthsign.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** The number of events taken from epoll at a time */
+#define DAEMON_EVENTS 64
+
+/** The amount read from a connection at a time */
+#define DAEMON_READ_SIZE 16384
+
+/** The number of strings before the parameters of a request */
+#define DAEMON_FIELDS 6
+
+/**
+ * The unsent replies past which a connection is no longer read from, so a
+ * client which never reads cannot make the daemon hold its replies without end
+ */
+#define DAEMON_MAX_PENDING (1 << 20)
+
+typedef struct Connection Connection;
+
+struct Connection {
+    int fd;
+    /* The events watched for, which depend on the replies waiting */
+    uint32_t events;
+    char *in;
+    size_t in_length;
+    size_t in_capacity;
+    char *out;
+    size_t out_length;
+    size_t out_sent;
+    size_t out_capacity;
+    Connection *prev;
+    Connection *next;
+};
+
+typedef struct {
+    pthread_t thread;
+    int listen_fd;
+    int stop_fd;
+    int epoll_fd;
+    Builder *builder;
+    AccountCache *cache;
+    Arena *arena;
+    Connection *connections;
+} DaemonWorker;
+
+/**
+ * @brief      Runs the threads of one process until it is signalled to stop
+ *
+ * @param[in]  listen_fd  The listening socket
+ * @param[in]  threads    The number of threads
+ *
+ * @return     0 on success, -1 if the threads could not be started
+ */
+static int serve(int listen_fd, int threads);
+
+/**
+ * @brief      The event loop of a daemon thread
+ *
+ * @param      arg   The DaemonWorker of this thread
+ *
+ * @return     NULL
+ */
+static void *daemon_thread(void *arg);
+
+/**
+ * @brief      Accepts every pending connection
+ *
+ * @param      worker  The worker
+ */
+static void accept_connections(DaemonWorker *worker);
+
+/**
+ * @brief      Reads what a connection has sent and answers every complete
+ * request
+ *
+ * @param      worker      The worker
+ * @param      connection  The connection
+ *
+ * @return     1 to keep the connection, 0 to close it
+ */
+static int read_connection(DaemonWorker *worker, Connection *connection);
+
+/**
+ * @brief      Answers the complete requests read from a connection, for as
+ * long as its unsent replies stay under DAEMON_MAX_PENDING
+ * @details    Carries on with the requests held back whenever all of the
+ * replies go out at once.
+ *
+ * @param      worker      The worker
+ * @param      connection  The connection
+ *
+ * @return     1 to keep the connection, 0 to close it
+ */
+static int answer_requests(DaemonWorker *worker, Connection *connection);
+
+/**
+ * @brief      Sends as much of the pending replies as the socket takes
+ * @details    Watches for the socket becoming writable while replies remain,
+ * and stops watching for requests while too many of them do.
+ *
+ * @param      worker      The worker
+ * @param      connection  The connection
+ *
+ * @return     1 to keep the connection, 0 to close it
+ */
+static int write_connection(DaemonWorker *worker, Connection *connection);
+
+/**
+ * @brief      Closes a connection and frees it
+ *
+ * @param      worker      The worker
+ * @param      connection  The connection
+ */
+static void close_connection(DaemonWorker *worker, Connection *connection);
+
+/**
+ * @brief      Signs one request and queues the reply
+ *
+ * @param      worker      The worker
+ * @param      connection  The connection
+ * @param[in]  frame       The request, without its length
+ * @param[in]  length      The length of the request
+ *
+ * @return     1 on success, 0 if the reply could not be queued
+ */
+static int handle_request(DaemonWorker *worker, Connection *connection, const unsigned char *frame,
+                          size_t length);
+
+/**
+ * @brief      Queues a reply
+ *
+ * @param      connection  The connection
+ * @param[in]  status      0 for a header, anything else for an error
+ * @param[in]  data        The header or error message
+ * @param[in]  length      The length of data
+ *
+ * @return     1 on success, 0 if allocation failed
+ */
+static int queue_reply(Connection *connection, unsigned char status, const char *data,
+                       size_t length);
+
+/**
+ * @brief      Grows a buffer to hold at least the given size
+ *
+ * @param      buffer    The buffer
+ * @param      capacity  The capacity of the buffer
+ * @param[in]  size      The size needed
+ *
+ * @return     1 on success, 0 if allocation failed
+ */
+static int reserve(char **buffer, size_t *capacity, size_t size);
+
+int run_daemon(const char *path, int threads, int processes) {
+    struct sockaddr_un address;
+    struct stat info;
+    sigset_t signals;
+    pid_t *children;
+    int listen_fd, p, result;
+
+    if (strlen(path) >= sizeof address.sun_path) {
+        e_log("daemon: socket path too long: %s\n", path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    /* Only a stale socket is replaced, never some other file */
+    if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(path);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, ( struct sockaddr * )&address, sizeof address) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        e_log("daemon: cannot listen on %s: %s\n", path, strerror(errno));
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        return -1;
+    }
+
+    /* Signals are taken by sigwait() in serve(), so every thread blocks them */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    processes = processes > 0 ? processes : 1;
+    children  = calloc(( size_t )processes, sizeof(pid_t));
+    if (children == NULL) {
+        close(listen_fd);
+        return -1;
+    }
+
+    for (p = 1; p < processes; ++p) {
+        children[p] = fork();
+        if (children[p] == 0) {
+            free(children);
+            _exit(serve(listen_fd, threads) == 0 ? 0 : 1);
+        }
+        if (children[p] < 0) {
+            e_log("daemon: cannot start process %d: %s\n", p, strerror(errno));
+        }
+    }
+
+    result = serve(listen_fd, threads);
+
+    for (p = 1; p < processes; ++p) {
+        if (children[p] > 0) {
+            kill(children[p], SIGTERM);
+            waitpid(children[p], NULL, 0);
+        }
+    }
+
+    free(children);
+    close(listen_fd);
+    unlink(path);
+
+    return result;
+}
+
+static int serve(int listen_fd, int threads) {
+    DaemonWorker *workers;
+    uint64_t one = 1;
+    sigset_t signals;
+    int stop_fd, signal_number, started = 0, i;
+
+    if (threads <= 0) {
+        threads = ( int )sysconf(_SC_NPROCESSORS_ONLN);
+        threads = threads > 0 ? threads : 1;
+    }
+
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    workers = calloc(( size_t )threads, sizeof(DaemonWorker));
+    if (stop_fd < 0 || workers == NULL) {
+        e_log("daemon: out of resources\n");
+        free(workers);
+        if (stop_fd >= 0) {
+            close(stop_fd);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < threads; ++i) {
+        workers[i].listen_fd = listen_fd;
+        workers[i].stop_fd   = stop_fd;
+        workers[i].epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+        workers[i].builder   = new_oauth_builder();
+        workers[i].cache     = new_account_cache();
+        workers[i].arena     = arena_new(4096);
+
+        if (workers[i].epoll_fd < 0 || workers[i].builder == NULL || workers[i].cache == NULL ||
+            workers[i].arena == NULL ||
+            pthread_create(&workers[i].thread, NULL, daemon_thread, &workers[i]) != 0) {
+            e_log("daemon: cannot start thread %d\n", i);
+            break;
+        }
+        started++;
+    }
+
+    if (started == threads) {
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigwait(&signals, &signal_number);
+    }
+
+    /* The event stays readable, so every thread sees it */
+    if (write(stop_fd, &one, sizeof one) != sizeof one) {
+        e_log("daemon: cannot stop the threads\n");
+    }
+
+    /* Threads past the one which failed to start were never set up */
+    for (i = 0; i < threads && i <= started; ++i) {
+        if (i < started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        while (workers[i].connections != NULL) {
+            close_connection(&workers[i], workers[i].connections);
+        }
+        if (workers[i].epoll_fd >= 0) {
+            close(workers[i].epoll_fd);
+        }
+        if (workers[i].arena != NULL) {
+            arena_destroy(workers[i].arena);
+        }
+        destroy_account_cache(&workers[i].cache);
+        destroy_builder(&workers[i].builder);
+    }
+
+    free(workers);
+    close(stop_fd);
+
+    return started == threads ? 0 : -1;
+}
+
+static void *daemon_thread(void *arg) {
+    DaemonWorker *worker = arg;
+    struct epoll_event events[DAEMON_EVENTS], event;
+    Connection *connection;
+    int count, i, keep;
+
+    /* The listening socket is marked with NULL and the stop event with the worker */
+    event.events   = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = NULL;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->listen_fd, &event);
+    event.events   = EPOLLIN;
+    event.data.ptr = worker;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->stop_fd, &event);
+
+    for (;;) {
+        count = epoll_wait(worker->epoll_fd, events, DAEMON_EVENTS, -1);
+        if (count < 0 && errno != EINTR) {
+            e_log("daemon: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; i < count; ++i) {
+            if (events[i].data.ptr == NULL) {
+                accept_connections(worker);
+                continue;
+            }
+            if (events[i].data.ptr == worker) {
+                return NULL;
+            }
+
+            connection = events[i].data.ptr;
+            keep       = 1;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                keep = read_connection(worker, connection);
+            }
+            if (keep && (events[i].events & EPOLLOUT)) {
+                keep = write_connection(worker, connection);
+                /* Requests left waiting while the replies were held up */
+                if (keep && connection->in_length > 0) {
+                    keep = answer_requests(worker, connection);
+                }
+            }
+            if (!keep) {
+                close_connection(worker, connection);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void accept_connections(DaemonWorker *worker) {
+    struct epoll_event event;
+    Connection *connection;
+    int fd;
+
+    /* Another thread or process may have taken the connection first */
+    while ((fd = accept4(worker->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        connection = calloc(1, sizeof(Connection));
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+
+        connection->fd     = fd;
+        connection->events = EPOLLIN | EPOLLRDHUP;
+        connection->next   = worker->connections;
+        if (worker->connections != NULL) {
+            worker->connections->prev = connection;
+        }
+        worker->connections = connection;
+
+        event.events   = connection->events;
+        event.data.ptr = connection;
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close_connection(worker, connection);
+        }
+    }
+}
+
+static int read_connection(DaemonWorker *worker, Connection *connection) {
+    ssize_t n;
+
+    if (!reserve(&connection->in, &connection->in_capacity,
+                 connection->in_length + DAEMON_READ_SIZE)) {
+        return 0;
+    }
+
+    n = read(connection->fd, connection->in + connection->in_length,
+             connection->in_capacity - connection->in_length);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        return 0;
+    }
+    if (n > 0) {
+        connection->in_length += ( size_t )n;
+    }
+
+    return answer_requests(worker, connection);
+}
+
+static int answer_requests(DaemonWorker *worker, Connection *connection) {
+    const unsigned char *frame;
+    size_t start, length;
+    int held;
+
+    /* Once the replies held back have all gone out, nothing may wake the
+       connection again, so the requests they held up are answered here */
+    do {
+        start = 0;
+        held  = 0;
+        while (connection->in_length - start >= 4) {
+            if (connection->out_length - connection->out_sent >= DAEMON_MAX_PENDING) {
+                held = 1;
+                break;
+            }
+            frame  = ( const unsigned char * )connection->in + start;
+            length = ( size_t )frame[0] << 24 | ( size_t )frame[1] << 16 |
+                     ( size_t )frame[2] << 8 | frame[3];
+            if (length > DAEMON_MAX_FRAME) {
+                return 0;
+            }
+            if (connection->in_length - start - 4 < length) {
+                break;
+            }
+
+            if (!handle_request(worker, connection, frame + 4, length)) {
+                return 0;
+            }
+            start += 4 + length;
+        }
+
+        memmove(connection->in, connection->in + start, connection->in_length - start);
+        connection->in_length -= start;
+
+        if (!write_connection(worker, connection)) {
+            return 0;
+        }
+    } while (held && connection->out_length == 0);
+
+    return 1;
+}
+
+static int write_connection(DaemonWorker *worker, Connection *connection) {
+    struct epoll_event event;
+    uint32_t events;
+    ssize_t n;
+
+    while (connection->out_sent < connection->out_length) {
+        n = send(connection->fd, connection->out + connection->out_sent,
+                 connection->out_length - connection->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN) {
+                return 0;
+            }
+            break;
+        }
+        connection->out_sent += ( size_t )n;
+    }
+
+    /* What was sent is dropped, so the buffer holds no more than is waiting */
+    if (connection->out_sent > 0) {
+        memmove(connection->out, connection->out + connection->out_sent,
+                connection->out_length - connection->out_sent);
+        connection->out_length -= connection->out_sent;
+        connection->out_sent = 0;
+    }
+
+    /* Only watch for writability while there is something left to send, and
+       for requests while the replies are not piling up */
+    events = connection->out_length > 0 ? EPOLLOUT : 0;
+    if (connection->out_length < DAEMON_MAX_PENDING) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events != connection->events) {
+        connection->events = events;
+        event.events       = events;
+        event.data.ptr     = connection;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    }
+
+    return 1;
+}
+
+static void close_connection(DaemonWorker *worker, Connection *connection) {
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        worker->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
+
+    free(connection->in);
+    free(connection->out);
+    free(connection);
+}
+
+static int handle_request(DaemonWorker *worker, Connection *connection, const unsigned char *frame,
+                          size_t length) {
+    const OauthCredentials *credentials;
+    const unsigned char *end = frame + length;
+    const char *error        = NULL, **strings = NULL;
+    char *header, *string, *method = NULL;
+    size_t count = 0, size, i;
+    int result;
+
+    if (length >= 2) {
+        count   = ( size_t )frame[0] << 8 | frame[1];
+        frame  += 2;
+        strings = arena_alloc(worker->arena, (count + 1) * sizeof(char *));
+    }
+
+    if (count < DAEMON_FIELDS) {
+        error = "expected at least 6 strings";
+    } else if (strings == NULL) {
+        error = "out of memory";
+    }
+
+    for (i = 0; error == NULL && i < count; ++i) {
+        if (end - frame < 2) {
+            error = "truncated request";
+            break;
+        }
+        size = ( size_t )frame[0] << 8 | frame[1];
+        if (( size_t )(end - frame - 2) < size) {
+            error = "truncated request";
+            break;
+        }
+
+        string = arena_strndup(worker->arena, ( const char * )frame + 2, size);
+        if (string == NULL) {
+            error = "out of memory";
+            break;
+        }
+        strings[i] = string;
+        method     = i == 4 ? string : method;
+        frame += 2 + size;
+    }
+
+    if (error == NULL && check_method(method) != 1) {
+        error = "method must be GET, POST, DELETE, PUT, or HEAD";
+    }
+
+    header = NULL;
+    if (error == NULL) {
+        credentials = find_credentials(worker->cache, strings[0], strings[1], strings[2], strings[3]);
+        if (credentials == NULL) {
+            error = "out of memory";
+        } else {
+            reset_builder(worker->builder);
+            set_credentials(worker->builder, credentials);
+            set_http_method(worker->builder, strings[4]);
+            set_base_url(worker->builder, strings[5]);
+            set_request_params(worker->builder, strings + DAEMON_FIELDS, ( int )(count - DAEMON_FIELDS));
+            header = get_authorization_header(worker->builder);
+            error  = header == NULL ? "signing failed" : NULL;
+        }
+    }
+
+    result = error == NULL ? queue_reply(connection, 0, header, strlen(header))
+                           : queue_reply(connection, 1, error, strlen(error));
+
+    free(header);
+    arena_reset(worker->arena);
+
+    return result;
+}
+
+static int queue_reply(Connection *connection, unsigned char status, const char *data,
+                       size_t length) {
+    unsigned char *out;
+    size_t frame = length + 1;
+
+    if (!reserve(&connection->out, &connection->out_capacity, connection->out_length + 5 + length)) {
+        return 0;
+    }
+
+    out    = ( unsigned char * )connection->out + connection->out_length;
+    out[0] = ( unsigned char )(frame >> 24);
+    out[1] = ( unsigned char )(frame >> 16);
+    out[2] = ( unsigned char )(frame >> 8);
+    out[3] = ( unsigned char )frame;
+    out[4] = status;
+    memcpy(out + 5, data, length);
+    connection->out_length += 5 + length;
+
+    return 1;
+}
+
+static int reserve(char **buffer, size_t *capacity, size_t size) {
+    size_t grown = *capacity ? *capacity : DAEMON_READ_SIZE;
+    char *data;
+
+    if (size <= *capacity) {
+        return 1;
+    }
+    while (grown < size) {
+        grown *= 2;
+    }
+
+    data = realloc(*buffer, grown);
+    if (data == NULL) {
+        return 0;
+    }
+    *buffer   = data;
+    *capacity = grown;
+
+    return 1;
+}
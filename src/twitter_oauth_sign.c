@@ -36,17 +36,27 @@
 ** For commentary on this license please see http://acme.com/license.html
 */
 
+#include "batch.h"
+#include "daemon.h"
 #include "logger.h"
-#include <ctype.h>
+#include <credential_store.h>
+#include <fcntl.h>
 #include <liboauthsign.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sysexits.h>
+#include <unistd.h>
 
 
 static void usage(void);
-static int check_method(char *method);
+static int batch_main(const char *path, int threads);
+static int make_store_main(const char *store_path, const char *path);
+static int read_account(char *line, OauthAccount *account);
+static char *map_body(const char *path, size_t *length);
+static void hash_body(Builder *b, const char *path);
 //static void exit_safe(void);
 
 static char *program_name;
@@ -65,7 +75,20 @@ int main(int argc, char **argv) {
     int paramc;
     const char **paramv;
     char *result;
-    Builder *b = new_oauth_builder();
+    int batch;
+    const char *batch_file;
+    int threads;
+    const char *daemon_path;
+    int processes;
+    const char *body_file;
+    const char *hash_file;
+    char *body;
+    size_t body_len;
+    const char *store_file;
+    const char *make_store;
+    OauthCredentialStore *store;
+    const OauthCredentials *credentials;
+    Builder *b;
 
     /* Figure out the program's name. */
     {
@@ -81,6 +104,18 @@ int main(int argc, char **argv) {
     query_mode = 0;
     show_sbs   = 0;
     show_curl  = 0;
+    batch      = 0;
+    batch_file = NULL;
+    threads    = 0;
+    daemon_path = NULL;
+    processes   = 1;
+    body_file   = NULL;
+    hash_file   = NULL;
+    body        = NULL;
+    body_len    = 0;
+    store_file  = NULL;
+    make_store  = NULL;
+    store       = NULL;
     while (argn < argc && argv[argn][0] == '-' && argv[argn][1] != '\0') {
         if (strcmp(argv[argn], "-q") == 0)
             query_mode = 1;
@@ -88,26 +123,85 @@ int main(int argc, char **argv) {
             show_sbs = 1;
         else if (strcmp(argv[argn], "-cc") == 0) {
             show_curl = 1;
+        } else if (strcmp(argv[argn], "--batch") == 0) {
+            batch = 1;
+            /* The file is optional, stdin is read without one */
+            if (argn + 1 < argc && (argv[argn + 1][0] != '-' || strcmp(argv[argn + 1], "-") == 0))
+                batch_file = argv[++argn];
+        } else if ((strcmp(argv[argn], "-j") == 0 || strcmp(argv[argn], "--threads") == 0) &&
+                   argn + 1 < argc) {
+            threads = atoi(argv[++argn]);
+        } else if (strcmp(argv[argn], "--daemon") == 0 && argn + 1 < argc) {
+            daemon_path = argv[++argn];
+        } else if (strcmp(argv[argn], "--processes") == 0 && argn + 1 < argc) {
+            processes = atoi(argv[++argn]);
+        } else if (strcmp(argv[argn], "--form-body") == 0 && argn + 1 < argc) {
+            body_file = argv[++argn];
+        } else if (strcmp(argv[argn], "--body-hash") == 0 && argn + 1 < argc) {
+            hash_file = argv[++argn];
+        } else if (strcmp(argv[argn], "--store") == 0 && argn + 1 < argc) {
+            store_file = argv[++argn];
+        } else if (strcmp(argv[argn], "--make-store") == 0 && argn + 1 < argc) {
+            make_store = argv[++argn];
         } else
             usage();
         ++argn;
     }
 
+    if (make_store != ( char * )0) {
+        /* The accounts are read from a file or, without one, stdin */
+        if (argc - argn > 1 || batch || daemon_path != ( char * )0 || store_file != ( char * )0)
+            usage();
+        exit(make_store_main(make_store, argn < argc ? argv[argn] : NULL));
+    }
+
+    if (daemon_path != ( char * )0) {
+        if (argn != argc || batch || body_file != ( char * )0 || hash_file != ( char * )0)
+            usage();
+        exit(run_daemon(daemon_path, threads, processes) == 0 ? EX_OK : EX_OSERR);
+    }
+
+    if (batch) {
+        if (argn != argc || body_file != ( char * )0 || hash_file != ( char * )0 ||
+            store_file != ( char * )0)
+            usage();
+        exit(batch_main(batch_file, threads));
+    }
+
     /* Get args. */
-    if (argc - argn < 6) {
+    if (argc - argn < (store_file != ( char * )0 ? 3 : 6)) {
         usage();
     }
 
-    consumer_key        = argv[argn++];
-    consumer_key_secret = argv[argn++];
-    token               = argv[argn++];
-    token_secret        = argv[argn++];
-    method              = argv[argn++];
+    if (store_file != ( char * )0) {
+        store = open_credential_store(store_file);
+        if (store == ( OauthCredentialStore * )0) {
+            e_log("%s: %s is not a credential store\n", program_name, store_file);
+            exit(EX_NOINPUT);
+        }
+        credentials = find_account(store, argv[argn], strlen(argv[argn]));
+        if (credentials == ( OauthCredentials * )0) {
+            e_log("%s: no account %s in %s\n", program_name, argv[argn], store_file);
+            destroy_credential_store(&store);
+            exit(EX_DATAERR);
+        }
+        ++argn;
+        b = new_oauth_request(credentials);
+    } else {
+        consumer_key        = argv[argn++];
+        consumer_key_secret = argv[argn++];
+        token               = argv[argn++];
+        token_secret        = argv[argn++];
 
-    /***********************************************/
-    /*char *url = strtok(oauth_strdup(key), "?#");*/
-    url = argv[argn++];
-    /***********************************************/
+        b = new_oauth_builder();
+        set_consumer_key(b, consumer_key);
+        set_consumer_secret(b, consumer_key_secret);
+        set_token(b, token);
+        set_token_secret(b, token_secret);
+    }
+    method = argv[argn++];
+
+    url                 = argv[argn++];
 
     paramc = argc - argn;
     paramv = &(argv[argn]);
@@ -122,14 +216,19 @@ int main(int argc, char **argv) {
         exit(EX_USAGE);
     }
 
-
-    set_consumer_key(b, consumer_key);
-    set_consumer_secret(b, consumer_key_secret);
-    set_token(b, token);
-    set_token_secret(b, token_secret);
     set_http_method(b, method);
-    set_base_url(b, url);
+    if (query_mode) {
+        set_request_url(b, url);
+    } else {
+        set_base_url(b, url);
+    }
     set_request_params(b, paramv, paramc);
+    if (body_file != ( char * )0) {
+        body = map_body(body_file, &body_len);
+        set_request_body(b, body, body_len);
+    }
+    if (hash_file != ( char * )0)
+        hash_body(b, hash_file);
 
     result = get_authorization_header(b);
     if (result == ( char * )0) {
@@ -155,38 +254,194 @@ int main(int argc, char **argv) {
     }
 
     destroy_builder(&b);
+    if (store != ( OauthCredentialStore * )0)
+        destroy_credential_store(&store);
+    if (body != ( char * )0)
+        munmap(body, body_len);
 
     exit(EX_OK);
 }
 
-static int check_method(char *method) {
-    static const char *methods[] = {
-        "GET", "POST", "DELETE",
-        "PUT", "HEAD"};
+static int batch_main(const char *path, int threads) {
+    FILE *in = stdin;
+    long failures;
+
+    if (path != ( char * )0 && strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == ( FILE * )0) {
+            e_log("%s: cannot open %s\n", program_name, path);
+            return EX_NOINPUT;
+        }
+    }
+
+    failures = run_batch(in, stdout, threads);
+
+    if (in != stdin)
+        fclose(in);
+
+    if (failures < 0)
+        return EX_IOERR;
+    return failures > 0 ? EX_DATAERR : EX_OK;
+}
+
+/* Writes the accounts read from a file, or stdin, one per line, to a store */
+static int make_store_main(const char *store_path, const char *path) {
+    FILE *in = stdin;
+    OauthAccount *accounts, *grown;
+    char **lines, **more;
+    char *line;
+    size_t count, capacity, line_size, i;
+    long lineno;
+    int status;
 
-    int valid = 0, size = sizeof methods, cnt;
-    char *up = method;
+    if (path != ( char * )0 && strcmp(path, "-") != 0) {
+        in = fopen(path, "r");
+        if (in == ( FILE * )0) {
+            e_log("%s: cannot open %s\n", program_name, path);
+            return EX_NOINPUT;
+        }
+    }
+
+    /* The lines are kept, the accounts point into them */
+    accounts  = ( OauthAccount * )0;
+    lines     = ( char ** )0;
+    count     = 0;
+    capacity  = 0;
+    lineno    = 0;
+    status    = EX_OK;
+    line      = ( char * )0;
+    line_size = 0;
+    while (getline(&line, &line_size, in) > 0) {
+        ++lineno;
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            grown    = realloc(accounts, capacity * sizeof(OauthAccount));
+            more     = realloc(lines, capacity * sizeof(char *));
+            if (grown != ( OauthAccount * )0)
+                accounts = grown;
+            if (more != ( char ** )0)
+                lines = more;
+            if (grown == ( OauthAccount * )0 || more == ( char ** )0) {
+                e_log("%s: out of memory\n", program_name);
+                status = EX_OSERR;
+                break;
+            }
+        }
+        if (!read_account(line, &accounts[count])) {
+            e_log("%s: line %ld: expected account, consumer key, consumer secret, token "
+                  "and token secret separated by tabs\n",
+                  program_name, lineno);
+            status = EX_DATAERR;
+            continue;
+        }
+        lines[count++] = line;
+        line           = ( char * )0;
+        line_size      = 0;
+    }
+    free(line);
+    if (ferror(in)) {
+        e_log("%s: cannot read %s\n", program_name, path != ( char * )0 ? path : "stdin");
+        status = EX_IOERR;
+    }
+    if (in != stdin)
+        fclose(in);
 
-    while (*up) {
-        *up = ( char )toupper(*up);
-        ++up;
+    if (status == EX_OK && !write_credential_store(store_path, accounts, count)) {
+        e_log("%s: cannot write %s, or an account is given twice\n", program_name, store_path);
+        status = EX_CANTCREAT;
     }
 
-    for (cnt = 0; cnt < size; cnt++) {
-        if (strcmp(method, methods[cnt]) == 0) {
-            valid = 1;
+    for (i = 0; i < count; ++i)
+        free(lines[i]);
+    free(lines);
+    free(accounts);
+    return status;
+}
+
+/* Splits a line of five tab separated strings into an account, in place */
+static int read_account(char *line, OauthAccount *account) {
+    char *fields[5];
+    char *end;
+    int n;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    for (n = 0; n < 5; ++n) {
+        fields[n] = line;
+        end       = strchr(line, '\t');
+        if (end == ( char * )0)
             break;
+        *end = '\0';
+        line = end + 1;
+    }
+    if (n != 4)
+        return 0;
+
+    account->account         = fields[0];
+    account->consumer_key    = fields[1];
+    account->consumer_secret = fields[2];
+    account->token           = fields[3];
+    account->token_secret    = fields[4];
+    return 1;
+}
+
+/* Maps a form body into memory, where it is signed without being copied */
+static char *map_body(const char *path, size_t *length) {
+    struct stat st;
+    char *body;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        e_log("%s: cannot open %s\n", program_name, path);
+        exit(EX_NOINPUT);
+    }
+
+    /* An empty body has no parameters, and cannot be mapped anyway */
+    *length = ( size_t )st.st_size;
+    body    = ( char * )0;
+    if (*length > 0) {
+        body = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (body == MAP_FAILED) {
+            e_log("%s: cannot map %s\n", program_name, path);
+            exit(EX_IOERR);
+        }
+    }
+    close(fd);
+
+    return body;
+}
+
+/* Hashes a body which is not form encoded for oauth_body_hash, "-" being stdin */
+static void hash_body(Builder *b, const char *path) {
+    int fd = 0;
+
+    if (strcmp(path, "-") != 0) {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            e_log("%s: cannot open %s\n", program_name, path);
+            exit(EX_NOINPUT);
         }
     }
 
-    return valid;
+    if (hash_body_fd(b, fd) != 0) {
+        e_log("%s: cannot read %s\n", program_name, path);
+        exit(EX_IOERR);
+    }
+
+    if (fd != 0)
+        close(fd);
 }
 
 static void usage(void) {
-    e_log("usage:  %s [-q|-b|-cc] "
+    e_log("usage:  %s [-q|-b|-cc] [--form-body file] [--body-hash file] "
           "<consumer_key> <consumer_key_secret> "
           "<token> <token_secret> <method< <url> "
-          "[name=value ...]\n",
-          program_name);
+          "[name=value ...]\n"
+          "        %s [-q|-b|-cc] [--form-body file] [--body-hash file] --store <store> "
+          "<account> <method> <url> [name=value ...]\n"
+          "        %s --make-store <store> [file]\n"
+          "        %s --batch [file] [-j threads]\n"
+          "        %s --daemon <socket> [-j threads] [--processes n]\n",
+          program_name, program_name, program_name, program_name, program_name);
     exit(EX_USAGE);
 }
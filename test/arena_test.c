@@ -0,0 +1,95 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <arena.h>
+#include <cmocka.h>
+#include <stdint.h>
+#include <string.h>
+
+static int create_test_arena(void **state) {
+    *state = arena_new(256);
+    return *state == NULL ? -1 : 0;
+}
+
+static int destroy_test_arena(void **state) {
+    arena_destroy(*state);
+    return 0;
+}
+
+static void test_alloc_alignment(void **state) {
+    Arena *arena = *state;
+    int i;
+
+    for (i = 1; i < 100; ++i) {
+        char *p = arena_alloc(arena, ( size_t )i);
+        assert_non_null(p);
+        assert_int_equal(0, ( uintptr_t )p % (2 * sizeof(void *)));
+        memset(p, 'x', ( size_t )i);
+    }
+}
+
+static void test_strndup(void **state) {
+    Arena *arena = *state;
+    char *s      = arena_strndup(arena, "include_entities=true", 16);
+
+    assert_string_equal("include_entities", s);
+}
+
+static void test_large_alloc(void **state) {
+    Arena *arena = *state;
+    char *big    = arena_alloc(arena, 10000);
+
+    assert_non_null(big);
+    memset(big, 'x', 10000);
+    assert_non_null(arena_alloc(arena, 8));
+}
+
+static void test_mark_release(void **state) {
+    Arena *arena   = *state;
+    ArenaMark mark = arena_mark(arena);
+    char *first, *second;
+    int i;
+
+    first = arena_alloc(arena, 64);
+    for (i = 0; i < 50; ++i) {
+        assert_non_null(arena_alloc(arena, 100));
+    }
+    arena_release(arena, mark);
+
+    second = arena_alloc(arena, 64);
+    assert_ptr_equal(first, second);
+}
+
+static void test_reset_reuses_chunks(void **state) {
+    Arena *arena = *state;
+    char *before[64], *after;
+    int i;
+
+    arena_reset(arena);
+    for (i = 0; i < 64; ++i) {
+        before[i] = arena_alloc(arena, 100);
+    }
+
+    arena_reset(arena);
+    for (i = 0; i < 64; ++i) {
+        after = arena_alloc(arena, 100);
+        assert_ptr_equal(before[i], after);
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_alloc_alignment),
+        cmocka_unit_test(test_strndup),
+        cmocka_unit_test(test_large_alloc),
+        cmocka_unit_test(test_mark_release),
+        cmocka_unit_test(test_reset_reuses_chunks)};
+    return cmocka_run_group_tests(tests, create_test_arena, destroy_test_arena);
+}
@@ -0,0 +1,114 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <base64.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Long enough to take several SIMD steps and every tail length */
+#define BASE64_TEST_MAX 100
+
+#define X_ENCODING_TESTS                                    \
+    X(empty, "", "", "")                                    \
+    X(one, "f", "Zg==", "Zg%3D%3D")                         \
+    X(two, "fo", "Zm8=", "Zm8%3D")                          \
+    X(three, "foo", "Zm9v", "Zm9v")                         \
+    X(six, "foobar", "Zm9vYmFy", "Zm9vYmFy")                \
+    X(plus_slash, "\xFB\xEF\xFF", "++//", "%2B%2B%2F%2F")
+
+/**
+ * @brief      Reference encoder, one character at a time
+ *
+ * @param      out   The destination
+ * @param[in]  in    The input
+ * @param[in]  len   The input length
+ *
+ * @return     The number of bytes written
+ */
+static size_t reference_encode(char *out, const unsigned char *in, size_t len) {
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t bits, n = 0, i;
+    unsigned long buffer = 0;
+
+    for (i = 0, bits = 0; i < len; ++i) {
+        buffer = buffer << 8 | in[i];
+        for (bits += 8; bits >= 6; bits -= 6) {
+            out[n++] = alphabet[buffer >> (bits - 6) & 0x3F];
+        }
+    }
+    if (bits > 0) {
+        out[n++] = alphabet[buffer << (6 - bits) & 0x3F];
+    }
+    while (n % 4 != 0) {
+        out[n++] = '=';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+#define X(name, in, plain, escaped)                                                    \
+    static void test_##name(void **state) {                                            \
+        char out[BASE64_ESCAPED_LENGTH(sizeof in) + 1];                                \
+        ( void )state;                                                                 \
+                                                                                       \
+        assert_int_equal(base64_encode(out, ( const unsigned char * )in, sizeof in - 1), \
+                         strlen(plain));                                               \
+        assert_string_equal(out, plain);                                               \
+        assert_int_equal(                                                              \
+            base64_encode_escaped(out, ( const unsigned char * )in, sizeof in - 1),    \
+            strlen(escaped));                                                          \
+        assert_string_equal(out, escaped);                                             \
+    }
+
+X_ENCODING_TESTS
+#undef X
+
+static void test_matches_reference(void **state) {
+    unsigned char in[BASE64_TEST_MAX];
+    char out[BASE64_ESCAPED_LENGTH(BASE64_TEST_MAX) + 1];
+    char expected[BASE64_ESCAPED_LENGTH(BASE64_TEST_MAX) + 1];
+    size_t length, i, n, e;
+    ( void )state;
+
+    srand(42);
+    for (i = 0; i < sizeof in; ++i) {
+        in[i] = ( unsigned char )rand();
+    }
+
+    for (length = 0; length <= BASE64_TEST_MAX; ++length) {
+        n = reference_encode(expected, in, length);
+        assert_int_equal(base64_encode(out, in, length), n);
+        assert_string_equal(out, expected);
+
+        /* The escaped form of the reference, built the slow way */
+        for (i = 0, e = 0; i < n; ++i) {
+            if (expected[i] == '+' || expected[i] == '/' || expected[i] == '=') {
+                e += ( size_t )sprintf(out + e, "%%%02X", ( unsigned int )expected[i]);
+            } else {
+                out[e++] = expected[i];
+            }
+        }
+        out[e] = '\0';
+        strcpy(expected, out);
+
+        assert_int_equal(base64_encode_escaped(out, in, length), e);
+        assert_string_equal(out, expected);
+    }
+}
+
+int main(void) {
+#define X(name, in, plain, escaped) cmocka_unit_test(test_##name),
+    const struct CMUnitTest tests[] = {X_ENCODING_TESTS cmocka_unit_test(test_matches_reference)};
+#undef X
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,201 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <credential_store.h>
+#include <liboauthsign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TOKEN "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb"
+
+/** The number of accounts of the large store */
+#define ACCOUNTS 20000
+
+static const OauthAccount DOCUMENTED = {
+    TOKEN, "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw", TOKEN,
+    "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE"};
+
+static char *temp_path(void) {
+    char *path = strdup("/tmp/credential_store_testXXXXXX");
+    int fd     = mkstemp(path);
+
+    assert_true(fd >= 0);
+    close(fd);
+    return path;
+}
+
+static char *sign_with(const OauthCredentials *credentials) {
+    const char *params[] = {"status=Hello Ladies + Gentlemen, a signed OAuth request!",
+                            "include_entities=true"};
+    Builder *builder = new_oauth_request(credentials);
+    char *header;
+
+    set_http_method(builder, "POST");
+    set_base_url(builder, "https://api.twitter.com/1/statuses/update.json");
+    set_request_params(builder, params, 2);
+    set_nonce(builder, "kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg");
+    set_timestamp(builder, "1318622958");
+    header = get_authorization_header(builder);
+
+    destroy_builder(&builder);
+    return header;
+}
+
+static void test_sign_from_store(void **state) {
+    OauthAccount accounts[3] = {
+        {"one", "key one", "secret/one", "token one", "token+secret"},
+        DOCUMENTED,
+        {"three", "key3", "", "", ""}};
+    char *path = temp_path(), *expected, *header;
+    OauthCredentials *copied;
+    OauthCredentialStore *store;
+    const OauthCredentials *stored;
+    size_t i;
+    ( void )state;
+
+    assert_true(write_credential_store(path, accounts, 3));
+    store = open_credential_store(path);
+    assert_non_null(store);
+    assert_int_equal(get_store_size(store), 3);
+
+    // Credentials from the store sign just as copied ones do
+    for (i = 0; i < 3; ++i) {
+        stored = find_account(store, accounts[i].account, strlen(accounts[i].account));
+        assert_non_null(stored);
+        assert_true(find_account(store, accounts[i].account, strlen(accounts[i].account)) ==
+                    stored);
+
+        copied = new_oauth_credentials(accounts[i].consumer_key, accounts[i].consumer_secret,
+                                       accounts[i].token, accounts[i].token_secret);
+        expected = sign_with(copied);
+        header   = sign_with(stored);
+        assert_string_equal(header, expected);
+        free(header);
+        free(expected);
+        destroy_credentials(&copied);
+    }
+
+    assert_null(find_account(store, "two", 3));
+    assert_null(find_account(store, "on", 2));
+    destroy_credential_store(&store);
+    assert_null(store);
+
+    unlink(path);
+    free(path);
+}
+
+static void test_many_accounts(void **state) {
+    OauthAccount *accounts = calloc(ACCOUNTS, sizeof(OauthAccount));
+    char (*names)[16]      = calloc(ACCOUNTS, sizeof names[0]);
+    char *path             = temp_path();
+    OauthCredentialStore *store;
+    int i;
+    ( void )state;
+
+    for (i = 0; i < ACCOUNTS; ++i) {
+        snprintf(names[i], sizeof names[i], "%d", i);
+        accounts[i].account         = names[i];
+        accounts[i].consumer_key    = "key";
+        accounts[i].consumer_secret = "secret";
+        accounts[i].token           = names[i];
+        accounts[i].token_secret    = names[i];
+    }
+    assert_true(write_credential_store(path, accounts, ACCOUNTS));
+
+    store = open_credential_store(path);
+    assert_non_null(store);
+    assert_int_equal(get_store_size(store), ACCOUNTS);
+    for (i = 0; i < ACCOUNTS; ++i) {
+        assert_non_null(find_account(store, names[i], strlen(names[i])));
+    }
+    assert_null(find_account(store, "-1", 2));
+    destroy_credential_store(&store);
+
+    // An account given twice
+    accounts[ACCOUNTS - 1].account = accounts[0].account;
+    assert_false(write_credential_store(path, accounts, ACCOUNTS));
+
+    unlink(path);
+    free(path);
+    free(names);
+    free(accounts);
+}
+
+static void test_bad_files(void **state) {
+    char *path = temp_path();
+    OauthCredentialStore *store;
+    FILE *file;
+    ( void )state;
+
+    assert_null(open_credential_store(path));
+    file = fopen(path, "w");
+    fputs("consumer_key\tconsumer_secret\ttoken\ttoken_secret\n", file);
+    fputs("consumer_key\tconsumer_secret\ttoken\ttoken_secret\n", file);
+    fclose(file);
+    assert_null(open_credential_store(path));
+    assert_null(open_credential_store("/nonexistent/store"));
+
+    // An empty store is still a store
+    assert_true(write_credential_store(path, NULL, 0));
+    store = open_credential_store(path);
+    assert_non_null(store);
+    assert_int_equal(get_store_size(store), 0);
+    assert_null(find_account(store, "one", 3));
+    destroy_credential_store(&store);
+
+    unlink(path);
+    free(path);
+}
+
+static void test_verify_from_store(void **state) {
+    const char *header = "OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", "
+                         "oauth_nonce=\"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg\", "
+                         "oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2FjLY%3D\", "
+                         "oauth_signature_method=\"HMAC-SHA1\", "
+                         "oauth_timestamp=\"1318622958\", oauth_token=\"" TOKEN "\", "
+                         "oauth_version=\"1.0\"";
+    const char *params[] = {"status=Hello Ladies + Gentlemen, a signed OAuth request!",
+                            "include_entities=true"};
+    char *path           = temp_path();
+    OauthCredentialStore *store;
+    Builder *builder;
+    ( void )state;
+
+    assert_true(write_credential_store(path, &DOCUMENTED, 1));
+    store   = open_credential_store(path);
+    builder = new_oauth_builder();
+    set_http_method(builder, "POST");
+    set_base_url(builder, "https://api.twitter.com/1/statuses/update.json");
+    set_request_params(builder, params, 2);
+    assert_true(verify_authorization_header(builder, header, strlen(header),
+                                            find_stored_credentials, store) == OAUTH_VERIFY_OK);
+
+    // The token is found but the consumer key is not its own
+    assert_null(
+        find_stored_credentials("xvz1evFS4wEEPTGEFPHBoh", 22, TOKEN, strlen(TOKEN), store));
+
+    destroy_builder(&builder);
+    destroy_credential_store(&store);
+    unlink(path);
+    free(path);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_sign_from_store),
+        cmocka_unit_test(test_many_accounts),
+        cmocka_unit_test(test_bad_files),
+        cmocka_unit_test(test_verify_from_store),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
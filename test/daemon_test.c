@@ -0,0 +1,155 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <daemon.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Enough requests for their replies to pass the daemon's limit on unsent replies */
+#define REQUESTS 6000
+
+/** How long to wait for the daemon before giving up on it, in milliseconds */
+#define TIMEOUT 10000
+
+static const char *fields[] = {"k", "s", "t", "x", "GET", "http://a/"};
+
+typedef struct {
+    pid_t pid;
+    char path[64];
+} Daemon;
+
+static int start_daemon(void **state) {
+    Daemon *daemon = calloc(1, sizeof(Daemon));
+
+    snprintf(daemon->path, sizeof daemon->path, "/tmp/daemon_test.%ld", ( long )getpid());
+    daemon->pid = fork();
+    if (daemon->pid == 0) {
+        _exit(run_daemon(daemon->path, 1, 1) == 0 ? 0 : 1);
+    }
+
+    *state = daemon;
+    return daemon->pid > 0 ? 0 : -1;
+}
+
+static int stop_daemon(void **state) {
+    Daemon *daemon = *state;
+    int status     = 1;
+
+    kill(daemon->pid, SIGTERM);
+    waitpid(daemon->pid, &status, 0);
+    free(daemon);
+
+    return status == 0 ? 0 : -1;
+}
+
+static int connect_daemon(const Daemon *daemon) {
+    struct sockaddr_un address;
+    int fd, tries;
+
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, daemon->path);
+
+    /* The daemon may not be listening yet */
+    for (tries = 0; tries < 1000; ++tries) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, ( struct sockaddr * )&address, sizeof address) == 0) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        usleep(10000);
+    }
+
+    return -1;
+}
+
+static size_t put_request(unsigned char *out) {
+    size_t length = 2, size, i;
+
+    out[4] = 0;
+    out[5] = sizeof fields / sizeof fields[0];
+    for (i = 0; i < sizeof fields / sizeof fields[0]; ++i) {
+        size                  = strlen(fields[i]);
+        out[4 + length]       = ( unsigned char )(size >> 8);
+        out[4 + length + 1]   = ( unsigned char )size;
+        memcpy(out + 4 + length + 2, fields[i], size);
+        length += 2 + size;
+    }
+    out[0] = 0;
+    out[1] = 0;
+    out[2] = ( unsigned char )(length >> 8);
+    out[3] = ( unsigned char )length;
+
+    return 4 + length;
+}
+
+static void transfer(int fd, short events, unsigned char *data, size_t length) {
+    struct pollfd wait = {fd, events, 0};
+    size_t done        = 0;
+    ssize_t n;
+
+    while (done < length) {
+        assert_int_equal(poll(&wait, 1, TIMEOUT), 1);
+        n = events == POLLOUT ? send(fd, data + done, length - done, MSG_DONTWAIT)
+                              : recv(fd, data + done, length - done, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            continue;
+        }
+        assert_true(n > 0);
+        done += ( size_t )n;
+    }
+}
+
+static void test_pipelined_requests(void **state) {
+    unsigned char request[64], reply[1024], *requests;
+    size_t size = put_request(request), length, i;
+    int fd      = connect_daemon(*state);
+
+    assert_true(fd >= 0);
+
+    /* Every request goes out before any reply is read */
+    requests = malloc(size * REQUESTS);
+    for (i = 0; i < REQUESTS; ++i) {
+        memcpy(requests + i * size, request, size);
+    }
+    transfer(fd, POLLOUT, requests, size * REQUESTS);
+
+    /* Gives the replies time to pile up past the daemon's limit */
+    usleep(100000);
+
+    for (i = 0; i < REQUESTS; ++i) {
+        transfer(fd, POLLIN, reply, 4);
+        length = ( size_t )reply[0] << 24 | ( size_t )reply[1] << 16 | ( size_t )reply[2] << 8 |
+                 reply[3];
+        assert_true(length > 1 && length < sizeof reply);
+        transfer(fd, POLLIN, reply, length);
+        assert_int_equal(reply[0], 0);
+        assert_memory_equal(reply + 1, "OAuth ", 6);
+    }
+
+    free(requests);
+    close(fd);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_pipelined_requests)};
+    return cmocka_run_group_tests(tests, start_daemon, stop_daemon);
+}
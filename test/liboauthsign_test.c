@@ -11,8 +11,10 @@
 #include <cmocka.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-#define X_DEFAULT_TESTS                                               \
+#define X_PLAIN_SETTER_TESTS                                          \
     X(consumer_key, "xvz1evFS4wEEPTGEFPHBog")                         \
     X(consumer_secret, "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw") \
     X(token, "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb")    \
@@ -20,27 +22,47 @@
     X(http_method, "POST")                                            \
     X(base_url, "https://api.twitter.com/1/statuses/update.json")     \
     X(nonce, "kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg")            \
-    X(signature_method, "HMAC-SHA1")                                  \
     X(timestamp, "1318622958")                                        \
     X(oauth_version, "1.0")
 
+/** The signature method is apart since its setter can refuse a method */
+#define X_DEFAULT_TESTS    \
+    X_PLAIN_SETTER_TESTS   \
+    X(signature_method, "HMAC-SHA1")
+
 typedef struct mBuilder Builder;
+typedef struct mCredentials OauthCredentials;
 
 extern Builder *new_oauth_builder(void);
+extern void reset_builder(Builder *);
 extern void destroy_builder(Builder **);
+extern OauthCredentials *new_oauth_credentials(const char *, const char *,
+                                               const char *, const char *);
+extern void destroy_credentials(OauthCredentials **);
+extern Builder *new_oauth_request(const OauthCredentials *);
 
 // implicit setters and getters
 #define X(name, _)                                               \
     extern void set_##name(Builder *builder, const char *value); \
     extern char *get_##name(const Builder *builder);
 
-X_DEFAULT_TESTS
+X_PLAIN_SETTER_TESTS
 
+extern int set_signature_method(Builder *builder, const char *value);
+extern char *get_signature_method(const Builder *builder);
 extern void set_request_params(Builder *builder, const char **params, int length);
+extern void set_request_url(Builder *builder, const char *url);
+extern void set_request_body(Builder *builder, const char *body, size_t length);
+extern void update_body_hash(Builder *builder, const void *data, size_t length);
+extern int hash_body_fd(Builder *builder, int fd);
 extern char **get_request_params(const Builder *builder);
 extern char *get_authorization_header(Builder *builder);
 extern char *get_cURL_command(Builder *builder);
 extern char *get_signature_base(Builder *builder);
+extern char *get_signature(const Builder *builder);
+extern size_t get_authorization_header_into(Builder *builder, char *buffer, size_t size);
+extern size_t get_cURL_command_into(Builder *builder, char *buffer, size_t size);
+extern size_t get_signature_base_into(const Builder *builder, char *buffer, size_t size);
 
 #undef X
 
@@ -142,6 +164,10 @@ static void test_get_header_string(void **state) {
                         "oauth_version=\"1.0\"",
                         value);
     free(value);
+
+    value = get_signature(builder);
+    assert_string_equal("tnnArxj06cWHq44gCs1OSKk/jLY=", value);
+    free(value);
 }
 
 static void test_get_cURL_command(void **state) {
@@ -160,6 +186,411 @@ static void test_get_cURL_command(void **state) {
     free(value);
 }
 
+static void test_reset_builder(void **state) {
+    Builder *builder = new_oauth_builder();
+    char *first, *second;
+    int round;
+    ( void )state;
+
+    const char *params[] = {
+        "include_entities=true",
+        "status=Hello Ladies + Gentlemen, a signed OAuth request!"};
+
+    for (round = 0; round < 2; ++round) {
+#define X(name, str) set_##name(builder, str);
+        X_DEFAULT_TESTS
+#undef X
+        set_request_params(builder, params, sizeof params / sizeof params[0]);
+
+        if (round == 0) {
+            first = get_authorization_header(builder);
+            reset_builder(builder);
+        } else {
+            second = get_authorization_header(builder);
+        }
+    }
+
+    assert_string_equal(first, second);
+    free(first);
+    free(second);
+    destroy_builder(&builder);
+}
+
+static void test_shared_credentials(void **state) {
+    OauthCredentials *credentials = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb",
+        "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    Builder *builder = new_oauth_request(credentials);
+    char *value;
+    int round;
+    ( void )state;
+
+    const char *params[] = {
+        "include_entities=true",
+        "status=Hello Ladies + Gentlemen, a signed OAuth request!"};
+
+    // the credentials must survive the builder being reset
+    for (round = 0; round < 2; ++round) {
+        reset_builder(builder);
+        set_http_method(builder, "POST");
+        set_base_url(builder, "https://api.twitter.com/1/statuses/update.json");
+        set_nonce(builder, "kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg");
+        set_timestamp(builder, "1318622958");
+        set_request_params(builder, params, sizeof params / sizeof params[0]);
+
+        value = get_authorization_header(builder);
+        assert_string_equal("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", "
+                            "oauth_nonce=\"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg\", "
+                            "oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2FjLY%3D\", "
+                            "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1318622958\", "
+                            "oauth_token=\"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb\", "
+                            "oauth_version=\"1.0\"",
+                            value);
+        free(value);
+    }
+
+    value = get_token_secret(builder);
+    assert_string_equal("LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE", value);
+    free(value);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+    assert_null(credentials);
+}
+
+static void test_short_signing_key(void **state) {
+    // secrets which need encoding and give a key shorter than a SHA-1 block
+    OauthCredentials *credentials = new_oauth_credentials("ck", "c s", "tk", "t+s");
+    Builder *builder              = new_oauth_request(credentials);
+    char *value;
+    ( void )state;
+
+    set_http_method(builder, "GET");
+    set_base_url(builder, "https://api.twitter.com/1.1/statuses/home_timeline.json");
+    set_nonce(builder, "abc");
+    set_timestamp(builder, "1318622958");
+    set_request_params(builder, NULL, 0);
+
+    value = get_authorization_header(builder);
+    assert_string_equal("OAuth oauth_consumer_key=\"ck\", oauth_nonce=\"abc\", "
+                        "oauth_signature=\"cavKrYOJI%2F6JfKYv%2ByNo3N1Iu%2Bo%3D\", "
+                        "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1318622958\", "
+                        "oauth_token=\"tk\", oauth_version=\"1.0\"",
+                        value);
+    free(value);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static void test_request_token(void **state) {
+    // no token secret yet, so the key is the encoded consumer secret and '&'
+    Builder *builder = new_oauth_builder();
+    char *value;
+    ( void )state;
+
+    set_http_method(builder, "GET");
+    set_base_url(builder, "https://api.twitter.com/oauth/request_token");
+    set_nonce(builder, "abc");
+    set_timestamp(builder, "1318622958");
+    set_request_params(builder, NULL, 0);
+    set_consumer_key(builder, "ck");
+
+    // without a consumer secret there is nothing to sign with
+    assert_null(get_authorization_header(builder));
+
+    set_consumer_secret(builder, "cs");
+    value = get_signature_base(builder);
+    assert_string_equal("GET&https%3A%2F%2Fapi.twitter.com%2Foauth%2Frequest_token&"
+                        "oauth_consumer_key%3Dck%26oauth_nonce%3Dabc%26"
+                        "oauth_signature_method%3DHMAC-SHA1%26oauth_timestamp%3D1318622958%26"
+                        "oauth_token%3D%26oauth_version%3D1.0",
+                        value);
+    free(value);
+
+    value = get_authorization_header(builder);
+    assert_non_null(value);
+    free(value);
+    value = get_signature(builder);
+    assert_string_equal("/w8TDXPF0QuYHNHIlcuL4oCkDJA=", value);
+    free(value);
+
+    destroy_builder(&builder);
+}
+
+static void test_hmac_sha256(void **state) {
+    OauthCredentials *credentials = new_oauth_credentials("ck", "c s", "tk", "t+s");
+    Builder *builder              = new_oauth_request(credentials);
+    char *value;
+    ( void )state;
+
+    set_http_method(builder, "GET");
+    set_base_url(builder, "https://api.twitter.com/1.1/statuses/home_timeline.json");
+    set_nonce(builder, "abc");
+    set_timestamp(builder, "1318622958");
+    assert_int_equal(set_signature_method(builder, "HMAC-SHA256"), 0);
+    assert_int_equal(set_signature_method(builder, "RSA-SHA1"), -1);
+    set_request_params(builder, NULL, 0);
+
+    value = get_authorization_header(builder);
+    assert_string_equal("OAuth oauth_consumer_key=\"ck\", oauth_nonce=\"abc\", "
+                        "oauth_signature=\"H3GK%2FIJB6MSpsKT%2BWSGMA3cEDwuGEwZ1i79TvUwx0GU%3D\", "
+                        "oauth_signature_method=\"HMAC-SHA256\", oauth_timestamp=\"1318622958\", "
+                        "oauth_token=\"tk\", oauth_version=\"1.0\"",
+                        value);
+    free(value);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static int compare_param_strings(const void *v1, const void *v2) {
+    const char *s1 = *( const char *const * )v1, *s2 = *( const char *const * )v2;
+    size_t n1 = strcspn(s1, "="), n2 = strcspn(s2, "=");
+    int r     = strncmp(s1, s2, n1 < n2 ? n1 : n2);
+
+    if (r == 0 && n1 != n2) {
+        r = n1 < n2 ? -1 : 1;
+    }
+    return r != 0 ? r : strcmp(s1 + n1, s2 + n2);
+}
+
+static void test_many_request_params(void **state) {
+    // enough params to be radix sorted, with shared prefixes and repeated names
+    const char *params[300], *sorted[300];
+    char storage[300][16], **result;
+    Builder *builder = new_oauth_builder();
+    int i, count = sizeof params / sizeof params[0];
+    ( void )state;
+
+    for (i = 0; i < count; ++i) {
+        snprintf(storage[i], sizeof storage[i], "%.*s=%d", 1 + (i * 7) % 5, "idsid" + (i % 3),
+                 (i * 37) % 101);
+        params[i] = sorted[i] = storage[i];
+    }
+    qsort(sorted, ( size_t )count, sizeof sorted[0], compare_param_strings);
+
+    set_request_params(builder, params, count);
+    result = get_request_params(builder);
+    for (i = 0; i < count; ++i) {
+        assert_string_equal(sorted[i], result[i]);
+        free(result[i]);
+    }
+    free(result);
+
+    destroy_builder(&builder);
+}
+
+static void sign_url_request(Builder *builder, const char *url, const char **params, int length) {
+    set_http_method(builder, "GET");
+    set_nonce(builder, "abc");
+    set_timestamp(builder, "1318622958");
+    if (url != NULL) {
+        set_request_url(builder, url);
+    } else {
+        set_base_url(builder, "https://api.twitter.com/1.1/statuses/user_timeline.json");
+    }
+    set_request_params(builder, params, length);
+}
+
+static void test_request_url(void **state) {
+    const char *params[] = {"screen_name=jack dorsey", "count=2", "include_rts"};
+    OauthCredentials *credentials = new_oauth_credentials("ck", "cs", "tk", "ts");
+    Builder *expected = new_oauth_request(credentials), *builder = new_oauth_request(credentials);
+    char *want, *got;
+    ( void )state;
+
+    sign_url_request(expected, NULL, params, 3);
+
+    // the query string is signed like the same params given apart, whatever
+    // way it encodes them, and the fragment is dropped
+    sign_url_request(builder,
+                     "https://api.twitter.com/1.1/statuses/user_timeline.json"
+                     "?screen_name=jack%20dorsey&&count=2&include_rts#top",
+                     NULL, 0);
+    want = get_signature_base(expected);
+    got  = get_signature_base(builder);
+    assert_string_equal(want, got);
+    free(got);
+
+    reset_builder(builder);
+    sign_url_request(builder,
+                     "https://api.twitter.com/1.1/statuses/user_timeline.json"
+                     "?include_rts&screen_name=jack+dors%65y&count=2",
+                     NULL, 0);
+    got = get_signature_base(builder);
+    assert_string_equal(want, got);
+    free(got);
+
+    // and merges with the other request params
+    reset_builder(builder);
+    sign_url_request(builder,
+                     "https://api.twitter.com/1.1/statuses/user_timeline.json?count=2&include_rts",
+                     params, 1);
+    free(want);
+    want = get_authorization_header(expected);
+    got  = get_authorization_header(builder);
+    assert_string_equal(want, got);
+    free(got);
+    free(want);
+
+    // only the base url is returned
+    got = get_base_url(builder);
+    assert_string_equal("https://api.twitter.com/1.1/statuses/user_timeline.json", got);
+    free(got);
+
+    destroy_builder(&builder);
+    destroy_builder(&expected);
+    destroy_credentials(&credentials);
+}
+
+static void test_request_body(void **state) {
+    // long enough to be decoded in many pieces, with escapes across their ends
+    enum { MEDIA_SIZE = 10000 };
+    const char *params[] = {"media_data=", "media_category=tweet_image", "tag=b", "tag=a c"};
+    OauthCredentials *credentials = new_oauth_credentials("ck", "cs", "tk", "ts");
+    Builder *expected = new_oauth_request(credentials), *builder = new_oauth_request(credentials);
+    char *media = malloc(MEDIA_SIZE + 12), *body = malloc(3 * MEDIA_SIZE + 64), *want, *got;
+    size_t length = 0;
+    int i;
+    ( void )state;
+
+    assert_non_null(media);
+    assert_non_null(body);
+    strcpy(media, params[0]);
+    length = strlen(strcpy(body, "tag=a+c&media_category=tweet_image&tag=b&media_data="));
+    for (i = 0; i < MEDIA_SIZE; ++i) {
+        media[11 + i] = "AZaz09+/="[(i * 7) % 9];
+        switch (media[11 + i]) {
+        case '+':
+            length += strlen(strcpy(body + length, "%2B"));
+            break;
+        case '/':
+            length += strlen(strcpy(body + length, "%2f"));
+            break;
+        case '=':
+            length += strlen(strcpy(body + length, "%3D"));
+            break;
+        default:
+            body[length++] = media[11 + i];
+        }
+    }
+    media[11 + MEDIA_SIZE] = '\0';
+    params[0]              = media;
+
+    set_http_method(expected, "POST");
+    set_base_url(expected, "https://upload.twitter.com/1.1/media/upload.json");
+    set_nonce(expected, "abc");
+    set_timestamp(expected, "1318622958");
+    set_request_params(expected, params, 4);
+
+    // the body is not null terminated
+    set_http_method(builder, "POST");
+    set_base_url(builder, "https://upload.twitter.com/1.1/media/upload.json");
+    set_nonce(builder, "abc");
+    set_timestamp(builder, "1318622958");
+    body[length] = '&';
+    set_request_body(builder, body, length);
+
+    want = get_signature_base(expected);
+    got  = get_signature_base(builder);
+    assert_string_equal(want, got);
+    free(got);
+    free(want);
+
+    want = get_authorization_header(expected);
+    got  = get_authorization_header(builder);
+    assert_string_equal(want, got);
+    free(got);
+    free(want);
+
+    destroy_builder(&builder);
+    destroy_builder(&expected);
+    destroy_credentials(&credentials);
+    free(body);
+    free(media);
+}
+
+static void test_body_hash(void **state) {
+    OauthCredentials *credentials = new_oauth_credentials("ck", "cs", "tk", "ts");
+    Builder *builder              = new_oauth_request(credentials);
+    char *header, *base;
+    int fds[2];
+    ( void )state;
+
+    // the example of the body hash extension, given in pieces
+    sign_url_request(builder, "https://ads-api.twitter.com/12/accounts", NULL, 0);
+    update_body_hash(builder, "Hello ", 6);
+    update_body_hash(builder, "World!", 6);
+    header = get_authorization_header(builder);
+    assert_int_equal(0, strncmp("OAuth oauth_body_hash=\"Lve95gjOVATpfV8EL5X4nxwjKHE%3D\", "
+                                "oauth_consumer_key=\"ck\"",
+                                header, 79));
+    free(header);
+
+    // and it is signed
+    base = get_signature_base(builder);
+    assert_non_null(strstr(base, "&oauth_body_hash%3DLve95gjOVATpfV8EL5X4nxwjKHE%253D%26"));
+    free(base);
+
+    // read from a file descriptor and hashed for HMAC-SHA256
+    reset_builder(builder);
+    sign_url_request(builder, "https://ads-api.twitter.com/12/accounts", NULL, 0);
+    set_signature_method(builder, "HMAC-SHA256");
+    assert_int_equal(0, pipe(fds));
+    assert_int_equal(12, write(fds[1], "Hello World!", 12));
+    close(fds[1]);
+    assert_int_equal(0, hash_body_fd(builder, fds[0]));
+    close(fds[0]);
+    header = get_authorization_header(builder);
+    assert_non_null(
+        strstr(header, "oauth_body_hash=\"f4OxZX%2Fx%2FFO5LcGBSKHWXfwtSx%2Bj1ncoSt3SABJtkGk%3D\""));
+    free(header);
+
+    // without a body there is no body hash
+    reset_builder(builder);
+    sign_url_request(builder, "https://ads-api.twitter.com/12/accounts", NULL, 0);
+    header = get_authorization_header(builder);
+    assert_null(strstr(header, "oauth_body_hash"));
+    free(header);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static void test_into_buffers(void **state) {
+    Builder *builder = *state;
+    char buffer[1024], small[16];
+    char *value;
+    size_t length;
+
+    // the group builder has every value set, so each call gives the same output
+    value  = get_authorization_header(builder);
+    length = get_authorization_header_into(builder, NULL, 0);
+    assert_int_equal(strlen(value), length);
+    assert_int_equal(length, get_authorization_header_into(builder, buffer, sizeof buffer));
+    assert_string_equal(value, buffer);
+
+    // a short buffer is cut and terminated, and the full length still returned
+    assert_int_equal(length, get_authorization_header_into(builder, small, sizeof small));
+    assert_int_equal(0, strncmp(value, small, sizeof small - 1));
+    assert_int_equal('\0', small[sizeof small - 1]);
+    free(value);
+
+    value = get_cURL_command(builder);
+    assert_int_equal(strlen(value), get_cURL_command_into(builder, buffer, sizeof buffer));
+    assert_string_equal(value, buffer);
+    free(value);
+
+    value = get_signature_base(builder);
+    assert_int_equal(strlen(value), get_signature_base_into(builder, buffer, sizeof buffer));
+    assert_string_equal(value, buffer);
+    assert_int_equal(strlen(value), get_signature_base_into(builder, small, 1));
+    assert_int_equal('\0', small[0]);
+    free(value);
+}
+
 int main(void) {
     // create the array of tests
     const struct CMUnitTest tests[] = {
@@ -167,7 +598,17 @@ int main(void) {
         X_DEFAULT_TESTS cmocka_unit_test(test_get_request_params),
         cmocka_unit_test(test_get_header_string),
         cmocka_unit_test(test_get_cURL_command),
-        cmocka_unit_test(test_get_signature_base)
+        cmocka_unit_test(test_get_signature_base),
+        cmocka_unit_test(test_reset_builder),
+        cmocka_unit_test(test_shared_credentials),
+        cmocka_unit_test(test_short_signing_key),
+        cmocka_unit_test(test_request_token),
+        cmocka_unit_test(test_hmac_sha256),
+        cmocka_unit_test(test_into_buffers),
+        cmocka_unit_test(test_many_request_params),
+        cmocka_unit_test(test_request_url),
+        cmocka_unit_test(test_request_body),
+        cmocka_unit_test(test_body_hash)
 #undef X
     };
     return cmocka_run_group_tests(tests, create_test_builder,
@@ -0,0 +1,97 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <nonce.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/** Enough nonces to go through the thread's ring several times */
+#define NONCE_TEST_COUNT 2000
+
+static int compare_nonces(const void *a, const void *b) {
+    return memcmp(a, b, NONCE_LENGTH + 1);
+}
+
+static void test_nonce_format(void **state) {
+    char nonce[NONCE_LENGTH + 1];
+    size_t i;
+    ( void )state;
+
+    assert_int_equal(make_nonce(nonce), 1);
+    assert_int_equal(strlen(nonce), NONCE_LENGTH);
+    for (i = 0; i < NONCE_LENGTH; ++i) {
+        assert_true((nonce[i] >= '0' && nonce[i] <= '9') || (nonce[i] >= 'A' && nonce[i] <= 'Z') ||
+                    (nonce[i] >= 'a' && nonce[i] <= 'z'));
+    }
+}
+
+static void test_nonces_distinct(void **state) {
+    char(*nonces)[NONCE_LENGTH + 1] = malloc(NONCE_TEST_COUNT * sizeof *nonces);
+    size_t seen[62] = {0}, i, j;
+    const char *c;
+    ( void )state;
+
+    assert_non_null(nonces);
+    for (i = 0; i < NONCE_TEST_COUNT; ++i) {
+        assert_int_equal(make_nonce(nonces[i]), 1);
+        for (j = 0; j < NONCE_LENGTH; ++j) {
+            c = nonces[i] + j;
+            seen[*c <= '9' ? *c - '0' : *c <= 'Z' ? *c - 'A' + 10 : *c - 'a' + 36]++;
+        }
+    }
+
+    qsort(nonces, NONCE_TEST_COUNT, sizeof *nonces, compare_nonces);
+    for (i = 1; i < NONCE_TEST_COUNT; ++i) {
+        assert_memory_not_equal(nonces[i - 1], nonces[i], NONCE_LENGTH);
+    }
+
+    /* 64000 characters put about 1032 on each; anything this far off is not chance */
+    for (i = 0; i < 62; ++i) {
+        assert_in_range(seen[i], 800, 1300);
+    }
+
+    free(nonces);
+}
+
+static void test_fork_refills(void **state) {
+    char parent[NONCE_LENGTH + 1], child[NONCE_LENGTH + 1];
+    int pipe_fds[2], status;
+    pid_t pid;
+    ( void )state;
+
+    /* Leaves most of the ring unused, for the child to inherit */
+    assert_int_equal(make_nonce(parent), 1);
+    assert_int_equal(pipe(pipe_fds), 0);
+
+    pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        _exit(make_nonce(child) && write(pipe_fds[1], child, sizeof child) == sizeof child ? 0 : 1);
+    }
+
+    assert_int_equal(make_nonce(parent), 1);
+    assert_int_equal(read(pipe_fds[0], child, sizeof child), sizeof child);
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_int_equal(status, 0);
+    assert_memory_not_equal(parent, child, NONCE_LENGTH);
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_nonce_format),
+                                       cmocka_unit_test(test_nonces_distinct),
+                                       cmocka_unit_test(test_fork_refills)};
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,301 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <liboauthsign.h>
+#include <oauth_alloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Room for any header of these tests */
+#define HEADER_SIZE 1024
+
+typedef struct {
+    size_t calls;
+    size_t live;
+    /* While failing, the allocations left before malloc() gives NULL */
+    int failing;
+    size_t left;
+} Counts;
+
+static Counts counts;
+
+/* Tells whether the failing allocator has run out, using up one allocation */
+static int run_out(Counts *context) {
+    if (!context->failing) {
+        return 0;
+    }
+    if (context->left == 0) {
+        return 1;
+    }
+    context->left--;
+    return 0;
+}
+
+static void *counting_malloc(size_t size, void *context) {
+    void *ptr = run_out(context) ? NULL : malloc(size);
+    if (ptr != NULL) {
+        (( Counts * )context)->calls++;
+        (( Counts * )context)->live++;
+    }
+    return ptr;
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *context) {
+    void *moved = run_out(context) ? NULL : realloc(ptr, size);
+    if (moved != NULL) {
+        (( Counts * )context)->calls++;
+        (( Counts * )context)->live += ptr == NULL;
+    }
+    return moved;
+}
+
+static void counting_free(void *ptr, void *context) {
+    (( Counts * )context)->live -= ptr != NULL;
+    free(ptr);
+}
+
+static void load_request(Builder *builder) {
+    const char *params[] = {"status=Hello Ladies + Gentlemen, a signed OAuth request!",
+                            "include_entities=true"};
+
+    set_http_method(builder, "POST");
+    set_base_url(builder, "https://api.twitter.com/1.1/statuses/update.json");
+    set_request_params(builder, params, 2);
+    set_nonce(builder, "kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg");
+    set_timestamp(builder, "1318622958");
+}
+
+static Builder *new_request(OauthCredentials *credentials) {
+    Builder *builder = new_oauth_request(credentials);
+
+    assert_non_null(builder);
+    load_request(builder);
+    return builder;
+}
+
+static OauthCredentials *new_credentials(void) {
+    OauthCredentials *credentials = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    assert_non_null(credentials);
+    return credentials;
+}
+
+static void sign_once(void) {
+    OauthCredentials *credentials = new_credentials();
+    Builder *builder              = new_request(credentials);
+    char *header                  = get_authorization_header(builder);
+
+    assert_non_null(header);
+    oauth_free(header);
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+/* Runs first, as OpenSSL only takes the allocator before it allocates */
+static void test_set_allocator(void **state) {
+    const OauthAllocator allocator = {counting_malloc, counting_realloc, counting_free, &counts};
+    size_t calls, live;
+    ( void )state;
+
+    assert_int_equal(oauth_set_allocator(&allocator), 1);
+
+    /* OpenSSL keeps what it sets up on first use, so a second round is
+       expected to give everything back */
+    sign_once();
+    calls = counts.calls;
+    live  = counts.live;
+    assert_true(calls >= 3);
+
+    sign_once();
+    assert_true(counts.calls >= calls + 3);
+    assert_int_equal(counts.live, live);
+}
+
+static void test_builder_steady_state(void **state) {
+    OauthCredentials *credentials = new_credentials();
+    Builder *builder              = new_request(credentials);
+    OauthAllocStats before, after;
+    char header[HEADER_SIZE];
+    int i;
+    ( void )state;
+
+    assert_true(get_authorization_header_into(builder, header, sizeof header) < sizeof header);
+    before = get_builder_alloc_stats(builder);
+    assert_true(before.allocations >= 1);
+    assert_true(before.bytes_in_use > 0);
+    assert_int_equal(before.bytes_in_use, before.peak_bytes);
+
+    /* A reused builder allocates nothing more */
+    for (i = 0; i < 100; ++i) {
+        reset_builder(builder);
+        load_request(builder);
+        get_authorization_header_into(builder, header, sizeof header);
+    }
+    after = get_builder_alloc_stats(builder);
+    assert_int_equal(after.allocations, before.allocations);
+    assert_int_equal(after.bytes_allocated, before.bytes_allocated);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static void test_repeated_into(void **state) {
+    OauthCredentials *credentials = new_credentials();
+    Builder *builder              = new_request(credentials);
+    OauthAllocStats before, after;
+    char header[HEADER_SIZE], again[HEADER_SIZE], command[2 * HEADER_SIZE];
+    int i;
+    ( void )state;
+
+    /* Signing the same request over and over holds on to nothing more */
+    get_authorization_header_into(builder, header, sizeof header);
+    before = get_builder_alloc_stats(builder);
+    for (i = 0; i < 2000; ++i) {
+        get_authorization_header_into(builder, again, sizeof again);
+        get_cURL_command_into(builder, command, sizeof command);
+    }
+    after = get_builder_alloc_stats(builder);
+    assert_string_equal(again, header);
+    assert_int_equal(after.allocations, before.allocations);
+    assert_int_equal(after.bytes_in_use, before.bytes_in_use);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static void test_out_of_memory(void **state) {
+    OauthCredentials *credentials = NULL;
+    size_t live                   = counts.live, tries = 0;
+    char secret[3000];
+    ( void )state;
+
+    /* A secret too long for the first chunk of the credentials */
+    memset(secret, '/', sizeof secret - 1);
+    secret[sizeof secret - 1] = '\0';
+
+    /* Credentials are either made in full or not at all, leaving nothing */
+    counts.failing = 1;
+    for (; credentials == NULL; ++tries) {
+        counts.left = tries;
+        credentials = new_oauth_credentials("key", secret, "token", secret);
+        if (credentials == NULL) {
+            assert_int_equal(counts.live, live);
+        }
+    }
+    counts.failing = 0;
+    assert_true(tries > 2);
+    destroy_credentials(&credentials);
+    assert_int_equal(counts.live, live);
+}
+
+static char *params_base(OauthCredentials *credentials, const char **params, int count,
+                         size_t left) {
+    Builder *builder = new_request(credentials);
+    char *base;
+
+    counts.failing = 1;
+    counts.left    = left;
+    set_request_params(builder, params, count);
+    counts.failing = 0;
+
+    base = get_signature_base(builder);
+    destroy_builder(&builder);
+    return base;
+}
+
+static void test_request_params_out_of_memory(void **state) {
+    OauthCredentials *credentials = new_credentials();
+    const char *params[64];
+    char param[64][200], *full, *none, *base;
+    size_t tries;
+    int i;
+    ( void )state;
+
+    /* More than the first chunk of the builder holds */
+    for (i = 0; i < 64; ++i) {
+        memset(param[i], 'v', sizeof param[i] - 1);
+        param[i][sizeof param[i] - 1] = '\0';
+        param[i][0]                   = ( char )('A' + i % 26);
+        param[i][1]                   = ( char )('a' + i / 26);
+        param[i][2]                   = '=';
+        params[i]                     = param[i];
+    }
+    full = params_base(credentials, params, 64, ( size_t )-1);
+    none = params_base(credentials, params, 0, ( size_t )-1);
+
+    /* The params are either all signed or left out, never half set up */
+    for (tries = 0;; ++tries) {
+        base = params_base(credentials, params, 64, tries);
+        if (strcmp(base, full) == 0) {
+            free(base);
+            break;
+        }
+        assert_string_equal(base, none);
+        free(base);
+    }
+    assert_true(tries > 0);
+
+    free(full);
+    free(none);
+    destroy_credentials(&credentials);
+}
+
+static void test_builder_results(void **state) {
+    OauthCredentials *credentials = new_credentials();
+    Builder *builder              = new_request(credentials);
+    OauthAllocStats before, after;
+    char *header;
+    ( void )state;
+
+    before = get_builder_alloc_stats(builder);
+    header = get_authorization_header(builder);
+    assert_non_null(header);
+    after = get_builder_alloc_stats(builder);
+
+    /* The header is counted but belongs to the caller */
+    assert_int_equal(after.allocations, before.allocations + 1);
+    assert_true(after.bytes_allocated > before.bytes_allocated + 100);
+    assert_int_equal(after.bytes_in_use, before.bytes_in_use);
+
+    oauth_free(header);
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static void test_thread_stats(void **state) {
+    OauthAllocStats before = oauth_thread_alloc_stats(), during, after;
+    OauthCredentials *credentials;
+    Builder *builder;
+    ( void )state;
+
+    credentials = new_credentials();
+    builder     = new_request(credentials);
+    during      = oauth_thread_alloc_stats();
+    assert_true(during.allocations >= before.allocations + 2);
+    assert_true(during.bytes_in_use > before.bytes_in_use);
+    assert_true(during.peak_bytes >= during.bytes_in_use);
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+    after = oauth_thread_alloc_stats();
+    assert_int_equal(after.bytes_in_use, before.bytes_in_use);
+    assert_int_equal(after.allocations, during.allocations);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_set_allocator), cmocka_unit_test(test_builder_steady_state),
+        cmocka_unit_test(test_repeated_into), cmocka_unit_test(test_out_of_memory),
+        cmocka_unit_test(test_request_params_out_of_memory),
+        cmocka_unit_test(test_builder_results), cmocka_unit_test(test_thread_stats)};
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,236 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <liboauthsign.h>
+#include <oauth_alloc.h>
+#include <oauth_pool.h>
+#include <sha1_mb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_SIZE 1000
+
+static const char *params[] = {"include_entities=true", "status=Hello%20Ladies%20%2B%20Gentlemen"};
+
+typedef struct {
+    OauthCredentials *credentials[2];
+    OauthRequest requests[BATCH_SIZE];
+    char nonces[BATCH_SIZE][16];
+    char *expected[BATCH_SIZE];
+} Batch;
+
+/** The allocations left before the failing allocator runs out */
+static size_t allocations_left;
+
+static void *failing_malloc(size_t size, void *context) {
+    ( void )context;
+    if (allocations_left == 0) {
+        return NULL;
+    }
+    allocations_left--;
+    return malloc(size);
+}
+
+static void *failing_realloc(void *ptr, size_t size, void *context) {
+    ( void )context;
+    if (allocations_left == 0) {
+        return NULL;
+    }
+    allocations_left--;
+    return realloc(ptr, size);
+}
+
+static void failing_free(void *ptr, void *context) {
+    ( void )context;
+    free(ptr);
+}
+
+static int create_batch(void **state) {
+    Batch *batch = calloc(1, sizeof(Batch));
+    Builder *builder;
+    size_t i;
+
+    batch->credentials[0] = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    batch->credentials[1] = new_oauth_credentials("ck", "c s", "tk", "t+s");
+
+    /* The same requests signed one at a time on a single builder */
+    for (i = 0; i < BATCH_SIZE; ++i) {
+        OauthRequest *request = &batch->requests[i];
+
+        snprintf(batch->nonces[i], sizeof(batch->nonces[i]), "nonce%lu", ( unsigned long )i);
+        request->credentials  = batch->credentials[i % 2];
+        request->method       = i % 3 ? "POST" : "GET";
+        request->url          = "https://api.twitter.com/1/statuses/update.json";
+        request->params       = params;
+        request->params_count = ( int )(i % 3);
+        request->nonce        = batch->nonces[i];
+        request->timestamp    = "1318622958";
+
+        builder = new_oauth_request(request->credentials);
+        set_http_method(builder, request->method);
+        set_base_url(builder, request->url);
+        set_request_params(builder, request->params, request->params_count);
+        set_nonce(builder, request->nonce);
+        set_timestamp(builder, request->timestamp);
+        batch->expected[i] = get_authorization_header(builder);
+        destroy_builder(&builder);
+    }
+
+    *state = batch;
+    return 0;
+}
+
+static int destroy_batch(void **state) {
+    Batch *batch = *state;
+    size_t i;
+
+    for (i = 0; i < BATCH_SIZE; ++i) {
+        free(batch->expected[i]);
+    }
+    destroy_credentials(&batch->credentials[0]);
+    destroy_credentials(&batch->credentials[1]);
+    free(batch);
+
+    return 0;
+}
+
+static void sign_and_compare(Batch *batch, int threads, size_t count) {
+    OauthPool *pool = new_oauth_pool(threads);
+    char **headers  = calloc(BATCH_SIZE, sizeof(char *));
+    size_t i;
+
+    assert_non_null(pool);
+    assert_int_equal(0, sign_batch(pool, batch->requests, headers, count));
+    for (i = 0; i < count; ++i) {
+        assert_string_equal(batch->expected[i], headers[i]);
+        free(headers[i]);
+    }
+
+    free(headers);
+    destroy_pool(&pool);
+}
+
+static void test_single_thread(void **state) {
+    sign_and_compare(*state, 1, BATCH_SIZE);
+}
+
+static void test_many_threads(void **state) {
+    sign_and_compare(*state, 8, BATCH_SIZE);
+}
+
+static void test_small_batch(void **state) {
+    sign_and_compare(*state, 4, 5);
+}
+
+static void test_pool_size(void **state) {
+    OauthPool *pool = new_oauth_pool(0);
+    ( void )state;
+
+    assert_non_null(pool);
+    assert_true(get_pool_size(pool) >= 1);
+    destroy_pool(&pool);
+    assert_null(pool);
+}
+
+static void test_reused_pool(void **state) {
+    Batch *batch    = *state;
+    OauthPool *pool = new_oauth_pool(3);
+    char **headers  = calloc(BATCH_SIZE, sizeof(char *));
+    size_t i;
+    int round;
+
+    for (round = 0; round < 5; ++round) {
+        assert_int_equal(0, sign_batch(pool, batch->requests, headers, BATCH_SIZE));
+        for (i = 0; i < BATCH_SIZE; ++i) {
+            assert_string_equal(batch->expected[i], headers[i]);
+            free(headers[i]);
+        }
+    }
+
+    free(headers);
+    destroy_pool(&pool);
+}
+
+static void test_failed_request(void **state) {
+    Batch *batch    = *state;
+    OauthPool *pool = new_oauth_pool(2);
+    OauthRequest requests[64];
+    char *headers[64];
+    size_t i;
+
+    memcpy(requests, batch->requests, sizeof(requests));
+    requests[7].credentials = NULL;
+    requests[40].url        = NULL;
+
+    assert_int_equal(2, sign_batch(pool, requests, headers, 64));
+    for (i = 0; i < 64; ++i) {
+        if (i == 7 || i == 40) {
+            assert_null(headers[i]);
+        } else {
+            assert_string_equal(batch->expected[i], headers[i]);
+        }
+        free(headers[i]);
+    }
+
+    destroy_pool(&pool);
+}
+
+static void test_out_of_memory(void **state) {
+    OauthAllocator failing = {failing_malloc, failing_realloc, failing_free, NULL};
+    OauthAllocStats before, after;
+    OauthPool *pool = NULL;
+    size_t budget;
+    ( void )state;
+
+    /* OpenSSL has allocated already, so only the library's memory is routed */
+    oauth_set_allocator(&failing);
+    for (budget = 0; pool == NULL; ++budget) {
+        allocations_left = budget;
+        before           = oauth_thread_alloc_stats();
+        pool             = new_oauth_pool(3);
+        after            = oauth_thread_alloc_stats();
+        if (pool == NULL) {
+            assert_int_equal(after.bytes_in_use, before.bytes_in_use);
+        }
+    }
+    destroy_pool(&pool);
+    oauth_set_allocator(NULL);
+}
+
+static void test_every_engine(void **state) {
+    Sha1Engine engines[] = {SHA1_ENGINE_OPENSSL, SHA1_ENGINE_VECTOR, SHA1_ENGINE_AVX2,
+                            SHA1_ENGINE_AVX512};
+    Sha1Engine original = sha1_engine();
+    size_t i;
+
+    for (i = 0; i < sizeof engines / sizeof engines[0]; ++i) {
+        if (sha1_set_engine(engines[i])) {
+            sign_and_compare(*state, 2, BATCH_SIZE);
+        }
+    }
+    assert_int_equal(sha1_set_engine(original), 1);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_single_thread),
+        cmocka_unit_test(test_many_threads),
+        cmocka_unit_test(test_small_batch),
+        cmocka_unit_test(test_pool_size),
+        cmocka_unit_test(test_reused_pool),
+        cmocka_unit_test(test_failed_request),
+        cmocka_unit_test(test_out_of_memory),
+        cmocka_unit_test(test_every_engine)};
+    return cmocka_run_group_tests(tests, create_batch, destroy_batch);
+}
@@ -0,0 +1,146 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <liboauthsign.h>
+#include <oauth_stats.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Room for the Prometheus text of every stage */
+#define TEXT_SIZE 65536
+
+/** The number of requests each test signs */
+#define REQUESTS 50
+
+static void sign_requests(void) {
+    const char *params[] = {"status=Hello Ladies + Gentlemen, a signed OAuth request!",
+                            "include_entities=true"};
+    OauthCredentials *credentials = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    Builder *builder = new_oauth_request(credentials);
+    char header[1024];
+    int i;
+
+    assert_non_null(builder);
+    for (i = 0; i < REQUESTS; ++i) {
+        reset_builder(builder);
+        set_http_method(builder, "POST");
+        set_base_url(builder, "https://api.twitter.com/1.1/statuses/update.json");
+        set_request_params(builder, params, 2);
+        assert_true(get_authorization_header_into(builder, header, sizeof header) > 0);
+    }
+
+    destroy_builder(&builder);
+    destroy_credentials(&credentials);
+}
+
+static void *sign_in_thread(void *arg) {
+    ( void )arg;
+    sign_requests();
+    return NULL;
+}
+
+static void test_stages_counted(void **state) {
+    OauthStats before, after;
+    uint64_t bucketed;
+    size_t i, b;
+    ( void )state;
+
+    oauth_stats_snapshot(&before);
+    sign_requests();
+    oauth_stats_snapshot(&after);
+
+    for (i = 0; i < OAUTH_STAGE_COUNT; ++i) {
+        if (!oauth_stats_enabled()) {
+            assert_int_equal(after.stages[i].calls, 0);
+            continue;
+        }
+
+        /* Every stage runs at least once for every request */
+        assert_true(after.stages[i].calls >= before.stages[i].calls + REQUESTS);
+
+        bucketed = 0;
+        for (b = 0; b < OAUTH_STATS_BUCKETS; ++b) {
+            bucketed += after.stages[i].buckets[b];
+        }
+        assert_int_equal(bucketed, after.stages[i].calls);
+    }
+
+    /* The parameters of a request are encoded under one timer */
+    if (oauth_stats_enabled()) {
+        assert_int_equal(after.stages[OAUTH_STAGE_ENCODE].calls,
+                         before.stages[OAUTH_STAGE_ENCODE].calls + REQUESTS);
+    }
+}
+
+static void test_threads_merged(void **state) {
+    OauthStats before, after;
+    pthread_t threads[4];
+    size_t i;
+    ( void )state;
+
+    oauth_stats_snapshot(&before);
+    for (i = 0; i < 4; ++i) {
+        assert_int_equal(pthread_create(&threads[i], NULL, sign_in_thread, NULL), 0);
+    }
+    for (i = 0; i < 4; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    oauth_stats_snapshot(&after);
+
+    /* Exited threads still count */
+    if (oauth_stats_enabled()) {
+        assert_int_equal(after.stages[OAUTH_STAGE_HEADER].calls,
+                         before.stages[OAUTH_STAGE_HEADER].calls + 4 * REQUESTS);
+    }
+}
+
+static void test_prometheus(void **state) {
+    char *text = malloc(TEXT_SIZE);
+    OauthStats stats;
+    size_t length, i;
+    ( void )state;
+
+    memset(&stats, 0, sizeof stats);
+    stats.stages[OAUTH_STAGE_MAC].calls      = 3;
+    stats.stages[OAUTH_STAGE_MAC].total_ns   = 1500;
+    stats.stages[OAUTH_STAGE_MAC].buckets[9] = 2;
+    stats.stages[OAUTH_STAGE_MAC].buckets[10] = 1;
+
+    assert_non_null(text);
+    length = oauth_stats_prometheus(&stats, text, TEXT_SIZE);
+    assert_int_equal(length, strlen(text));
+    assert_non_null(strstr(text, "# TYPE oauth_stage_seconds histogram\n"));
+    assert_non_null(strstr(text, "oauth_stage_seconds_bucket{stage=\"mac\",le=\"2.56e-07\"} 0\n"));
+    assert_non_null(strstr(text, "oauth_stage_seconds_bucket{stage=\"mac\",le=\"5.12e-07\"} 2\n"));
+    assert_non_null(strstr(text, "oauth_stage_seconds_bucket{stage=\"mac\",le=\"1.024e-06\"} 3\n"));
+    assert_non_null(strstr(text, "oauth_stage_seconds_bucket{stage=\"mac\",le=\"+Inf\"} 3\n"));
+    assert_non_null(strstr(text, "oauth_stage_seconds_sum{stage=\"mac\"} 0.000001500\n"));
+    assert_non_null(strstr(text, "oauth_stage_seconds_count{stage=\"mac\"} 3\n"));
+    for (i = 0; i < OAUTH_STAGE_COUNT; ++i) {
+        assert_non_null(strstr(text, oauth_stage_name(( OauthStage )i)));
+    }
+
+    /* A short buffer gets as much as fits and the full length is returned */
+    assert_int_equal(oauth_stats_prometheus(&stats, text, 100), length);
+    assert_int_equal(strlen(text), 99);
+
+    free(text);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_stages_counted),
+                                       cmocka_unit_test(test_threads_merged),
+                                       cmocka_unit_test(test_prometheus)};
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,187 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <liboauthsign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONSUMER_KEY "xvz1evFS4wEEPTGEFPHBog"
+#define TOKEN "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb"
+#define URL "https://api.twitter.com/1/statuses/update.json"
+
+static const char *PARAMS[] = {"status=Hello Ladies + Gentlemen, a signed OAuth request!",
+                               "include_entities=true"};
+
+static const OauthCredentials *find_credentials(const char *consumer_key,
+                                                size_t consumer_key_len, const char *token,
+                                                size_t token_len, void *context) {
+    if (consumer_key_len != strlen(CONSUMER_KEY) ||
+        memcmp(consumer_key, CONSUMER_KEY, consumer_key_len) != 0 ||
+        token_len != strlen(TOKEN) || memcmp(token, TOKEN, token_len) != 0) {
+        return NULL;
+    }
+    return context;
+}
+
+static OauthCredentials *make_credentials(void) {
+    return new_oauth_credentials(CONSUMER_KEY, "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+                                 TOKEN, "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+}
+
+/**
+ * Signs the request of the Twitter documentation and verifies the header
+ * against a request built the same way, but for the first count params
+ */
+static OauthVerifyResult sign_and_verify(const char *method, int count, const char *body) {
+    OauthCredentials *credentials = make_credentials();
+    Builder *signer               = new_oauth_request(credentials);
+    Builder *verifier             = new_oauth_builder();
+    OauthVerifyResult result;
+    char header[1024];
+
+    set_http_method(signer, "POST");
+    set_base_url(signer, URL);
+    set_signature_method(signer, method);
+    set_request_params(signer, PARAMS, 2);
+    if (body != NULL) {
+        update_body_hash(signer, body, strlen(body));
+    }
+    assert_true(get_authorization_header_into(signer, header, sizeof header) > 0);
+
+    set_http_method(verifier, "POST");
+    set_base_url(verifier, URL);
+    set_request_params(verifier, PARAMS, count);
+    if (body != NULL) {
+        set_signature_method(verifier, method);
+        update_body_hash(verifier, "Hello World!", 12);
+    }
+    result = verify_authorization_header(verifier, header, strlen(header), find_credentials,
+                                         credentials);
+
+    destroy_builder(&signer);
+    destroy_builder(&verifier);
+    destroy_credentials(&credentials);
+    return result;
+}
+
+static void check_header(const char *header, OauthVerifyResult expected) {
+    OauthCredentials *credentials = make_credentials();
+    Builder *verifier             = new_oauth_builder();
+    OauthVerifyResult result;
+
+    set_http_method(verifier, "POST");
+    set_base_url(verifier, URL);
+    set_request_params(verifier, PARAMS, 2);
+    result = verify_authorization_header(verifier, header, strlen(header), find_credentials,
+                                         credentials);
+    assert_string_equal(oauth_verify_result_name(result), oauth_verify_result_name(expected));
+
+    destroy_builder(&verifier);
+    destroy_credentials(&credentials);
+}
+
+static void test_round_trip(void **state) {
+    ( void )state;
+
+    assert_true(sign_and_verify("HMAC-SHA1", 2, NULL) == OAUTH_VERIFY_OK);
+    assert_true(sign_and_verify("HMAC-SHA256", 2, NULL) == OAUTH_VERIFY_OK);
+    assert_true(sign_and_verify("HMAC-SHA1", 1, NULL) == OAUTH_VERIFY_BAD_SIGNATURE);
+}
+
+static void test_documented_header(void **state) {
+    ( void )state;
+
+    // The header of the Twitter documentation, with its name
+    check_header("Authorization: OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", "
+                 "oauth_nonce=\"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg\", "
+                 "oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2FjLY%3D\", "
+                 "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1318622958\", "
+                 "oauth_token=\"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb\", "
+                 "oauth_version=\"1.0\"",
+                 OAUTH_VERIFY_OK);
+
+    // The same, in another order with a realm and lowercase escapes
+    check_header("OAuth realm=\"https://api.twitter.com/\", oauth_version=\"1.0\", "
+                 "oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2fjLY%3d\", "
+                 "oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", "
+                 "oauth_nonce=\"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg\", "
+                 "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1318622958\", "
+                 "oauth_token=\"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb\"",
+                 OAUTH_VERIFY_OK);
+
+    // A different timestamp
+    check_header("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", "
+                 "oauth_nonce=\"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg\", "
+                 "oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2FjLY%3D\", "
+                 "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1318622959\", "
+                 "oauth_token=\"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb\", "
+                 "oauth_version=\"1.0\"",
+                 OAUTH_VERIFY_BAD_SIGNATURE);
+}
+
+static void test_rejected_headers(void **state) {
+    ( void )state;
+
+    check_header("", OAUTH_VERIFY_MALFORMED);
+    check_header("Basic dXNlcjpwYXNz", OAUTH_VERIFY_MALFORMED);
+    check_header("OAuthoauth_nonce=\"abc\"", OAUTH_VERIFY_MALFORMED);
+
+    // A missing timestamp
+    check_header("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", oauth_nonce=\"abc\", "
+                 "oauth_signature=\"abc\", oauth_signature_method=\"HMAC-SHA1\", "
+                 "oauth_token=\"\", oauth_version=\"1.0\"",
+                 OAUTH_VERIFY_MALFORMED);
+
+    // An unterminated value
+    check_header("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", oauth_nonce=\"abc\", "
+                 "oauth_signature=\"abc\", oauth_signature_method=\"HMAC-SHA1\", "
+                 "oauth_timestamp=\"1\", oauth_token=\"\", oauth_version=\"1.0",
+                 OAUTH_VERIFY_MALFORMED);
+
+    // A parameter given twice
+    check_header("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", oauth_nonce=\"abc\", "
+                 "oauth_signature=\"abc\", oauth_nonce=\"abc\", "
+                 "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1\", "
+                 "oauth_token=\"\", oauth_version=\"1.0\"",
+                 OAUTH_VERIFY_MALFORMED);
+
+    check_header("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", oauth_nonce=\"abc\", "
+                 "oauth_signature=\"abc\", oauth_signature_method=\"PLAINTEXT\", "
+                 "oauth_timestamp=\"1\", oauth_token=\"\", oauth_version=\"1.0\"",
+                 OAUTH_VERIFY_UNSUPPORTED_METHOD);
+
+    // The token is not the one the credentials are for
+    check_header("OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", oauth_nonce=\"abc\", "
+                 "oauth_signature=\"abc\", oauth_signature_method=\"HMAC-SHA1\", "
+                 "oauth_timestamp=\"1\", oauth_token=\"\", oauth_version=\"1.0\"",
+                 OAUTH_VERIFY_UNKNOWN_CREDENTIALS);
+
+    assert_string_equal(oauth_verify_result_name(OAUTH_VERIFY_OK), "valid");
+}
+
+static void test_body_hash(void **state) {
+    ( void )state;
+
+    assert_true(sign_and_verify("HMAC-SHA1", 2, "Hello World!") == OAUTH_VERIFY_OK);
+    assert_true(sign_and_verify("HMAC-SHA256", 2, "Hello World!") == OAUTH_VERIFY_OK);
+    assert_true(sign_and_verify("HMAC-SHA1", 2, "Hello World?") ==
+                OAUTH_VERIFY_BAD_BODY_HASH);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_round_trip),
+        cmocka_unit_test(test_documented_header),
+        cmocka_unit_test(test_rejected_headers),
+        cmocka_unit_test(test_body_hash),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,139 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <percent_encode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define X_ENCODING_TESTS                                                    \
+    X(empty, "", "")                                                        \
+    X(unreserved, "Az09-._~", "Az09-._~")                                   \
+    X(status, "Ladies + Gentlemen", "Ladies%20%2B%20Gentlemen")             \
+    X(punctuation, "An encoded string!", "An%20encoded%20string%21")        \
+    X(reserved, "Dogs, Cats & Mice", "Dogs%2C%20Cats%20%26%20Mice")         \
+    X(utf8, "\xE2\x98\x83", "%E2%98%83")                                    \
+    X(long_run, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123" \
+                "456789-._~/",                                              \
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-._~%2F")
+
+/**
+ * @brief      Reference encoder, one byte at a time
+ *
+ * @param      out   The destination
+ * @param[in]  in    The input
+ * @param[in]  len   The input length
+ *
+ * @return     The number of bytes written
+ */
+static size_t reference_encode(char *out, const unsigned char *in, size_t len) {
+    size_t i, n = 0;
+    for (i = 0; i < len; ++i) {
+        if ((in[i] >= 'A' && in[i] <= 'Z') || (in[i] >= 'a' && in[i] <= 'z') ||
+            (in[i] >= '0' && in[i] <= '9') || (in[i] && strchr("-._~", in[i]) != NULL)) {
+            out[n++] = ( char )in[i];
+        } else {
+            n += ( size_t )sprintf(&out[n], "%%%02X", in[i]);
+        }
+    }
+    return n;
+}
+
+// generate tests
+#define X(name, in, expected)                                        \
+    static void test_encode_##name(void **state) {                   \
+        size_t len = percent_encoded_length(in, strlen(in));         \
+        char *out  = malloc(len + 1);                                \
+        ( void )state;                                               \
+                                                                     \
+        assert_int_equal(strlen(expected), len);                     \
+        assert_int_equal(len, percent_encode(out, in, strlen(in)));  \
+        out[len] = '\0';                                             \
+        assert_string_equal(expected, out);                          \
+                                                                     \
+        len      = percent_decode(out, out, len);                    \
+        out[len] = '\0';                                             \
+        assert_string_equal(in, out);                                \
+                                                                     \
+        free(out);                                                   \
+    }
+
+X_ENCODING_TESTS
+#undef X
+
+static void test_encode_matches_reference(void **state) {
+    unsigned char in[300];
+    char expected[900], out[900];
+    size_t len, offset, reserved_at, n;
+    ( void )state;
+
+    srand(5849);
+    for (len = 0; len < 200; ++len) {
+        for (offset = 0; offset < 2; ++offset) {
+            // a run of unreserved characters with a single reserved byte
+            // at every possible position, to exercise the SIMD tails
+            for (reserved_at = 0; reserved_at <= len; reserved_at += 7) {
+                for (n = 0; n < len; ++n) {
+                    in[offset + n] = ( unsigned char )"abcXYZ019-._~"[n % 13];
+                }
+                if (reserved_at < len) {
+                    in[offset + reserved_at] = ( unsigned char )(rand() % 256);
+                }
+
+                n = reference_encode(expected, in + offset, len);
+                assert_int_equal(n, percent_encoded_length(( char * )in + offset, len));
+                assert_int_equal(n, percent_encode(out, ( char * )in + offset, len));
+                assert_memory_equal(expected, out, n);
+            }
+        }
+    }
+}
+
+static void test_decode_malformed(void **state) {
+    char out[16];
+    size_t n;
+    ( void )state;
+
+    n = percent_decode(out, "%4g%2%", 6);
+    assert_int_equal(6, n);
+    assert_memory_equal("%4g%2%", out, n);
+
+    n = percent_decode(out, "%e2%98%83", 9);
+    assert_int_equal(3, n);
+    assert_memory_equal("\xE2\x98\x83", out, n);
+}
+
+static void test_is_canonical(void **state) {
+    ( void )state;
+
+    assert_true(percent_is_canonical("", 0));
+    assert_true(percent_is_canonical("jack-dorsey_1.0~", 16));
+    assert_true(percent_is_canonical("a%20b%2B%E2%98%83", 17));
+
+    // what percent_encode() would write differently
+    assert_false(percent_is_canonical("a b", 3));
+    assert_false(percent_is_canonical("a+b", 3));
+    assert_false(percent_is_canonical("%2b", 3));
+    assert_false(percent_is_canonical("%41", 3));
+    assert_false(percent_is_canonical("%4", 2));
+    assert_false(percent_is_canonical("%zz", 3));
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+#define X(name, _, __) cmocka_unit_test(test_encode_##name),
+        X_ENCODING_TESTS cmocka_unit_test(test_encode_matches_reference),
+        cmocka_unit_test(test_decode_malformed),
+        cmocka_unit_test(test_is_canonical)
+#undef X
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,249 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <liboauthsign.h>
+#include <pthread.h>
+#include <replay_cache.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NOW 1318622958L
+#define WINDOW 300
+
+/** The threads and distinct nonces of the concurrent test */
+#define THREADS 4
+#define NONCES 20000
+
+typedef struct {
+    OauthReplayCache *cache;
+    int accepted;
+} Worker;
+
+static int check(OauthReplayCache *cache, const char *token, const char *nonce, long timestamp,
+                 long now) {
+    OauthReplayResult result = check_nonce(cache, "key", 3, token, strlen(token), nonce,
+                                           strlen(nonce), timestamp, now);
+    return result;
+}
+
+static void test_replayed(void **state) {
+    OauthReplayCache *cache = new_replay_cache(1000, WINDOW, NULL);
+    ( void )state;
+
+    assert_non_null(cache);
+    assert_int_equal(check(cache, "token", "abc", NOW, NOW), OAUTH_REPLAY_NEW);
+    assert_int_equal(check(cache, "token", "abc", NOW, NOW), OAUTH_REPLAY_REPLAYED);
+    assert_int_equal(check(cache, "token", "abc", NOW + 1, NOW + 1), OAUTH_REPLAY_REPLAYED);
+
+    // The same nonce for other credentials
+    assert_int_equal(check(cache, "other", "abc", NOW, NOW), OAUTH_REPLAY_NEW);
+    assert_true(check_nonce(cache, "keyt", 4, "oken", 4, "abc", 3, NOW, NOW) == OAUTH_REPLAY_NEW);
+
+    assert_string_equal(oauth_replay_result_name(OAUTH_REPLAY_REPLAYED), "nonce already used");
+    destroy_replay_cache(&cache);
+    assert_null(cache);
+}
+
+static void test_window(void **state) {
+    OauthReplayCache *cache = new_replay_cache(1000, WINDOW, NULL);
+    ( void )state;
+
+    assert_int_equal(check(cache, "token", "old", NOW - WINDOW - 1, NOW), OAUTH_REPLAY_EXPIRED);
+    assert_int_equal(check(cache, "token", "new", NOW + WINDOW + 1, NOW), OAUTH_REPLAY_EXPIRED);
+    assert_int_equal(check(cache, "token", "old", NOW - WINDOW, NOW), OAUTH_REPLAY_NEW);
+    assert_int_equal(check(cache, "token", "new", NOW + WINDOW, NOW), OAUTH_REPLAY_NEW);
+
+    // Once its timestamp has left the window the nonce is forgotten
+    assert_int_equal(check(cache, "token", "old", NOW, NOW), OAUTH_REPLAY_REPLAYED);
+    assert_int_equal(check(cache, "token", "old", NOW + 1, NOW + 1), OAUTH_REPLAY_NEW);
+
+    destroy_replay_cache(&cache);
+
+    // Windows of more than a day are fine
+    cache = new_replay_cache(1000, 100000, NULL);
+    assert_int_equal(check(cache, "token", "abc", NOW - 90000, NOW), OAUTH_REPLAY_NEW);
+    assert_int_equal(check(cache, "token", "abc", NOW + 90000, NOW), OAUTH_REPLAY_REPLAYED);
+    destroy_replay_cache(&cache);
+}
+
+static void test_seconds_wrap(void **state) {
+    OauthReplayCache *cache = new_replay_cache(1000, WINDOW, NULL);
+    char nonce[32];
+    long later = NOW + 65536;
+    int i;
+    ( void )state;
+
+    for (i = 0; i < 1000; ++i) {
+        snprintf(nonce, sizeof nonce, "nonce%d", i);
+        assert_int_equal(check(cache, "token", nonce, NOW, NOW), OAUTH_REPLAY_NEW);
+    }
+
+    // Nonces long expired neither come back nor hold on to their slots
+    for (i = 0; i < 1000; ++i) {
+        snprintf(nonce, sizeof nonce, "nonce%d", i);
+        assert_int_equal(check(cache, "token", nonce, later, later), OAUTH_REPLAY_NEW);
+    }
+    for (i = 0; i < 1000; ++i) {
+        snprintf(nonce, sizeof nonce, "other%d", i);
+        assert_int_equal(check(cache, "token", nonce, later + 1000, later + 1000),
+                         OAUTH_REPLAY_NEW);
+    }
+    destroy_replay_cache(&cache);
+}
+
+static void test_full(void **state) {
+    OauthReplayCache *cache = new_replay_cache(16, WINDOW, NULL);
+    char nonce[32];
+    int i, accepted = 0, full = 0, result;
+    ( void )state;
+
+    for (i = 0; i < 1000; ++i) {
+        snprintf(nonce, sizeof nonce, "nonce%d", i);
+        result = check(cache, "token", nonce, NOW, NOW);
+        accepted += result == OAUTH_REPLAY_NEW;
+        full += result == OAUTH_REPLAY_FULL;
+    }
+    assert_true(accepted >= 16);
+    assert_int_equal(accepted + full, 1000);
+
+    // Expired nonces make room
+    for (i = 0; i < 16; ++i) {
+        snprintf(nonce, sizeof nonce, "later%d", i);
+        assert_int_equal(check(cache, "token", nonce, NOW + 1000, NOW + 1000), OAUTH_REPLAY_NEW);
+    }
+    destroy_replay_cache(&cache);
+}
+
+static void test_file(void **state) {
+    char path[] = "/tmp/replay_cache_testXXXXXX";
+    OauthReplayCache *cache;
+    int fd = mkstemp(path);
+    ( void )state;
+
+    assert_true(fd >= 0);
+    close(fd);
+
+    cache = new_replay_cache(1000, WINDOW, path);
+    assert_non_null(cache);
+    assert_int_equal(check(cache, "token", "abc", NOW, NOW), OAUTH_REPLAY_NEW);
+    destroy_replay_cache(&cache);
+
+    // The nonce survives a restart
+    cache = new_replay_cache(1000, WINDOW, path);
+    assert_non_null(cache);
+    assert_int_equal(check(cache, "token", "abc", NOW, NOW), OAUTH_REPLAY_REPLAYED);
+    destroy_replay_cache(&cache);
+
+    // But not a cache of another window
+    cache = new_replay_cache(1000, WINDOW / 2, path);
+    assert_non_null(cache);
+    assert_int_equal(check(cache, "token", "abc", NOW, NOW), OAUTH_REPLAY_NEW);
+    destroy_replay_cache(&cache);
+
+    unlink(path);
+}
+
+static void *check_in_thread(void *arg) {
+    Worker *worker = arg;
+    char nonce[32];
+    int i;
+
+    for (i = 0; i < NONCES; ++i) {
+        snprintf(nonce, sizeof nonce, "%d", i);
+        if (check(worker->cache, "token", nonce, NOW, NOW) == OAUTH_REPLAY_NEW) {
+            worker->accepted++;
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent(void **state) {
+    OauthReplayCache *cache = new_replay_cache(NONCES, WINDOW, NULL);
+    pthread_t threads[THREADS];
+    Worker workers[THREADS];
+    int t, accepted = 0;
+    ( void )state;
+
+    // Every nonce is checked on every thread, and accepted on exactly one
+    for (t = 0; t < THREADS; ++t) {
+        workers[t].cache    = cache;
+        workers[t].accepted = 0;
+        pthread_create(&threads[t], NULL, check_in_thread, &workers[t]);
+    }
+    for (t = 0; t < THREADS; ++t) {
+        pthread_join(threads[t], NULL);
+        accepted += workers[t].accepted;
+    }
+    assert_int_equal(accepted, NONCES);
+
+    destroy_replay_cache(&cache);
+}
+
+static const OauthCredentials *find_credentials(const char *consumer_key,
+                                                size_t consumer_key_len, const char *token,
+                                                size_t token_len, void *context) {
+    ( void )consumer_key;
+    ( void )consumer_key_len;
+    ( void )token;
+    ( void )token_len;
+    return context;
+}
+
+static void test_check_replay(void **state) {
+    const char *header =
+        "OAuth oauth_consumer_key=\"xvz1evFS4wEEPTGEFPHBog\", "
+        "oauth_nonce=\"kYjzVBB8Y0ZFabxSWbWovY3uYSQ2pTgmZeNu2VS4cg\", "
+        "oauth_signature=\"tnnArxj06cWHq44gCs1OSKk%2FjLY%3D\", "
+        "oauth_signature_method=\"HMAC-SHA1\", oauth_timestamp=\"1318622958\", "
+        "oauth_token=\"370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb\", "
+        "oauth_version=\"1.0\"";
+    const char *params[] = {"status=Hello Ladies + Gentlemen, a signed OAuth request!",
+                            "include_entities=true"};
+    OauthCredentials *credentials = new_oauth_credentials(
+        "xvz1evFS4wEEPTGEFPHBog", "kAcSOqF21Fu85e7zjz7ZN2U4ZRhfV3WpwPAoE3Z7kBw",
+        "370773112-GmHxMAgYyLbNEtIKZeRNFsMKPR9EyMZeS9weJAEb", "LswwdoUaIvS8ltyTt5jkRh4J50vUPVVHtR2YPi5kE");
+    OauthReplayCache *cache = new_replay_cache(1000, WINDOW, NULL);
+    Builder *builder        = new_oauth_builder();
+    int i;
+    ( void )state;
+
+    // The same request verified twice is only accepted the first time
+    for (i = 0; i < 2; ++i) {
+        reset_builder(builder);
+        set_http_method(builder, "POST");
+        set_base_url(builder, "https://api.twitter.com/1/statuses/update.json");
+        set_request_params(builder, params, 2);
+        assert_true(verify_authorization_header(builder, header, strlen(header),
+                                                find_credentials, credentials) == OAUTH_VERIFY_OK);
+        assert_true(check_replay(builder, cache, NOW + 10) ==
+                    (i == 0 ? OAUTH_REPLAY_NEW : OAUTH_REPLAY_REPLAYED));
+    }
+    assert_true(check_replay(builder, cache, NOW + WINDOW + 1) == OAUTH_REPLAY_EXPIRED);
+
+    destroy_builder(&builder);
+    destroy_replay_cache(&cache);
+    destroy_credentials(&credentials);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_replayed),
+        cmocka_unit_test(test_window),
+        cmocka_unit_test(test_seconds_wrap),
+        cmocka_unit_test(test_full),
+        cmocka_unit_test(test_file),
+        cmocka_unit_test(test_concurrent),
+        cmocka_unit_test(test_check_replay),
+    };
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
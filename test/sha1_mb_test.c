@@ -0,0 +1,133 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+/* The expected digests are made with the low level SHA-1 interface */
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <cmocka.h>
+#include <openssl/sha.h>
+#include <sha1_mb.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** More than one group, with a partial one at the end */
+#define JOB_COUNT 37
+
+/** Longer than any message, so every length around a block boundary is tried */
+#define MESSAGE_SIZE 300
+
+typedef struct {
+    unsigned char messages[JOB_COUNT][MESSAGE_SIZE];
+    unsigned char prefix[64];
+    unsigned char digests[JOB_COUNT][SHA_DIGEST_LENGTH];
+    unsigned char expected[JOB_COUNT][SHA_DIGEST_LENGTH];
+    Sha1Job jobs[JOB_COUNT];
+} Messages;
+
+static int create_messages(void **state) {
+    Messages *messages = malloc(sizeof(Messages));
+    size_t i, j;
+
+    srand(7);
+    for (i = 0; i < JOB_COUNT; ++i) {
+        for (j = 0; j < MESSAGE_SIZE; ++j) {
+            messages->messages[i][j] = ( unsigned char )rand();
+        }
+    }
+    for (j = 0; j < sizeof messages->prefix; ++j) {
+        messages->prefix[j] = ( unsigned char )rand();
+    }
+
+    *state = messages;
+    return messages == NULL;
+}
+
+static int destroy_messages(void **state) {
+    free(*state);
+    return 0;
+}
+
+/**
+ * @brief      Hashes messages of lengths from base on with an engine, some
+ * from the start and some after a prefix block, and checks them against
+ * OpenSSL
+ *
+ * @param      messages  The messages
+ * @param[in]  engine    The engine
+ * @param[in]  base      The length of the first message
+ */
+static void check_engine(Messages *messages, Sha1Engine engine, size_t base) {
+    SHA_CTX ctx;
+    size_t i;
+
+    for (i = 0; i < JOB_COUNT; ++i) {
+        SHA1_Init(&ctx);
+        if (i % 2) {
+            SHA1_Update(&ctx, messages->prefix, sizeof messages->prefix);
+        }
+        messages->jobs[i].state[0] = ctx.h0;
+        messages->jobs[i].state[1] = ctx.h1;
+        messages->jobs[i].state[2] = ctx.h2;
+        messages->jobs[i].state[3] = ctx.h3;
+        messages->jobs[i].state[4] = ctx.h4;
+        messages->jobs[i].hashed   = i % 2 ? sizeof messages->prefix : 0;
+        messages->jobs[i].data     = messages->messages[i];
+        messages->jobs[i].length   = (base + i) % MESSAGE_SIZE;
+        messages->jobs[i].digest   = messages->digests[i];
+
+        SHA1_Update(&ctx, messages->messages[i], messages->jobs[i].length);
+        SHA1_Final(messages->expected[i], &ctx);
+    }
+
+    assert_int_equal(sha1_set_engine(engine), 1);
+    sha1_multi(messages->jobs, JOB_COUNT);
+    for (i = 0; i < JOB_COUNT; ++i) {
+        assert_memory_equal(messages->digests[i], messages->expected[i], SHA_DIGEST_LENGTH);
+    }
+}
+
+static void test_engines_match_openssl(void **state) {
+    Sha1Engine engines[] = {SHA1_ENGINE_OPENSSL, SHA1_ENGINE_VECTOR, SHA1_ENGINE_AVX2,
+                            SHA1_ENGINE_AVX512};
+    Sha1Engine original = sha1_engine();
+    size_t i, base;
+
+    for (i = 0; i < sizeof engines / sizeof engines[0]; ++i) {
+        if (!sha1_set_engine(engines[i])) {
+            continue;
+        }
+        for (base = 0; base < MESSAGE_SIZE; base += JOB_COUNT) {
+            check_engine(*state, engines[i], base);
+        }
+    }
+    assert_int_equal(sha1_set_engine(original), 1);
+}
+
+static void test_digest_in_place(void **state) {
+    Messages *messages = *state;
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    Sha1Job job = {{0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u, 0xC3D2E1F0u},
+                   0,
+                   messages->digests[0],
+                   SHA_DIGEST_LENGTH,
+                   messages->digests[0]};
+
+    memset(messages->digests[0], 'x', SHA_DIGEST_LENGTH);
+    SHA1(messages->digests[0], SHA_DIGEST_LENGTH, expected);
+
+    sha1_multi(&job, 1);
+    assert_memory_equal(messages->digests[0], expected, SHA_DIGEST_LENGTH);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_engines_match_openssl),
+                                       cmocka_unit_test(test_digest_in_place)};
+    return cmocka_run_group_tests(tests, create_messages, destroy_messages);
+}
@@ -0,0 +1,52 @@
+// #######################################################
+// These headers or their equivalents should be included##
+// prior to including cmocka header file.#################
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+// This allows test applications to use custom definitions
+// of C standard library functions and types.#############
+// #######################################################
+
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <timestamp.h>
+
+static void test_timestamp_digits(void **state) {
+    char timestamp[TIMESTAMP_SIZE];
+    size_t length, i;
+    ( void )state;
+
+    length = current_timestamp(timestamp);
+    assert_int_equal(length, strlen(timestamp));
+    assert_true(length > 0 && timestamp[0] != '0');
+    for (i = 0; i < length; ++i) {
+        assert_true(timestamp[i] >= '0' && timestamp[i] <= '9');
+    }
+}
+
+static void test_timestamp_matches_time(void **state) {
+    char timestamp[TIMESTAMP_SIZE];
+    long before, after, value;
+    ( void )state;
+
+    /* The coarse clock may lag the precise one by a tick */
+    before = ( long )time(NULL) - 1;
+    current_timestamp(timestamp);
+    value = strtol(timestamp, NULL, 10);
+    after = ( long )time(NULL);
+
+    assert_in_range(value, before, after);
+
+    /* Read again, which now comes from the shared word */
+    current_timestamp(timestamp);
+    assert_in_range(strtol(timestamp, NULL, 10), value, after + 1);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {cmocka_unit_test(test_timestamp_digits),
+                                       cmocka_unit_test(test_timestamp_matches_time)};
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
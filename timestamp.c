@@ -0,0 +1,129 @@
+/* clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <time.h>
+#include <timestamp.h>
+
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE CLOCK_REALTIME
+#endif
+
+/**
+ * The number of decimal digits kept in the shared word, one per nibble.
+ * Seconds have ten digits until the year 2286.
+ */
+#define TIMESTAMP_DIGITS 10
+
+/** Set in the shared word once it holds a second */
+#define TIMESTAMP_VALID (( uint64_t )1 << 63)
+
+/** The low bits of the second the shared word holds, which tell when it is stale */
+#define TIMESTAMP_TAG_BITS 23
+#define TIMESTAMP_TAG_SHIFT (4 * TIMESTAMP_DIGITS)
+#define TIMESTAMP_TAG_MASK ((( uint64_t )1 << TIMESTAMP_TAG_BITS) - 1)
+
+/**
+ * The valid bit, then the tag, then the digits of the second packed one per
+ * nibble, the last digit lowest. Holding everything in one word is what lets
+ * it be read and replaced without a lock.
+ */
+static uint64_t cached_second;
+
+/**
+ * @brief      Packs the digits of a second and its tag into one word
+ *
+ * @param[in]  seconds  The second, which must have at most TIMESTAMP_DIGITS
+ * digits
+ *
+ * @return     The word
+ */
+static uint64_t pack_second(uint64_t seconds);
+
+/**
+ * @brief      Writes the digits packed in a word
+ *
+ * @param      out     Receives the digits and a terminating null
+ * @param[in]  packed  The word
+ *
+ * @return     The number of digits, leading zeros left out
+ */
+static size_t unpack_second(char *out, uint64_t packed);
+
+/**
+ * @brief      Writes a number in decimal
+ *
+ * @param      out    Receives the digits and a terminating null
+ * @param[in]  value  The number
+ *
+ * @return     The number of digits
+ */
+static size_t write_decimal(char *out, uint64_t value);
+
+size_t current_timestamp(char *out) {
+    struct timespec now;
+    uint64_t seconds, packed;
+
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &now) != 0 || now.tv_sec < 0) {
+        now.tv_sec = time(NULL);
+    }
+    seconds = ( uint64_t )now.tv_sec;
+
+    if (seconds >= 10000000000ULL) {
+        return write_decimal(out, seconds);
+    }
+
+    packed = __atomic_load_n(&cached_second, __ATOMIC_RELAXED);
+    if (!(packed & TIMESTAMP_VALID) ||
+        (packed >> TIMESTAMP_TAG_SHIFT & TIMESTAMP_TAG_MASK) != (seconds & TIMESTAMP_TAG_MASK)) {
+        /* Threads which notice the new second together all store the same word */
+        packed = pack_second(seconds);
+        __atomic_store_n(&cached_second, packed, __ATOMIC_RELAXED);
+    }
+
+    return unpack_second(out, packed);
+}
+
+static uint64_t pack_second(uint64_t seconds) {
+    uint64_t packed = TIMESTAMP_VALID | (seconds & TIMESTAMP_TAG_MASK) << TIMESTAMP_TAG_SHIFT;
+    int digit;
+
+    for (digit = 0; digit < TIMESTAMP_DIGITS; ++digit) {
+        packed  |= (seconds % 10) << (4 * digit);
+        seconds /= 10;
+    }
+
+    return packed;
+}
+
+static size_t unpack_second(char *out, uint64_t packed) {
+    size_t length = 0;
+    int digit     = TIMESTAMP_DIGITS - 1;
+
+    while (digit > 0 && (packed >> (4 * digit) & 0xF) == 0) {
+        digit--;
+    }
+    for (; digit >= 0; --digit) {
+        out[length++] = ( char )('0' + (packed >> (4 * digit) & 0xF));
+    }
+    out[length] = '\0';
+
+    return length;
+}
+
+static size_t write_decimal(char *out, uint64_t value) {
+    char digits[TIMESTAMP_SIZE];
+    size_t length = 0, i;
+
+    do {
+        digits[length++] = ( char )('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    for (i = 0; i < length; ++i) {
+        out[i] = digits[length - 1 - i];
+    }
+    out[length] = '\0';
+
+    return length;
+}